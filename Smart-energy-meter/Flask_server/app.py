@@ -1,9 +1,14 @@
-from flask import Flask, render_template, jsonify, request
+from flask import Flask, render_template, jsonify, request, Response
 from flask_cors import CORS
+from werkzeug.serving import WSGIRequestHandler
 import mysql.connector
 from mysql.connector import Error
 from datetime import datetime, timedelta
+import io
 import json
+import struct
+import threading
+import time
 
 app = Flask(__name__)
 CORS(app)
@@ -27,11 +32,65 @@ relay_states = {
 
 theft_status = {
     'detected': False,
-    'timestamp': None
+    'timestamp': None,
+    'confidence': 0.0,
+    'leakage': 0.0
 }
 
 price_per_unit = 5.0  # Default price per kWh
 
+# Commands pushed to the meter over /api/commands/stream. Each one carries the
+# full desired relay and price state, so a replayed or missed command is harmless.
+COMMAND_PING_SECONDS = 20  # Keep-alive comment on an idle stream
+command_channel = {
+    'id': 0,
+    'issued': {},       # command id -> time.monotonic() when issued
+    'streams': 0,
+    'condition': threading.Condition(),
+}
+command_stats = {
+    'acked': 0,
+    'last_ms': None,
+    'max_ms': 0.0,
+    'total_ms': 0.0,
+    'last_apply_us': None,
+}
+MJ_PER_KWH = 3.6e9    # Meter energy registers are in millijoules
+
+# Instrumentation snapshots (Prometheus text) uploaded by the meters in parts.
+# The latest complete one of each meter is served at /metrics for scraping.
+METRICS_STALE_SECONDS = 300   # Meters silent this long are left out
+meter_metrics = {
+    'parts': {},        # meter address -> parts of the snapshot being received
+    'latest': {},       # meter address -> (time.time() when complete, text)
+    'lock': threading.Lock(),
+}
+
+# Columns added after the first release (name -> SQL definition)
+READING_EXTRA_COLUMNS = {
+    'apparent_power1': 'FLOAT DEFAULT 0',
+    'apparent_power2': 'FLOAT DEFAULT 0',
+    'reactive_power1': 'FLOAT DEFAULT 0',
+    'reactive_power2': 'FLOAT DEFAULT 0',
+    'power_factor1': 'FLOAT DEFAULT 0',
+    'power_factor2': 'FLOAT DEFAULT 0',
+    'frequency': 'FLOAT DEFAULT 0',
+    'thd_voltage': 'FLOAT DEFAULT NULL',
+    'thd_current1': 'FLOAT DEFAULT NULL',
+    'thd_current2': 'FLOAT DEFAULT NULL',
+    'harmonics': 'TEXT DEFAULT NULL',
+    'device_seq': 'BIGINT DEFAULT NULL',
+    'queue_depth': 'INT DEFAULT NULL',
+    'queue_dropped': 'INT DEFAULT NULL',
+    'energy_l1_mj': 'BIGINT DEFAULT NULL',
+    'energy_l2_mj': 'BIGINT DEFAULT NULL',
+}
+
+# Indexes added after the first release (name -> SQL definition)
+READING_EXTRA_INDEXES = {
+    'uniq_device_seq': 'UNIQUE KEY uniq_device_seq (device_seq)',
+}
+
 # ===================== DATABASE FUNCTIONS =====================
 def get_db_connection():
     """Create and return database connection"""
@@ -42,6 +101,32 @@ def get_db_connection():
         print(f"❌ Error connecting to MySQL: {e}")
         return None
 
+def ensure_columns(cursor, table, columns):
+    """Add any missing columns to an existing table"""
+    cursor.execute("""
+        SELECT COLUMN_NAME FROM INFORMATION_SCHEMA.COLUMNS
+        WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = %s
+    """, (table,))
+    existing = {row[0] for row in cursor.fetchall()}
+    
+    for name, definition in columns.items():
+        if name not in existing:
+            cursor.execute(f"ALTER TABLE {table} ADD COLUMN {name} {definition}")
+            print(f"   ➕ Added column {table}.{name}")
+
+def ensure_indexes(cursor, table, indexes):
+    """Add any missing indexes to an existing table"""
+    cursor.execute("""
+        SELECT DISTINCT INDEX_NAME FROM INFORMATION_SCHEMA.STATISTICS
+        WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = %s
+    """, (table,))
+    existing = {row[0] for row in cursor.fetchall()}
+    
+    for name, definition in indexes.items():
+        if name not in existing:
+            cursor.execute(f"ALTER TABLE {table} ADD {definition}")
+            print(f"   ➕ Added index {table}.{name}")
+
 def init_database():
     """Initialize database and create tables"""
     try:
@@ -81,6 +166,41 @@ def init_database():
                 INDEX idx_timestamp (timestamp)
             )
         """)
+        ensure_columns(cursor, 'readings', READING_EXTRA_COLUMNS)
+        ensure_indexes(cursor, 'readings', READING_EXTRA_INDEXES)
+        
+        # Power quality events (waveform chunks uploaded by the meter)
+        cursor.execute("""
+            CREATE TABLE IF NOT EXISTS pq_events (
+                id INT AUTO_INCREMENT PRIMARY KEY,
+                received_at DATETIME DEFAULT CURRENT_TIMESTAMP,
+                device_event_id INT,
+                device_ms BIGINT,
+                type VARCHAR(16),
+                channel TINYINT,
+                trigger_value FLOAT,
+                extreme_value FLOAT,
+                sample_rate INT,
+                pre_rows INT,
+                total_rows INT,
+                channels TINYINT,
+                pins VARCHAR(32),
+                chunks INT,
+                chunks_received INT DEFAULT 0,
+                UNIQUE KEY uniq_device_event (device_event_id, device_ms),
+                INDEX idx_received (received_at)
+            )
+        """)
+        
+        cursor.execute("""
+            CREATE TABLE IF NOT EXISTS pq_event_chunks (
+                event_id INT,
+                chunk INT,
+                start_row INT,
+                samples MEDIUMTEXT,
+                PRIMARY KEY (event_id, chunk)
+            )
+        """)
         
         # Settings table for price
         cursor.execute("""
@@ -103,6 +223,241 @@ def init_database():
     except Error as e:
         print(f"❌ Error initializing database: {e}")
 
+def optional_float(data, key):
+    """Float value of an optional field, None when absent"""
+    value = data.get(key)
+    return float(value) if value is not None else None
+
+def harmonics_json(data):
+    """Pack the optional per-channel harmonic arrays into one JSON column"""
+    harmonics = {key: data[f'harmonics_{key}'] for key in ('v', 'i1', 'i2') if f'harmonics_{key}' in data}
+    return json.dumps(harmonics) if harmonics else None
+
+def reading_time(data):
+    """When a (possibly queued) reading was taken: device Unix time, age, or now"""
+    if data.get('ts') is not None:
+        return datetime.fromtimestamp(int(data['ts']))
+    if data.get('age_s') is not None:
+        return datetime.now() - timedelta(seconds=int(data['age_s']))
+    return datetime.now()
+
+# Binary telemetry (application/x-msgpack, see main/TelemetryCodec.h):
+# field ID -> (JSON key, scale); values are delta-coded scaled integers
+BINARY_FIELDS = [
+    ('seq', 1), ('time', 1), ('flags', 1),
+    ('voltage', 100), ('frequency', 1000),
+    ('current1', 10000), ('current2', 10000), ('current3', 10000),
+    ('power1', 100), ('power2', 100),
+    ('energy_l1_mj', 1), ('energy_l2_mj', 1),
+    ('apparent_power1', 100), ('apparent_power2', 100),
+    ('reactive_power1', 100), ('reactive_power2', 100),
+    ('power_factor1', 1000), ('power_factor2', 1000),
+    ('thd_v', 100), ('thd_i1', 100), ('thd_i2', 100),
+] + [(f'harmonics_{channel}', 100) for channel in ('v', 'i1', 'i2') for _ in range(5)]
+BINARY_FLAG_SYNCED = 0x01
+BINARY_FLAG_THEFT = 0x02
+BINARY_FLAG_HARMONICS = 0x04
+BINARY_FLAG_RELAY1 = 0x08
+BINARY_FLAG_RELAY2 = 0x10
+BINARY_FLAG_NO_TIME = 0x80
+BINARY_VERSION = 2
+
+def msgpack_unpack(payload):
+    """Decode the MessagePack subset the meter writes (ints, maps, arrays, nil, bool, floats)"""
+    def read(pos):
+        tag = payload[pos]
+        pos += 1
+        if tag <= 0x7F:
+            return tag, pos
+        if tag >= 0xE0:
+            return tag - 0x100, pos
+        if 0x80 <= tag <= 0x8F:
+            return read_map(pos, tag & 0x0F)
+        if 0x90 <= tag <= 0x9F:
+            return read_array(pos, tag & 0x0F)
+        if tag == 0xC0:
+            return None, pos
+        if tag in (0xC2, 0xC3):
+            return tag == 0xC3, pos
+        formats = {0xCA: '>f', 0xCB: '>d', 0xCC: '>B', 0xCD: '>H', 0xCE: '>I', 0xCF: '>Q',
+                   0xD0: '>b', 0xD1: '>h', 0xD2: '>i', 0xD3: '>q'}
+        if tag in formats:
+            size = struct.calcsize(formats[tag])
+            return struct.unpack_from(formats[tag], payload, pos)[0], pos + size
+        if tag in (0xDC, 0xDE):
+            count = struct.unpack_from('>H', payload, pos)[0]
+            return (read_array if tag == 0xDC else read_map)(pos + 2, count)
+        if tag in (0xDD, 0xDF):
+            count = struct.unpack_from('>I', payload, pos)[0]
+            return (read_array if tag == 0xDD else read_map)(pos + 4, count)
+        raise ValueError(f'unsupported MessagePack type 0x{tag:02x}')
+
+    def read_array(pos, count):
+        items = []
+        for _ in range(count):
+            item, pos = read(pos)
+            items.append(item)
+        return items, pos
+
+    def read_map(pos, count):
+        items = {}
+        for _ in range(count):
+            key, pos = read(pos)
+            items[key], pos = read(pos)
+        return items, pos
+
+    value, _ = read(0)
+    return value
+
+def decode_binary_batch(payload):
+    """Expand a delta-coded binary batch into the JSON batch shape"""
+    body = msgpack_unpack(payload)
+    if body.get(0) != BINARY_VERSION:
+        raise ValueError(f'unsupported telemetry version {body.get(0)}')
+    
+    readings = []
+    values = [0] * len(BINARY_FIELDS)
+    for index, deltas in enumerate(body.get(3, [])):
+        for field in range(len(BINARY_FIELDS)):
+            predicted = values[field] + (1 if field == 0 and index > 0 else 0)
+            values[field] = predicted + deltas.get(field, 0)
+        
+        flags = values[2]
+        reading = {'seq': values[0],
+                   'theft_detected': bool(flags & BINARY_FLAG_THEFT),
+                   'relay1': bool(flags & BINARY_FLAG_RELAY1),
+                   'relay2': bool(flags & BINARY_FLAG_RELAY2)}
+        if flags & BINARY_FLAG_SYNCED:
+            reading['ts'] = values[1]
+        elif not flags & BINARY_FLAG_NO_TIME:
+            reading['age_s'] = values[1]
+        for field in range(3, len(BINARY_FIELDS)):
+            key, scale = BINARY_FIELDS[field]
+            if key.startswith('harmonics_'):
+                if flags & BINARY_FLAG_HARMONICS:
+                    reading.setdefault(key, []).append(values[field] / scale)
+            elif key.startswith('thd_'):
+                if flags & BINARY_FLAG_HARMONICS:
+                    reading[key] = values[field] / scale
+            elif scale == 1:
+                reading[key] = values[field]
+            else:
+                reading[key] = values[field] / scale
+        readings.append(reading)
+    
+    return {'queue_depth': body.get(1), 'queue_dropped': body.get(2), 'readings': readings}
+
+def reading_row(data, batch):
+    """Column values of one reading; totals and costs are derived when the device omits them"""
+    current1 = float(data.get('current1', 0))
+    current2 = float(data.get('current2', 0))
+    power1 = float(data.get('power1', 0))
+    power2 = float(data.get('power2', 0))
+    # Exact registers (mJ) when the meter sends them; kWh from older firmware
+    energy_l1_mj = data.get('energy_l1_mj')
+    energy_l2_mj = data.get('energy_l2_mj')
+    energy_l1 = energy_l1_mj / MJ_PER_KWH if energy_l1_mj is not None else float(data.get('energy_l1', 0))
+    energy_l2 = energy_l2_mj / MJ_PER_KWH if energy_l2_mj is not None else float(data.get('energy_l2', 0))
+    cost_l1 = float(data.get('cost_l1', energy_l1 * price_per_unit))
+    cost_l2 = float(data.get('cost_l2', energy_l2 * price_per_unit))
+    seq = data.get('seq')
+    return (
+        reading_time(data),
+        int(seq) if seq is not None else None,
+        batch.get('queue_depth'),
+        batch.get('queue_dropped'),
+        float(data.get('voltage', 0)),
+        current1,
+        current2,
+        float(data.get('current3', 0)),
+        float(data.get('total_current', current1 + current2)),
+        power1,
+        power2,
+        float(data.get('total_power', power1 + power2)),
+        energy_l1,
+        energy_l2,
+        float(data.get('total_energy', energy_l1 + energy_l2)),
+        cost_l1,
+        cost_l2,
+        float(data.get('total_cost', cost_l1 + cost_l2)),
+        bool(data.get('theft_detected', False)),
+        bool(data.get('relay1', relay_states['relay1'])),
+        bool(data.get('relay2', relay_states['relay2'])),
+        float(data.get('apparent_power1', 0)),
+        float(data.get('apparent_power2', 0)),
+        float(data.get('reactive_power1', 0)),
+        float(data.get('reactive_power2', 0)),
+        float(data.get('power_factor1', 0)),
+        float(data.get('power_factor2', 0)),
+        float(data.get('frequency', 0)),
+        optional_float(data, 'thd_v'),
+        optional_float(data, 'thd_i1'),
+        optional_float(data, 'thd_i2'),
+        harmonics_json(data),
+        int(energy_l1_mj) if energy_l1_mj is not None else None,
+        int(energy_l2_mj) if energy_l2_mj is not None else None
+    )
+
+# ===================== KEEP-ALIVE =====================
+
+class RequestBody(io.RawIOBase):
+    """Body of one request on a kept-alive connection: reads stop at its end"""
+
+    def __init__(self, rfile, length):
+        self.rfile = rfile
+        self.left = length
+
+    def readable(self):
+        return True
+
+    def read(self, size=-1):
+        if size is None or size < 0 or size > self.left:
+            size = self.left
+        data = self.rfile.read(size) if size > 0 else b''
+        self.left -= len(data)
+        return data
+
+    def readinto(self, buffer):
+        data = self.read(len(buffer))
+        buffer[:len(data)] = data
+        return len(data)
+
+class KeepAliveRequestHandler(WSGIRequestHandler):
+    """Development server handler that keeps HTTP/1.1 connections open.
+    Werkzeug closes every connection and, after each response, discards
+    whatever is left on the socket, which on a kept-alive connection would be
+    the next request. Each request is therefore read through a RequestBody
+    limited to its Content-Length, and any unread rest of it is skipped."""
+    protocol_version = "HTTP/1.1"
+
+    def parse_request(self):
+        ok = super().parse_request()
+        # Answer in the client's version (no chunked bodies for HTTP/1.0 clients)
+        if self.request_version != "HTTP/1.1":
+            self.protocol_version = "HTTP/1.0"
+        return ok
+
+    def keep_alive(self):
+        chunked = 'chunked' in self.headers.get('Transfer-Encoding', '').lower()
+        return self.request_version == "HTTP/1.1" and not self.close_connection and not chunked
+
+    def send_header(self, keyword, value):
+        if keyword.lower() == 'connection' and value.lower() == 'close' and self.keep_alive():
+            return
+        super().send_header(keyword, value)
+
+    def run_wsgi(self):
+        if not self.keep_alive():
+            return super().run_wsgi()
+        rfile = self.rfile
+        body = RequestBody(rfile, int(self.headers.get('Content-Length') or 0))
+        self.rfile = body
+        try:
+            super().run_wsgi()
+            body.read()
+        finally:
+            self.rfile = rfile
+
 # ===================== API ENDPOINTS =====================
 
 @app.route('/')
@@ -112,12 +467,23 @@ def index():
 
 @app.route('/api/data', methods=['POST'])
 def receive_data():
-    """Receive complete sensor data from ESP32"""
+    """Receive sensor readings from ESP32: one reading, or a batch as {"readings": [...]}
+    in JSON or delta-coded MessagePack"""
     try:
-        data = request.get_json()
-        print(f"📊 Data received: Power={data.get('total_power', 0):.2f}W, "
-              f"Energy={data.get('total_energy', 0):.3f}kWh, "
-              f"Theft={data.get('theft_detected', False)}")
+        if request.mimetype == 'application/x-msgpack':
+            data = decode_binary_batch(request.get_data())
+        elif request.is_json:
+            data = request.get_json()
+        else:
+            return jsonify({'status': 'error', 'message': 'Unsupported content type'}), 415
+        readings = data['readings'] if 'readings' in data else [data]
+        if not readings:
+            return jsonify({'status': 'success', 'message': 'No readings', 'count': 0}), 200
+        
+        rows = [reading_row(r, data) for r in readings]
+        latest = rows[-1]
+        print(f"📊 Data received: {len(rows)} reading(s) from #{rows[0][1]}, "
+              f"Power={latest[11]:.2f}W, Energy={latest[14]:.3f}kWh, Theft={latest[18]}")
         
         connection = get_db_connection()
         if not connection:
@@ -126,50 +492,163 @@ def receive_data():
         cursor = connection.cursor()
         
         # Update theft status
-        if data.get('theft_detected', False):
+        if any(r.get('theft_detected', False) for r in readings):
             theft_status['detected'] = True
             theft_status['timestamp'] = datetime.now().isoformat()
         
+        # A retried upload whose first attempt was stored is acknowledged again
+        # without a second row (unique device_seq)
         query = """
             INSERT INTO readings 
-            (voltage, current1, current2, current3, total_current, 
+            (timestamp, device_seq, queue_depth, queue_dropped, voltage,
+             current1, current2, current3, total_current, 
              power1, power2, total_power, energy_l1, energy_l2, total_energy,
-             cost_l1, cost_l2, total_cost, theft_detected, relay1_state, relay2_state)
-            VALUES (%s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s)
+             cost_l1, cost_l2, total_cost, theft_detected, relay1_state, relay2_state,
+             apparent_power1, apparent_power2, reactive_power1, reactive_power2,
+             power_factor1, power_factor2, frequency,
+             thd_voltage, thd_current1, thd_current2, harmonics,
+             energy_l1_mj, energy_l2_mj)
+            VALUES (%s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s,
+                    %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s)
+            ON DUPLICATE KEY UPDATE device_seq = device_seq
         """
         
-        values = (
-            float(data.get('voltage', 0)),
-            float(data.get('current1', 0)),
-            float(data.get('current2', 0)),
-            float(data.get('current3', 0)),
-            float(data.get('total_current', 0)),
-            float(data.get('power1', 0)),
-            float(data.get('power2', 0)),
-            float(data.get('total_power', 0)),
-            float(data.get('energy_l1', 0)),
-            float(data.get('energy_l2', 0)),
-            float(data.get('total_energy', 0)),
-            float(data.get('cost_l1', 0)),
-            float(data.get('cost_l2', 0)),
-            float(data.get('total_cost', 0)),
-            bool(data.get('theft_detected', False)),
-            relay_states['relay1'],
-            relay_states['relay2']
-        )
-        
-        cursor.execute(query, values)
+        # The whole batch is one transaction
+        cursor.executemany(query, rows)
         connection.commit()
         
         cursor.close()
         connection.close()
         
-        return jsonify({'status': 'success', 'message': 'Data saved'}), 200
+        return jsonify({'status': 'success', 'message': 'Data saved', 'count': len(readings)}), 200
         
     except Exception as e:
         print(f"❌ Error saving data: {e}")
         return jsonify({'status': 'error', 'message': str(e)}), 500
 
+@app.route('/api/pq/event', methods=['POST'])
+def receive_pq_event():
+    """Receive one waveform chunk of a power quality event from ESP32"""
+    try:
+        data = request.get_json()
+        
+        connection = get_db_connection()
+        if not connection:
+            return jsonify({'status': 'error', 'message': 'Database connection failed'}), 500
+        
+        cursor = connection.cursor()
+        cursor.execute("""
+            INSERT INTO pq_events
+            (device_event_id, device_ms, type, channel, trigger_value, extreme_value,
+             sample_rate, pre_rows, total_rows, channels, pins, chunks)
+            VALUES (%s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s)
+            ON DUPLICATE KEY UPDATE id = LAST_INSERT_ID(id)
+        """, (
+            int(data['event_id']),
+            int(data['device_ms']),
+            str(data.get('type', 'none')),
+            int(data.get('channel', 0)),
+            float(data.get('trigger_value', 0)),
+            float(data.get('extreme_value', 0)),
+            int(data.get('sample_rate', 0)),
+            int(data.get('pre_rows', 0)),
+            int(data.get('rows', 0)),
+            int(data.get('channels', 0)),
+            json.dumps(data.get('pins', [])),
+            int(data.get('chunks', 1))
+        ))
+        event_id = cursor.lastrowid
+        
+        # Re-sent chunks replace the stored copy
+        cursor.execute("""
+            REPLACE INTO pq_event_chunks (event_id, chunk, start_row, samples)
+            VALUES (%s, %s, %s, %s)
+        """, (event_id, int(data['chunk']), int(data.get('start_row', 0)), json.dumps(data.get('samples', []))))
+        
+        cursor.execute("""
+            UPDATE pq_events SET chunks_received =
+                (SELECT COUNT(*) FROM pq_event_chunks WHERE event_id = %s)
+            WHERE id = %s
+        """, (event_id, event_id))
+        
+        connection.commit()
+        cursor.close()
+        connection.close()
+        
+        if int(data['chunk']) == int(data.get('chunks', 1)) - 1:
+            print(f"📉 Power quality event: {data.get('type')} on channel {data.get('channel')} "
+                  f"({data.get('extreme_value', 0):.2f})")
+        
+        return jsonify({'status': 'success', 'event_id': event_id}), 200
+        
+    except Exception as e:
+        print(f"❌ Error saving power quality event: {e}")
+        return jsonify({'status': 'error', 'message': str(e)}), 500
+
+@app.route('/api/pq/events', methods=['GET'])
+def get_pq_events():
+    """List captured power quality events"""
+    try:
+        limit = request.args.get('limit', 50, type=int)
+        
+        connection = get_db_connection()
+        if not connection:
+            return jsonify({'status': 'error'}), 500
+        
+        cursor = connection.cursor(dictionary=True)
+        cursor.execute("""
+            SELECT * FROM pq_events ORDER BY received_at DESC LIMIT %s
+        """, (limit,))
+        results = cursor.fetchall()
+        cursor.close()
+        connection.close()
+        
+        for row in results:
+            row['received_at'] = row['received_at'].isoformat()
+            row['pins'] = json.loads(row['pins'] or '[]')
+        
+        return jsonify(results), 200
+        
+    except Exception as e:
+        print(f"❌ Error fetching power quality events: {e}")
+        return jsonify({'status': 'error', 'message': str(e)}), 500
+
+@app.route('/api/pq/events/<int:event_id>', methods=['GET'])
+def get_pq_event(event_id):
+    """Get one power quality event with its reassembled waveform"""
+    try:
+        connection = get_db_connection()
+        if not connection:
+            return jsonify({'status': 'error'}), 500
+        
+        cursor = connection.cursor(dictionary=True)
+        cursor.execute("SELECT * FROM pq_events WHERE id = %s", (event_id,))
+        event = cursor.fetchone()
+        if not event:
+            cursor.close()
+            connection.close()
+            return jsonify({'status': 'not found'}), 404
+        
+        cursor.execute("""
+            SELECT samples FROM pq_event_chunks WHERE event_id = %s ORDER BY chunk ASC
+        """, (event_id,))
+        samples = []
+        for row in cursor.fetchall():
+            samples.extend(json.loads(row['samples']))
+        cursor.close()
+        connection.close()
+        
+        event['received_at'] = event['received_at'].isoformat()
+        event['pins'] = json.loads(event['pins'] or '[]')
+        channels = event['channels'] or 1
+        event['waveform'] = [samples[i:i + channels] for i in range(0, len(samples), channels)]
+        
+        return jsonify(event), 200
+        
+    except Exception as e:
+        print(f"❌ Error fetching power quality event: {e}")
+        return jsonify({'status': 'error', 'message': str(e)}), 500
+
 @app.route('/api/latest', methods=['GET'])
 def get_latest():
     """Get the most recent reading"""
@@ -300,6 +779,168 @@ def get_stats():
         print(f"❌ Error fetching stats: {e}")
         return jsonify({'status': 'error', 'message': str(e)}), 500
 
+# ===================== COMMAND CHANNEL =====================
+
+def push_command():
+    """Announce the current relay and price state as a new command for the meter"""
+    with command_channel['condition']:
+        command_channel['id'] += 1
+        command_id = command_channel['id']
+        command_channel['issued'][command_id] = time.monotonic()
+        # Only recent commands can still be acknowledged
+        for old in [i for i in command_channel['issued'] if i <= command_id - 32]:
+            del command_channel['issued'][old]
+        command_channel['condition'].notify_all()
+    return command_id
+
+def command_event(command_id):
+    """SSE event with the state as of now (newer than the command if the meter posted since)"""
+    command = {
+        'id': command_id,
+        'relay1': bool(relay_states['relay1']),
+        'relay2': bool(relay_states['relay2']),
+        'relay3': bool(relay_states['relay3']),
+        'price': price_per_unit,
+    }
+    return f"event: command\nid: {command_id}\ndata: {json.dumps(command)}\n\n"
+
+@app.route('/api/commands/stream', methods=['GET'])
+def command_stream():
+    """Server-sent events to the meter: the latest command at once, then each new one"""
+    def events():
+        condition = command_channel['condition']
+        with condition:
+            command_channel['streams'] += 1
+            sent = command_channel['id']
+        print("📡 Meter command stream opened")
+        try:
+            # Catch up on anything missed while disconnected
+            if sent:
+                yield command_event(sent)
+            while True:
+                with condition:
+                    changed = condition.wait_for(lambda: command_channel['id'] != sent,
+                                                 timeout=COMMAND_PING_SECONDS)
+                    sent = command_channel['id']
+                if changed:
+                    yield command_event(sent)
+                else:
+                    yield ": ping\n\n"
+        finally:
+            with condition:
+                command_channel['streams'] -= 1
+            print("📡 Meter command stream closed")
+
+    headers = {'Cache-Control': 'no-cache', 'X-Accel-Buffering': 'no'}
+    return Response(events(), mimetype='text/event-stream', headers=headers)
+
+@app.route('/api/commands/ack', methods=['POST'])
+def command_ack():
+    """Meter confirms a command was applied; latency runs from the dashboard click"""
+    try:
+        data = request.get_json()
+        command_id = int(data.get('id', 0))
+        with command_channel['condition']:
+            issued = command_channel['issued'].pop(command_id, None)
+        if issued is None:
+            # Replay after a reconnect, or already acknowledged
+            return jsonify({'status': 'success', 'latency_ms': None}), 200
+
+        latency_ms = (time.monotonic() - issued) * 1000.0
+        command_stats['acked'] += 1
+        command_stats['last_ms'] = round(latency_ms, 1)
+        command_stats['total_ms'] += latency_ms
+        command_stats['max_ms'] = max(command_stats['max_ms'], latency_ms)
+        command_stats['last_apply_us'] = data.get('apply_us')
+        print(f"⚡ Command {command_id} applied {latency_ms:.1f} ms after the click "
+              f"(meter: {data.get('apply_us')} µs from receive to relay write)")
+        return jsonify({'status': 'success', 'latency_ms': command_stats['last_ms']}), 200
+    except Exception as e:
+        return jsonify({'status': 'error', 'message': str(e)}), 500
+
+@app.route('/api/commands/stats', methods=['GET'])
+def get_command_stats():
+    """Click-to-actuation latency of pushed commands"""
+    acked = command_stats['acked']
+    return jsonify({
+        'streams': command_channel['streams'],
+        'last_command': command_channel['id'],
+        'acked': acked,
+        'last_ms': command_stats['last_ms'],
+        'avg_ms': round(command_stats['total_ms'] / acked, 1) if acked else None,
+        'max_ms': round(command_stats['max_ms'], 1),
+        'last_apply_us': command_stats['last_apply_us'],
+    }), 200
+
+# ===================== METER METRICS =====================
+
+@app.route('/api/metrics', methods=['POST'])
+def receive_metrics():
+    """Meter uploads one part of its metrics snapshot; the last part publishes it"""
+    meter = request.remote_addr
+    part = request.args.get('part', 0, type=int)
+    last = request.args.get('last', 0, type=int) == 1
+    text = request.get_data(as_text=True)
+    with meter_metrics['lock']:
+        parts = meter_metrics['parts']
+        if part == 0:
+            parts[meter] = []
+        received = parts.get(meter)
+        if received is None or len(received) != part:
+            # A part went missing: the meter starts over with its next snapshot
+            parts.pop(meter, None)
+            return jsonify({'status': 'error', 'message': 'Unexpected part'}), 409
+        received.append(text)
+        if last:
+            meter_metrics['latest'][meter] = (time.time(), ''.join(parts.pop(meter)))
+    return jsonify({'status': 'success'}), 200
+
+def merge_metrics(snapshots):
+    """One exposition of several meters' snapshots, each sample labelled with its meter"""
+    families = {}   # name -> {'help', 'type', 'samples'}, in first-seen order
+    for meter, text in snapshots:
+        family = None
+        for line in text.splitlines():
+            if line.startswith('# HELP ') or line.startswith('# TYPE '):
+                fields = line.split(' ', 3)
+                family = families.setdefault(fields[2], {'help': None, 'type': None, 'samples': []})
+                key = 'help' if fields[1] == 'HELP' else 'type'
+                if family[key] is None:
+                    family[key] = line
+                continue
+            if not line or line.startswith('#') or family is None:
+                continue
+            name, brace, rest = line.partition('{')
+            if brace:
+                family['samples'].append(f'{name}{{instance="{meter}",{rest}')
+            else:
+                name, _, value = line.partition(' ')
+                family['samples'].append(f'{name}{{instance="{meter}"}} {value}')
+
+    lines = []
+    for family in families.values():
+        lines.extend(line for line in (family['help'], family['type']) if line)
+        lines.extend(family['samples'])
+    return '\n'.join(lines) + '\n' if lines else ''
+
+@app.route('/metrics', methods=['GET'])
+def get_metrics():
+    """Latest metrics of every meter heard from recently, for a Prometheus scrape"""
+    now = time.time()
+    with meter_metrics['lock']:
+        latest = sorted(meter_metrics['latest'].items())
+    snapshots = []
+    ages = []
+    for meter, (received, text) in latest:
+        if now - received <= METRICS_STALE_SECONDS:
+            snapshots.append((meter, text))
+            ages.append(f'meter_metrics_age_seconds{{instance="{meter}"}} {now - received:.1f}\n')
+    body = merge_metrics(snapshots)
+    body += ('# HELP meter_metrics_age_seconds Time since the snapshot was uploaded\n'
+             '# TYPE meter_metrics_age_seconds gauge\n')
+    body += ''.join(ages)
+    return Response(body, content_type='text/plain; version=0.0.4; charset=utf-8')
+
 # ===================== RELAY CONTROL =====================
 
 @app.route('/api/relay/state', methods=['POST'])
@@ -381,12 +1022,14 @@ def control_relay():
             theft_status['timestamp'] = None
             print("✅ Theft alert cleared via web dashboard")
         
+        command_id = push_command()
         print(f"🌐 Web command: Relay {relay} → {'ON' if state else 'OFF'}")
         
         return jsonify({
             'status': 'success',
             'relay': relay,
-            'state': state
+            'state': state,
+            'command_id': command_id
         }), 200
         
     except Exception as e:
@@ -403,8 +1046,11 @@ def theft_alert():
         
         theft_status['detected'] = detected
         theft_status['timestamp'] = datetime.now().isoformat() if detected else None
+        theft_status['confidence'] = optional_float(data, 'confidence') or 0.0
+        theft_status['leakage'] = optional_float(data, 'leakage') or 0.0
         
-        print(f"🚨 Theft status updated: {detected}")
+        print(f"🚨 Theft status updated: {detected} "
+              f"(confidence {theft_status['confidence']:.2f}, leakage {theft_status['leakage']:.4f} A)")
         
         return jsonify({'status': 'success'}), 200
     except Exception as e:
@@ -427,6 +1073,7 @@ def update_price():
             connection.close()
             
             price_per_unit = new_price
+            push_command()
             print(f"💰 Price updated to ₹{new_price} per kWh")
             
             return jsonify({'status': 'success', 'price': new_price}), 200
@@ -459,4 +1106,5 @@ if __name__ == '__main__':
     print("\n" + "="*60)
     print("✅ Server starting...\n")
     
-    app.run(host='0.0.0.0', port=5000, debug=True)
\ No newline at end of file
+    # Keep-alive: the meter reuses one connection for all its requests
+    app.run(host='0.0.0.0', port=5000, debug=True, request_handler=KeepAliveRequestHandler)
\ No newline at end of file
@@ -0,0 +1,433 @@
+#ifndef ADC_SAMPLER_H
+#define ADC_SAMPLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <esp_adc/adc_continuous.h>
+#else
+#include <math.h>
+#endif
+
+// One raw conversion as delivered by an AdcSource.
+// channel is the index into the sampler's pin list, not the hardware ADC channel.
+struct AdcConversion {
+    uint8_t channel;
+    uint16_t raw;
+};
+
+// Block of interleaved samples for every sampled pin at one fixed per-channel rate.
+// Sample n of every channel belongs to the same conversion sweep.
+struct AdcFrame {
+    static const uint8_t MAX_CHANNELS = 4;
+    static const uint16_t SAMPLES = 200;  // Per channel (10 ms at 20 kHz)
+
+    uint16_t raw[MAX_CHANNELS][SAMPLES];
+    uint8_t pins[MAX_CHANNELS];
+    uint8_t channels;
+    uint32_t sampleRate;  // Hz per channel
+    uint32_t sequence;
+
+    // Index of the column holding a GPIO, -1 if the pin is not sampled
+    int8_t channelOf(uint8_t pin) const {
+        for (uint8_t i = 0; i < channels; i++) {
+            if (pins[i] == pin) return i;
+        }
+        return -1;
+    }
+};
+
+// Source of raw conversions, sweeping the configured pins in order
+class AdcSource {
+public:
+    virtual ~AdcSource() {}
+    virtual bool begin(const uint8_t* pins, uint8_t count, uint32_t sampleRate) = 0;
+    virtual size_t read(AdcConversion* out, size_t maxCount, uint32_t timeoutMs) = 0;
+    virtual void end() {}
+};
+
+#ifdef ARDUINO
+// ESP32 continuous (DMA) ADC mode. All pins must be on ADC1 (GPIO32-39).
+class Esp32AdcSource : public AdcSource {
+private:
+    static const size_t READ_BYTES = 256;
+    static const uint8_t NO_CHANNEL = 0xFF;
+
+    adc_continuous_handle_t handle;
+    uint8_t channelIndex[SOC_ADC_MAX_CHANNEL_NUM];  // Hardware channel -> pin index
+    uint8_t buffer[READ_BYTES];
+
+public:
+    Esp32AdcSource() : handle(nullptr) {}
+
+    bool begin(const uint8_t* pins, uint8_t count, uint32_t sampleRate) override {
+        if (handle != nullptr) return true;
+
+        adc_continuous_handle_cfg_t handleConfig = {};
+        handleConfig.max_store_buf_size = 4096;
+        handleConfig.conv_frame_size = READ_BYTES;
+        if (adc_continuous_new_handle(&handleConfig, &handle) != ESP_OK) {
+            handle = nullptr;
+            return false;
+        }
+
+        for (uint8_t i = 0; i < SOC_ADC_MAX_CHANNEL_NUM; i++) {
+            channelIndex[i] = NO_CHANNEL;
+        }
+
+        adc_digi_pattern_config_t pattern[AdcFrame::MAX_CHANNELS] = {};
+        for (uint8_t i = 0; i < count; i++) {
+            adc_unit_t unit;
+            adc_channel_t channel;
+            if (adc_continuous_io_to_channel(pins[i], &unit, &channel) != ESP_OK || unit != ADC_UNIT_1) {
+                end();
+                return false;
+            }
+            pattern[i].atten = ADC_ATTEN_DB_12;  // Same 0-3.3 V range analogRead() used
+            pattern[i].channel = channel;
+            pattern[i].unit = ADC_UNIT_1;
+            pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+            channelIndex[channel] = i;
+        }
+
+        adc_continuous_config_t config = {};
+        config.pattern_num = count;
+        config.adc_pattern = pattern;
+        config.sample_freq_hz = sampleRate * count;  // Conversions per second over all pins
+        config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+        config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+
+        if (adc_continuous_config(handle, &config) != ESP_OK || adc_continuous_start(handle) != ESP_OK) {
+            end();
+            return false;
+        }
+        return true;
+    }
+
+    size_t read(AdcConversion* out, size_t maxCount, uint32_t timeoutMs) override {
+        if (handle == nullptr) return 0;
+
+        uint32_t length = maxCount * SOC_ADC_DIGI_RESULT_BYTES;
+        if (length > READ_BYTES) length = READ_BYTES;
+
+        uint32_t received = 0;
+        if (adc_continuous_read(handle, buffer, length, &received, timeoutMs) != ESP_OK) {
+            return 0;
+        }
+
+        size_t count = 0;
+        for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= received; i += SOC_ADC_DIGI_RESULT_BYTES) {
+            const adc_digi_output_data_t* result = (const adc_digi_output_data_t*)&buffer[i];
+            uint8_t channel = result->type1.channel;
+            if (channel >= SOC_ADC_MAX_CHANNEL_NUM || channelIndex[channel] == NO_CHANNEL) continue;
+            out[count].channel = channelIndex[channel];
+            out[count].raw = result->type1.data;
+            count++;
+        }
+        return count;
+    }
+
+    void end() override {
+        if (handle == nullptr) return;
+        adc_continuous_stop(handle);
+        adc_continuous_deinit(handle);
+        handle = nullptr;
+    }
+};
+#else
+// Host-side stand-in producing synthetic sine waves, one tone per channel,
+// with the same sequential sweep order (and inter-channel skew) as the hardware.
+class FakeAdcSource : public AdcSource {
+public:
+    struct Tone {
+        float offset;     // ADC counts
+        float amplitude;  // ADC counts, peak
+        float frequency;  // Hz
+        float phase;      // Radians
+    };
+
+private:
+    Tone tones[AdcFrame::MAX_CHANNELS];
+    uint8_t channels;
+    uint32_t sampleRate;
+    uint64_t conversions;
+    uint32_t noiseSeed;
+    uint16_t noiseCounts;
+
+    uint16_t noise() {
+        if (noiseCounts == 0) return 0;
+        noiseSeed = noiseSeed * 1664525u + 1013904223u;
+        return (noiseSeed >> 16) % (2 * noiseCounts + 1);
+    }
+
+public:
+    FakeAdcSource() : channels(0), sampleRate(0), conversions(0), noiseSeed(1), noiseCounts(0) {
+        for (uint8_t i = 0; i < AdcFrame::MAX_CHANNELS; i++) {
+            tones[i] = {2048.0f, 0.0f, 50.0f, 0.0f};
+        }
+    }
+
+    void setTone(uint8_t channel, float offset, float amplitude, float frequency, float phase = 0.0f) {
+        if (channel < AdcFrame::MAX_CHANNELS) {
+            tones[channel] = {offset, amplitude, frequency, phase};
+        }
+    }
+
+    // Uniform noise of +/- counts added to every conversion
+    void setNoise(uint16_t counts) {
+        noiseCounts = counts;
+    }
+
+    bool begin(const uint8_t* pins, uint8_t count, uint32_t rate) override {
+        (void)pins;
+        channels = count;
+        sampleRate = rate;
+        conversions = 0;
+        return count > 0 && count <= AdcFrame::MAX_CHANNELS && rate > 0;
+    }
+
+    size_t read(AdcConversion* out, size_t maxCount, uint32_t timeoutMs) override {
+        (void)timeoutMs;
+        if (channels == 0) return 0;
+
+        const double conversionRate = (double)sampleRate * channels;
+        for (size_t i = 0; i < maxCount; i++) {
+            uint8_t channel = conversions % channels;
+            double t = conversions / conversionRate;
+            const Tone& tone = tones[channel];
+            double value = tone.offset + tone.amplitude * sin(2.0 * M_PI * tone.frequency * t + tone.phase);
+            value += (double)noise() - noiseCounts;
+            if (value < 0) value = 0;
+            if (value > 4095) value = 4095;
+
+            out[i].channel = channel;
+            out[i].raw = (uint16_t)(value + 0.5);
+            conversions++;
+        }
+        return maxCount;
+    }
+};
+#endif
+
+// Assembles conversions from an AdcSource into double-buffered frames.
+// The producer side (pump) runs on its own task; the consumer takes completed
+// frames with acquireFrame()/releaseFrame(). Neither side ever blocks the other.
+class AdcSampler {
+private:
+    enum BufferState : uint8_t { FREE, FILLING, READY, READING };
+    static const size_t READ_CHUNK = 64;
+    static const uint8_t NO_BUFFER = 0xFF;
+    static const uint8_t STALL_LIMIT = 5;  // Pumps (1 tick each) without a buffer
+
+    AdcSource& source;
+    uint8_t pins[AdcFrame::MAX_CHANNELS];
+    uint8_t channels;
+    uint32_t sampleRate;
+
+    AdcFrame frames[2];
+    std::atomic<uint8_t> state[2];
+    uint8_t fillIndex;     // Producer-owned, NO_BUFFER while the consumer holds both
+    uint16_t row;          // Next sample index in the frame being filled
+    uint8_t expected;      // Next channel expected in the sweep
+    uint32_t sequence;
+    uint8_t stalls;
+    AdcConversion scratch[READ_CHUNK];
+    size_t scratchNext;    // Conversions in scratch not yet placed in a frame
+    size_t scratchCount;
+
+    std::atomic<uint32_t> framesProduced;
+    std::atomic<uint32_t> overruns;
+    std::atomic<uint32_t> syncErrors;
+
+#ifdef ARDUINO
+    TaskHandle_t task;
+
+    static void taskEntry(void* arg) {
+        AdcSampler* self = static_cast<AdcSampler*>(arg);
+        for (;;) {
+            self->pump(100);
+        }
+    }
+#endif
+
+    bool claim(uint8_t index, uint8_t from) {
+        uint8_t expectedState = from;
+        return state[index].compare_exchange_strong(expectedState, FILLING);
+    }
+
+    // Pick the next buffer to fill after `published` was handed to the consumer.
+    // If the consumer is lagging, the oldest unread frame is dropped. If it is
+    // still reading the other buffer, there is nothing to fill yet (NO_BUFFER).
+    uint8_t nextFillBuffer(uint8_t published) {
+        uint8_t other = published ^ 1;
+        if (claim(other, FREE)) return other;
+        if (claim(other, READY)) {
+            overruns++;
+            return other;
+        }
+        return NO_BUFFER;
+    }
+
+    // Leave NO_BUFFER once the consumer releases a frame. The source only buffers
+    // a few ms, so after STALL_LIMIT tries an unread frame is dropped instead.
+    bool claimBuffer() {
+        for (uint8_t i = 0; i < 2; i++) {
+            if (claim(i, FREE)) {
+                fillIndex = i;
+                stalls = 0;
+                return true;
+            }
+        }
+        if (++stalls < STALL_LIMIT) return false;
+        for (uint8_t i = 0; i < 2; i++) {
+            if (claim(i, READY)) {
+                overruns++;
+                fillIndex = i;
+                stalls = 0;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void publish() {
+        AdcFrame& frame = frames[fillIndex];
+        frame.channels = channels;
+        frame.sampleRate = sampleRate;
+        frame.sequence = sequence++;
+        for (uint8_t i = 0; i < channels; i++) {
+            frame.pins[i] = pins[i];
+        }
+
+        uint8_t published = fillIndex;
+        state[published].store(READY, std::memory_order_release);
+        framesProduced++;
+        fillIndex = nextFillBuffer(published);
+        row = 0;
+    }
+
+public:
+    AdcSampler(AdcSource& adcSource, const uint8_t* pinList, uint8_t count, uint32_t rate)
+        : source(adcSource),
+          channels(count > AdcFrame::MAX_CHANNELS ? AdcFrame::MAX_CHANNELS : count),
+          sampleRate(rate),
+          fillIndex(0),
+          row(0),
+          expected(0),
+          sequence(0),
+          stalls(0),
+          scratchNext(0),
+          scratchCount(0),
+          framesProduced(0),
+          overruns(0),
+          syncErrors(0)
+#ifdef ARDUINO
+          , task(nullptr)
+#endif
+    {
+        for (uint8_t i = 0; i < channels; i++) {
+            pins[i] = pinList[i];
+        }
+        frames[0].sequence = 0;
+        frames[1].sequence = 0;
+        state[0].store(FILLING);
+        state[1].store(FREE);
+    }
+
+    // Configure the source; call once before start() or pump()
+    bool begin() {
+        return source.begin(pins, channels, sampleRate);
+    }
+
+#ifdef ARDUINO
+    // Run the producer on its own task (core 0 by default, away from loop())
+    bool start(BaseType_t core = 0) {
+        if (task != nullptr) return true;
+        return xTaskCreatePinnedToCore(taskEntry, "adc_sampler", 4096, this, 5, &task, core) == pdPASS;
+    }
+#endif
+
+    // Producer step: pull available conversions into the current frame.
+    // Returns the number of conversions consumed from the source.
+    // While the consumer holds both buffers nothing is read: conversions wait
+    // in the source (the DMA pool on the ESP32) and the task yields.
+    size_t pump(uint32_t timeoutMs) {
+        if (fillIndex == NO_BUFFER && !claimBuffer()) {
+#ifdef ARDUINO
+            vTaskDelay(1);
+#endif
+            return 0;
+        }
+
+        if (scratchNext == scratchCount) {
+            scratchCount = source.read(scratch, READ_CHUNK, timeoutMs);
+            scratchNext = 0;
+        }
+
+        size_t start = scratchNext;
+        while (scratchNext < scratchCount) {
+            const AdcConversion& conversion = scratch[scratchNext++];
+
+            // Lost conversions break the sweep: drop the partial row and resync on channel 0
+            if (conversion.channel != expected) {
+                syncErrors++;
+                expected = 0;
+                if (conversion.channel != 0) continue;
+            }
+
+            frames[fillIndex].raw[conversion.channel][row] = conversion.raw;
+            if (++expected == channels) {
+                expected = 0;
+                if (++row == AdcFrame::SAMPLES) {
+                    publish();
+                    // The rest of the chunk stays in scratch for the next frame
+                    if (fillIndex == NO_BUFFER) break;
+                }
+            }
+        }
+        return scratchNext - start;
+    }
+
+    // Oldest completed frame not yet consumed, or nullptr. Must be released.
+    // A frame's sequence is only read once it is claimed: the producer may be
+    // refilling a buffer that is not READY (an overrun) at any time.
+    const AdcFrame* acquireFrame() {
+        uint8_t chosen = NO_BUFFER;
+        for (uint8_t i = 0; i < 2 && chosen == NO_BUFFER; i++) {
+            uint8_t expectedState = READY;
+            if (state[i].compare_exchange_strong(expectedState, READING, std::memory_order_acquire)) chosen = i;
+        }
+        if (chosen == NO_BUFFER) return nullptr;
+
+        // If the other buffer holds an older frame too, take that one first
+        uint8_t other = chosen ^ 1;
+        uint8_t expectedState = READY;
+        if (state[other].compare_exchange_strong(expectedState, READING, std::memory_order_acquire)) {
+            if (frames[other].sequence < frames[chosen].sequence) {
+                uint8_t newer = chosen;
+                chosen = other;
+                other = newer;
+            }
+            state[other].store(READY, std::memory_order_release);
+        }
+        return &frames[chosen];
+    }
+
+    void releaseFrame(const AdcFrame* frame) {
+        for (uint8_t i = 0; i < 2; i++) {
+            if (frame == &frames[i]) {
+                state[i].store(FREE, std::memory_order_release);
+            }
+        }
+    }
+
+    uint32_t getSampleRate() const { return sampleRate; }
+    uint32_t getFrameCount() const { return framesProduced.load(); }
+    uint32_t getOverruns() const { return overruns.load(); }
+    uint32_t getSyncErrors() const { return syncErrors.load(); }
+};
+
+#endif // ADC_SAMPLER_H
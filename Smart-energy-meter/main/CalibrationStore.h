@@ -0,0 +1,186 @@
+#ifndef CALIBRATION_STORE_H
+#define CALIBRATION_STORE_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <math.h>
+#include <atomic>
+#include "FlashPartition.h"
+#include "current.h"
+#include "EventLog.h"
+
+// Current sensor zero offsets as saved in NVS
+struct CalibrationRecord {
+    static const uint16_t MAGIC = 0x4F43;     // "CO"
+    static const uint8_t MAX_SENSORS = 4;
+
+    uint16_t magic;
+    uint8_t count;
+    uint8_t linearized;                       // Offsets in linearized mV (else raw counts)
+    uint8_t pins[MAX_SENSORS];
+    int32_t offsets[MAX_SENSORS];             // ADC units
+    uint32_t crc;                             // CRC-32 of the fields before it
+
+    uint32_t checksum() const {
+        return flashCrc32(this, offsetof(CalibrationRecord, crc));
+    }
+};
+
+// Keeps the current sensors' zero offsets across reboots, so boot reuses them
+// instead of calibrating for a second with NO LOAD connected (not possible after
+// a brownout in the field). Saved offsets are checked in the background against
+// the mean of the first cycle-aligned power windows: an AC load has no DC
+// component, so this works with loads on. A shift beyond TOLERANCE_MV replaces
+// the saved value; a fresh calibration is saved once it has been checked.
+// Offsets moved later on (drift tracking) are saved at most every SAVE_INTERVAL_MS.
+// addWindow() runs on the control task and only flags a save; saveIfMoved()
+// writes NVS from a slower task.
+class CalibrationStore {
+public:
+    static const uint16_t CHECK_WINDOWS = 10;       // About 2 s of power windows
+    static constexpr float TOLERANCE_MV = 5.0;      // ~27 mA on an ACS712-5A
+    static const uint32_t SAVE_INTERVAL_MS = 3600000;
+
+private:
+    Preferences preferences;
+    CurrentSensor* sensors[CalibrationRecord::MAX_SENSORS];
+    uint8_t count;
+    double residuals[CalibrationRecord::MAX_SENSORS];   // Sum of window means (ADC units)
+    uint16_t windows;
+    std::atomic<bool> checking;
+    std::atomic<bool> savePending;      // Boot check done and the offsets changed
+    bool restored;
+    uint32_t saves;
+    int32_t saved[CalibrationRecord::MAX_SENSORS];      // Offsets in flash (ADC units)
+    bool hasSaved;
+    uint32_t lastSaveMs;
+
+    bool load(CalibrationRecord& record) {
+        if (preferences.getBytes("offsets", &record, sizeof(record)) != sizeof(record)) return false;
+        if (record.magic != CalibrationRecord::MAGIC || record.crc != record.checksum()) return false;
+        if (record.count != count || record.linearized != (sensors[0]->isLinearized() ? 1 : 0)) return false;
+
+        for (uint8_t i = 0; i < count; i++) {
+            // Wired to the same pins, and within the ADC range
+            float millivolts = record.offsets[i] * sensors[i]->getMillivoltsPerUnit();
+            if (record.pins[i] != sensors[i]->getPin() || millivolts <= 0 || millivolts >= 3300) return false;
+        }
+        return true;
+    }
+
+    void save() {
+        CalibrationRecord record;
+        memset(&record, 0, sizeof(record));
+        record.magic = CalibrationRecord::MAGIC;
+        record.count = count;
+        record.linearized = sensors[0]->isLinearized() ? 1 : 0;
+        for (uint8_t i = 0; i < count; i++) {
+            record.pins[i] = sensors[i]->getPin();
+            record.offsets[i] = sensors[i]->getOffsetUnits();
+        }
+        record.crc = record.checksum();
+        if (preferences.putBytes("offsets", &record, sizeof(record)) == sizeof(record)) {
+            memcpy(saved, record.offsets, sizeof(saved));
+            hasSaved = true;
+            saves++;
+        }
+        lastSaveMs = millis();
+    }
+
+public:
+    CalibrationStore()
+        : count(0),
+          windows(0),
+          checking(false),
+          savePending(false),
+          restored(false),
+          saves(0),
+          hasSaved(false),
+          lastSaveMs(0) {}
+
+    // Register every sensor before begin(), in a fixed order
+    void addSensor(CurrentSensor& sensor) {
+        if (count < CalibrationRecord::MAX_SENSORS) sensors[count++] = &sensor;
+    }
+
+    // Apply the saved offsets (sensors are calibrated at once). Returns false if
+    // none are saved or they do not match this setup; calibrate the sensors then.
+    bool begin() {
+        preferences.begin("calibration", false);
+        windows = 0;
+        checking = true;
+        for (uint8_t i = 0; i < count; i++) {
+            residuals[i] = 0;
+        }
+
+        CalibrationRecord record;
+        restored = count > 0 && load(record);
+        if (restored) {
+            for (uint8_t i = 0; i < count; i++) {
+                sensors[i]->setOffset(record.offsets[i]);
+            }
+            memcpy(saved, record.offsets, sizeof(saved));
+            hasSaved = true;
+        }
+        return restored;
+    }
+
+    // Call after every completed power window
+    void addWindow() {
+        if (!checking) return;
+        for (uint8_t i = 0; i < count; i++) {
+            if (!sensors[i]->isCalibrated()) return;    // First-boot calibration still running
+        }
+        for (uint8_t i = 0; i < count; i++) {
+            residuals[i] += sensors[i]->getWindowMean();
+        }
+        if (++windows < CHECK_WINDOWS) return;
+        checking = false;
+
+        bool changed = !restored;
+        for (uint8_t i = 0; i < count; i++) {
+            float residual = residuals[i] / windows;
+            if (fabsf(residual * sensors[i]->getMillivoltsPerUnit()) > TOLERANCE_MV) {
+                sensors[i]->setOffset(sensors[i]->getOffsetUnits() + (int32_t)lroundf(residual));
+                changed = true;
+
+                LOG_INFO(LOG_METER, "🔧 Zero offset on pin %u re-measured: %.1f mV",
+                         sensors[i]->getPin(), sensors[i]->getOffset());
+            }
+        }
+        if (changed) savePending.store(true, std::memory_order_release);
+    }
+
+    // Save offsets set by the boot check, or that moved beyond TOLERANCE_MV since
+    // the last save (rate-limited, NVS wears). Call periodically.
+    void saveIfMoved(uint32_t nowMs) {
+        if (savePending.exchange(false, std::memory_order_acquire)) {
+            save();
+            return;
+        }
+        if (checking || !hasSaved || nowMs - lastSaveMs < SAVE_INTERVAL_MS) return;
+        for (uint8_t i = 0; i < count; i++) {
+            int32_t moved = sensors[i]->getOffsetUnits() - saved[i];
+            if (fabsf(moved * sensors[i]->getMillivoltsPerUnit()) > TOLERANCE_MV) {
+                save();
+                return;
+            }
+        }
+    }
+
+    // Offsets came from flash at boot
+    bool isRestored() const {
+        return restored;
+    }
+
+    // Background check still running
+    bool isChecking() const {
+        return checking;
+    }
+
+    uint32_t getSaveCount() const {
+        return saves;
+    }
+};
+
+#endif // CALIBRATION_STORE_H
@@ -0,0 +1,215 @@
+#ifndef COMMAND_CHANNEL_H
+#define COMMAND_CHANNEL_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <ArduinoJson.h>
+#include <string.h>
+#include <stdlib.h>
+#include "EventLog.h"
+
+// One command pushed by the server: the full desired relay and price state
+struct ServerCommand {
+    uint32_t id;
+    bool relay1;
+    bool relay2;
+    bool relay3;
+    float price;                    // <= 0: unchanged
+    unsigned long receivedUs;       // micros() when the event was complete
+};
+
+// Server-sent events from GET /api/commands/stream on a socket of its own
+// (the keep-alive request connection stays free for uploads).
+// poll() never waits for the network: it only parses bytes already received,
+// so a command is applied within one loop pass of arriving. The server pings
+// an idle stream every 20 s; a stream silent for IDLE_TIMEOUT is treated as
+// dead and reopened with backoff, which is also the fallback poll's cue.
+class CommandChannel {
+public:
+    static const size_t LINE_SIZE = 256;
+    static const unsigned long IDLE_TIMEOUT = 60000;
+    static const unsigned long MIN_RETRY = 2000;
+    static const unsigned long MAX_RETRY = 60000;
+    static const uint16_t CONNECT_TIMEOUT_MS = 1000;
+
+private:
+    enum State {
+        CLOSED,
+        HEADERS,
+        EVENTS
+    };
+
+    WiFiClient tcp;
+    const char* host;
+    uint16_t port;
+    State state;
+
+    char line[LINE_SIZE];
+    size_t lineLength;
+    char data[LINE_SIZE];           // Data of the event being received
+    size_t dataLength;
+    bool commandEvent;
+    bool statusOk;
+
+    unsigned long lastByte;
+    unsigned long lastAttempt;
+    unsigned long retryInterval;
+    uint32_t connects;
+    uint32_t commands;
+
+    void close() {
+        tcp.stop();
+        if (state == EVENTS) LOG_INFO(LOG_NET, "📡 Command channel closed - polling until it reopens");
+        state = CLOSED;
+    }
+
+    void open(unsigned long now) {
+        lastAttempt = now;
+        if (!tcp.connect(host, port, CONNECT_TIMEOUT_MS)) {
+            retryInterval = (retryInterval * 2 < MAX_RETRY) ? retryInterval * 2 : MAX_RETRY;
+            return;
+        }
+        tcp.setNoDelay(true);
+        // HTTP/1.0: the server streams the body unchunked until either side closes
+        char request[128];
+        int n = snprintf(request, sizeof(request),
+            "GET /api/commands/stream HTTP/1.0\r\nHost: %s:%u\r\nAccept: text/event-stream\r\n\r\n",
+            host, port);
+        if (n >= (int)sizeof(request) || tcp.write((const uint8_t*)request, n) != (size_t)n) {
+            tcp.stop();
+            return;
+        }
+        state = HEADERS;
+        statusOk = false;
+        lineLength = 0;
+        dataLength = 0;
+        commandEvent = false;
+        lastByte = now;
+    }
+
+    // Handle one complete line; true when it completed a command event
+    bool handleLine(ServerCommand& out) {
+        if (state == HEADERS) {
+            if (!statusOk) {
+                const char* space = strchr(line, ' ');
+                statusOk = strncmp(line, "HTTP/1.", 7) == 0 && space && atoi(space + 1) == 200;
+                if (!statusOk) close();
+            } else if (lineLength == 0) {
+                state = EVENTS;
+                connects++;
+                retryInterval = MIN_RETRY;
+                LOG_INFO(LOG_NET, "📡 Command channel connected");
+            }
+            return false;
+        }
+
+        if (lineLength == 0) {
+            // Blank line: dispatch the event
+            bool dispatch = commandEvent && dataLength > 0;
+            commandEvent = false;
+            if (!dispatch) {
+                dataLength = 0;
+                return false;
+            }
+            data[dataLength] = '\0';
+            dataLength = 0;
+            return parseCommand(out);
+        }
+        if (line[0] == ':') return false;               // Comment (server ping)
+
+        char* value = strchr(line, ':');
+        if (value) {
+            *value++ = '\0';
+            if (*value == ' ') value++;
+        } else {
+            value = line + lineLength;                  // Field with an empty value
+        }
+        if (strcmp(line, "event") == 0) {
+            commandEvent = strcmp(value, "command") == 0;
+        } else if (strcmp(line, "data") == 0) {
+            size_t length = strlen(value);
+            if (dataLength > 0 && dataLength < LINE_SIZE - 1) data[dataLength++] = '\n';
+            if (length > LINE_SIZE - 1 - dataLength) length = LINE_SIZE - 1 - dataLength;
+            memcpy(data + dataLength, value, length);
+            dataLength += length;
+        }
+        return false;
+    }
+
+    bool parseCommand(ServerCommand& out) {
+        StaticJsonDocument<256> doc;
+        if (deserializeJson(doc, data, strlen(data))) return false;
+        out.id = doc["id"] | 0;
+        out.relay1 = doc["relay1"];
+        out.relay2 = doc["relay2"];
+        out.relay3 = doc["relay3"] | true;
+        out.price = doc["price"] | 0.0f;
+        out.receivedUs = micros();
+        commands++;
+        return true;
+    }
+
+public:
+    CommandChannel()
+        : host(""),
+          port(80),
+          state(CLOSED),
+          lineLength(0),
+          dataLength(0),
+          commandEvent(false),
+          statusOk(false),
+          lastByte(0),
+          lastAttempt(0),
+          retryInterval(MIN_RETRY),
+          connects(0),
+          commands(0) {}
+
+    void begin(const char* serverHost, uint16_t serverPort) {
+        host = serverHost;
+        port = serverPort;
+    }
+
+    // Call every loop pass; true when 'out' holds a new command
+    bool poll(ServerCommand& out, unsigned long now) {
+        if (state == CLOSED) {
+            if (WiFi.status() == WL_CONNECTED && now - lastAttempt >= retryInterval) open(now);
+            return false;
+        }
+
+        while (tcp.available()) {
+            int c = tcp.read();
+            if (c < 0) break;
+            lastByte = now;
+            if (c == '\r') continue;
+            if (c != '\n') {
+                if (lineLength < LINE_SIZE - 1) line[lineLength++] = (char)c;
+                continue;
+            }
+            line[lineLength] = '\0';
+            bool complete = handleLine(out);
+            lineLength = 0;
+            if (complete) return true;                  // The rest waits for the next pass
+            if (state == CLOSED) return false;
+        }
+
+        if (!tcp.connected() || now - lastByte >= IDLE_TIMEOUT) {
+            lastAttempt = now;
+            close();
+        }
+        return false;
+    }
+
+    bool isConnected() const {
+        return state == EVENTS;
+    }
+
+    uint32_t getConnectCount() const {
+        return connects;
+    }
+
+    uint32_t getCommandCount() const {
+        return commands;
+    }
+};
+
+#endif // COMMAND_CHANNEL_H
@@ -0,0 +1,228 @@
+#ifndef DEADLINE_SCHEDULER_H
+#define DEADLINE_SCHEDULER_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <string.h>
+#include "EventLog.h"
+#include "Metrics.h"
+
+typedef void (*TaskFunction)();
+
+// Timing of one scheduled task since boot (microseconds)
+struct TaskStats {
+    uint32_t runs;
+    uint32_t misses;                // Runs that finished after release + deadline
+    uint32_t maxLatencyUs;          // Release to start
+    uint32_t maxResponseUs;         // Release to finish
+    uint32_t maxRunUs;
+    uint64_t totalRunUs;
+
+    uint32_t averageRunUs() const {
+        return runs ? (uint32_t)(totalRunUs / runs) : 0;
+    }
+};
+
+// Run-to-completion scheduler for one FreeRTOS task. Every task has a period,
+// a relative deadline and a priority; of the tasks due, the highest priority
+// runs first and equal priorities go earliest deadline first. A task that
+// overran its period is released once more right away instead of in a burst.
+// Tasks can also be triggered from another FreeRTOS task (wakes the scheduler);
+// a task with period 0 runs only when triggered.
+class DeadlineScheduler {
+public:
+    static const uint8_t MAX_TASKS = 10;
+
+private:
+    struct Task {
+        const char* name;
+        TaskFunction function;
+        uint32_t periodUs;
+        uint32_t deadlineUs;
+        uint8_t priority;
+        uint32_t releaseUs;         // Next release
+        bool waiting;               // Period 0: released by trigger() only
+        TaskStats stats;
+    };
+
+    const char* name;
+    Task tasks[MAX_TASKS];
+    std::atomic<bool> triggered[MAX_TASKS];
+    std::atomic<uint32_t> triggeredUs[MAX_TASKS];
+    uint8_t count;
+    LatencyHistogram releaseLatency;    // Release to start over all tasks (jitter)
+
+#ifdef ARDUINO
+    TaskHandle_t handle;
+
+    static void taskEntry(void* arg) {
+        DeadlineScheduler* self = static_cast<DeadlineScheduler*>(arg);
+        const uint32_t tickUs = portTICK_PERIOD_MS * 1000;
+        for (;;) {
+            uint32_t waitUs = self->runOnce();
+            // Sleep until the next release (rounded up) or a trigger
+            if (waitUs > 0) ulTaskNotifyTake(pdTRUE, waitUs / tickUs + 1);
+        }
+    }
+#endif
+
+    static bool reached(uint32_t now, uint32_t time) {
+        return (int32_t)(now - time) >= 0;
+    }
+
+    void record(Task& task, uint32_t start, uint32_t end) {
+        TaskStats& s = task.stats;
+        uint32_t latency = start - task.releaseUs;
+        uint32_t response = end - task.releaseUs;
+        uint32_t run = end - start;
+        s.runs++;
+        s.totalRunUs += run;
+        if (latency > s.maxLatencyUs) s.maxLatencyUs = latency;
+        if (response > s.maxResponseUs) s.maxResponseUs = response;
+        if (run > s.maxRunUs) s.maxRunUs = run;
+        if (response > task.deadlineUs) s.misses++;
+#if METRICS_ENABLED
+        releaseLatency.record(latency);
+#endif
+    }
+
+public:
+    DeadlineScheduler(const char* schedulerName)
+        : name(schedulerName),
+          count(0)
+#ifdef ARDUINO
+          , handle(nullptr)
+#endif
+    {
+        for (uint8_t i = 0; i < MAX_TASKS; i++) {
+            triggered[i].store(false);
+            triggeredUs[i].store(0);
+        }
+    }
+
+    // Register a task (first release right away); returns its index, -1 if full.
+    // Higher priority values run first.
+    int8_t add(const char* taskName, TaskFunction function, uint32_t periodMs,
+               uint32_t deadlineMs, uint8_t priority) {
+        if (count >= MAX_TASKS) return -1;
+        Task& task = tasks[count];
+        task.name = taskName;
+        task.function = function;
+        task.periodUs = periodMs * 1000;
+        task.deadlineUs = deadlineMs * 1000;
+        task.priority = priority;
+        task.releaseUs = micros();
+        task.waiting = periodMs == 0;
+        memset(&task.stats, 0, sizeof(task.stats));
+        return (int8_t)count++;
+    }
+
+#ifdef ARDUINO
+    // Run the scheduler on its own FreeRTOS task
+    bool start(BaseType_t core, UBaseType_t taskPriority, uint32_t stackSize) {
+        if (handle != nullptr) return true;
+        return xTaskCreatePinnedToCore(taskEntry, name, stackSize, this, taskPriority, &handle, core) == pdPASS;
+    }
+#endif
+
+    // Run the most urgent due task, if any. Returns the microseconds until the
+    // next release (0 if another task is already due).
+    uint32_t runOnce() {
+        uint32_t now = micros();
+        int8_t best = -1;
+        uint32_t bestDeadline = 0;
+
+        for (uint8_t i = 0; i < count; i++) {
+            Task& task = tasks[i];
+            if (triggered[i].exchange(false)) {
+                uint32_t at = triggeredUs[i].load();
+                if (task.waiting || !reached(at, task.releaseUs)) task.releaseUs = at;
+                task.waiting = false;
+            }
+            if (task.waiting || !reached(now, task.releaseUs)) continue;
+            uint32_t deadline = task.releaseUs + task.deadlineUs;
+            if (best < 0 || task.priority > tasks[best].priority ||
+                (task.priority == tasks[best].priority && (int32_t)(deadline - bestDeadline) < 0)) {
+                best = i;
+                bestDeadline = deadline;
+            }
+        }
+
+        if (best >= 0) {
+            Task& task = tasks[best];
+            uint32_t start = micros();
+            task.function();
+            uint32_t end = micros();
+            record(task, start, end);
+
+            if (task.periodUs == 0) {
+                task.waiting = true;
+            } else {
+                task.releaseUs += task.periodUs;
+                if (reached(end, task.releaseUs)) task.releaseUs = end;    // Overran: skip missed releases
+            }
+        }
+
+        now = micros();
+        uint32_t wait = 0xFFFFFFFF;
+        for (uint8_t i = 0; i < count; i++) {
+            if (triggered[i].load()) return 0;
+            if (tasks[i].waiting) continue;
+            if (reached(now, tasks[i].releaseUs)) return 0;
+            uint32_t left = tasks[i].releaseUs - now;
+            if (left < wait) wait = left;
+        }
+        return wait;
+    }
+
+    // Make a task due now; safe to call from another FreeRTOS task
+    void trigger(int8_t index) {
+        if (index < 0 || index >= count) return;
+        triggeredUs[index].store(micros());
+        triggered[index].store(true);
+#ifdef ARDUINO
+        if (handle != nullptr) xTaskNotifyGive(handle);
+#endif
+    }
+
+    // Change a periodic task's period; the next release moves with it
+    void setPeriod(int8_t index, uint32_t periodMs) {
+        if (index < 0 || index >= count) return;
+        Task& task = tasks[index];
+        uint32_t periodUs = periodMs * 1000;
+        if (periodUs == task.periodUs || periodUs == 0 || task.periodUs == 0) return;
+        task.releaseUs = task.releaseUs - task.periodUs + periodUs;
+        task.periodUs = periodUs;
+    }
+
+    uint8_t getTaskCount() const {
+        return count;
+    }
+
+    const char* getTaskName(uint8_t index) const {
+        return tasks[index].name;
+    }
+
+    const TaskStats& getStats(uint8_t index) const {
+        return tasks[index].stats;
+    }
+
+    const char* getName() const {
+        return name;
+    }
+
+    const LatencyHistogram& getLatencyHistogram() const {
+        return releaseLatency;
+    }
+
+    void printStats() const {
+        LOG_INFO(LOG_TASKS, "⏱️ %s tasks (runs | deadline misses | worst latency | worst response | run avg/max, ms)", name);
+        for (uint8_t i = 0; i < count; i++) {
+            const TaskStats& s = tasks[i].stats;
+            LOG_INFO(LOG_TASKS, "   %s: %lu | %lu | %.1f | %.1f | %.2f/%.1f", tasks[i].name, s.runs, s.misses,
+                     s.maxLatencyUs / 1000.0, s.maxResponseUs / 1000.0, s.averageRunUs() / 1000.0, s.maxRunUs / 1000.0);
+        }
+    }
+};
+
+#endif // DEADLINE_SCHEDULER_H
@@ -0,0 +1,174 @@
+#ifndef DIFFERENTIAL_CURRENT_H
+#define DIFFERENTIAL_CURRENT_H
+
+#include <Arduino.h>
+#include "AdcSampler.h"
+#include "current.h"
+#include "PowerMeter.h"
+
+// Sample-by-sample leakage signal I3 - (I1 + I2) for theft detection, with
+// each channel signed by the polarity it was registered with in PowerMeter.
+// The ADC converts the pins one after another, so within a sweep the branch
+// and main channels are a few tens of microseconds apart. Each channel is
+// linearly interpolated back to the instant of the earliest one before the
+// subtraction. Every mains cycle yields the broadband RMS of the difference
+// and the RMS of its fundamental (single-bin Goertzel), which rejects most of
+// the sensor noise that a difference of RMS values cannot.
+class DifferentialCurrent {
+private:
+    static constexpr float NOMINAL_FREQUENCY = 50.0;
+
+    CurrentSensor& mainSensor;
+    CurrentSensor& branch1;
+    CurrentSensor& branch2;
+    PowerMeter& meter;
+
+    float previous[3];         // Last sample of main, branch1, branch2 (amps)
+    bool hasPrevious;
+
+    // Open cycle
+    uint32_t cycleLength;
+    uint32_t cycleSamples;
+    float sum;
+    float sumSquares;
+    float coeff;
+    float s1;
+    float s2;
+
+    // Last completed cycle
+    float lastRms;
+    float lastFundamental;
+    uint32_t cycles;
+
+    // Running average for the theft detector
+    float fundamentalSum;
+    uint32_t fundamentalCount;
+
+    void startCycle(uint32_t sampleRate) {
+        float frequency = meter.getFrequency();
+        if (frequency <= 0) frequency = NOMINAL_FREQUENCY;
+        cycleLength = (uint32_t)(sampleRate / frequency + 0.5f);
+        coeff = 2.0f * cosf(2.0f * 3.14159265f * frequency / sampleRate);
+        cycleSamples = 0;
+        sum = 0;
+        sumSquares = 0;
+        s1 = 0;
+        s2 = 0;
+    }
+
+    void closeCycle() {
+        float mean = sum / cycleSamples;
+        float variance = sumSquares / cycleSamples - mean * mean;
+        lastRms = variance > 0 ? sqrtf(variance) : 0;
+
+        // Fundamental amplitude -> RMS: |X| * 2 / N / sqrt(2)
+        float power = s1 * s1 + s2 * s2 - coeff * s1 * s2;
+        lastFundamental = power > 0 ? sqrtf(2.0f * power) / cycleSamples : 0;
+
+        fundamentalSum += lastFundamental;
+        fundamentalCount++;
+        cycles++;
+    }
+
+public:
+    DifferentialCurrent(CurrentSensor& main, CurrentSensor& load1, CurrentSensor& load2, PowerMeter& powerMeter)
+        : mainSensor(main),
+          branch1(load1),
+          branch2(load2),
+          meter(powerMeter),
+          hasPrevious(false),
+          cycleLength(0),
+          cycleSamples(0),
+          sum(0),
+          sumSquares(0),
+          coeff(0),
+          s1(0),
+          s2(0),
+          lastRms(0),
+          lastFundamental(0),
+          cycles(0),
+          fundamentalSum(0),
+          fundamentalCount(0) {
+        previous[0] = previous[1] = previous[2] = 0;
+    }
+
+    // Consume one completed frame from the sampler
+    void consume(const AdcFrame& frame) {
+        if (!mainSensor.isCalibrated() || !branch1.isCalibrated() || !branch2.isCalibrated()) {
+            hasPrevious = false;
+            return;
+        }
+
+        CurrentSensor* sensors[3] = {&mainSensor, &branch1, &branch2};
+        int8_t channels[3];
+        for (uint8_t k = 0; k < 3; k++) {
+            channels[k] = frame.channelOf(sensors[k]->getPin());
+            if (channels[k] < 0) return;
+        }
+
+        // Delay of each channel behind the earliest one, as a fraction of the sweep period
+        int8_t first = channels[0];
+        if (channels[1] < first) first = channels[1];
+        if (channels[2] < first) first = channels[2];
+        float delay[3];
+        float scale[3];
+        for (uint8_t k = 0; k < 3; k++) {
+            delay[k] = (float)(channels[k] - first) / frame.channels;
+            // Turn a sensor fitted backwards around so every channel reads import positive
+            scale[k] = sensors[k]->getAmpsPerUnit() * meter.getPolarity(*sensors[k]);
+        }
+
+        if (cycleLength == 0) {
+            startCycle(frame.sampleRate);
+        }
+
+        for (uint16_t i = 0; i < AdcFrame::SAMPLES; i++) {
+            float aligned[3];
+            for (uint8_t k = 0; k < 3; k++) {
+                float x = sensors[k]->toSample(frame.raw[channels[k]][i]) * scale[k];
+                // Interpolate back to the sweep start: x(t - d) ~ x[n] - d * (x[n] - x[n-1])
+                aligned[k] = hasPrevious ? x - delay[k] * (x - previous[k]) : x;
+                previous[k] = x;
+            }
+            hasPrevious = true;
+
+            float difference = aligned[0] - (aligned[1] + aligned[2]);
+            sum += difference;
+            sumSquares += difference * difference;
+            float s0 = difference + coeff * s1 - s2;
+            s2 = s1;
+            s1 = s0;
+
+            if (++cycleSamples >= cycleLength) {
+                closeCycle();
+                startCycle(frame.sampleRate);
+            }
+        }
+    }
+
+    // Broadband RMS of the difference over the last cycle (A)
+    float getCycleRms() const {
+        return lastRms;
+    }
+
+    // RMS of the 50/60 Hz component of the difference over the last cycle (A)
+    float getCycleFundamental() const {
+        return lastFundamental;
+    }
+
+    uint32_t getCycleCount() const {
+        return cycles;
+    }
+
+    // Mean fundamental leakage of the cycles since the previous call (A).
+    // Returns -1 if no cycle completed in between.
+    float takeAverageLeakage() {
+        if (fundamentalCount == 0) return -1;
+        float average = fundamentalSum / fundamentalCount;
+        fundamentalSum = 0;
+        fundamentalCount = 0;
+        return average;
+    }
+};
+
+#endif // DIFFERENTIAL_CURRENT_H
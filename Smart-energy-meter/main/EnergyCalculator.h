@@ -3,118 +3,197 @@
 
 #include <Arduino.h>
 #include <Preferences.h>
+#include <atomic>
+#include "EnergyJournal.h"
+#include "EventLog.h"
 
-// Energy Calculation and Cost Management
+// Exact energy register in millijoules (mW·s).
+// Each window adds P * samples / rate; the sub-mJ part is carried as an
+// integer remainder, so nothing is lost however large the total grows.
+// 64 bits hold 2.5e9 kWh.
+struct EnergyRegister {
+    uint64_t millijoules;
+    uint64_t remainder;        // µW·samples not yet worth a whole mJ
+    uint32_t remainderRate;    // Sample rate the remainder is counted in
+
+    void reset(uint64_t value = 0) {
+        millijoules = value;
+        remainder = 0;
+        remainderRate = 0;
+    }
+
+    // Add one measurement window of imported power (W, >= 0) lasting samples / sampleRate seconds
+    void add(float watts, uint32_t samples, uint32_t sampleRate) {
+        if (sampleRate == 0 || samples == 0 || !(watts > 0)) return;
+        if (sampleRate != remainderRate) {
+            remainder = remainderRate ? remainder * sampleRate / remainderRate : 0;
+            remainderRate = sampleRate;
+        }
+        // Power is quantized to 1 µW (below float resolution); the rest is integer
+        uint64_t microwatts = (uint64_t)(watts * 1e6f + 0.5f);
+        uint64_t perMillijoule = (uint64_t)sampleRate * 1000;
+        remainder += microwatts * samples;
+        millijoules += remainder / perMillijoule;
+        remainder %= perMillijoule;
+    }
+
+    double kWh() const {
+        return millijoules / 3.6e9;
+    }
+};
+
+// Energy Calculation and Cost Management.
+// The registers belong to the task that integrates windows; queueSave() hands
+// a copy to saveToFlash(), which runs on a slower task (a journal sector erase
+// stalls for tens of ms).
 class EnergyCalculator {
 private:
-    float energyL1; // kWh
-    float energyL2; // kWh
-    float totalEnergy; // kWh
+    EnergyRegister energyL1;
+    EnergyRegister energyL2;
     float pricePerUnit; // Price per kWh
     
-    unsigned long lastUpdateTime;
     Preferences preferences;
+    EnergyJournal* journal;          // Energy counters; Preferences only as fallback
+    uint64_t queuedL1;               // Last values handed to saveToFlash() (mJ)
+    uint64_t queuedL2;
+    uint64_t pendingL1;              // Copy saveToFlash() writes
+    uint64_t pendingL2;
+    std::atomic<bool> savePending;
+    std::atomic<bool> pricePending;
     
 public:
-    EnergyCalculator() : energyL1(0), energyL2(0), totalEnergy(0), 
-                         pricePerUnit(0), lastUpdateTime(0) {}
+    EnergyCalculator() : pricePerUnit(0), journal(nullptr), queuedL1(0), queuedL2(0),
+                         pendingL1(0), pendingL2(0), savePending(false), pricePending(false) {
+        energyL1.reset();
+        energyL2.reset();
+    }
     
-    void begin(float price = 5.0) {
+    void begin(float price = 5.0, EnergyJournal* energyJournal = nullptr) {
         preferences.begin("energy", false);
         
-        // Load saved energy values
-        energyL1 = preferences.getFloat("energyL1", 0);
-        energyL2 = preferences.getFloat("energyL2", 0);
-        totalEnergy = preferences.getFloat("totalEnergy", 0);
-        pricePerUnit = preferences.getFloat("price", price);
+        journal = energyJournal;
+        if (journal != nullptr && !journal->begin()) {
+            Serial.println("⚠️ Energy journal partition not found - using Preferences");
+            journal = nullptr;
+        }
         
-        lastUpdateTime = millis();
+        // Load saved energy values (kWh floats from older firmware are converted once)
+        uint64_t journalL1, journalL2;
+        if (journal != nullptr && journal->getLatest(journalL1, journalL2)) {
+            energyL1.reset(journalL1);
+            energyL2.reset(journalL2);
+        } else if (preferences.isKey("energyL1_mJ")) {
+            energyL1.reset(preferences.getULong64("energyL1_mJ", 0));
+            energyL2.reset(preferences.getULong64("energyL2_mJ", 0));
+        } else {
+            energyL1.reset((uint64_t)(preferences.getFloat("energyL1", 0) * 3.6e9));
+            energyL2.reset((uint64_t)(preferences.getFloat("energyL2", 0) * 3.6e9));
+        }
+        pricePerUnit = preferences.getFloat("price", price);
+        queuedL1 = energyL1.millijoules;
+        queuedL2 = energyL2.millijoules;
+        if (journal != nullptr && journal->getSequence() == 0) {
+            journal->append(queuedL1, queuedL2);  // Seed an empty journal with the migrated values
+        }
         
         Serial.println("⚡ Energy Calculator initialized");
         Serial.print("   Load 1 Energy: ");
-        Serial.print(energyL1, 3);
+        Serial.print(getEnergyL1(), 3);
         Serial.println(" kWh");
         Serial.print("   Load 2 Energy: ");
-        Serial.print(energyL2, 3);
+        Serial.print(getEnergyL2(), 3);
         Serial.println(" kWh");
         Serial.print("   Total Energy: ");
-        Serial.print(totalEnergy, 3);
+        Serial.print(getTotalEnergy(), 3);
         Serial.println(" kWh");
         Serial.print("   Price per Unit: ₹");
         Serial.println(pricePerUnit, 2);
     }
     
-    // Update energy consumption (call this periodically with power readings)
-    void updateEnergy(float power1, float power2) {
-        unsigned long currentTime = millis();
-        float elapsedHours = (currentTime - lastUpdateTime) / 3600000.0; // Convert ms to hours
-        
-        if (elapsedHours > 0) {
-            // Calculate energy increment in kWh
-            float energyIncrementL1 = (power1 / 1000.0) * elapsedHours;
-            float energyIncrementL2 = (power2 / 1000.0) * elapsedHours;
-            
-            energyL1 += energyIncrementL1;
-            energyL2 += energyIncrementL2;
-            totalEnergy = energyL1 + energyL2;
-            
-            lastUpdateTime = currentTime;
-        }
+    // Integrate one completed measurement window (real power in W, window length in samples).
+    // Only import is billed: exported (negative) power counts as 0, never as energy.
+    void addWindow(float power1, float power2, uint32_t samples, uint32_t sampleRate) {
+        energyL1.add(power1 > 0 ? power1 : 0, samples, sampleRate);
+        energyL2.add(power2 > 0 ? power2 : 0, samples, sampleRate);
     }
     
-    // Save energy values to flash (call periodically to prevent data loss)
+    // Copy the counters for saveToFlash() (call periodically on the integrating task).
+    // Unchanged counters are not handed over, so an idle meter causes no flash wear;
+    // skipped while the last copy is unsaved.
+    void queueSave() {
+        if (savePending.load(std::memory_order_acquire)) return;
+        if (energyL1.millijoules == queuedL1 && energyL2.millijoules == queuedL2) return;
+        pendingL1 = queuedL1 = energyL1.millijoules;
+        pendingL2 = queuedL2 = energyL2.millijoules;
+        savePending.store(true, std::memory_order_release);
+    }
+    
+    // Write the copy from queueSave() and a changed price (storage task).
+    // A failed journal write is retried on the next call.
     void saveToFlash() {
-        preferences.putFloat("energyL1", energyL1);
-        preferences.putFloat("energyL2", energyL2);
-        preferences.putFloat("totalEnergy", totalEnergy);
+        if (pricePending.exchange(false)) {
+            preferences.putFloat("price", pricePerUnit);
+        }
+        if (!savePending.load(std::memory_order_acquire)) return;
+        
+        bool saved;
+        if (journal != nullptr) {
+            saved = journal->append(pendingL1, pendingL2);
+        } else {
+            saved = preferences.putULong64("energyL1_mJ", pendingL1) > 0 &&
+                    preferences.putULong64("energyL2_mJ", pendingL2) > 0;
+        }
+        if (saved) savePending.store(false, std::memory_order_release);
     }
     
-    // Set price per unit
+    // Set price per unit (saved by the next saveToFlash())
     void setPricePerUnit(float price) {
         pricePerUnit = price;
-        preferences.putFloat("price", price);
-        Serial.print("💰 Price updated to ₹");
-        Serial.print(price, 2);
-        Serial.println(" per kWh");
+        pricePending = true;
+        LOG_INFO(LOG_METER, "💰 Price updated to ₹%.2f per kWh", price);
     }
     
-    // Get energy values
-    float getEnergyL1() const { return energyL1; }
-    float getEnergyL2() const { return energyL2; }
-    float getTotalEnergy() const { return totalEnergy; }
+    // Get energy values (kWh)
+    float getEnergyL1() const { return energyL1.kWh(); }
+    float getEnergyL2() const { return energyL2.kWh(); }
+    float getTotalEnergy() const { return (energyL1.millijoules + energyL2.millijoules) / 3.6e9; }
     float getPricePerUnit() const { return pricePerUnit; }
     
-    // Calculate costs
-    float getCostL1() const { return energyL1 * pricePerUnit; }
-    float getCostL2() const { return energyL2 * pricePerUnit; }
-    float getTotalCost() const { return totalEnergy * pricePerUnit; }
+    // Exact counters (mJ)
+    uint64_t getEnergyL1Millijoules() const { return energyL1.millijoules; }
+    uint64_t getEnergyL2Millijoules() const { return energyL2.millijoules; }
+    
+    // Calculate costs from the exact counters
+    float getCostL1() const { return energyL1.kWh() * pricePerUnit; }
+    float getCostL2() const { return energyL2.kWh() * pricePerUnit; }
+    float getTotalCost() const { return (energyL1.kWh() + energyL2.kWh()) * pricePerUnit; }
     
-    // Reset energy counters
+    // Reset energy counters (saved by the next saveToFlash() once handed over)
     void resetEnergy() {
-        energyL1 = 0;
-        energyL2 = 0;
-        totalEnergy = 0;
-        saveToFlash();
-        Serial.println("🔄 Energy counters reset");
+        energyL1.reset();
+        energyL2.reset();
+        queuedL1 = queuedL2 = UINT64_MAX;  // Force the handover
+        queueSave();
+        LOG_INFO(LOG_METER, "🔄 Energy counters reset");
     }
     
     // Print current energy status
     void printStatus() {
         Serial.println("\n========== ENERGY STATUS ==========");
         Serial.print("Load 1: ");
-        Serial.print(energyL1, 3);
+        Serial.print(getEnergyL1(), 3);
         Serial.print(" kWh (₹");
         Serial.print(getCostL1(), 2);
         Serial.println(")");
         
         Serial.print("Load 2: ");
-        Serial.print(energyL2, 3);
+        Serial.print(getEnergyL2(), 3);
         Serial.print(" kWh (₹");
         Serial.print(getCostL2(), 2);
         Serial.println(")");
         
         Serial.print("Total: ");
-        Serial.print(totalEnergy, 3);
+        Serial.print(getTotalEnergy(), 3);
         Serial.print(" kWh (₹");
         Serial.print(getTotalCost(), 2);
         Serial.println(")");
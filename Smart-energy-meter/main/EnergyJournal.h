@@ -0,0 +1,167 @@
+#ifndef ENERGY_JOURNAL_H
+#define ENERGY_JOURNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "FlashPartition.h"
+
+// One journal entry, exactly one 32-byte flash slot
+struct EnergyJournalRecord {
+    static const uint32_t MAGIC = 0x4A4E4745;  // "EGNJ"
+
+    uint32_t magic;
+    uint32_t sequence;
+    uint64_t energyL1;      // mJ
+    uint64_t energyL2;      // mJ
+    uint32_t reserved;
+    uint32_t crc;           // CRC-32 of all fields before it
+};
+
+// Append-only, wear-levelled energy log in a raw flash partition.
+// Records go into the sectors round-robin; a sector is erased only when the
+// head moves into it, so every sector wears equally. A power cut can at most
+// leave one half-programmed slot (rejected by its CRC) or one half-erased
+// sector; begin() replays the partition and resumes from the newest valid record.
+class EnergyJournal {
+public:
+    static const uint32_t SLOT_SIZE = sizeof(EnergyJournalRecord);
+    static const uint32_t SLOTS_PER_SECTOR = FlashPartition::SECTOR_SIZE / SLOT_SIZE;
+
+private:
+    FlashPartition& flash;
+    uint32_t sectors;
+    bool ready;
+
+    bool hasRecord;
+    EnergyJournalRecord latest;
+    uint32_t headSector;
+    uint32_t headSlot;       // Next slot to try; SLOTS_PER_SECTOR = sector full
+    uint32_t appends;
+
+    static uint32_t checksum(const EnergyJournalRecord& record) {
+        return flashCrc32(&record, offsetof(EnergyJournalRecord, crc));
+    }
+
+    static bool isValid(const EnergyJournalRecord& record) {
+        return record.magic == EnergyJournalRecord::MAGIC && record.crc == checksum(record);
+    }
+
+    static bool isBlank(const EnergyJournalRecord& record) {
+        const uint8_t* bytes = (const uint8_t*)&record;
+        for (uint32_t i = 0; i < SLOT_SIZE; i++) {
+            if (bytes[i] != 0xFF) return false;
+        }
+        return true;
+    }
+
+    uint32_t slotOffset(uint32_t sector, uint32_t slot) const {
+        return sector * FlashPartition::SECTOR_SIZE + slot * SLOT_SIZE;
+    }
+
+    // Move the head to the next sector and erase it
+    bool openNextSector() {
+        headSector = (headSector + 1) % sectors;
+        headSlot = 0;
+        return flash.eraseSector(headSector);
+    }
+
+public:
+    EnergyJournal(FlashPartition& partition)
+        : flash(partition),
+          sectors(0),
+          ready(false),
+          hasRecord(false),
+          headSector(0),
+          headSlot(0),
+          appends(0) {
+        memset(&latest, 0, sizeof(latest));
+    }
+
+    // Replay the partition; false if it is missing or too small
+    bool begin() {
+        ready = false;
+        hasRecord = false;
+        if (!flash.begin()) return false;
+        sectors = flash.sectorCount();
+        if (sectors < 2) return false;
+
+        for (uint32_t sector = 0; sector < sectors; sector++) {
+            for (uint32_t slot = 0; slot < SLOTS_PER_SECTOR; slot++) {
+                EnergyJournalRecord record;
+                if (!flash.read(slotOffset(sector, slot), &record, SLOT_SIZE)) return false;
+                if (!isValid(record)) continue;
+                // Wrap-safe sequence comparison
+                if (!hasRecord || (int32_t)(record.sequence - latest.sequence) > 0) {
+                    latest = record;
+                    hasRecord = true;
+                    headSector = sector;
+                    headSlot = slot + 1;
+                }
+            }
+        }
+
+        if (!hasRecord) {
+            // Empty (or foreign) partition: start over in sector 0
+            headSector = sectors - 1;
+            if (!openNextSector()) return false;
+        }
+        ready = true;
+        return true;
+    }
+
+    bool isReady() const {
+        return ready;
+    }
+
+    // Newest valid record; false if the journal is empty
+    bool getLatest(uint64_t& energyL1, uint64_t& energyL2) const {
+        if (!hasRecord) return false;
+        energyL1 = latest.energyL1;
+        energyL2 = latest.energyL2;
+        return true;
+    }
+
+    // Append a new state; one 32-byte program, plus a sector erase every SLOTS_PER_SECTOR appends
+    bool append(uint64_t energyL1, uint64_t energyL2) {
+        if (!ready) return false;
+
+        EnergyJournalRecord record;
+        record.magic = EnergyJournalRecord::MAGIC;
+        record.sequence = hasRecord ? latest.sequence + 1 : 1;
+        record.energyL1 = energyL1;
+        record.energyL2 = energyL2;
+        record.reserved = 0xFFFFFFFF;
+        record.crc = checksum(record);
+
+        // Skip slots dirtied by an interrupted write; never program a slot twice
+        for (;;) {
+            if (headSlot >= SLOTS_PER_SECTOR) {
+                if (!openNextSector()) return false;
+            }
+            EnergyJournalRecord existing;
+            if (!flash.read(slotOffset(headSector, headSlot), &existing, SLOT_SIZE)) return false;
+            if (isBlank(existing)) break;
+            headSlot++;
+        }
+
+        uint32_t offset = slotOffset(headSector, headSlot);
+        headSlot++;
+        if (!flash.write(offset, &record, SLOT_SIZE)) return false;
+
+        latest = record;
+        hasRecord = true;
+        appends++;
+        return true;
+    }
+
+    uint32_t getSequence() const {
+        return hasRecord ? latest.sequence : 0;
+    }
+
+    uint32_t getAppendCount() const {
+        return appends;
+    }
+};
+
+#endif // ENERGY_JOURNAL_H
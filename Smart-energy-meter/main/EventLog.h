@@ -0,0 +1,357 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <string.h>
+#include <stdio.h>
+#include <type_traits>
+
+enum LogLevel : uint8_t {
+    LOG_LEVEL_OFF = 0,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG
+};
+
+enum LogModule : uint8_t {
+    LOG_MAIN = 0,                   // Setup, relays, theft, display
+    LOG_METER,                      // Sensors, calibration, energy
+    LOG_NET,                        // WiFi, server uploads and commands, local API
+    LOG_TASKS,                      // Scheduler statistics
+    LOG_MODULES
+};
+
+// Levels above this are compiled out (the call and its format string are removed)
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_AT(level, module, ...) \
+    do { if ((level) <= LOG_COMPILE_LEVEL) EventLog::instance().write((level), (module), __VA_ARGS__); } while (0)
+#define LOG_ERROR(module, ...) LOG_AT(LOG_LEVEL_ERROR, module, __VA_ARGS__)
+#define LOG_WARN(module, ...)  LOG_AT(LOG_LEVEL_WARN, module, __VA_ARGS__)
+#define LOG_INFO(module, ...)  LOG_AT(LOG_LEVEL_INFO, module, __VA_ARGS__)
+#define LOG_DEBUG(module, ...) LOG_AT(LOG_LEVEL_DEBUG, module, __VA_ARGS__)
+
+// Deferred-format log. A log call only copies the format string's address (a
+// literal in flash, so it serves as the format ID), up to MAX_ARGS arguments,
+// the time, level and module into a lock-free ring buffer; no text is formatted
+// and the UART is not touched. drain() formats the events on a low-priority task
+// and writes only what the serial TX FIFO takes without waiting. When the ring
+// is full new events are dropped and counted. %s arguments must stay valid until
+// drained (literals or long-lived buffers).
+// Formats take printf conversions d i u x X c s f e g; length modifiers are ignored
+// and integers are kept as 32 bits.
+class EventLog {
+public:
+    static const uint16_t RING_SIZE = 128;          // Power of two
+    static const uint8_t MAX_ARGS = 8;                // types holds 2 bits each
+    static const size_t LINE_SIZE = 192;
+
+private:
+    enum ArgType : uint8_t {
+        ARG_INT,
+        ARG_UINT,
+        ARG_FLOAT,
+        ARG_STRING
+    };
+
+    union Value {
+        int32_t i;
+        uint32_t u;
+        float f;
+        const char* s;
+    };
+
+    struct Entry {
+        std::atomic<uint32_t> sequence;             // Slot state (bounded MPMC queue)
+        uint32_t timeMs;
+        const char* format;
+        uint8_t level;
+        uint8_t module;
+        uint8_t argc;
+        uint16_t types;                             // 2 bits per argument
+        Value args[MAX_ARGS];
+    };
+
+    Entry ring[RING_SIZE];
+    std::atomic<uint32_t> head;                     // Next slot to claim
+    uint32_t tail;                                  // Next slot to drain (drain task only)
+    std::atomic<uint8_t> levels[LOG_MODULES];
+
+    std::atomic<uint32_t> written;
+    std::atomic<uint32_t> dropped;
+    uint32_t droppedReported;
+    uint32_t drained;
+    uint16_t highWater;
+
+    char line[LINE_SIZE];
+    size_t lineLength;
+    size_t lineSent;
+
+    // Argument packing by type
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, ArgType>::type
+    pack(Value& v, T value) {
+        v.i = (int32_t)value;
+        return ARG_INT;
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, ArgType>::type
+    pack(Value& v, T value) {
+        v.u = (uint32_t)value;
+        return ARG_UINT;
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value, ArgType>::type
+    pack(Value& v, T value) {
+        v.f = (float)value;
+        return ARG_FLOAT;
+    }
+
+    static ArgType pack(Value& v, const char* value) {
+        v.s = value;
+        return ARG_STRING;
+    }
+
+    void packArgs(Entry&, uint8_t) {}
+
+    template <typename T, typename... Rest>
+    void packArgs(Entry& e, uint8_t index, T value, Rest... rest) {
+        e.types |= (uint16_t)pack(e.args[index], value) << (index * 2);
+        packArgs(e, index + 1, rest...);
+    }
+
+    static const char* levelName(uint8_t level) {
+        static const char* const names[] = {"off", "error", "warn", "info", "debug"};
+        return level <= LOG_LEVEL_DEBUG ? names[level] : "?";
+    }
+
+    static const char* moduleName(uint8_t module) {
+        static const char* const names[] = {"main", "meter", "net", "tasks"};
+        return module < LOG_MODULES ? names[module] : "?";
+    }
+
+    // One conversion of a format with one typed argument
+    static int formatArg(char* out, size_t space, const char* spec, char conversion, uint8_t type, Value v) {
+        switch (conversion) {
+            case 'd': case 'i': case 'c':
+                return snprintf(out, space, spec, type == ARG_FLOAT ? (int)v.f : (int)v.i);
+            case 'u': case 'x': case 'X':
+                return snprintf(out, space, spec, type == ARG_FLOAT ? (unsigned)v.f : (unsigned)v.u);
+            case 'f': case 'e': case 'g': case 'E': case 'G':
+                return snprintf(out, space, spec, type == ARG_FLOAT ? (double)v.f :
+                                (type == ARG_INT ? (double)v.i : (double)v.u));
+            case 's':
+                return snprintf(out, space, spec, type == ARG_STRING && v.s ? v.s : "?");
+        }
+        return 0;
+    }
+
+    // Text of an event into line (without the line ending)
+    void formatEntry(const Entry& e) {
+        lineLength = snprintf(line, LINE_SIZE, "%lu.%03lu %c %s: ", (unsigned long)(e.timeMs / 1000),
+                              (unsigned long)(e.timeMs % 1000), "-EWID"[e.level], moduleName(e.module));
+        const char* p = e.format;
+        uint8_t arg = 0;
+        while (*p && lineLength < LINE_SIZE - 1) {
+            if (*p != '%') {
+                line[lineLength++] = *p++;
+                continue;
+            }
+            if (p[1] == '%') {
+                line[lineLength++] = '%';
+                p += 2;
+                continue;
+            }
+            // Copy flags, width and precision; skip length modifiers
+            char spec[16] = "%";
+            size_t specLength = 1;
+            p++;
+            while (*p && strchr("-+ #0123456789.", *p) && specLength < sizeof(spec) - 2) spec[specLength++] = *p++;
+            while (*p && strchr("hlLzjt", *p)) p++;
+            if (*p == '\0') break;
+            char conversion = *p++;
+            spec[specLength++] = conversion;
+            spec[specLength] = '\0';
+
+            int n = 0;
+            if (arg < e.argc) {
+                n = formatArg(line + lineLength, LINE_SIZE - lineLength, spec, conversion,
+                              (e.types >> (arg * 2)) & 3, e.args[arg]);
+                arg++;
+            }
+            if (n > 0) lineLength += n;
+            if (lineLength > LINE_SIZE - 1) lineLength = LINE_SIZE - 1;     // Truncated
+        }
+        line[lineLength] = '\0';
+    }
+
+    // Next line to write: a drop notice first if events were lost, else the oldest event
+    bool formatNext() {
+        uint32_t lost = dropped.load();
+        if (lost != droppedReported) {
+            lineLength = snprintf(line, LINE_SIZE, "⚠️ %lu log events dropped (ring full)",
+                                  (unsigned long)(lost - droppedReported));
+            droppedReported = lost;
+        } else {
+            Entry& e = ring[tail & (RING_SIZE - 1)];
+            if (e.sequence.load(std::memory_order_acquire) != tail + 1) return false;   // Empty, or still being written
+            formatEntry(e);
+            e.sequence.store(tail + RING_SIZE, std::memory_order_release);
+            tail++;
+            drained++;
+        }
+        if (lineLength > LINE_SIZE - 3) lineLength = LINE_SIZE - 3;
+        line[lineLength++] = '\r';
+        line[lineLength++] = '\n';
+        lineSent = 0;
+        return true;
+    }
+
+    // Queue an event whatever the module's level
+    template <typename... Args>
+    bool append(LogLevel level, LogModule module, const char* format, Args... args) {
+        static_assert(sizeof...(Args) <= MAX_ARGS, "Too many log arguments");
+        uint32_t position = head.load(std::memory_order_relaxed);
+        Entry* e;
+        for (;;) {
+            e = &ring[position & (RING_SIZE - 1)];
+            int32_t state = (int32_t)(e->sequence.load(std::memory_order_acquire) - position);
+            if (state == 0) {
+                if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            } else if (state < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);      // Full
+                return false;
+            } else {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+        e->timeMs = millis();
+        e->format = format;
+        e->level = level;
+        e->module = module;
+        e->argc = sizeof...(Args);
+        e->types = 0;
+        packArgs(*e, 0, args...);
+        e->sequence.store(position + 1, std::memory_order_release);
+        written.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+
+public:
+    EventLog()
+        : head(0),
+          tail(0),
+          written(0),
+          dropped(0),
+          droppedReported(0),
+          drained(0),
+          highWater(0),
+          lineLength(0),
+          lineSent(0) {
+        for (uint16_t i = 0; i < RING_SIZE; i++) ring[i].sequence.store(i);
+        for (uint8_t i = 0; i < LOG_MODULES; i++) levels[i].store(LOG_LEVEL_INFO);
+    }
+
+    // The log of the firmware (shared by all tasks)
+    static EventLog& instance() {
+        static EventLog log;
+        return log;
+    }
+
+    // Queue an event; safe from any task on either core. False if filtered or dropped.
+    template <typename... Args>
+    bool write(LogLevel level, LogModule module, const char* format, Args... args) {
+        if (level > levels[module].load(std::memory_order_relaxed)) return false;
+        return append(level, module, format, args...);
+    }
+
+
+    // Format and write queued events while the output takes them without
+    // blocking (TX FIFO space); call from one low-priority task. Returns the
+    // number of lines completed.
+    uint16_t drain(Print& out, uint16_t maxLines = 16) {
+        uint32_t depth = head.load(std::memory_order_relaxed) - tail;
+        if (depth > highWater) highWater = depth > RING_SIZE ? RING_SIZE : depth;
+
+        uint16_t lines = 0;
+        for (;;) {
+            if (lineSent < lineLength) {
+                int space = out.availableForWrite();
+                if (space <= 0) break;
+                size_t n = lineLength - lineSent;
+                if (n > (size_t)space) n = space;
+                lineSent += out.write((const uint8_t*)line + lineSent, n);
+                if (lineSent < lineLength) break;
+                lines++;
+            }
+            if (lines >= maxLines || !formatNext()) break;
+        }
+        return lines;
+    }
+
+    void setLevel(LogModule module, LogLevel level) {
+        if (module < LOG_MODULES) levels[module].store(level);
+    }
+
+    LogLevel getLevel(LogModule module) const {
+        return (LogLevel)levels[module].load();
+    }
+
+    // Console command: "log" prints the levels, "log <module|all> <off|error|warn|info|debug>"
+    // sets them. Returns false if the line is not a log command.
+    bool command(const char* text) {
+        if (strncmp(text, "log", 3) != 0 || (text[3] != '\0' && text[3] != ' ')) return false;
+        char module[12] = "", level[12] = "";
+        sscanf(text + 3, "%11s %11s", module, level);
+
+        if (module[0] != '\0') {
+            int8_t m = -1, l = -1;
+            for (uint8_t i = 0; i < LOG_MODULES; i++) {
+                if (strcmp(module, moduleName(i)) == 0) m = i;
+            }
+            for (uint8_t i = 0; i <= LOG_LEVEL_DEBUG; i++) {
+                if (strcmp(level, levelName(i)) == 0) l = i;
+            }
+            if ((m < 0 && strcmp(module, "all") != 0) || l < 0) {
+                append(LOG_LEVEL_INFO, LOG_MAIN, "Usage: log [main|meter|net|tasks|all off|error|warn|info|debug]");
+                return true;
+            }
+            for (uint8_t i = 0; i < LOG_MODULES; i++) {
+                if (m < 0 || m == i) setLevel((LogModule)i, (LogLevel)l);
+            }
+        }
+        append(LOG_LEVEL_INFO, LOG_MAIN, "Log levels: main %s | meter %s | net %s | tasks %s (compiled up to %s)",
+              levelName(getLevel(LOG_MAIN)), levelName(getLevel(LOG_METER)),
+              levelName(getLevel(LOG_NET)), levelName(getLevel(LOG_TASKS)), levelName(LOG_COMPILE_LEVEL));
+        append(LOG_LEVEL_INFO, LOG_MAIN, "Log events: %lu written | %lu dropped | ring high water %u of %u",
+              (unsigned long)getWritten(), (unsigned long)getDropped(), highWater, RING_SIZE);
+        return true;
+    }
+
+    uint32_t getWritten() const {
+        return written.load();
+    }
+
+    // Events lost because the ring was full
+    uint32_t getDropped() const {
+        return dropped.load();
+    }
+
+    uint32_t getDrained() const {
+        return drained;
+    }
+
+    // Most events seen waiting by drain()
+    uint16_t getHighWater() const {
+        return highWater;
+    }
+};
+
+#endif // EVENT_LOG_H
@@ -0,0 +1,195 @@
+#ifndef FLASH_PARTITION_H
+#define FLASH_PARTITION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <esp_partition.h>
+#endif
+
+// CRC-32 (IEEE) for flash records, nibble table
+inline uint32_t flashCrc32(const void* data, size_t length) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ bytes[i]) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (bytes[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+// Raw NOR flash region: erase sets a sector to 0xFF, writes can only clear bits
+class FlashPartition {
+public:
+    static const uint32_t SECTOR_SIZE = 4096;
+
+    virtual ~FlashPartition() {}
+    virtual bool begin() = 0;
+    virtual uint32_t size() const = 0;
+    virtual bool read(uint32_t offset, void* data, size_t length) = 0;
+    virtual bool write(uint32_t offset, const void* data, size_t length) = 0;
+    virtual bool eraseSector(uint32_t sector) = 0;
+
+    // Whole partition mapped into the address space for zero-copy reads (nullptr if unsupported)
+    virtual const uint8_t* map() {
+        return nullptr;
+    }
+
+    uint32_t sectorCount() const {
+        return size() / SECTOR_SIZE;
+    }
+};
+
+#ifdef ARDUINO
+// Data partition from the partition table (see partitions.csv), found by label
+class Esp32FlashPartition : public FlashPartition {
+private:
+    const char* label;
+    const esp_partition_t* partition;
+    const void* mapped;
+    esp_partition_mmap_handle_t mapHandle;
+
+public:
+    Esp32FlashPartition(const char* partitionLabel)
+        : label(partitionLabel), partition(nullptr), mapped(nullptr), mapHandle(0) {}
+
+    bool begin() override {
+        partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+        return partition != nullptr;
+    }
+
+    uint32_t size() const override {
+        return partition ? partition->size : 0;
+    }
+
+    bool read(uint32_t offset, void* data, size_t length) override {
+        return partition && esp_partition_read(partition, offset, data, length) == ESP_OK;
+    }
+
+    bool write(uint32_t offset, const void* data, size_t length) override {
+        return partition && esp_partition_write(partition, offset, data, length) == ESP_OK;
+    }
+
+    bool eraseSector(uint32_t sector) override {
+        return partition && esp_partition_erase_range(partition, sector * SECTOR_SIZE, SECTOR_SIZE) == ESP_OK;
+    }
+
+    // Flash writes through esp_partition_* invalidate the cache of mapped ranges
+    const uint8_t* map() override {
+        if (mapped == nullptr && partition != nullptr) {
+            if (esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA,
+                                   &mapped, &mapHandle) != ESP_OK) {
+                mapped = nullptr;
+            }
+        }
+        return (const uint8_t*)mapped;
+    }
+};
+#else
+// Host-side flash emulator with NOR semantics, erase counters and power-fail
+// injection: after the armed number of programmed bytes (or at the next erase)
+// the operation stops partway and every later call fails until powerCycle().
+class RamFlashPartition : public FlashPartition {
+private:
+    uint8_t* memory;
+    uint32_t bytes;
+    uint32_t* eraseCounts;
+    int64_t bytesUntilFailure;   // -1 = never
+    int32_t erasedUntilFailure;  // Bytes the next erase clears before the cut, -1 = never
+    bool failed;
+
+public:
+    RamFlashPartition(uint32_t sectors)
+        : bytes(sectors * SECTOR_SIZE), bytesUntilFailure(-1), erasedUntilFailure(-1), failed(false) {
+        memory = new uint8_t[bytes];
+        eraseCounts = new uint32_t[sectors];
+        memset(memory, 0xFF, bytes);
+        memset(eraseCounts, 0, sectors * sizeof(uint32_t));
+    }
+
+    ~RamFlashPartition() {
+        delete[] memory;
+        delete[] eraseCounts;
+    }
+
+    bool begin() override {
+        return true;
+    }
+
+    uint32_t size() const override {
+        return bytes;
+    }
+
+    bool read(uint32_t offset, void* data, size_t length) override {
+        if (failed || offset + length > bytes) return false;
+        memcpy(data, memory + offset, length);
+        return true;
+    }
+
+    bool write(uint32_t offset, const void* data, size_t length) override {
+        if (failed || offset + length > bytes) return false;
+        const uint8_t* source = (const uint8_t*)data;
+        for (size_t i = 0; i < length; i++) {
+            if (bytesUntilFailure == 0) {
+                failed = true;
+                return false;
+            }
+            if (bytesUntilFailure > 0) bytesUntilFailure--;
+            memory[offset + i] &= source[i];
+        }
+        return true;
+    }
+
+    bool eraseSector(uint32_t sector) override {
+        if (failed || sector >= sectorCount()) return false;
+        eraseCounts[sector]++;
+        uint8_t* start = memory + sector * SECTOR_SIZE;
+        if (bytesUntilFailure == 0 || erasedUntilFailure >= 0) {
+            // Interrupted erase: only the start of the sector is cleared (half by default)
+            int32_t cleared = erasedUntilFailure >= 0 ? erasedUntilFailure : SECTOR_SIZE / 2;
+            memset(start, 0xFF, cleared < (int32_t)SECTOR_SIZE ? cleared : SECTOR_SIZE);
+            failed = true;
+            return false;
+        }
+        memset(start, 0xFF, SECTOR_SIZE);
+        return true;
+    }
+
+    // Cut the power after this many more programmed bytes (0 = on the next write or erase)
+    void failAfter(int64_t programmedBytes) {
+        bytesUntilFailure = programmedBytes;
+    }
+
+    // Cut the power during the next erase, once it has cleared this many bytes
+    void failEraseAfter(uint32_t erasedBytes) {
+        erasedUntilFailure = (int32_t)erasedBytes;
+    }
+
+    void powerCycle() {
+        failed = false;
+        bytesUntilFailure = -1;
+        erasedUntilFailure = -1;
+    }
+
+    bool hasFailed() const {
+        return failed;
+    }
+
+    const uint8_t* map() override {
+        return memory;
+    }
+
+    uint32_t getEraseCount(uint32_t sector) const {
+        return sector < sectorCount() ? eraseCounts[sector] : 0;
+    }
+};
+#endif
+
+#endif // FLASH_PARTITION_H
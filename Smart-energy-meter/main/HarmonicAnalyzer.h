@@ -0,0 +1,116 @@
+#ifndef HARMONIC_ANALYZER_H
+#define HARMONIC_ANALYZER_H
+
+#include <stdint.h>
+#include <math.h>
+
+// Harmonic content of one channel over the last completed window
+struct HarmonicReading {
+    static const uint8_t COUNT = 6;
+
+    float fundamental;          // Amplitude of the 1st harmonic (channel units, peak)
+    float percent[COUNT - 1];   // 3rd..11th as % of the fundamental
+    float thd;                  // % (odd harmonics up to the 11th)
+};
+
+// Streaming Goertzel bank for the fundamental and the 3rd/5th/7th/9th/11th harmonics.
+// Samples are summed in blocks of DECIMATION (a boxcar low-pass, one add per sample)
+// and the resonators run at the decimated rate; the boxcar response is divided out
+// at window end. Windows span whole mains cycles, so no taper is needed.
+class GoertzelBank {
+public:
+    static const uint8_t HARMONICS = HarmonicReading::COUNT;
+    static const uint8_t DECIMATION = 4;
+
+private:
+    float coeff[HARMONICS];
+    float gain[HARMONICS];       // Boxcar magnitude response at each harmonic
+    float s1[HARMONICS];
+    float s2[HARMONICS];
+    int32_t blockSum;
+    uint8_t blockCount;
+    uint32_t blocks;
+    HarmonicReading result;
+
+    static uint8_t order(uint8_t h) {
+        return h == 0 ? 1 : 2 * h + 1;  // 1, 3, 5, 7, 9, 11
+    }
+
+    inline void push(float x) {
+        for (uint8_t h = 0; h < HARMONICS; h++) {
+            float s0 = x + coeff[h] * s1[h] - s2[h];
+            s2[h] = s1[h];
+            s1[h] = s0;
+        }
+        blocks++;
+    }
+
+public:
+    GoertzelBank() : blockSum(0), blockCount(0), blocks(0) {
+        for (uint8_t h = 0; h < HARMONICS; h++) {
+            coeff[h] = 0;
+            gain[h] = DECIMATION;
+            s1[h] = 0;
+            s2[h] = 0;
+        }
+        result.fundamental = 0;
+        result.thd = 0;
+        for (uint8_t h = 0; h < HARMONICS - 1; h++) {
+            result.percent[h] = 0;
+        }
+    }
+
+    // Prepare for a new window at the expected fundamental frequency
+    void start(float fundamentalHz, uint32_t sampleRate) {
+        const float pi = 3.14159265f;
+        for (uint8_t h = 0; h < HARMONICS; h++) {
+            float f = order(h) * fundamentalHz;
+            float w = 2.0f * pi * f * DECIMATION / sampleRate;
+            coeff[h] = 2.0f * cosf(w);
+
+            float x = pi * f / sampleRate;
+            gain[h] = (x > 0) ? fabsf(sinf(x * DECIMATION) / sinf(x)) : DECIMATION;
+            s1[h] = 0;
+            s2[h] = 0;
+        }
+        blockSum = 0;
+        blockCount = 0;
+        blocks = 0;
+    }
+
+    // Per-sample work: one add, plus one resonator update every DECIMATION samples
+    inline void add(int32_t sample) {
+        blockSum += sample;
+        if (++blockCount == DECIMATION) {
+            push((float)blockSum);
+            blockSum = 0;
+            blockCount = 0;
+        }
+    }
+
+    // Evaluate the window; results stay available until the next finish()
+    void finish() {
+        if (blocks == 0) return;
+
+        float amplitude[HARMONICS];
+        for (uint8_t h = 0; h < HARMONICS; h++) {
+            float power = s1[h] * s1[h] + s2[h] * s2[h] - coeff[h] * s1[h] * s2[h];
+            amplitude[h] = power > 0 ? 2.0f * sqrtf(power) / (blocks * gain[h]) : 0;
+        }
+
+        result.fundamental = amplitude[0];
+        float distortion = 0;
+        for (uint8_t h = 1; h < HARMONICS; h++) {
+            float ratio = amplitude[0] > 0 ? amplitude[h] / amplitude[0] : 0;
+            result.percent[h - 1] = ratio * 100.0f;
+            distortion += ratio * ratio;
+        }
+        result.thd = sqrtf(distortion) * 100.0f;
+    }
+
+    const HarmonicReading& getReading() const {
+        return result;
+    }
+};
+
+#endif // HARMONIC_ANALYZER_H
@@ -0,0 +1,75 @@
+#ifndef HEAP_MONITOR_H
+#define HEAP_MONITOR_H
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+
+// Heap health for long uptimes: free heap, its low watermark and fragmentation
+// (how much of the free heap is NOT in the largest block). A request path that
+// allocates keeps splitting the heap, so the largest free block keeps reaching
+// new lows; with the preallocated buffers that counter should stop after boot.
+class HeapMonitor {
+private:
+    uint32_t freeBytes;
+    uint32_t minFreeBytes;
+    uint32_t largestBlock;
+    uint32_t smallestLargestBlock;
+    uint8_t fragmentation;
+    uint8_t worstFragmentation;
+    uint32_t blockLows;
+    uint32_t samples;
+
+public:
+    HeapMonitor()
+        : freeBytes(0),
+          minFreeBytes(0),
+          largestBlock(0),
+          smallestLargestBlock(0xFFFFFFFF),
+          fragmentation(0),
+          worstFragmentation(0),
+          blockLows(0),
+          samples(0) {}
+
+    void sample() {
+        freeBytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        minFreeBytes = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+        largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+        fragmentation = freeBytes ? (uint8_t)(100 - (uint64_t)largestBlock * 100 / freeBytes) : 0;
+        if (fragmentation > worstFragmentation) worstFragmentation = fragmentation;
+        if (largestBlock < smallestLargestBlock) {
+            if (samples > 0) blockLows++;
+            smallestLargestBlock = largestBlock;
+        }
+        samples++;
+    }
+
+    uint32_t getFreeBytes() const {
+        return freeBytes;
+    }
+
+    // Lowest free heap since boot (maintained by the allocator)
+    uint32_t getMinFreeBytes() const {
+        return minFreeBytes;
+    }
+
+    uint32_t getLargestBlock() const {
+        return largestBlock;
+    }
+
+    // 0 % = all free memory in one block
+    uint8_t getFragmentation() const {
+        return fragmentation;
+    }
+
+    uint8_t getWorstFragmentation() const {
+        return worstFragmentation;
+    }
+
+    // Times the largest free block shrank to a new low after the first sample
+    uint32_t getBlockLows() const {
+        return blockLows;
+    }
+};
+
+#endif // HEAP_MONITOR_H
@@ -0,0 +1,176 @@
+#ifndef HTTP_CONNECTION_H
+#define HTTP_CONNECTION_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+
+// Minimal HTTP/1.1 client over one kept-alive WiFiClient. Request headers are
+// formatted into a fixed buffer and the response body is read into another,
+// so after the connection is open a request does no heap allocation (unlike
+// HTTPClient, which builds Strings for the URL, headers and payload).
+// Only plain http:// with Content-Length (or close-delimited) responses.
+class HttpConnection {
+public:
+    static const size_t HOST_SIZE = 64;
+    static const size_t HEADER_SIZE = 256;
+    static const size_t RESPONSE_SIZE = 1024;   // Longer bodies are truncated
+
+    // Transport errors (HTTP codes are positive)
+    static const int ERROR_CONNECT = -1;
+    static const int ERROR_SEND = -2;
+    static const int ERROR_TIMEOUT = -3;        // Also: closed before a full response
+    static const int ERROR_PROTOCOL = -4;
+
+private:
+    WiFiClient tcp;
+    char host[HOST_SIZE];
+    uint16_t port;
+    uint16_t timeoutMs;
+    char header[HEADER_SIZE];                   // Request headers, then response header lines
+    char response[RESPONSE_SIZE + 1];
+    size_t responseLength;
+
+    // Wait for the next byte; -1 on timeout or when the server closed
+    int readByte(unsigned long start) {
+        while (!tcp.available()) {
+            if (!tcp.connected() || millis() - start >= timeoutMs) return -1;
+            delay(1);
+        }
+        return tcp.read();
+    }
+
+    // One header line without CR/LF (overlong lines are cut); -1 on timeout
+    int readLine(unsigned long start) {
+        size_t n = 0;
+        for (;;) {
+            int c = readByte(start);
+            if (c < 0) return -1;
+            if (c == '\n') break;
+            if (c != '\r' && n < HEADER_SIZE - 1) header[n++] = (char)c;
+        }
+        header[n] = '\0';
+        return (int)n;
+    }
+
+    int readResponse() {
+        unsigned long start = millis();
+        responseLength = 0;
+        response[0] = '\0';
+
+        if (readLine(start) < 0) return ERROR_TIMEOUT;
+        if (strncmp(header, "HTTP/1.", 7) != 0) return ERROR_PROTOCOL;
+        bool keepAlive = header[7] == '1';      // HTTP/1.0 closes by default
+        const char* space = strchr(header, ' ');
+        int code = space ? atoi(space + 1) : 0;
+        if (code <= 0) return ERROR_PROTOCOL;
+
+        long contentLength = -1;
+        for (;;) {
+            int n = readLine(start);
+            if (n < 0) return ERROR_TIMEOUT;
+            if (n == 0) break;
+            if (strncasecmp(header, "Content-Length:", 15) == 0) {
+                contentLength = strtol(header + 15, nullptr, 10);
+            } else if (strncasecmp(header, "Connection:", 11) == 0) {
+                if (strcasestr(header + 11, "close")) keepAlive = false;
+                if (strcasestr(header + 11, "keep-alive")) keepAlive = true;
+            }
+        }
+
+        // Body: keep what fits, drain the rest so the connection stays in step
+        if (contentLength < 0) keepAlive = false;   // Delimited by the server closing
+        long remaining = contentLength;
+        while (remaining != 0) {
+            int c = readByte(start);
+            if (c < 0) {
+                if (contentLength >= 0) return ERROR_TIMEOUT;
+                break;
+            }
+            if (responseLength < RESPONSE_SIZE) response[responseLength++] = (char)c;
+            if (remaining > 0) remaining--;
+        }
+        response[responseLength] = '\0';
+
+        if (!keepAlive) tcp.stop();
+        return code;
+    }
+
+public:
+    HttpConnection() : port(80), timeoutMs(5000), responseLength(0) {
+        host[0] = '\0';
+        response[0] = '\0';
+    }
+
+    // Split "http://host[:port]" once, so requests only carry the path
+    bool begin(const char* url, uint16_t timeout = 5000) {
+        timeoutMs = timeout;
+        if (strncmp(url, "http://", 7) == 0) url += 7;
+        size_t n = strcspn(url, ":/");
+        if (n == 0 || n >= HOST_SIZE) return false;
+        memcpy(host, url, n);
+        host[n] = '\0';
+        port = (url[n] == ':') ? (uint16_t)atoi(url + n + 1) : 80;
+        return port != 0;
+    }
+
+    // Send one request (POST if body is set, else GET) and read the response.
+    // Returns the HTTP code, or a negative ERROR_* for a transport failure.
+    int request(const char* path, const uint8_t* body = nullptr, size_t length = 0,
+                const char* contentType = nullptr) {
+        if (!tcp.connected()) {
+            tcp.stop();
+            if (!tcp.connect(host, port)) return ERROR_CONNECT;
+            tcp.setNoDelay(true);               // Header and body are separate writes
+        }
+
+        int n = snprintf(header, HEADER_SIZE,
+            "%s %s HTTP/1.1\r\nHost: %s:%u\r\nConnection: keep-alive\r\n",
+            body ? "POST" : "GET", path, host, port);
+        if (body) {
+            n += snprintf(header + n, n < (int)HEADER_SIZE ? HEADER_SIZE - n : 0,
+                "Content-Type: %s\r\nContent-Length: %u\r\n",
+                contentType ? contentType : "application/octet-stream", (unsigned)length);
+        }
+        n += snprintf(header + n, n < (int)HEADER_SIZE ? HEADER_SIZE - n : 0, "\r\n");
+        if (n >= (int)HEADER_SIZE) return ERROR_SEND;
+
+        if (tcp.write((const uint8_t*)header, n) != (size_t)n ||
+            (length > 0 && tcp.write(body, length) != length)) {
+            tcp.stop();
+            return ERROR_SEND;
+        }
+        int code = readResponse();
+        if (code < 0) tcp.stop();
+        return code;
+    }
+
+    // Response body of the last request (NUL-terminated, parsed in place)
+    char* body() {
+        return response;
+    }
+
+    size_t bodyLength() const {
+        return responseLength;
+    }
+
+    bool isOpen() {
+        return tcp.connected();
+    }
+
+    void stop() {
+        tcp.stop();
+    }
+
+    const char* getHost() const {
+        return host;
+    }
+
+    uint16_t getPort() const {
+        return port;
+    }
+};
+
+#endif // HTTP_CONNECTION_H
@@ -4,6 +4,7 @@
 #include <Arduino.h>
 #include <IRremote.h>
 #include "PinConfig.h"
+#include "EventLog.h"
 
 // IR Remote Control Handler Class
 class IRHandler {
@@ -12,15 +13,17 @@ private:
     static const uint8_t IR_RECEIVE_PIN = 19;
     static const unsigned long IR_CODE_RELAY1 = 0xA758FF00;
     static const unsigned long IR_CODE_RELAY2 = 0xBB44FF00;
+    static const unsigned long IR_CODE_PAGE = 0xBF40FF00;   // "Next" key: LCD page
     
     // ==================== PRIVATE VARIABLES ====================
     unsigned long lastCode;
     bool initialized;
+    bool pageRequested;
     PinConfig& pinConfig;  // Reference to PinConfig instance
 
 public:
     // Constructor taking PinConfig reference
-    IRHandler(PinConfig& config) : lastCode(0), initialized(false), pinConfig(config) {}
+    IRHandler(PinConfig& config) : lastCode(0), initialized(false), pageRequested(false), pinConfig(config) {}
 
     // Initialize IR receiver
     void begin() {
@@ -31,7 +34,7 @@ public:
         }
     }
 
-    // Process IR input - returns true if a valid command was processed
+    // Process IR input - returns true if a relay command was processed
     bool update() {
         if (!initialized || !pinConfig.isInitialized()) return false;
         if (!IrReceiver.decode()) return false;
@@ -47,14 +50,18 @@ public:
         if (code != 0) {
             if (code == IR_CODE_RELAY1) {
                 pinConfig.toggleRelay1();
-                Serial.println(pinConfig.getRelay1State() ? "Relay1 ON" : "Relay1 OFF");
+                LOG_INFO(LOG_MAIN, pinConfig.getRelay1State() ? "Relay1 ON" : "Relay1 OFF");
                 processed = true;
             }
             else if (code == IR_CODE_RELAY2) {
                 pinConfig.toggleRelay2();
-                Serial.println(pinConfig.getRelay2State() ? "Relay2 ON" : "Relay2 OFF");
+                LOG_INFO(LOG_MAIN, pinConfig.getRelay2State() ? "Relay2 ON" : "Relay2 OFF");
                 processed = true;
             }
+            else if (code == IR_CODE_PAGE) {
+                pageRequested = true;
+                lastCode = code;
+            }
 
             if (processed) {
                 lastCode = code;
@@ -66,6 +73,13 @@ public:
         return processed;
     }
 
+    // The page key was pressed since the last call
+    bool takePageRequest() {
+        bool requested = pageRequested;
+        pageRequested = false;
+        return requested;
+    }
+
     // Get the last received code
     unsigned long getLastCode() const {
         return lastCode;
@@ -0,0 +1,645 @@
+#ifndef LOCAL_API_H
+#define LOCAL_API_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <atomic>
+#include "RollupStore.h"
+#include "OffsetTracker.h"
+#include "Metrics.h"
+#include "EventLog.h"
+
+#ifdef ARDUINO
+#include <lwip/sockets.h>
+#else
+#include <sys/socket.h>
+#endif
+
+// Latest readings for local clients. Field names follow the server's /api/latest.
+struct LocalSnapshot {
+    uint32_t window;                // Measurement windows since boot
+    uint32_t timestamp;             // Unix time if synced, else seconds since boot
+    bool synced;
+    float voltage;
+    float frequency;
+    float current1;
+    float current2;
+    float current3;
+    float power1;
+    float power2;
+    float apparentPower1;
+    float apparentPower2;
+    float powerFactor1;
+    float powerFactor2;
+    float leakage;
+    uint64_t energyL1;              // mJ
+    uint64_t energyL2;
+    float price;                    // Per kWh
+    bool relay1;
+    bool relay2;
+    bool theft;
+};
+
+// One completed measurement window, pushed to every /api/stream client
+struct LocalWindow {
+    uint32_t window;
+    uint32_t timestamp;
+    bool synced;
+    float voltage;
+    float frequency;
+    float current1;
+    float current2;
+    float current3;
+    float power1;
+    float power2;
+    uint64_t energyL1;              // mJ
+    uint64_t energyL2;
+};
+
+// One value handed from the control task to the network task without a lock:
+// write() never waits, read() retries while a write overlaps its copy
+// (sequence lock, as in LatencyHistogram)
+template <typename T>
+class SeqlockSlot {
+private:
+    std::atomic<uint32_t> version;  // Odd while write() runs, 0 before the first one
+    T value;
+
+public:
+    SeqlockSlot() : version(0) {
+        memset(&value, 0, sizeof(value));
+    }
+
+    // From one task only
+    void write(const T& v) {
+        uint32_t before = version.load(std::memory_order_relaxed);
+        version.store(before + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&value, &v, sizeof(value));
+        version.store(before + 2, std::memory_order_release);
+    }
+
+    // Copy of the last value written; false before the first write or if
+    // writes kept overlapping the copy for a few tries
+    bool read(T& out) const {
+        for (uint8_t attempt = 0; attempt < 8; attempt++) {
+            uint32_t before = version.load(std::memory_order_acquire);
+            if (before == 0) return false;
+            memcpy(&out, &value, sizeof(out));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ((before & 1) == 0 && version.load(std::memory_order_relaxed) == before) return true;
+        }
+        return false;
+    }
+};
+
+// Read-only HTTP API served by the meter itself, for LAN dashboards when the
+// central server is down (or to spare it ten pollers):
+//   GET /api/latest                          latest snapshot
+//   GET /api/history?tier=1s|1m|15m&from=&to= rollup records, bucket start in [from, to)
+//   GET /api/stream                          server-sent event per measurement window
+//   GET /api/offsets                         current sensor zero offsets, drift and history
+//   GET /metrics                             instrumentation, Prometheus text format
+// poll() is called from the loop and does bounded work: it accepts at most one
+// client, reads what has arrived and sends only what the socket takes without
+// waiting (MSG_DONTWAIT). History is generated from the rollup cursor as the
+// client drains it, and a stream client that falls behind skips windows
+// instead of stalling the loop. Responses close the connection when done.
+// Readings arrive from the control task through SeqlockSlots and the offsets
+// under OffsetTracker's sequence counter, so only poll() needs the network task.
+class LocalApi {
+public:
+    static const uint8_t MAX_CLIENTS = 6;
+    static const size_t REQUEST_SIZE = 256;
+    static const size_t OUTPUT_SIZE = 1024;
+    static const unsigned long REQUEST_TIMEOUT = 3000;  // Idle client without a full request
+    static const unsigned long SEND_TIMEOUT = 10000;    // Client not reading its response
+    static const uint32_t HISTORY_SCAN = 32;            // Rollup slots looked at per history refill
+
+private:
+    enum State {
+        FREE,
+        REQUEST,                    // Reading the request head
+        RESPONSE,                   // Sending a response, then close
+        HISTORY,                    // Sending rollup records as they fit
+        OFFSETS,                    // Sending offset history points as they fit
+        METRICS,                    // Sending the metrics snapshot part by part
+        STREAM                      // Server-sent events until the client leaves
+    };
+
+    struct Connection {
+        WiFiClient client;
+        State state;
+        char request[REQUEST_SIZE];
+        size_t requestLength;
+        char output[OUTPUT_SIZE];
+        size_t outputLength;
+        size_t outputSent;
+        unsigned long lastProgress;
+        RollupCursor cursor;
+        uint8_t tier;
+        uint32_t records;           // History records (or metrics items) written so far
+    };
+
+    WiFiServer server;
+    uint16_t port;
+    bool started;
+    const RollupStore* rollups;
+    const OffsetTracker* offsets;
+    MetricsSource metrics;
+    Connection connections[MAX_CLIENTS];
+
+    SeqlockSlot<LocalSnapshot> latest;
+    SeqlockSlot<LocalWindow> windows;
+    uint32_t streamedWindow;        // Last window queued on the streams
+    bool hasStreamed;
+    char event[384];                // The current window event, formatted once for all streams
+
+    uint32_t requests;
+    uint32_t rejected;
+    uint32_t eventsSent;
+    uint32_t eventsSkipped;
+
+    // snprintf at out + length; advances length only if the text fitted
+    static int appendf(char* out, size_t space, size_t& length, const char* format, ...) {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(out + length, length < space ? space - length : 0, format, args);
+        va_end(args);
+        if (n > 0 && length + n < space) {
+            length += n;
+            return n;
+        }
+        return 0;
+    }
+
+    // Queue bytes behind what the connection is already sending; false if they do not fit
+    static bool queue(Connection& c, const char* data, size_t length) {
+        if (c.outputSent > 0) {
+            memmove(c.output, c.output + c.outputSent, c.outputLength - c.outputSent);
+            c.outputLength -= c.outputSent;
+            c.outputSent = 0;
+        }
+        if (c.outputLength + length > OUTPUT_SIZE) return false;
+        memcpy(c.output + c.outputLength, data, length);
+        c.outputLength += length;
+        return true;
+    }
+
+    static void startResponse(Connection& c, int code, const char* status, const char* contentType) {
+        c.outputLength = 0;
+        c.outputSent = 0;
+        appendf(c.output, OUTPUT_SIZE, c.outputLength,
+            "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nCache-Control: no-cache\r\n"
+            "Access-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n",
+            code, status, contentType);
+    }
+
+    static void sendError(Connection& c, int code, const char* status) {
+        startResponse(c, code, status, "application/json");
+        appendf(c.output, OUTPUT_SIZE, c.outputLength, "{\"status\":\"error\",\"message\":\"%s\"}", status);
+        c.state = RESPONSE;
+    }
+
+    void sendLatest(Connection& c) {
+        LocalSnapshot s;
+        if (!latest.read(s)) {
+            sendError(c, 503, "No reading yet");
+            return;
+        }
+        float energyL1 = s.energyL1 / 3.6e9f;
+        float energyL2 = s.energyL2 / 3.6e9f;
+        startResponse(c, 200, "OK", "application/json");
+        appendf(c.output, OUTPUT_SIZE, c.outputLength,
+            "{\"window\":%lu,\"timestamp\":%lu,\"synced\":%s,"
+            "\"voltage\":%.2f,\"frequency\":%.3f,\"current1\":%.4f,\"current2\":%.4f,\"current3\":%.4f,"
+            "\"total_current\":%.4f,\"power1\":%.2f,\"power2\":%.2f,\"total_power\":%.2f,"
+            "\"apparent_power1\":%.2f,\"apparent_power2\":%.2f,\"power_factor1\":%.3f,\"power_factor2\":%.3f,"
+            "\"leakage\":%.4f,\"energy_l1_mj\":%llu,\"energy_l2_mj\":%llu,"
+            "\"energy_l1\":%.6f,\"energy_l2\":%.6f,\"total_energy\":%.6f,"
+            "\"cost_l1\":%.4f,\"cost_l2\":%.4f,\"total_cost\":%.4f,\"price\":%.2f,"
+            "\"relay1_state\":%s,\"relay2_state\":%s,\"theft_detected\":%s}",
+            (unsigned long)s.window, (unsigned long)s.timestamp, s.synced ? "true" : "false",
+            s.voltage, s.frequency, s.current1, s.current2, s.current3,
+            s.current1 + s.current2, s.power1, s.power2, s.power1 + s.power2,
+            s.apparentPower1, s.apparentPower2, s.powerFactor1, s.powerFactor2,
+            s.leakage, (unsigned long long)s.energyL1, (unsigned long long)s.energyL2,
+            energyL1, energyL2, energyL1 + energyL2,
+            energyL1 * s.price, energyL2 * s.price, (energyL1 + energyL2) * s.price, s.price,
+            s.relay1 ? "true" : "false", s.relay2 ? "true" : "false", s.theft ? "true" : "false");
+        c.state = RESPONSE;
+    }
+
+    // Value of a query parameter, or nullptr (the value ends at '&' or the end)
+    static const char* parameter(const char* query, const char* name) {
+        size_t length = strlen(name);
+        while (query != nullptr && *query) {
+            if (strncmp(query, name, length) == 0 && query[length] == '=') return query + length + 1;
+            query = strchr(query, '&');
+            if (query) query++;
+        }
+        return nullptr;
+    }
+
+    static const char* tierName(uint8_t tier) {
+        return tier == ROLLUP_SECOND ? "1s" : (tier == ROLLUP_MINUTE ? "1m" : "15m");
+    }
+
+    void startHistory(Connection& c, const char* query) {
+        if (rollups == nullptr) {
+            sendError(c, 404, "No history");
+            return;
+        }
+        const char* tier = parameter(query, "tier");
+        const char* from = parameter(query, "from");
+        const char* to = parameter(query, "to");
+        if (tier == nullptr || strncmp(tier, "1s", 2) == 0) {
+            c.tier = ROLLUP_SECOND;
+        } else if (strncmp(tier, "1m", 2) == 0) {
+            c.tier = ROLLUP_MINUTE;
+        } else if (strncmp(tier, "15m", 3) == 0) {
+            c.tier = ROLLUP_QUARTER;
+        } else {
+            sendError(c, 400, "Unknown tier");
+            return;
+        }
+        uint32_t start = from ? strtoul(from, nullptr, 10) : 0;
+        uint32_t end = to ? strtoul(to, nullptr, 10) : 0xFFFFFFFF;
+
+        c.cursor = rollups->query((RollupTier)c.tier, start, end);
+        c.records = 0;
+        startResponse(c, 200, "OK", "application/json");
+        appendf(c.output, OUTPUT_SIZE, c.outputLength, "{\"tier\":\"%s\",\"records\":[", tierName(c.tier));
+        c.state = HISTORY;
+    }
+
+    // Refill the output with records once the previous ones are sent. At most
+    // HISTORY_SCAN slots are looked at per pass (a run of empty or out-of-range
+    // ones is crossed over several polls instead of in one).
+    void fillHistory(Connection& c) {
+        if (c.outputSent < c.outputLength) return;
+        c.outputLength = 0;
+        c.outputSent = 0;
+
+        const RollupRecord* r;
+        uint32_t first = c.cursor.getPosition();
+        while (OUTPUT_SIZE - c.outputLength > 320) {
+            uint32_t scanned = c.cursor.getPosition() - first;
+            if (scanned >= HISTORY_SCAN || (r = c.cursor.next(HISTORY_SCAN - scanned)) == nullptr) break;
+            appendf(c.output, OUTPUT_SIZE, c.outputLength,
+                "%s{\"start\":%lu,\"synced\":%s,\"windows\":%u,"
+                "\"voltage\":[%.1f,%.1f,%.1f],\"current1\":[%.3f,%.3f,%.3f],"
+                "\"current2\":[%.3f,%.3f,%.3f],\"current3\":[%.3f,%.3f,%.3f],"
+                "\"power1\":[%.2f,%.2f,%.2f],\"power2\":[%.2f,%.2f,%.2f],\"energy_j\":[%.3f,%.3f]}",
+                c.records ? "," : "", (unsigned long)r->start,
+                (r->flags & RollupRecord::FLAG_SYNCED) ? "true" : "false", r->windows,
+                r->getMin(ROLLUP_VOLTAGE), r->getAverage(ROLLUP_VOLTAGE), r->getMax(ROLLUP_VOLTAGE),
+                r->getMin(ROLLUP_CURRENT1), r->getAverage(ROLLUP_CURRENT1), r->getMax(ROLLUP_CURRENT1),
+                r->getMin(ROLLUP_CURRENT2), r->getAverage(ROLLUP_CURRENT2), r->getMax(ROLLUP_CURRENT2),
+                r->getMin(ROLLUP_CURRENT3), r->getAverage(ROLLUP_CURRENT3), r->getMax(ROLLUP_CURRENT3),
+                r->getMin(ROLLUP_POWER1), r->getAverage(ROLLUP_POWER1), r->getMax(ROLLUP_POWER1),
+                r->getMin(ROLLUP_POWER2), r->getAverage(ROLLUP_POWER2), r->getMax(ROLLUP_POWER2),
+                r->energy[0], r->energy[1]);
+            c.records++;
+        }
+        if (c.outputLength == 0 && c.cursor.isDone()) {
+            appendf(c.output, OUTPUT_SIZE, c.outputLength, "],\"count\":%lu}", (unsigned long)c.records);
+            c.state = RESPONSE;     // Close once this is sent
+        }
+    }
+
+    void startOffsets(Connection& c) {
+        if (offsets == nullptr || offsets->getHistoryCount() == 0) {
+            sendError(c, 503, "No offsets yet");
+            return;
+        }
+        unsigned long now = millis();
+        startResponse(c, 200, "OK", "application/json");
+        appendf(c.output, OUTPUT_SIZE, c.outputLength, "{\"uptime\":%lu,\"interval_s\":%lu,\"channels\":[",
+                now / 1000, (unsigned long)(OffsetTracker::HISTORY_INTERVAL_MS / 1000));
+        // Formatted again if the tracker moved meanwhile
+        size_t mark = c.outputLength;
+        for (uint8_t attempt = 0; attempt < 8; attempt++) {
+            c.outputLength = mark;
+            uint32_t version = offsets->readBegin();
+            for (uint8_t i = 0; i < offsets->getChannelCount(); i++) {
+                const CurrentSensor& sensor = offsets->getSensor(i);
+                appendf(c.output, OUTPUT_SIZE, c.outputLength,
+                    "%s{\"pin\":%u,\"offset_mv\":%.2f,\"idle\":%s,\"idle_windows\":%lu,"
+                    "\"corrections\":%lu,\"drift_mv\":%.2f,\"drift_mv_per_h\":%.3f}",
+                    i ? "," : "", sensor.getPin(), sensor.getOffset(),
+                    offsets->isIdle(i, now) ? "true" : "false",
+                    (unsigned long)offsets->getIdleWindows(i), (unsigned long)offsets->getCorrections(i),
+                    offsets->getDrift(i), offsets->getDriftRate(i));
+            }
+            if (offsets->readValid(version)) break;
+        }
+        appendf(c.output, OUTPUT_SIZE, c.outputLength, "],\"history\":[");
+        c.records = 0;
+        c.state = OFFSETS;
+    }
+
+    // History points as [uptime_s, mV per channel], refilled once the previous ones are sent
+    void fillOffsets(Connection& c) {
+        if (c.outputSent < c.outputLength) return;
+        c.outputLength = 0;
+        c.outputSent = 0;
+
+        uint8_t channels = offsets->getChannelCount();
+        while (OUTPUT_SIZE - c.outputLength > 96) {
+            OffsetPoint p = {};
+            uint8_t attempt = 0;
+            uint32_t version;
+            do {
+                version = offsets->readBegin();
+                if (c.records < offsets->getHistoryCount()) p = offsets->getHistory(c.records);
+            } while (!offsets->readValid(version) && ++attempt < 8);
+            if (c.records >= offsets->getHistoryCount()) break;
+            appendf(c.output, OUTPUT_SIZE, c.outputLength, "%s[%lu", c.records ? "," : "", (unsigned long)p.uptime);
+            for (uint8_t i = 0; i < channels; i++) {
+                appendf(c.output, OUTPUT_SIZE, c.outputLength, ",%.2f", p.offsets[i]);
+            }
+            appendf(c.output, OUTPUT_SIZE, c.outputLength, "]");
+            c.records++;
+        }
+        if (c.outputLength == 0) {
+            appendf(c.output, OUTPUT_SIZE, c.outputLength, "]}");
+            c.state = RESPONSE;     // Close once this is sent
+        }
+    }
+
+    void startMetrics(Connection& c) {
+        if (metrics == nullptr) {
+            sendError(c, 404, "Not found");
+            return;
+        }
+        startResponse(c, 200, "OK", "text/plain; version=0.0.4");
+        c.records = 0;
+        c.state = METRICS;
+    }
+
+    // The next part of the snapshot, once the previous one is sent
+    void fillMetrics(Connection& c) {
+        if (c.outputSent < c.outputLength) return;
+        c.outputLength = 0;
+        c.outputSent = 0;
+
+        MetricsWriter writer(c.output, OUTPUT_SIZE, (uint16_t)c.records);
+        metrics(writer);
+        c.outputLength = writer.getLength();
+        if (writer.isComplete()) {
+            c.state = RESPONSE;     // Close once this is sent
+        } else {
+            c.records = writer.getNextItem();
+        }
+    }
+
+    void startStream(Connection& c) {
+        startResponse(c, 200, "OK", "text/event-stream");
+        appendf(c.output, OUTPUT_SIZE, c.outputLength, "retry: 2000\n\n");
+        c.state = STREAM;
+    }
+
+    void route(Connection& c) {
+        requests++;
+        char* line = c.request;
+        char* path = strchr(line, ' ');
+        if (path == nullptr) {
+            sendError(c, 400, "Bad request");
+            return;
+        }
+        *path++ = '\0';
+        char* end = strchr(path, ' ');
+        if (end) *end = '\0';
+        char* query = strchr(path, '?');
+        if (query) *query++ = '\0';
+
+        if (strcmp(line, "GET") != 0) {
+            sendError(c, 405, "Method not allowed");
+        } else if (strcmp(path, "/api/latest") == 0) {
+            sendLatest(c);
+        } else if (strcmp(path, "/api/history") == 0) {
+            startHistory(c, query);
+        } else if (strcmp(path, "/api/stream") == 0) {
+            startStream(c);
+        } else if (strcmp(path, "/api/offsets") == 0) {
+            startOffsets(c);
+        } else if (strcmp(path, "/metrics") == 0) {
+            startMetrics(c);
+        } else {
+            sendError(c, 404, "Not found");
+        }
+    }
+
+    void close(Connection& c) {
+        c.client.stop();
+        c.state = FREE;
+    }
+
+    void readRequest(Connection& c, unsigned long now) {
+        int available = c.client.available();
+        while (available-- > 0 && c.requestLength < REQUEST_SIZE - 1) {
+            int ch = c.client.read();
+            if (ch < 0) break;
+            c.request[c.requestLength++] = (char)ch;
+            c.lastProgress = now;
+        }
+        c.request[c.requestLength] = '\0';
+        if (strstr(c.request, "\r\n\r\n") || strstr(c.request, "\n\n")) {
+            route(c);
+        } else if (c.requestLength >= REQUEST_SIZE - 1) {
+            sendError(c, 431, "Request too large");
+        } else if (!c.client.connected() || now - c.lastProgress >= REQUEST_TIMEOUT) {
+            close(c);
+        }
+    }
+
+    // Send what the socket takes right now; false once the client is gone
+    bool flush(Connection& c, unsigned long now) {
+        while (c.outputSent < c.outputLength) {
+            ssize_t n = send(c.client.fd(), c.output + c.outputSent, c.outputLength - c.outputSent,
+                             MSG_DONTWAIT);
+            if (n <= 0) {
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    return now - c.lastProgress < SEND_TIMEOUT;
+                }
+                return false;
+            }
+            c.outputSent += n;
+            c.lastProgress = now;
+        }
+        return true;
+    }
+
+    void accept(unsigned long now) {
+        WiFiClient client = server.available();
+        if (!client) return;
+        for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+            Connection& c = connections[i];
+            if (c.state != FREE) continue;
+            c.client = client;
+            c.client.setNoDelay(true);
+            c.state = REQUEST;
+            c.requestLength = 0;
+            c.outputLength = 0;
+            c.outputSent = 0;
+            c.lastProgress = now;
+            return;
+        }
+        // All slots busy
+        rejected++;
+        static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+        send(client.fd(), busy, sizeof(busy) - 1, MSG_DONTWAIT);
+        client.stop();
+    }
+
+    // Queue the newest published window on every stream; a client still
+    // sending an earlier event skips this one, and windows published since the
+    // previous poll count as skipped by every stream
+    void streamWindow() {
+        LocalWindow w;
+        if (!windows.read(w) || (hasStreamed && w.window == streamedWindow)) return;
+        uint32_t missed = hasStreamed ? w.window - streamedWindow - 1 : 0;
+        streamedWindow = w.window;
+        hasStreamed = true;
+
+        size_t length = 0;
+        for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+            Connection& c = connections[i];
+            if (c.state != STREAM) continue;
+            eventsSkipped += missed;
+            if (length == 0) {
+                appendf(event, sizeof(event), length,
+                    "id: %lu\ndata: {\"window\":%lu,\"timestamp\":%lu,\"synced\":%s,"
+                    "\"voltage\":%.2f,\"frequency\":%.3f,\"current1\":%.4f,\"current2\":%.4f,\"current3\":%.4f,"
+                    "\"power1\":%.2f,\"power2\":%.2f,\"energy_l1_mj\":%llu,\"energy_l2_mj\":%llu}\n\n",
+                    (unsigned long)w.window, (unsigned long)w.window, (unsigned long)w.timestamp,
+                    w.synced ? "true" : "false", w.voltage, w.frequency,
+                    w.current1, w.current2, w.current3, w.power1, w.power2,
+                    (unsigned long long)w.energyL1, (unsigned long long)w.energyL2);
+                if (length == 0) return;
+            }
+            if (queue(c, event, length)) {
+                eventsSent++;
+            } else {
+                eventsSkipped++;
+            }
+        }
+    }
+
+public:
+    LocalApi(uint16_t listenPort = 80)
+        : server(listenPort),
+          port(listenPort),
+          started(false),
+          rollups(nullptr),
+          offsets(nullptr),
+          metrics(nullptr),
+          streamedWindow(0),
+          hasStreamed(false),
+          requests(0),
+          rejected(0),
+          eventsSent(0),
+          eventsSkipped(0) {
+        for (uint8_t i = 0; i < MAX_CLIENTS; i++) connections[i].state = FREE;
+    }
+
+    // History comes from the rollup store, offsets from the drift tracker and
+    // /metrics from the snapshot writer (the last two optional)
+    void begin(const RollupStore* store, const OffsetTracker* tracker = nullptr,
+               MetricsSource metricsSource = nullptr) {
+        rollups = store;
+        offsets = tracker;
+        metrics = metricsSource;
+    }
+
+    // Call every loop pass; listens once WiFi is up
+    void poll(unsigned long now) {
+        if (!started) {
+            if (WiFi.status() != WL_CONNECTED) return;
+            server.begin();
+            server.setNoDelay(true);
+            started = true;
+            LOG_INFO(LOG_NET, "🏠 Local API on port %u", port);
+        }
+        accept(now);
+        streamWindow();
+
+        for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+            Connection& c = connections[i];
+            switch (c.state) {
+                case FREE:
+                    break;
+                case REQUEST:
+                    readRequest(c, now);
+                    if (c.state == REQUEST || c.state == FREE) break;
+                    // Fall through - start sending the response in this pass
+                case RESPONSE:
+                case HISTORY:
+                case OFFSETS:
+                case METRICS:
+                case STREAM:
+                    if (c.state == HISTORY) fillHistory(c);
+                    if (c.state == OFFSETS) fillOffsets(c);
+                    if (c.state == METRICS) fillMetrics(c);
+                    if (!flush(c, now)) {
+                        close(c);
+                    } else if (c.state == RESPONSE && c.outputSent == c.outputLength) {
+                        close(c);
+                    } else if (c.state == STREAM && !c.client.connected()) {
+                        close(c);
+                    }
+                    break;
+            }
+        }
+    }
+
+    // Latest readings for /api/latest. Called from the control task; never waits.
+    void setLatest(const LocalSnapshot& snapshot) {
+        latest.write(snapshot);
+    }
+
+    // A completed window for the streams, queued by the next poll(). Called
+    // from the control task; never waits.
+    void publishWindow(const LocalWindow& w) {
+        windows.write(w);
+    }
+
+    uint8_t getClientCount() const {
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+            if (connections[i].state != FREE) count++;
+        }
+        return count;
+    }
+
+    uint8_t getStreamCount() const {
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+            if (connections[i].state == STREAM) count++;
+        }
+        return count;
+    }
+
+    uint32_t getRequestCount() const {
+        return requests;
+    }
+
+    uint32_t getRejectedCount() const {
+        return rejected;
+    }
+
+    uint32_t getEventsSent() const {
+        return eventsSent;
+    }
+
+    uint32_t getEventsSkipped() const {
+        return eventsSkipped;
+    }
+};
+
+#endif // LOCAL_API_H
@@ -0,0 +1,287 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+// Hot-path stages with their own latency histogram
+enum MetricStage : uint8_t {
+    STAGE_SAMPLING = 0,             // Frame consumption: power, power quality, leakage
+    STAGE_COMPUTE,                  // Window integration (energy, rollups) and readSensors()
+    STAGE_DISPLAY,                  // LCD page and serial report
+    STAGE_NETWORK,                  // Requests to the server
+    STAGE_FLASH,                    // Energy journal, offsets, telemetry queue
+    METRIC_STAGES
+};
+
+// 0 removes the scoped timers (METRIC_SCOPE expands to nothing); the counters
+// the modules keep anyway are still exported
+#ifndef METRICS_ENABLED
+#define METRICS_ENABLED 1
+#endif
+
+#define METRIC_CONCAT_(a, b) a##b
+#define METRIC_CONCAT(a, b) METRIC_CONCAT_(a, b)
+#if METRICS_ENABLED
+#define METRIC_SCOPE(which) ScopedTimer METRIC_CONCAT(metricTimer, __LINE__)(Metrics::instance().histogramOf(which))
+#else
+#define METRIC_SCOPE(which) do {} while (0)
+#endif
+
+// CPU cycle counter of the calling core. Tasks are pinned, so a timer starts
+// and stops on the same core; it wraps after ~17 s at 240 MHz.
+#ifdef ARDUINO
+inline uint32_t metricCycles() {
+    return ESP.getCycleCount();
+}
+
+inline uint32_t metricCyclesPerUs() {
+    return ESP.getCpuFreqMHz();
+}
+#else
+inline uint32_t metricCycles() {
+    return micros();
+}
+
+inline uint32_t metricCyclesPerUs() {
+    return 1;
+}
+#endif
+
+// Consistent copy of a histogram
+struct HistogramSnapshot {
+    static const uint8_t BUCKETS = 13;
+
+    uint32_t buckets[BUCKETS];      // Not cumulative; the last one is +Inf
+    uint32_t count;
+    uint64_t sumUs;
+    uint32_t maxUs;
+};
+
+// Durations in fixed buckets (50 us .. 2 s, +Inf), with their sum and maximum.
+// Written by one task; other tasks read it through snapshot(), which retries
+// while a record() is in progress (sequence lock), so recording never waits.
+class LatencyHistogram {
+public:
+    static const uint8_t BUCKETS = HistogramSnapshot::BUCKETS;
+
+    // Upper bounds (us) and the same as Prometheus "le" labels (s)
+    static uint32_t bound(uint8_t bucket) {
+        static const uint32_t bounds[BUCKETS - 1] = {
+            50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000, 500000, 2000000
+        };
+        return bucket < BUCKETS - 1 ? bounds[bucket] : 0xFFFFFFFF;
+    }
+
+    static const char* boundLabel(uint8_t bucket) {
+        static const char* const labels[BUCKETS] = {
+            "5e-05", "0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005",
+            "0.01", "0.025", "0.1", "0.5", "2", "+Inf"
+        };
+        return labels[bucket < BUCKETS ? bucket : BUCKETS - 1];
+    }
+
+private:
+    std::atomic<uint32_t> version;  // Odd while a record() is writing
+    HistogramSnapshot data;
+
+public:
+    LatencyHistogram() : version(0) {
+        memset(&data, 0, sizeof(data));
+    }
+
+    void record(uint32_t us) {
+        uint8_t bucket = 0;
+        while (bucket < BUCKETS - 1 && us > bound(bucket)) bucket++;
+
+        uint32_t v = version.load(std::memory_order_relaxed);
+        version.store(v + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        data.buckets[bucket]++;
+        data.count++;
+        data.sumUs += us;
+        if (us > data.maxUs) data.maxUs = us;
+        version.store(v + 2, std::memory_order_release);
+    }
+
+    // Copy taken between two records; false if records kept overlapping the
+    // copy for a few tries (the copy may then be off by a record in progress)
+    bool snapshot(HistogramSnapshot& out) const {
+        for (uint8_t attempt = 0; attempt < 8; attempt++) {
+            uint32_t before = version.load(std::memory_order_acquire);
+            memcpy(&out, &data, sizeof(out));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ((before & 1) == 0 && version.load(std::memory_order_relaxed) == before) return true;
+        }
+        return false;
+    }
+
+    uint32_t getCount() const {
+        return data.count;
+    }
+};
+
+// Records the time from construction to the end of the scope (see METRIC_SCOPE)
+class ScopedTimer {
+private:
+    LatencyHistogram& histogram;
+    uint32_t start;
+
+public:
+    explicit ScopedTimer(LatencyHistogram& target)
+        : histogram(target),
+          start(metricCycles()) {}
+
+    ~ScopedTimer();
+};
+
+// Stage histograms shared by every module
+class Metrics {
+private:
+    LatencyHistogram stages[METRIC_STAGES];
+    uint32_t cyclesPerUs;
+
+    Metrics() : cyclesPerUs(metricCyclesPerUs()) {
+        if (cyclesPerUs == 0) cyclesPerUs = 1;
+    }
+
+public:
+    static Metrics& instance() {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    static const char* stageName(uint8_t stage) {
+        static const char* const names[METRIC_STAGES] = {"sampling", "compute", "display", "network", "flash"};
+        return stage < METRIC_STAGES ? names[stage] : "unknown";
+    }
+
+    LatencyHistogram& histogramOf(MetricStage stage) {
+        return stages[stage];
+    }
+
+    const LatencyHistogram& getStage(uint8_t stage) const {
+        return stages[stage < METRIC_STAGES ? stage : 0];
+    }
+
+    uint32_t toMicros(uint32_t cycles) const {
+        return cycles / cyclesPerUs;
+    }
+};
+
+inline ScopedTimer::~ScopedTimer() {
+    histogram.record(Metrics::instance().toMicros(metricCycles() - start));
+}
+
+// Prometheus text exposition into a fixed buffer. Every sample line (a family's
+// HELP/TYPE header counts as one) is an item; a snapshot larger than the buffer
+// is written in parts: pass getNextItem() of one part as firstItem of the next.
+// Items are only formatted for the part they land in.
+class MetricsWriter {
+private:
+    char* out;
+    size_t space;
+    size_t length;
+    uint16_t first;                 // Items before this one went out in earlier parts
+    uint16_t item;                  // Index of the next item
+    uint16_t next;                  // First item of the next part
+    bool full;
+
+    // Format one item if it belongs to this part and fits; an item too large
+    // for an empty buffer is dropped rather than stalling every later part
+    void add(const char* format, ...) {
+        uint16_t index = item++;
+        if (index < first || full) return;
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(out + length, space - length, format, args);
+        va_end(args);
+        if (n >= 0 && length + n < space) {
+            length += n;
+        } else if (length > 0) {
+            out[length] = '\0';
+            full = true;
+            next = index;
+        } else {
+            out[0] = '\0';
+        }
+    }
+
+    // True if none of the next `items` items is written in this part
+    bool skip(uint16_t items) {
+        if (full || item + items <= first) {
+            item += items;
+            return true;
+        }
+        return false;
+    }
+
+public:
+    MetricsWriter(char* buffer, size_t size, uint16_t firstItem = 0)
+        : out(buffer),
+          space(size),
+          length(0),
+          first(firstItem),
+          item(0),
+          next(0),
+          full(false) {
+        if (space > 0) out[0] = '\0';
+    }
+
+    // HELP and TYPE lines of a metric family
+    void family(const char* name, const char* type, const char* help) {
+        add("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    }
+
+    // One sample; labels without braces (name="value",...) or nullptr
+    void sample(const char* name, const char* labels, double value) {
+        if (labels != nullptr) {
+            add("%s{%s} %.10g\n", name, labels, value);
+        } else {
+            add("%s %.10g\n", name, value);
+        }
+    }
+
+    // Cumulative buckets, sum and count of a histogram (seconds)
+    void histogram(const char* name, const char* labels, const LatencyHistogram& source) {
+        if (skip(HistogramSnapshot::BUCKETS + 2)) return;
+        HistogramSnapshot s;
+        source.snapshot(s);
+        const char* comma = labels != nullptr ? "," : "";
+        if (labels == nullptr) labels = "";
+
+        uint32_t cumulative = 0;
+        for (uint8_t b = 0; b < HistogramSnapshot::BUCKETS; b++) {
+            cumulative += s.buckets[b];
+            add("%s_bucket{%s%sle=\"%s\"} %lu\n", name, labels, comma,
+                LatencyHistogram::boundLabel(b), (unsigned long)cumulative);
+        }
+        add(*labels ? "%s_sum{%s} %.6f\n" : "%s_sum%s %.6f\n", name, labels, s.sumUs / 1e6);
+        add(*labels ? "%s_count{%s} %lu\n" : "%s_count%s %lu\n", name, labels, (unsigned long)s.count);
+    }
+
+    const char* getText() const {
+        return out;
+    }
+
+    size_t getLength() const {
+        return length;
+    }
+
+    // Everything from firstItem on was written
+    bool isComplete() const {
+        return !full;
+    }
+
+    uint16_t getNextItem() const {
+        return next;
+    }
+};
+
+// Writes a whole snapshot through the writer (the caller decides the parts)
+typedef void (*MetricsSource)(MetricsWriter& writer);
+
+#endif // METRICS_H
@@ -0,0 +1,214 @@
+#ifndef OFFSET_TRACKER_H
+#define OFFSET_TRACKER_H
+
+#include <Arduino.h>
+#include <math.h>
+#include <atomic>
+#include "current.h"
+
+// Relays whose branch a sensor measures (all of them off = no current through it)
+enum OffsetRelay : uint8_t {
+    OFFSET_RELAY1 = 1,
+    OFFSET_RELAY2 = 2
+};
+
+// Applied zero offsets of all channels at one time
+struct OffsetPoint {
+    static const uint8_t MAX_CHANNELS = 4;
+
+    uint32_t uptime;                // s
+    float offsets[MAX_CHANNELS];    // mV
+};
+
+// Follows the current sensors' zero offset drift (temperature) without pausing
+// the measurement. While every relay feeding a sensor's branch has been off for
+// SETTLE_MS the branch carries no current, so the mean of each power window is
+// the offset error alone; it is averaged into an estimate and the sensor offset
+// follows it in whole ADC units. A branch that still shows current with its
+// relays off is not learned from. The applied offsets are sampled every
+// HISTORY_INTERVAL_MS for diagnostics, with a least-squares drift rate.
+// addWindow() runs on the control task; readers on other tasks check their
+// copy with readBegin()/readValid() (sequence lock) instead of locking it.
+class OffsetTracker {
+public:
+    static const uint8_t MAX_CHANNELS = OffsetPoint::MAX_CHANNELS;
+    static const uint8_t HISTORY_SIZE = 96;                 // 24 h
+    static const uint32_t HISTORY_INTERVAL_MS = 900000;     // 15 min
+    static const uint32_t SETTLE_MS = 2000;                 // After a relay opens
+    static constexpr float LEARN_RATE = 0.05;               // Per idle window (~4 s time constant)
+    static constexpr float IDLE_CURRENT = 0.02;             // A; above it the branch is not idle
+
+private:
+    struct Channel {
+        CurrentSensor* sensor;
+        uint8_t relays;             // OffsetRelay bits
+        bool idle;
+        uint32_t idleSinceMs;
+        bool hasEstimate;
+        float estimate;             // ADC units
+        float startOffset;          // mV, first applied offset seen
+        uint32_t idleWindows;
+        uint32_t corrections;
+    };
+
+    Channel channels[MAX_CHANNELS];
+    uint8_t count;
+
+    OffsetPoint history[HISTORY_SIZE];
+    uint8_t historyHead;            // Next slot
+    uint8_t historyCount;
+    uint32_t lastHistoryMs;
+    std::atomic<uint32_t> version;  // Odd while addWindow() runs
+
+    void record(uint32_t nowMs) {
+        OffsetPoint& point = history[historyHead];
+        point.uptime = nowMs / 1000;
+        for (uint8_t i = 0; i < MAX_CHANNELS; i++) {
+            point.offsets[i] = i < count ? channels[i].sensor->getOffset() : 0;
+        }
+        historyHead = (historyHead + 1) % HISTORY_SIZE;
+        if (historyCount < HISTORY_SIZE) historyCount++;
+        lastHistoryMs = nowMs;
+    }
+
+public:
+    OffsetTracker()
+        : count(0),
+          historyHead(0),
+          historyCount(0),
+          lastHistoryMs(0),
+          version(0) {}
+
+    // Register a sensor and the relays of the branch it measures
+    void addChannel(CurrentSensor& sensor, uint8_t relays) {
+        if (count >= MAX_CHANNELS) return;
+        Channel& c = channels[count++];
+        c.sensor = &sensor;
+        c.relays = relays;
+        c.idle = false;
+        c.idleSinceMs = 0;
+        c.hasEstimate = false;
+        c.estimate = 0;
+        c.startOffset = 0;
+        c.idleWindows = 0;
+        c.corrections = 0;
+    }
+
+    // Call after every completed power window with the relays now on (OffsetRelay bits)
+    void addWindow(uint8_t relaysOn, uint32_t nowMs) {
+        uint32_t v = version.load(std::memory_order_relaxed);
+        version.store(v + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        bool calibrated = count > 0;
+        for (uint8_t i = 0; i < count; i++) {
+            Channel& c = channels[i];
+            if (!c.sensor->isCalibrated()) {
+                calibrated = false;
+                continue;
+            }
+            if (c.startOffset == 0) c.startOffset = c.sensor->getOffset();
+
+            if (relaysOn & c.relays) {
+                c.idle = false;
+                continue;
+            }
+            if (!c.idle) {
+                c.idle = true;
+                c.idleSinceMs = nowMs;
+            }
+            if (nowMs - c.idleSinceMs < SETTLE_MS || c.sensor->getCurrent() > IDLE_CURRENT) continue;
+
+            // Offset the window would have needed to have zero mean
+            float measured = c.sensor->getOffsetUnits() + c.sensor->getWindowMean();
+            if (!c.hasEstimate) {
+                c.estimate = measured;
+                c.hasEstimate = true;
+            } else {
+                c.estimate += LEARN_RATE * (measured - c.estimate);
+            }
+            c.idleWindows++;
+
+            int32_t units = (int32_t)lroundf(c.estimate);
+            if (units != c.sensor->getOffsetUnits()) {
+                c.sensor->setOffset(units);
+                c.corrections++;
+            }
+        }
+
+        if (calibrated && (historyCount == 0 || nowMs - lastHistoryMs >= HISTORY_INTERVAL_MS)) {
+            record(nowMs);
+        }
+        version.store(v + 2, std::memory_order_release);
+    }
+
+    // What is read between readBegin() and a true readValid(before) comes from
+    // one state between two addWindow() calls
+    uint32_t readBegin() const {
+        return version.load(std::memory_order_acquire);
+    }
+
+    bool readValid(uint32_t before) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return (before & 1) == 0 && version.load(std::memory_order_relaxed) == before;
+    }
+
+    uint8_t getChannelCount() const {
+        return count;
+    }
+
+    const CurrentSensor& getSensor(uint8_t channel) const {
+        return *channels[channel].sensor;
+    }
+
+    // Relays off and settled: the offset is being learned
+    bool isIdle(uint8_t channel, uint32_t nowMs) const {
+        const Channel& c = channels[channel];
+        return c.idle && nowMs - c.idleSinceMs >= SETTLE_MS;
+    }
+
+    uint32_t getIdleWindows(uint8_t channel) const {
+        return channels[channel].idleWindows;
+    }
+
+    // Times the applied offset moved
+    uint32_t getCorrections(uint8_t channel) const {
+        return channels[channel].corrections;
+    }
+
+    // Applied offset change since tracking began (mV)
+    float getDrift(uint8_t channel) const {
+        const Channel& c = channels[channel];
+        return c.startOffset != 0 ? c.sensor->getOffset() - c.startOffset : 0;
+    }
+
+    // Least-squares slope of the offset history (mV/h), 0 with fewer than two points
+    float getDriftRate(uint8_t channel) const {
+        if (historyCount < 2) return 0;
+        const OffsetPoint& first = getHistory(0);
+        double sumT = 0, sumV = 0, sumTT = 0, sumTV = 0;
+        for (uint8_t i = 0; i < historyCount; i++) {
+            const OffsetPoint& p = getHistory(i);
+            double t = (p.uptime - first.uptime) / 3600.0;
+            double v = p.offsets[channel];
+            sumT += t;
+            sumV += v;
+            sumTT += t * t;
+            sumTV += t * v;
+        }
+        double d = historyCount * sumTT - sumT * sumT;
+        return d > 0 ? (float)((historyCount * sumTV - sumT * sumV) / d) : 0;
+    }
+
+    uint8_t getHistoryCount() const {
+        return historyCount;
+    }
+
+    // History point, oldest first
+    const OffsetPoint& getHistory(uint8_t index) const {
+        uint8_t oldest = historyCount < HISTORY_SIZE ? 0 : historyHead;
+        return history[(oldest + index) % HISTORY_SIZE];
+    }
+};
+
+#endif // OFFSET_TRACKER_H
@@ -0,0 +1,321 @@
+#ifndef POWER_METER_H
+#define POWER_METER_H
+
+#include <Arduino.h>
+#include "AdcSampler.h"
+#include "current.h"
+#include "Voltage.h"
+#include "ZeroCrossDetector.h"
+#include "HarmonicAnalyzer.h"
+
+// Power figures of one load over the last completed window
+struct PowerReading {
+    float voltage;        // V rms
+    float current;        // A rms
+    float realPower;      // W, negative when power flows back to the grid
+    float apparentPower;  // VA
+    float reactivePower;  // var (magnitude)
+    float powerFactor;    // 0..1 (|real| / apparent)
+};
+
+// Drives the measurement windows for the voltage and all current channels.
+// Every channel sees exactly the same samples per window, and per-sample
+// V x I products give true real power instead of Vrms x Irms.
+// Windows end on rising zero crossings of the voltage, so each one spans a
+// whole number of mains cycles (no partial-cycle ripple in the RMS values).
+class PowerMeter {
+public:
+    static const uint8_t MAX_LOADS = 3;
+
+private:
+    VoltageSensor& voltage;
+    CurrentSensor* loads[MAX_LOADS];
+    int8_t polarity[MAX_LOADS];       // +1, or -1 for a sensor fitted against the import direction
+    uint8_t loadCount;
+
+    static constexpr float NOMINAL_FREQUENCY = 50.0;
+    static constexpr float MIN_FREQUENCY = 40.0;
+
+    ZeroCrossDetector zeroCross;
+    bool aligned;                     // Open window started on a zero crossing
+    uint8_t windowCycles;             // Mains cycles per window
+    uint8_t openCycles;               // Cycles completed in the open window
+    float openPeriodSum;              // Measured length of those cycles (samples)
+    uint8_t openPeriodCount;
+    float frequency;                  // Hz, 0 when no mains is detected
+    uint32_t windowSamples;           // Samples accumulated in the open window
+    int64_t crossSum[MAX_LOADS];      // Sum of v * i (ADC units) in the open window
+    PowerReading readings[MAX_LOADS];
+    uint32_t windowsCompleted;
+    uint32_t lastWindowSamples;       // Length of the last completed window
+    uint32_t lastSampleRate;
+
+    // Optional harmonic analysis on the same sample stream
+    bool harmonicsEnabled;
+    bool harmonicsStarted;
+    GoertzelBank voltageHarmonics;
+    GoertzelBank loadHarmonics[MAX_LOADS];
+
+    void startHarmonics(uint32_t sampleRate) {
+        float fundamental = frequency > 0 ? frequency : NOMINAL_FREQUENCY;
+        voltageHarmonics.start(fundamental, sampleRate);
+        for (uint8_t k = 0; k < loadCount; k++) {
+            loadHarmonics[k].start(fundamental, sampleRate);
+        }
+        harmonicsStarted = true;
+    }
+
+    void accumulateHarmonics(const AdcFrame& frame, int8_t voltageChannel,
+                             const int8_t* loadChannels, uint16_t from, uint16_t to) {
+        const uint16_t* vRaw = frame.raw[voltageChannel];
+        for (uint16_t i = from; i < to; i++) {
+            voltageHarmonics.add(voltage.toSample(vRaw[i]));
+        }
+        for (uint8_t k = 0; k < loadCount; k++) {
+            if (loadChannels[k] < 0) continue;
+            const uint16_t* iRaw = frame.raw[loadChannels[k]];
+            const CurrentSensor& load = *loads[k];
+            GoertzelBank& bank = loadHarmonics[k];
+            for (uint16_t i = from; i < to; i++) {
+                bank.add(load.toSample(iRaw[i]));
+            }
+        }
+    }
+
+    void accumulateProducts(const AdcFrame& frame, int8_t voltageChannel,
+                            const int8_t* loadChannels, uint16_t from, uint16_t to) {
+        const uint16_t* vRaw = frame.raw[voltageChannel];
+        for (uint8_t k = 0; k < loadCount; k++) {
+            if (loadChannels[k] < 0) continue;
+            const uint16_t* iRaw = frame.raw[loadChannels[k]];
+            const CurrentSensor& load = *loads[k];
+
+            int64_t sum = 0;
+            for (uint16_t i = from; i < to; i++) {
+                sum += (int64_t)voltage.toSample(vRaw[i]) * load.toSample(iRaw[i]);
+            }
+            crossSum[k] += sum;
+        }
+    }
+
+    void closeWindow(uint32_t sampleRate) {
+        frequency = (openPeriodCount > 0 && openPeriodSum > 0)
+                  ? sampleRate * openPeriodCount / openPeriodSum
+                  : 0;
+        openCycles = 0;
+        openPeriodSum = 0;
+        openPeriodCount = 0;
+
+        uint32_t voltageSamples = voltage.closeWindow();
+        float vrms = voltage.getRmsVoltage();
+
+        for (uint8_t k = 0; k < loadCount; k++) {
+            uint32_t loadSamples = loads[k]->closeWindow();
+            PowerReading& r = readings[k];
+
+            r.voltage = vrms;
+            r.current = loads[k]->getCurrent();
+            r.apparentPower = vrms * r.current;
+
+            // Signed PF from the window covariance; scale-free, so the ADC units cancel out.
+            // Only valid when both channels accumulated the whole window.
+            float pf = 0;
+            if (loadSamples == windowSamples && voltageSamples == windowSamples && r.current > 0) {
+                double covariance = (double)crossSum[k] / windowSamples
+                                  - (double)voltage.getWindowMean() * loads[k]->getWindowMean();
+                double denominator = (double)voltage.getWindowSigma() * loads[k]->getWindowSigma();
+                if (denominator > 0) {
+                    pf = polarity[k] * covariance / denominator;
+                    if (pf > 1) pf = 1;
+                    if (pf < -1) pf = -1;
+                }
+            }
+
+            r.powerFactor = fabsf(pf);
+            r.realPower = r.apparentPower * pf;
+            float q2 = r.apparentPower * r.apparentPower - r.realPower * r.realPower;
+            r.reactivePower = q2 > 0 ? sqrtf(q2) : 0;
+
+            crossSum[k] = 0;
+        }
+
+        if (harmonicsEnabled) {
+            voltageHarmonics.finish();
+            for (uint8_t k = 0; k < loadCount; k++) {
+                loadHarmonics[k].finish();
+            }
+            startHarmonics(sampleRate);
+        }
+
+        lastWindowSamples = windowSamples;
+        lastSampleRate = sampleRate;
+        windowSamples = 0;
+        windowsCompleted++;
+    }
+
+public:
+    PowerMeter(VoltageSensor& voltageSensor)
+        : voltage(voltageSensor),
+          loadCount(0),
+          aligned(false),
+          windowCycles(10),  // 200 ms at 50Hz
+          openCycles(0),
+          openPeriodSum(0),
+          openPeriodCount(0),
+          frequency(0),
+          windowSamples(0),
+          windowsCompleted(0),
+          lastWindowSamples(0),
+          lastSampleRate(0),
+          harmonicsEnabled(false),
+          harmonicsStarted(false) {
+        for (uint8_t k = 0; k < MAX_LOADS; k++) {
+            loads[k] = nullptr;
+            polarity[k] = 1;
+            crossSum[k] = 0;
+            readings[k] = {0, 0, 0, 0, 0, 0};
+        }
+    }
+
+    // Register a current channel; returns its load index (or -1 if full).
+    // sensorPolarity is -1 if the sensor is fitted so that import reads negative.
+    int8_t addLoad(CurrentSensor& sensor, int8_t sensorPolarity = 1) {
+        if (loadCount >= MAX_LOADS) return -1;
+        loads[loadCount] = &sensor;
+        polarity[loadCount] = sensorPolarity < 0 ? -1 : 1;
+        return loadCount++;
+    }
+
+    void setPolarity(uint8_t load, int8_t sensorPolarity) {
+        if (load < MAX_LOADS) polarity[load] = sensorPolarity < 0 ? -1 : 1;
+    }
+
+    // Polarity a sensor was registered with (+1 if it is not a load)
+    int8_t getPolarity(const CurrentSensor& sensor) const {
+        for (uint8_t k = 0; k < loadCount; k++) {
+            if (loads[k] == &sensor) return polarity[k];
+        }
+        return 1;
+    }
+
+    // Consume one completed frame from the sampler
+    void consume(const AdcFrame& frame) {
+        int8_t voltageChannel = frame.channelOf(voltage.getPin());
+        if (voltageChannel < 0) return;
+
+        int8_t loadChannels[MAX_LOADS];
+        for (uint8_t k = 0; k < loadCount; k++) {
+            loadChannels[k] = frame.channelOf(loads[k]->getPin());
+        }
+
+        // Without mains on the voltage channel, fall back to time-based windows
+        zeroCross.setSampleRate(frame.sampleRate);
+        uint32_t maxWindowSamples = (uint32_t)(windowCycles * frame.sampleRate / MIN_FREQUENCY);
+        if (harmonicsEnabled && !harmonicsStarted) {
+            startHarmonics(frame.sampleRate);
+        }
+
+        uint16_t start = 0;
+        uint16_t scan = 0;
+        while (start < AdcFrame::SAMPLES) {
+            int32_t crossing = scan < AdcFrame::SAMPLES
+                             ? zeroCross.next(frame.raw[voltageChannel], scan, AdcFrame::SAMPLES)
+                             : -1;
+            uint16_t end = crossing >= 0 ? (uint16_t)crossing : AdcFrame::SAMPLES;
+            scan = crossing >= 0 ? crossing + 1 : AdcFrame::SAMPLES;
+
+            uint32_t room = maxWindowSamples - windowSamples;
+            bool timedOut = (uint32_t)(end - start) >= room;
+            if (timedOut) {
+                end = start + room;
+                crossing = -1;
+            }
+
+            voltage.consume(frame, start, end);
+            for (uint8_t k = 0; k < loadCount; k++) {
+                loads[k]->consume(frame, start, end);
+            }
+            accumulateProducts(frame, voltageChannel, loadChannels, start, end);
+            if (harmonicsEnabled) {
+                accumulateHarmonics(frame, voltageChannel, loadChannels, start, end);
+            }
+            windowSamples += end - start;
+            start = end;
+
+            if (crossing >= 0) {
+                if (!aligned) {
+                    // First crossing: close the unaligned partial window, start cycle counting
+                    aligned = true;
+                    if (windowSamples > 0) {
+                        openPeriodCount = 0;
+                        closeWindow(frame.sampleRate);
+                    }
+                    continue;
+                }
+
+                float period = zeroCross.getLastPeriod();
+                if (period > 0) {
+                    openPeriodSum += period;
+                    openPeriodCount++;
+                }
+                if (++openCycles >= windowCycles) {
+                    closeWindow(frame.sampleRate);
+                }
+            } else if (timedOut) {
+                aligned = false;
+                openPeriodCount = 0;
+                closeWindow(frame.sampleRate);
+            }
+        }
+    }
+
+    // Readings of the last completed window for a load index
+    const PowerReading& getReading(uint8_t load) const {
+        return readings[load < loadCount ? load : 0];
+    }
+
+    // Set window length in whole mains cycles
+    void setWindowCycles(uint8_t cycles) {
+        windowCycles = cycles > 0 ? cycles : 1;
+    }
+
+    // Enable the Goertzel harmonic bank (fundamental + odd harmonics to the 11th)
+    void setHarmonicsEnabled(bool enabled) {
+        harmonicsEnabled = enabled;
+        harmonicsStarted = false;
+    }
+
+    bool isHarmonicsEnabled() const {
+        return harmonicsEnabled;
+    }
+
+    // Harmonics of the last completed window
+    const HarmonicReading& getVoltageHarmonics() const {
+        return voltageHarmonics.getReading();
+    }
+
+    const HarmonicReading& getLoadHarmonics(uint8_t load) const {
+        return loadHarmonics[load < loadCount ? load : 0].getReading();
+    }
+
+    // Mains frequency measured over the last window (Hz, 0 without mains)
+    float getFrequency() const {
+        return frequency;
+    }
+
+    // Number of windows completed so far (changes whenever new readings are ready)
+    uint32_t getWindowCount() const {
+        return windowsCompleted;
+    }
+
+    // Duration of the last completed window as samples at getWindowSampleRate()
+    uint32_t getWindowSamples() const {
+        return lastWindowSamples;
+    }
+
+    uint32_t getWindowSampleRate() const {
+        return lastSampleRate;
+    }
+};
+
+#endif // POWER_METER_H
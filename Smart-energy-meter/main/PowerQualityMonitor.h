@@ -0,0 +1,365 @@
+#ifndef POWER_QUALITY_MONITOR_H
+#define POWER_QUALITY_MONITOR_H
+
+#include <Arduino.h>
+#include <stdlib.h>
+#include <atomic>
+#include "AdcSampler.h"
+#include "current.h"
+#include "Voltage.h"
+#include "PowerMeter.h"
+
+#ifdef ARDUINO
+#include <esp_heap_caps.h>
+#endif
+
+enum PqEventType : uint8_t {
+    PQ_NONE = 0,
+    PQ_SAG,
+    PQ_SWELL,
+    PQ_INTERRUPTION,
+    PQ_INRUSH
+};
+
+// One captured event: raw waveform rows around the trigger (all sampled channels)
+struct PqEvent {
+    static const uint16_t PRE_ROWS = 400;    // 4 cycles at 50Hz before the trigger
+    static const uint16_t POST_ROWS = 600;   // 6 cycles after
+    static const uint16_t ROWS = PRE_ROWS + POST_ROWS;
+
+    uint32_t id;
+    uint32_t timestamp;       // millis() at trigger
+    PqEventType type;
+    uint8_t channel;          // 0 = voltage, 1.. = load index + 1
+    float triggerValue;       // Half-cycle RMS that fired the trigger (V or A)
+    float extremeValue;       // Worst half-cycle RMS during the post-trigger window
+    uint32_t sampleRate;      // Stored row rate (Hz)
+    uint8_t channels;
+    uint8_t pins[AdcFrame::MAX_CHANNELS];
+    uint16_t (*rows)[AdcFrame::MAX_CHANNELS];
+
+    static const char* typeName(PqEventType type) {
+        switch (type) {
+            case PQ_SAG: return "sag";
+            case PQ_SWELL: return "swell";
+            case PQ_INTERRUPTION: return "interruption";
+            case PQ_INRUSH: return "inrush";
+            default: return "none";
+        }
+    }
+};
+
+// Power-quality trigger and waveform capture.
+// Keeps a ring of the last ~10 cycles of raw samples (decimated to 5 kHz) and
+// evaluates a one-cycle RMS every half cycle per channel. When voltage leaves its
+// bands or a load current exceeds the inrush threshold, the pre-trigger ring plus
+// a post-trigger window is frozen into an event slot. Slots are handed to the
+// uploader lock-free, so the capture path never waits on the network.
+class PowerQualityMonitor {
+public:
+    struct Thresholds {
+        float nominalVoltage;     // V rms
+        float sagLevel;           // Fraction of nominal
+        float swellLevel;
+        float interruptionLevel;
+        float inrushCurrent;      // A rms
+    };
+
+    static const uint16_t RING_ROWS = 1024;
+    static const uint8_t STORE_DECIMATION = 4;
+    static const uint8_t EVENT_SLOTS = 2;
+
+private:
+    enum SlotState : uint8_t { FREE, WRITING, READY, READING };
+
+    VoltageSensor& voltage;
+    PowerMeter& meter;
+    CurrentSensor* loads[PowerMeter::MAX_LOADS];
+    uint8_t loadCount;
+    Thresholds thresholds;
+
+    // Raw ring (decimated rows)
+    uint16_t (*ring)[AdcFrame::MAX_CHANNELS];
+    uint16_t ringHead;
+    uint32_t rowsStored;
+    uint32_t decimationSum[AdcFrame::MAX_CHANNELS];
+    uint8_t decimationCount;
+
+    // Half-cycle RMS state; index 0 = voltage, 1.. = loads
+    static const uint8_t MONITORED = PowerMeter::MAX_LOADS + 1;
+    uint64_t halfSquares[MONITORED];
+    uint64_t previousHalfSquares[MONITORED];
+    uint32_t halfCount;
+    uint32_t previousHalfCount;
+    PqEventType condition[MONITORED];
+
+    // Capture in progress
+    bool capturing;
+    uint16_t postRemaining;
+    PqEvent pending;
+
+    PqEvent events[EVENT_SLOTS];
+    std::atomic<uint8_t> slotState[EVENT_SLOTS];
+    uint32_t nextEventId;
+    std::atomic<uint32_t> eventsCaptured;
+    std::atomic<uint32_t> eventsDropped;
+
+    static void* allocate(size_t bytes) {
+#ifdef ARDUINO
+        void* p = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (p != nullptr) return p;
+#endif
+        return malloc(bytes);
+    }
+
+    PqEventType classifyVoltage(float volts) const {
+        float nominal = thresholds.nominalVoltage;
+        if (volts < nominal * thresholds.interruptionLevel) return PQ_INTERRUPTION;
+        if (volts < nominal * thresholds.sagLevel) return PQ_SAG;
+        if (volts > nominal * thresholds.swellLevel) return PQ_SWELL;
+        return PQ_NONE;
+    }
+
+    void trigger(PqEventType type, uint8_t channel, float value) {
+        if (capturing || rowsStored < PqEvent::PRE_ROWS) return;
+        capturing = true;
+        postRemaining = PqEvent::POST_ROWS;
+        pending.type = type;
+        pending.channel = channel;
+        pending.triggerValue = value;
+        pending.extremeValue = value;
+        pending.timestamp = millis();
+    }
+
+    void trackExtreme(uint8_t channel, float value) {
+        if (!capturing || channel != pending.channel) return;
+        bool lower = pending.type == PQ_SAG || pending.type == PQ_INTERRUPTION;
+        if (lower ? value < pending.extremeValue : value > pending.extremeValue) {
+            pending.extremeValue = value;
+        }
+    }
+
+    // Evaluate the one-cycle RMS (two half cycles) of every channel
+    void closeHalfCycle() {
+        uint32_t samples = halfCount + previousHalfCount;
+        if (samples > 0 && previousHalfCount > 0) {
+            for (uint8_t c = 0; c < 1 + loadCount; c++) {
+                float rmsUnits = sqrtf((float)((double)(halfSquares[c] + previousHalfSquares[c]) / samples));
+                PqEventType type;
+                float value;
+                if (c == 0) {
+                    value = rmsUnits * voltage.getVoltsPerCount();
+                    type = classifyVoltage(value);
+                } else if (!loads[c - 1]->isCalibrated()) {
+                    value = 0;
+                    type = PQ_NONE;
+                } else {
+                    value = loads[c - 1]->rmsToCurrent(rmsUnits);
+                    type = (thresholds.inrushCurrent > 0 && value > thresholds.inrushCurrent) ? PQ_INRUSH : PQ_NONE;
+                }
+
+                if (type != PQ_NONE && type != condition[c]) {
+                    trigger(type, c, value);
+                }
+                condition[c] = type;
+                trackExtreme(c, value);
+            }
+        }
+
+        for (uint8_t c = 0; c < MONITORED; c++) {
+            previousHalfSquares[c] = halfSquares[c];
+            halfSquares[c] = 0;
+        }
+        previousHalfCount = halfCount;
+        halfCount = 0;
+    }
+
+    void storeRow(const uint32_t* sums, uint8_t channels) {
+        for (uint8_t c = 0; c < channels; c++) {
+            ring[ringHead][c] = (uint16_t)(sums[c] / STORE_DECIMATION);
+        }
+        ringHead = (ringHead + 1) % RING_ROWS;
+        rowsStored++;
+
+        if (capturing && --postRemaining == 0) {
+            freeze();
+        }
+    }
+
+    // Copy the ring window around the trigger into a free event slot
+    void freeze() {
+        capturing = false;
+
+        for (uint8_t i = 0; i < EVENT_SLOTS; i++) {
+            uint8_t expected = FREE;
+            if (!slotState[i].compare_exchange_strong(expected, WRITING)) continue;
+
+            PqEvent& event = events[i];
+            uint16_t (*rows)[AdcFrame::MAX_CHANNELS] = event.rows;
+            event = pending;
+            event.rows = rows;
+            event.id = nextEventId++;
+
+            uint16_t start = (ringHead + RING_ROWS - PqEvent::ROWS) % RING_ROWS;
+            for (uint16_t r = 0; r < PqEvent::ROWS; r++) {
+                memcpy(event.rows[r], ring[(start + r) % RING_ROWS], sizeof(event.rows[r]));
+            }
+
+            slotState[i].store(READY, std::memory_order_release);
+            eventsCaptured++;
+            return;
+        }
+        eventsDropped++;
+    }
+
+public:
+    PowerQualityMonitor(VoltageSensor& voltageSensor, PowerMeter& powerMeter)
+        : voltage(voltageSensor),
+          meter(powerMeter),
+          loadCount(0),
+          ring(nullptr),
+          ringHead(0),
+          rowsStored(0),
+          decimationCount(0),
+          halfCount(0),
+          previousHalfCount(0),
+          capturing(false),
+          postRemaining(0),
+          nextEventId(1),
+          eventsCaptured(0),
+          eventsDropped(0) {
+        thresholds = {230.0, 0.90, 1.10, 0.10, 5.0};
+        for (uint8_t c = 0; c < AdcFrame::MAX_CHANNELS; c++) {
+            decimationSum[c] = 0;
+        }
+        for (uint8_t c = 0; c < MONITORED; c++) {
+            halfSquares[c] = 0;
+            previousHalfSquares[c] = 0;
+            condition[c] = PQ_NONE;
+        }
+        for (uint8_t i = 0; i < EVENT_SLOTS; i++) {
+            events[i].rows = nullptr;
+            slotState[i].store(FREE);
+        }
+        pending = PqEvent();
+    }
+
+    int8_t addLoad(CurrentSensor& sensor) {
+        if (loadCount >= PowerMeter::MAX_LOADS) return -1;
+        loads[loadCount] = &sensor;
+        return loadCount++;
+    }
+
+    // Allocate the ring and event buffers (PSRAM when available)
+    bool begin() {
+        if (ring != nullptr) return true;
+        const size_t rowBytes = sizeof(uint16_t) * AdcFrame::MAX_CHANNELS;
+
+        bool allocated = true;
+        for (uint8_t i = 0; i < EVENT_SLOTS; i++) {
+            events[i].rows = (uint16_t (*)[AdcFrame::MAX_CHANNELS])allocate(PqEvent::ROWS * rowBytes);
+            allocated = allocated && events[i].rows != nullptr;
+        }
+        if (allocated) {
+            ring = (uint16_t (*)[AdcFrame::MAX_CHANNELS])allocate(RING_ROWS * rowBytes);
+        }
+        if (ring == nullptr) {
+            Serial.println("❌ Power quality monitor: buffer allocation failed");
+            return false;
+        }
+
+        Serial.println("📉 Power quality monitor initialized");
+        return true;
+    }
+
+    void setThresholds(const Thresholds& t) {
+        thresholds = t;
+    }
+
+    const Thresholds& getThresholds() const {
+        return thresholds;
+    }
+
+    // Consume one completed frame from the sampler (same context as PowerMeter)
+    void consume(const AdcFrame& frame) {
+        if (ring == nullptr) return;
+
+        int8_t channelIndex[MONITORED];
+        channelIndex[0] = frame.channelOf(voltage.getPin());
+        if (channelIndex[0] < 0) return;
+        for (uint8_t k = 0; k < loadCount; k++) {
+            channelIndex[k + 1] = frame.channelOf(loads[k]->getPin());
+        }
+
+        float frequency = meter.getFrequency();
+        uint32_t halfLength = (uint32_t)(frame.sampleRate / (2.0f * (frequency > 0 ? frequency : 50.0f)));
+
+        // Remove the DC level measured in the last window
+        int32_t dc[MONITORED];
+        dc[0] = (int32_t)voltage.getWindowMean();
+        for (uint8_t k = 0; k < loadCount; k++) {
+            dc[k + 1] = (int32_t)loads[k]->getWindowMean();
+        }
+
+        for (uint16_t i = 0; i < AdcFrame::SAMPLES; i++) {
+            int32_t v = voltage.toSample(frame.raw[channelIndex[0]][i]) - dc[0];
+            halfSquares[0] += (uint64_t)((int64_t)v * v);
+            for (uint8_t k = 0; k < loadCount; k++) {
+                if (channelIndex[k + 1] < 0) continue;
+                int32_t a = loads[k]->toSample(frame.raw[channelIndex[k + 1]][i]) - dc[k + 1];
+                halfSquares[k + 1] += (uint64_t)((int64_t)a * a);
+            }
+            if (++halfCount >= halfLength) {
+                closeHalfCycle();
+            }
+
+            for (uint8_t c = 0; c < frame.channels; c++) {
+                decimationSum[c] += frame.raw[c][i];
+            }
+            if (++decimationCount == STORE_DECIMATION) {
+                storeRow(decimationSum, frame.channels);
+                for (uint8_t c = 0; c < AdcFrame::MAX_CHANNELS; c++) {
+                    decimationSum[c] = 0;
+                }
+                decimationCount = 0;
+            }
+        }
+
+        pending.sampleRate = frame.sampleRate / STORE_DECIMATION;
+        pending.channels = frame.channels;
+        for (uint8_t c = 0; c < frame.channels; c++) {
+            pending.pins[c] = frame.pins[c];
+        }
+    }
+
+    // Oldest captured event waiting for upload, or nullptr. Must be released.
+    const PqEvent* acquireEvent() {
+        const PqEvent* oldest = nullptr;
+        uint8_t oldestSlot = 0;
+        for (uint8_t i = 0; i < EVENT_SLOTS; i++) {
+            if (slotState[i].load(std::memory_order_acquire) != READY) continue;
+            if (oldest == nullptr || events[i].id < oldest->id) {
+                oldest = &events[i];
+                oldestSlot = i;
+            }
+        }
+        if (oldest == nullptr) return nullptr;
+
+        uint8_t expected = READY;
+        return slotState[oldestSlot].compare_exchange_strong(expected, READING) ? oldest : nullptr;
+    }
+
+    void releaseEvent(const PqEvent* event) {
+        for (uint8_t i = 0; i < EVENT_SLOTS; i++) {
+            if (event == &events[i]) {
+                slotState[i].store(FREE, std::memory_order_release);
+            }
+        }
+    }
+
+    bool isCapturing() const { return capturing; }
+    uint32_t getEventsCaptured() const { return eventsCaptured.load(); }
+    uint32_t getEventsDropped() const { return eventsDropped.load(); }
+};
+
+#endif // POWER_QUALITY_MONITOR_H
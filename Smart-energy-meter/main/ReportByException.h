@@ -0,0 +1,136 @@
+#ifndef REPORT_BY_EXCEPTION_H
+#define REPORT_BY_EXCEPTION_H
+
+#include <stdint.h>
+#include <math.h>
+
+// Channels watched by the report-by-exception filter
+enum ReportChannel {
+    REPORT_VOLTAGE = 0,
+    REPORT_FREQUENCY,
+    REPORT_CURRENT1,
+    REPORT_CURRENT2,
+    REPORT_CURRENT3,
+    REPORT_POWER1,
+    REPORT_POWER2,
+    REPORT_CHANNELS
+};
+
+// A channel is reported once it moves more than max(absolute, relative * |last reported|)
+struct ReportDeadband {
+    float absolute;
+    float relative;
+};
+
+// Why a reading was (or was not) reported
+enum ReportReason {
+    REPORT_SUPPRESS = 0,
+    REPORT_FIRST = 0x01,
+    REPORT_DEADBAND = 0x02,
+    REPORT_STATE = 0x04,        // Relay or theft state changed (send at once)
+    REPORT_HEARTBEAT = 0x08     // Max silence expired
+};
+
+// Report-by-exception filter for telemetry captures.
+// A capture is reported only if a channel left its deadband around the last
+// reported value, the relay/theft state changed, or nothing was reported for
+// maxSilenceMs. Comparing against the last reported value (not the previous
+// capture) means slow drifts are reported too. Energy registers are cumulative,
+// so every reported reading reconciles exactly however many are skipped.
+class ExceptionReporter {
+private:
+    bool enabled;
+    ReportDeadband deadbands[REPORT_CHANNELS];
+    unsigned long maxSilenceMs;
+
+    bool hasReport;
+    float reported[REPORT_CHANNELS];
+    uint8_t reportedState;
+    unsigned long lastReport;
+
+    uint32_t reports;
+    uint32_t suppressed;
+
+public:
+    ExceptionReporter()
+        : enabled(false),
+          maxSilenceMs(300000),
+          hasReport(false),
+          reportedState(0),
+          lastReport(0),
+          reports(0),
+          suppressed(0) {
+        // Defaults: well above the noise of one 200 ms power window
+        deadbands[REPORT_VOLTAGE] = {2.0, 0.01};
+        deadbands[REPORT_FREQUENCY] = {0.05, 0};
+        deadbands[REPORT_CURRENT1] = {0.05, 0.05};
+        deadbands[REPORT_CURRENT2] = {0.05, 0.05};
+        deadbands[REPORT_CURRENT3] = {0.05, 0.05};
+        deadbands[REPORT_POWER1] = {10.0, 0.05};
+        deadbands[REPORT_POWER2] = {10.0, 0.05};
+        for (uint8_t c = 0; c < REPORT_CHANNELS; c++) reported[c] = 0;
+    }
+
+    // Disabled, every capture is reported
+    void setEnabled(bool on) {
+        enabled = on;
+    }
+
+    bool isEnabled() const {
+        return enabled;
+    }
+
+    void setDeadband(ReportChannel channel, float absolute, float relative) {
+        if (channel < REPORT_CHANNELS) deadbands[channel] = {absolute, relative};
+    }
+
+    void setMaxSilence(unsigned long ms) {
+        maxSilenceMs = ms;
+    }
+
+    // Reasons to report this capture (REPORT_SUPPRESS = skip it)
+    uint8_t check(const float values[REPORT_CHANNELS], uint8_t state, unsigned long now) const {
+        if (!enabled || !hasReport) return REPORT_FIRST;
+
+        uint8_t reason = REPORT_SUPPRESS;
+        if (state != reportedState) reason |= REPORT_STATE;
+        if (now - lastReport >= maxSilenceMs) reason |= REPORT_HEARTBEAT;
+        for (uint8_t c = 0; c < REPORT_CHANNELS; c++) {
+            float band = deadbands[c].relative * fabsf(reported[c]);
+            if (band < deadbands[c].absolute) band = deadbands[c].absolute;
+            if (fabsf(values[c] - reported[c]) > band) {
+                reason |= REPORT_DEADBAND;
+                break;
+            }
+        }
+        return reason;
+    }
+
+    // Only the state part changed since the last report?
+    bool stateChanged(uint8_t state) const {
+        return enabled && hasReport && state != reportedState;
+    }
+
+    // Record a reported capture (or count a suppressed one)
+    void update(uint8_t reason, const float values[REPORT_CHANNELS], uint8_t state, unsigned long now) {
+        if (reason == REPORT_SUPPRESS) {
+            suppressed++;
+            return;
+        }
+        for (uint8_t c = 0; c < REPORT_CHANNELS; c++) reported[c] = values[c];
+        reportedState = state;
+        lastReport = now;
+        hasReport = true;
+        reports++;
+    }
+
+    uint32_t getReportCount() const {
+        return reports;
+    }
+
+    uint32_t getSuppressedCount() const {
+        return suppressed;
+    }
+};
+
+#endif // REPORT_BY_EXCEPTION_H
@@ -0,0 +1,104 @@
+#ifndef RMS_KERNEL_H
+#define RMS_KERNEL_H
+
+#include <stdint.h>
+#include <math.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <esp_adc/adc_cali.h>
+#include <esp_adc/adc_cali_scheme.h>
+#endif
+
+// Integer window statistics over offset-corrected ADC values.
+// Per sample: one subtract, one multiply, two adds. Float math happens once per window.
+struct RmsAccumulator {
+    int64_t sum;
+    uint64_t sumSquares;
+    uint32_t count;
+
+    RmsAccumulator() : sum(0), sumSquares(0), count(0) {}
+
+    void reset() {
+        sum = 0;
+        sumSquares = 0;
+        count = 0;
+    }
+
+    inline void add(int32_t value) {
+        sum += value;
+        sumSquares += (uint64_t)((int64_t)value * value);
+        count++;
+    }
+
+    float mean() const {
+        return count ? (float)((double)sum / count) : 0.0f;
+    }
+
+    // Mean square about zero (offset already removed by the caller)
+    float meanSquare() const {
+        return count ? (float)((double)sumSquares / count) : 0.0f;
+    }
+
+    // Standard deviation (AC RMS with any residual DC removed)
+    float sigma() const {
+        if (count == 0) return 0.0f;
+        double m = (double)sum / count;
+        double variance = (double)sumSquares / count - m * m;
+        return variance > 0 ? (float)sqrt(variance) : 0.0f;
+    }
+};
+
+// Optional raw-count -> mV table (4096 entries, 8 KB) built once at boot.
+// On the ESP32 it folds in the eFuse line-fitting calibration, correcting
+// the ADC's gain/offset error for free in the per-sample path.
+class AdcLinearization {
+private:
+    static const uint16_t ENTRIES = 4096;
+    uint16_t millivolts[ENTRIES];
+    bool ready;
+
+public:
+    AdcLinearization() : ready(false) {}
+
+    // Build the table; falls back to the ideal linear transfer if no calibration is available
+    bool begin(float adcRefMv = 3300.0, uint16_t adcMax = 4095) {
+        bool calibratedScheme = false;
+
+#if defined(ARDUINO) && ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
+        adc_cali_handle_t handle = nullptr;
+        adc_cali_line_fitting_config_t config = {};
+        config.unit_id = ADC_UNIT_1;
+        config.atten = ADC_ATTEN_DB_12;
+        config.bitwidth = ADC_BITWIDTH_12;
+        if (adc_cali_create_scheme_line_fitting(&config, &handle) == ESP_OK) {
+            for (uint16_t raw = 0; raw < ENTRIES; raw++) {
+                int mv = 0;
+                adc_cali_raw_to_voltage(handle, raw, &mv);
+                millivolts[raw] = (uint16_t)mv;
+            }
+            adc_cali_delete_scheme_line_fitting(handle);
+            calibratedScheme = true;
+        }
+#endif
+
+        if (!calibratedScheme) {
+            for (uint16_t raw = 0; raw < ENTRIES; raw++) {
+                millivolts[raw] = (uint16_t)(raw * adcRefMv / adcMax + 0.5f);
+            }
+        }
+
+        ready = true;
+        return calibratedScheme;
+    }
+
+    inline uint16_t toMillivolts(uint16_t raw) const {
+        return millivolts[raw & (ENTRIES - 1)];
+    }
+
+    bool isReady() const {
+        return ready;
+    }
+};
+
+#endif // RMS_KERNEL_H
@@ -0,0 +1,496 @@
+#ifndef ROLLUP_STORE_H
+#define ROLLUP_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include "FlashPartition.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#endif
+
+enum RollupTier : uint8_t {
+    ROLLUP_SECOND = 0,    // RAM ring (writing 1 s buckets to flash would wear it out in years)
+    ROLLUP_MINUTE = 1,    // Flash
+    ROLLUP_QUARTER = 2,   // Flash, 15 minutes
+    ROLLUP_TIERS = 3
+};
+
+// Channels summarized in every bucket
+enum RollupChannel : uint8_t {
+    ROLLUP_VOLTAGE = 0,   // V rms
+    ROLLUP_CURRENT1,      // A rms
+    ROLLUP_CURRENT2,
+    ROLLUP_CURRENT3,      // Main
+    ROLLUP_POWER1,        // W real
+    ROLLUP_POWER2,
+    ROLLUP_CHANNELS
+};
+
+// One bucket of one tier; fixed 64 bytes so 64 records fill a flash sector.
+// Statistics are fixed point: 0.1 V, 1 mA and 0.25 W per count.
+struct RollupRecord {
+    static const uint16_t MAGIC = 0x5552;  // "RU"
+    static const uint8_t FLAG_SYNCED = 0x01;  // start is Unix time (else seconds since boot)
+
+    uint16_t magic;
+    uint8_t tier;
+    uint8_t flags;
+    uint32_t sequence;
+    uint32_t start;                        // Bucket start (s)
+    uint16_t windows;                      // Measurement windows merged into the bucket
+    uint16_t reserved;
+    int16_t minimum[ROLLUP_CHANNELS];
+    int16_t maximum[ROLLUP_CHANNELS];
+    int16_t average[ROLLUP_CHANNELS];
+    float energy[2];                       // J per load, from the exact energy registers
+    uint32_t crc;
+
+    static float scale(uint8_t channel) {
+        return channel == ROLLUP_VOLTAGE ? 10.0f : (channel <= ROLLUP_CURRENT3 ? 1000.0f : 4.0f);
+    }
+
+    static int16_t encode(uint8_t channel, float value) {
+        float scaled = value * scale(channel);
+        if (scaled > 32767.0f) return 32767;
+        if (scaled < -32768.0f) return -32768;
+        return (int16_t)(scaled + (scaled >= 0 ? 0.5f : -0.5f));
+    }
+
+    float getMin(uint8_t channel) const { return minimum[channel] / scale(channel); }
+    float getMax(uint8_t channel) const { return maximum[channel] / scale(channel); }
+    float getAverage(uint8_t channel) const { return average[channel] / scale(channel); }
+
+    uint32_t checksum() const {
+        return flashCrc32(this, offsetof(RollupRecord, crc));
+    }
+
+    bool isValid(uint8_t expectedTier) const {
+        return magic == MAGIC && tier == expectedTier && crc == checksum();
+    }
+};
+
+static_assert(sizeof(RollupRecord) == 64, "RollupRecord must stay 64 bytes");
+
+// Open bucket being accumulated
+struct RollupBucket {
+    uint32_t start;
+    uint8_t flags;
+    uint32_t windows;
+    float minimum[ROLLUP_CHANNELS];
+    float maximum[ROLLUP_CHANNELS];
+    float sum[ROLLUP_CHANNELS];            // Window-weighted sum of the averages
+    float energy[2];
+
+    void open(uint32_t bucketStart, uint8_t bucketFlags) {
+        start = bucketStart;
+        flags = bucketFlags;
+        windows = 0;
+        for (uint8_t c = 0; c < ROLLUP_CHANNELS; c++) {
+            minimum[c] = 1e30f;
+            maximum[c] = -1e30f;
+            sum[c] = 0;
+        }
+        energy[0] = energy[1] = 0;
+    }
+
+    void add(const float* values) {
+        for (uint8_t c = 0; c < ROLLUP_CHANNELS; c++) {
+            if (values[c] < minimum[c]) minimum[c] = values[c];
+            if (values[c] > maximum[c]) maximum[c] = values[c];
+            sum[c] += values[c];
+        }
+        windows++;
+    }
+
+    // Fold a closed record of the tier below into this bucket
+    void merge(const RollupRecord& record) {
+        for (uint8_t c = 0; c < ROLLUP_CHANNELS; c++) {
+            if (record.getMin(c) < minimum[c]) minimum[c] = record.getMin(c);
+            if (record.getMax(c) > maximum[c]) maximum[c] = record.getMax(c);
+            sum[c] += record.getAverage(c) * record.windows;
+        }
+        windows += record.windows;
+        energy[0] += record.energy[0];
+        energy[1] += record.energy[1];
+    }
+
+    void close(RollupRecord& record, uint8_t tier, uint32_t sequence) const {
+        record.magic = RollupRecord::MAGIC;
+        record.tier = tier;
+        record.flags = flags;
+        record.sequence = sequence;
+        record.start = start;
+        record.windows = windows > 0xFFFF ? 0xFFFF : windows;
+        record.reserved = 0xFFFF;
+        for (uint8_t c = 0; c < ROLLUP_CHANNELS; c++) {
+            record.minimum[c] = RollupRecord::encode(c, minimum[c]);
+            record.maximum[c] = RollupRecord::encode(c, maximum[c]);
+            record.average[c] = RollupRecord::encode(c, sum[c] / windows);
+        }
+        record.energy[0] = energy[0];
+        record.energy[1] = energy[1];
+        record.crc = record.checksum();
+    }
+};
+
+// Ring of RollupRecords over a range of flash sectors, erased one sector ahead of the head
+class RollupFlashRing {
+public:
+    static const uint32_t SLOTS_PER_SECTOR = FlashPartition::SECTOR_SIZE / sizeof(RollupRecord);
+
+private:
+    FlashPartition* flash;
+    uint8_t tier;
+    uint32_t firstSector;
+    uint32_t sectors;
+    uint32_t headSector;     // Relative to firstSector
+    uint32_t headSlot;
+    uint32_t sequence;       // Of the newest record
+
+    uint32_t offsetOf(uint32_t sector, uint32_t slot) const {
+        return (firstSector + sector) * FlashPartition::SECTOR_SIZE + slot * sizeof(RollupRecord);
+    }
+
+public:
+    RollupFlashRing()
+        : flash(nullptr), tier(0), firstSector(0), sectors(0), headSector(0), headSlot(0), sequence(0) {}
+
+    // Scan the sectors for the newest record and resume after it
+    bool begin(FlashPartition& partition, uint8_t ringTier, uint32_t first, uint32_t count) {
+        flash = &partition;
+        tier = ringTier;
+        firstSector = first;
+        sectors = count;
+        headSector = 0;
+        headSlot = 0;
+        sequence = 0;
+        if (sectors < 2) return false;
+
+        bool found = false;
+        for (uint32_t sector = 0; sector < sectors; sector++) {
+            for (uint32_t slot = 0; slot < SLOTS_PER_SECTOR; slot++) {
+                RollupRecord record;
+                if (!flash->read(offsetOf(sector, slot), &record, sizeof(record))) return false;
+                if (!record.isValid(tier)) continue;
+                if (!found || (int32_t)(record.sequence - sequence) > 0) {
+                    found = true;
+                    sequence = record.sequence;
+                    headSector = sector;
+                    headSlot = slot + 1;
+                }
+            }
+        }
+        if (!found) {
+            headSlot = 0;
+            return flash->eraseSector(firstSector);
+        }
+        return true;
+    }
+
+    uint32_t nextSequence() const {
+        return sequence + 1;
+    }
+
+    bool append(const RollupRecord& record) {
+        if (flash == nullptr) return false;
+        for (;;) {
+            if (headSlot >= SLOTS_PER_SECTOR) {
+                headSector = (headSector + 1) % sectors;
+                headSlot = 0;
+                if (!flash->eraseSector(firstSector + headSector)) return false;
+            }
+            // Never program a slot twice (one may be dirty after a power cut)
+            uint32_t first;
+            if (!flash->read(offsetOf(headSector, headSlot), &first, sizeof(first))) return false;
+            if (first == 0xFFFFFFFF) break;
+            headSlot++;
+        }
+        uint32_t offset = offsetOf(headSector, headSlot++);
+        if (!flash->write(offset, &record, sizeof(record))) return false;
+        sequence = record.sequence;
+        return true;
+    }
+
+    uint32_t capacity() const {
+        return sectors * SLOTS_PER_SECTOR;
+    }
+
+    // Slot by age: 0 is the oldest slot (first one after the head sector)
+    uint32_t offsetByAge(uint32_t position) const {
+        uint32_t sector = (headSector + 1 + position / SLOTS_PER_SECTOR) % sectors;
+        return offsetOf(sector, position % SLOTS_PER_SECTOR);
+    }
+};
+
+class RollupStore;
+
+// Iterates the records of one tier whose bucket start lies in [from, to), oldest first,
+// from a binary-searched first position to the first record past the range.
+// Records are returned in place (mapped flash or RAM); without a mapping one record at a time
+// is copied into the cursor.
+class RollupCursor {
+private:
+    const RollupStore* store;
+    uint8_t tier;
+    uint32_t from;
+    uint32_t to;
+    uint32_t position;
+    bool done;
+    RollupRecord buffer;
+
+    friend class RollupStore;
+
+public:
+    RollupCursor() : store(nullptr), tier(0), from(0), to(0), position(0), done(true) {}
+
+    // Next record in range, looking at no more than maxScan slots. nullptr at the
+    // end of the range or when the slots ran out first; isDone() tells which.
+    const RollupRecord* next(uint32_t maxScan = 0xFFFFFFFF);
+
+    bool isDone() const {
+        return done;
+    }
+
+    // Age position of the next slot to look at
+    uint32_t getPosition() const {
+        return position;
+    }
+};
+
+// Tiered 1 s / 1 min / 15 min rollups of the measurement windows.
+// Windows are folded into the open 1 s bucket; a closed bucket is merged into
+// the next tier up, so min/max/avg and energy stay exact across tiers.
+class RollupStore {
+public:
+    static const uint16_t SECOND_RECORDS = 300;   // 5 minutes of 1 s buckets in RAM
+
+private:
+    static uint32_t tierSeconds(uint8_t tier) {
+        return tier == ROLLUP_SECOND ? 1 : (tier == ROLLUP_MINUTE ? 60 : 900);
+    }
+
+    FlashPartition& flash;
+    const uint8_t* mapped;
+    RollupFlashRing rings[ROLLUP_TIERS];          // [ROLLUP_MINUTE], [ROLLUP_QUARTER]
+    bool flashReady;
+
+    RollupRecord* seconds;
+    uint16_t secondsHead;                         // Next write index
+    uint16_t secondsCount;
+    uint32_t secondsSequence;
+
+    RollupBucket open[ROLLUP_TIERS];
+    bool isOpen[ROLLUP_TIERS];
+    uint64_t energyAtStart[2];                    // Energy registers before the 1 s bucket's first window (mJ)
+    uint32_t recordsWritten;
+
+    static void* allocate(size_t bytes) {
+#ifdef ARDUINO
+        void* p = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (p != nullptr) return p;
+#endif
+        return malloc(bytes);
+    }
+
+    void store(uint8_t tier, const RollupRecord& record) {
+        if (tier == ROLLUP_SECOND) {
+            seconds[secondsHead] = record;
+            secondsHead = (secondsHead + 1) % SECOND_RECORDS;
+            if (secondsCount < SECOND_RECORDS) secondsCount++;
+            secondsSequence = record.sequence;
+        } else if (flashReady) {
+            rings[tier].append(record);
+        }
+        recordsWritten++;
+    }
+
+    uint32_t nextSequence(uint8_t tier) const {
+        return tier == ROLLUP_SECOND ? secondsSequence + 1 : rings[tier].nextSequence();
+    }
+
+    // Close the bucket of a tier and merge it upwards
+    void closeTier(uint8_t tier) {
+        if (!isOpen[tier]) return;
+        isOpen[tier] = false;
+        if (open[tier].windows == 0) return;
+
+        RollupRecord record;
+        open[tier].close(record, tier, nextSequence(tier));
+        store(tier, record);
+
+        uint8_t upper = tier + 1;
+        if (upper < ROLLUP_TIERS) {
+            uint32_t upperStart = record.start - record.start % tierSeconds(upper);
+            if (isOpen[upper] && (open[upper].start != upperStart || open[upper].flags != record.flags)) {
+                closeTier(upper);
+            }
+            if (!isOpen[upper]) {
+                open[upper].open(upperStart, record.flags);
+                isOpen[upper] = true;
+            }
+            open[upper].merge(record);
+        }
+    }
+
+public:
+    RollupStore(FlashPartition& partition)
+        : flash(partition),
+          mapped(nullptr),
+          flashReady(false),
+          seconds(nullptr),
+          secondsHead(0),
+          secondsCount(0),
+          secondsSequence(0),
+          recordsWritten(0) {
+        for (uint8_t t = 0; t < ROLLUP_TIERS; t++) {
+            isOpen[t] = false;
+        }
+        energyAtStart[0] = energyAtStart[1] = 0;
+    }
+
+    // Allocate the 1 s ring and replay the flash tiers (3/4 of the sectors for minutes)
+    bool begin() {
+        if (seconds == nullptr) {
+            seconds = (RollupRecord*)allocate(SECOND_RECORDS * sizeof(RollupRecord));
+            if (seconds == nullptr) return false;
+        }
+
+        flashReady = false;
+        if (flash.begin() && flash.sectorCount() >= 4) {
+            uint32_t minuteSectors = flash.sectorCount() * 3 / 4;
+            flashReady = rings[ROLLUP_MINUTE].begin(flash, ROLLUP_MINUTE, 0, minuteSectors) &&
+                         rings[ROLLUP_QUARTER].begin(flash, ROLLUP_QUARTER, minuteSectors,
+                                                     flash.sectorCount() - minuteSectors);
+            mapped = flash.map();
+        }
+        return flashReady;
+    }
+
+    // Add one completed measurement window. values[] is indexed by RollupChannel,
+    // energy registers are the exact per-load counters (mJ) before this window was
+    // integrated, now is the current time (s). A bucket's energy is then exactly
+    // that of its own windows.
+    void addWindow(const float* values, uint64_t energyL1, uint64_t energyL2, uint32_t now, bool synced) {
+        if (seconds == nullptr) return;
+        uint8_t flags = synced ? RollupRecord::FLAG_SYNCED : 0;
+
+        RollupBucket& second = open[ROLLUP_SECOND];
+        if (isOpen[ROLLUP_SECOND] && (second.start != now || second.flags != flags)) {
+            second.energy[0] = (energyL1 - energyAtStart[0]) / 1000.0f;
+            second.energy[1] = (energyL2 - energyAtStart[1]) / 1000.0f;
+            closeTier(ROLLUP_SECOND);
+        }
+        if (!isOpen[ROLLUP_SECOND]) {
+            second.open(now, flags);
+            isOpen[ROLLUP_SECOND] = true;
+            energyAtStart[0] = energyL1;
+            energyAtStart[1] = energyL2;
+        }
+        second.add(values);
+
+        // Close upper buckets as soon as their period is over, not only when the next one fills
+        for (uint8_t t = ROLLUP_MINUTE; t < ROLLUP_TIERS; t++) {
+            if (isOpen[t] && (now - open[t].start >= tierSeconds(t) || open[t].flags != flags)) {
+                closeTier(t);
+            }
+        }
+    }
+
+    // Records of a tier with bucket start in [from, to)
+    RollupCursor query(RollupTier tier, uint32_t from, uint32_t to) const {
+        RollupCursor cursor;
+        cursor.store = this;
+        cursor.tier = tier;
+        cursor.from = from;
+        cursor.to = to;
+        cursor.position = firstAtOrAfter(tier, from);
+        cursor.done = false;
+        return cursor;
+    }
+
+    // First age position of a tier whose record starts at or after `from`, by
+    // binary search: records are written in time order. An invalid slot is
+    // stepped over to the next valid one within a sector; a sector's worth of
+    // them is the unwritten (oldest) end of the ring, anything up to the upper
+    // bound the unwritten tail of the head sector. Starts only rise within one
+    // clock (Unix time, or seconds since one boot); across a reboot before the
+    // time sync the search may start late or the cursor stop early.
+    uint32_t firstAtOrAfter(uint8_t tier, uint32_t from) const {
+        RollupRecord buffer;
+        uint32_t low = 0;
+        uint32_t high = capacity(tier);
+        while (low < high) {
+            uint32_t middle = low + (high - low) / 2;
+            uint32_t probe = middle;
+            const RollupRecord* record = nullptr;
+            while (probe < high && probe - middle < RollupFlashRing::SLOTS_PER_SECTOR &&
+                   (record = recordAt(tier, probe, buffer)) == nullptr) {
+                probe++;
+            }
+            if (record == nullptr) {
+                if (probe >= high) high = middle;
+                else low = probe;
+            } else if (record->start < from) {
+                low = probe + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low;
+    }
+
+    // Record at an age position of a tier (0 = oldest), or nullptr for an empty or invalid slot
+    const RollupRecord* recordAt(uint8_t tier, uint32_t position, RollupRecord& buffer) const {
+        if (tier == ROLLUP_SECOND) {
+            if (position >= secondsCount) return nullptr;
+            uint16_t oldest = (secondsHead + SECOND_RECORDS - secondsCount) % SECOND_RECORDS;
+            return &seconds[(oldest + position) % SECOND_RECORDS];
+        }
+        if (!flashReady || tier >= ROLLUP_TIERS || position >= rings[tier].capacity()) return nullptr;
+
+        uint32_t offset = rings[tier].offsetByAge(position);
+        const RollupRecord* record;
+        if (mapped != nullptr) {
+            record = (const RollupRecord*)(mapped + offset);
+        } else {
+            if (!flash.read(offset, &buffer, sizeof(buffer))) return nullptr;
+            record = &buffer;
+        }
+        return record->isValid(tier) ? record : nullptr;
+    }
+
+    // Number of age positions of a tier
+    uint32_t capacity(uint8_t tier) const {
+        if (tier == ROLLUP_SECOND) return secondsCount;
+        return flashReady && tier < ROLLUP_TIERS ? rings[tier].capacity() : 0;
+    }
+
+    bool isFlashReady() const {
+        return flashReady;
+    }
+
+    uint32_t getRecordsWritten() const {
+        return recordsWritten;
+    }
+};
+
+inline const RollupRecord* RollupCursor::next(uint32_t maxScan) {
+    if (store == nullptr || done) return nullptr;
+    uint32_t limit = store->capacity(tier);
+    for (uint32_t scanned = 0; position < limit; scanned++) {
+        if (scanned >= maxScan) return nullptr;
+        const RollupRecord* record = store->recordAt(tier, position++, buffer);
+        if (record == nullptr || record->start < from) continue;
+        if (record->start >= to) break;     // Time ordered: nothing later is in range
+        return record;
+    }
+    position = limit;
+    done = true;
+    return nullptr;
+}
+
+#endif // ROLLUP_STORE_H
@@ -0,0 +1,242 @@
+#ifndef TELEMETRY_CODEC_H
+#define TELEMETRY_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include "TelemetryQueue.h"
+
+// Minimal MessagePack writer into a fixed buffer (no heap). Overflow is sticky:
+// once a write does not fit, ok() stays false and the buffer content is unusable.
+class MsgPackWriter {
+private:
+    uint8_t* buffer;
+    size_t capacity;
+    size_t position;
+    bool fits;
+
+    void put(uint8_t byte) {
+        if (position < capacity) {
+            buffer[position++] = byte;
+        } else {
+            fits = false;
+        }
+    }
+
+    void putBig(uint64_t value, uint8_t bytes) {
+        for (int8_t shift = (bytes - 1) * 8; shift >= 0; shift -= 8) {
+            put((uint8_t)(value >> shift));
+        }
+    }
+
+public:
+    MsgPackWriter(uint8_t* out, size_t size)
+        : buffer(out), capacity(size), position(0), fits(true) {}
+
+    // Smallest encoding of a signed integer
+    void writeInt(int64_t value) {
+        if (value >= 0) {
+            if (value < 128) {
+                put((uint8_t)value);                        // positive fixint
+            } else if (value < 256) {
+                put(0xCC); putBig(value, 1);
+            } else if (value < 65536) {
+                put(0xCD); putBig(value, 2);
+            } else if (value < 4294967296LL) {
+                put(0xCE); putBig(value, 4);
+            } else {
+                put(0xCF); putBig(value, 8);
+            }
+        } else if (value >= -32) {
+            put((uint8_t)(int8_t)value);                    // negative fixint
+        } else if (value >= -128) {
+            put(0xD0); putBig((uint8_t)(int8_t)value, 1);
+        } else if (value >= -32768) {
+            put(0xD1); putBig((uint16_t)(int16_t)value, 2);
+        } else if (value >= -2147483648LL) {
+            put(0xD2); putBig((uint32_t)(int32_t)value, 4);
+        } else {
+            put(0xD3); putBig((uint64_t)value, 8);
+        }
+    }
+
+    void writeMapHeader(uint16_t entries) {
+        if (entries < 16) {
+            put(0x80 | entries);
+        } else {
+            put(0xDE); putBig(entries, 2);
+        }
+    }
+
+    void writeArrayHeader(uint16_t entries) {
+        if (entries < 16) {
+            put(0x90 | entries);
+        } else {
+            put(0xDC); putBig(entries, 2);
+        }
+    }
+
+    // array16 header whose count is filled in later with patchArray16()
+    size_t reserveArray16() {
+        size_t at = position;
+        put(0xDC); put(0); put(0);
+        return at;
+    }
+
+    void patchArray16(size_t at, uint16_t entries) {
+        if (at + 3 <= position) {
+            buffer[at + 1] = (uint8_t)(entries >> 8);
+            buffer[at + 2] = (uint8_t)entries;
+        }
+    }
+
+    size_t size() const {
+        return position;
+    }
+
+    bool ok() const {
+        return fits;
+    }
+
+    // Roll back to an earlier size (e.g. drop a record that did not fit)
+    void truncate(size_t length) {
+        if (length <= position) {
+            position = length;
+            fits = true;
+        }
+    }
+};
+
+// Field IDs of the binary reading format (keep in sync with BINARY_FIELDS in app.py).
+// Every value is a scaled integer; costs and totals are derived by the server.
+enum TelemetryField {
+    TF_SEQUENCE = 0,        // count
+    TF_TIME,                // s: Unix time if TF_FLAGS has FLAG_SYNCED, else age before the upload
+    TF_FLAGS,               // TelemetryRecord flags plus TF_FLAG_NO_TIME
+    TF_VOLTAGE,             // 0.01 V
+    TF_FREQUENCY,           // 0.001 Hz
+    TF_CURRENT1,            // 0.1 mA
+    TF_CURRENT2,
+    TF_CURRENT3,
+    TF_POWER1,              // 0.01 W
+    TF_POWER2,
+    TF_ENERGY_L1,           // mJ (exact register)
+    TF_ENERGY_L2,
+    TF_APPARENT1,           // 0.01 VA
+    TF_APPARENT2,
+    TF_REACTIVE1,           // 0.01 var
+    TF_REACTIVE2,
+    TF_PF1,                 // 0.001
+    TF_PF2,
+    TF_THD_V,               // 0.01 %
+    TF_THD_I1,
+    TF_THD_I2,
+    TF_HARMONICS,           // 15 fields: 3rd..11th of V, I1, I2 in 0.01 %
+    TF_FIELDS = TF_HARMONICS + 15
+};
+
+static const uint8_t TF_FLAG_NO_TIME = 0x80;   // Capture time unknown (unsynced, earlier boot)
+
+// Batch body: {0: version, 1: queue depth, 2: queue dropped, 3: [reading, ...]}.
+// Each reading is a map {field ID: delta} against the previous reading of the
+// batch (the first against zero); the sequence is predicted as previous + 1.
+// Fields whose delta is zero are left out, so a steady load costs a few bytes.
+class TelemetryEncoder {
+public:
+    static const uint8_t VERSION = 2;
+
+private:
+    MsgPackWriter writer;
+    size_t readingsHeader;
+    uint16_t count;
+    int64_t previous[TF_FIELDS];
+
+    static int64_t scaled(float value, float scale) {
+        return (int64_t)llroundf(value * scale);
+    }
+
+    void fields(const TelemetryRecord& record, int32_t age, int64_t* out) const {
+        out[TF_SEQUENCE] = record.sequence;
+        bool synced = (record.flags & TelemetryRecord::FLAG_SYNCED) != 0;
+        out[TF_TIME] = synced ? (int64_t)record.timestamp : (age >= 0 ? age : 0);
+        out[TF_FLAGS] = record.flags | (!synced && age < 0 ? TF_FLAG_NO_TIME : 0);
+        out[TF_VOLTAGE] = scaled(record.voltage, 100.0f);
+        out[TF_FREQUENCY] = scaled(record.frequency, 1000.0f);
+        out[TF_CURRENT1] = scaled(record.current1, 10000.0f);
+        out[TF_CURRENT2] = scaled(record.current2, 10000.0f);
+        out[TF_CURRENT3] = scaled(record.current3, 10000.0f);
+        out[TF_POWER1] = scaled(record.power1, 100.0f);
+        out[TF_POWER2] = scaled(record.power2, 100.0f);
+        out[TF_ENERGY_L1] = (int64_t)record.energyL1;
+        out[TF_ENERGY_L2] = (int64_t)record.energyL2;
+        out[TF_APPARENT1] = scaled(record.apparentPower1, 100.0f);
+        out[TF_APPARENT2] = scaled(record.apparentPower2, 100.0f);
+        out[TF_REACTIVE1] = scaled(record.reactivePower1, 100.0f);
+        out[TF_REACTIVE2] = scaled(record.reactivePower2, 100.0f);
+        out[TF_PF1] = scaled(record.powerFactor1, 1000.0f);
+        out[TF_PF2] = scaled(record.powerFactor2, 1000.0f);
+        for (uint8_t c = 0; c < 3; c++) {
+            out[TF_THD_V + c] = scaled(record.thd[c], 100.0f);
+            for (uint8_t h = 0; h < 5; h++) {
+                out[TF_HARMONICS + c * 5 + h] = record.harmonics[c][h];
+            }
+        }
+    }
+
+public:
+    TelemetryEncoder(uint8_t* buffer, size_t size, uint32_t queueDepth, uint32_t queueDropped)
+        : writer(buffer, size), count(0) {
+        writer.writeMapHeader(4);
+        writer.writeInt(0);
+        writer.writeInt(VERSION);
+        writer.writeInt(1);
+        writer.writeInt(queueDepth);
+        writer.writeInt(2);
+        writer.writeInt(queueDropped);
+        writer.writeInt(3);
+        readingsHeader = writer.reserveArray16();
+        for (uint8_t f = 0; f < TF_FIELDS; f++) previous[f] = 0;
+    }
+
+    // Append one reading; false (and nothing written) if it does not fit
+    bool add(const TelemetryRecord& record, int32_t age) {
+        int64_t current[TF_FIELDS];
+        fields(record, age, current);
+
+        int64_t delta[TF_FIELDS];
+        uint8_t changed = 0;
+        for (uint8_t f = 0; f < TF_FIELDS; f++) {
+            int64_t predicted = previous[f] + (f == TF_SEQUENCE && count > 0 ? 1 : 0);
+            delta[f] = current[f] - predicted;
+            if (delta[f] != 0) changed++;
+        }
+
+        size_t mark = writer.size();
+        writer.writeMapHeader(changed);
+        for (uint8_t f = 0; f < TF_FIELDS; f++) {
+            if (delta[f] == 0) continue;
+            writer.writeInt(f);
+            writer.writeInt(delta[f]);
+        }
+        if (!writer.ok()) {
+            writer.truncate(mark);
+            return false;
+        }
+
+        for (uint8_t f = 0; f < TF_FIELDS; f++) previous[f] = current[f];
+        count++;
+        return true;
+    }
+
+    // Finished body length (0 if not even the header fitted)
+    size_t finish() {
+        writer.patchArray16(readingsHeader, count);
+        return writer.ok() ? writer.size() : 0;
+    }
+
+    uint16_t getCount() const {
+        return count;
+    }
+};
+
+#endif // TELEMETRY_CODEC_H
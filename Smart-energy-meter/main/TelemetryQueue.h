@@ -0,0 +1,381 @@
+#ifndef TELEMETRY_QUEUE_H
+#define TELEMETRY_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <Preferences.h>
+#include "FlashPartition.h"
+
+// One /api/data reading; fixed 128 bytes so 32 records fill a flash sector
+struct TelemetryRecord {
+    static const uint16_t MAGIC = 0x5155;           // "UQ" (layout 2: exact energy registers)
+    static const uint8_t FLAG_SYNCED = 0x01;        // timestamp is Unix time (else seconds since boot)
+    static const uint8_t FLAG_THEFT = 0x02;
+    static const uint8_t FLAG_HARMONICS = 0x04;     // thd/harmonics are valid
+    static const uint8_t FLAG_RELAY1 = 0x08;        // Relay states when the reading was taken
+    static const uint8_t FLAG_RELAY2 = 0x10;
+
+    uint16_t magic;
+    uint8_t flags;
+    uint8_t boot;                 // Boot the record was taken in (low byte)
+    uint32_t sequence;            // Unique across reboots, the server deduplicates on it
+    uint32_t timestamp;
+    float voltage;
+    float frequency;
+    float current1;
+    float current2;
+    float current3;
+    float power1;                 // W real
+    float power2;
+    uint64_t energyL1;            // mJ, exact register (costs are derived by the server)
+    uint64_t energyL2;
+    float apparentPower1;
+    float apparentPower2;
+    float reactivePower1;
+    float reactivePower2;
+    float powerFactor1;
+    float powerFactor2;
+    float thd[3];                 // V, I1, I2 (%)
+    uint16_t harmonics[3][5];     // 3rd..11th, 0.01 % per count
+    uint16_t pending;             // 0xFFFF until delivered; programmed to 0 in flash afterwards
+    uint32_t crc;                 // CRC-32 of the fields before 'pending'
+
+    uint32_t checksum() const {
+        return flashCrc32(this, offsetof(TelemetryRecord, pending));
+    }
+
+    bool isValid() const {
+        return magic == MAGIC && crc == checksum();
+    }
+};
+
+static_assert(sizeof(TelemetryRecord) == 128, "TelemetryRecord must stay 128 bytes");
+
+// Bounded FIFO of readings waiting for the server.
+// While the server keeps up, records wait in a small RAM front. Once that is
+// full the whole backlog moves to a flash ring and new records follow it there
+// until it drains, so a long outage keeps hours of readings and survives reboots.
+// Delivered flash records are marked by programming their 'pending' field to 0
+// (no erase), and begin() rebuilds the backlog from the records still pending.
+// When the ring is full the oldest sector is dropped and counted.
+class TelemetryQueue {
+public:
+    static const uint8_t RAM_RECORDS = 32;
+    static const uint32_t SLOTS_PER_SECTOR = FlashPartition::SECTOR_SIZE / sizeof(TelemetryRecord);
+    static const uint32_t SEQUENCE_BLOCK = 4096;    // Sequence numbers reserved per NVS write
+
+private:
+    FlashPartition& flash;
+    bool flashReady;
+    uint32_t slots;
+
+    // Flash ring positions are slot indices 0..slots-1
+    uint32_t head;                // Oldest pending flash record
+    uint32_t tail;                // Next slot to program
+    uint32_t flashCount;          // Pending records between head and tail
+
+    TelemetryRecord ram[RAM_RECORDS];
+    uint8_t ramHead;
+    uint8_t ramCount;
+
+    Preferences preferences;
+    uint32_t nextSequence;
+    uint32_t sequenceLimit;       // End of the reserved block
+    uint8_t bootId;
+
+    uint32_t dropped;
+    uint32_t spilled;
+    uint32_t delivered;
+
+    uint32_t offsetOf(uint32_t slot) const {
+        return slot * sizeof(TelemetryRecord);
+    }
+
+    bool readSlot(uint32_t slot, TelemetryRecord& record) {
+        return flash.read(offsetOf(slot), &record, sizeof(record));
+    }
+
+    bool isPending(uint32_t slot) {
+        TelemetryRecord record;
+        return readSlot(slot, record) && record.isValid() && record.pending == 0xFFFF;
+    }
+
+    // Move head forward to the next pending record (or to tail)
+    void advanceHead() {
+        while (head != tail && !isPending(head)) {
+            head = (head + 1) % slots;
+        }
+    }
+
+    bool spill(const TelemetryRecord& record) {
+        if (tail % SLOTS_PER_SECTOR == 0) {
+            // Entering a sector: drop whatever is still pending in it, then erase
+            uint32_t sector = tail / SLOTS_PER_SECTOR;
+            for (uint32_t slot = tail; slot < tail + SLOTS_PER_SECTOR; slot++) {
+                if (flashCount > 0 && isPending(slot)) {
+                    flashCount--;
+                    dropped++;
+                }
+            }
+            if (!flash.eraseSector(sector)) return false;
+            if (flashCount > 0 && head / SLOTS_PER_SECTOR == sector) {
+                head = ((sector + 1) * SLOTS_PER_SECTOR) % slots;
+                advanceHead();
+            }
+        }
+        if (!flash.write(offsetOf(tail), &record, sizeof(record))) return false;
+        if (flashCount == 0) head = tail;
+        tail = (tail + 1) % slots;
+        flashCount++;
+        spilled++;
+        return true;
+    }
+
+    // Reserve the next block of sequence numbers, all of them >= minimum
+    void reserveSequences(uint32_t minimum) {
+        uint32_t block = preferences.getUInt("block", 0) + 1;
+        if (block * SEQUENCE_BLOCK < minimum) block = minimum / SEQUENCE_BLOCK + 1;
+        preferences.putUInt("block", block);
+        nextSequence = block * SEQUENCE_BLOCK;
+        sequenceLimit = nextSequence + SEQUENCE_BLOCK;
+    }
+
+public:
+    TelemetryQueue(FlashPartition& partition)
+        : flash(partition),
+          flashReady(false),
+          slots(0),
+          head(0),
+          tail(0),
+          flashCount(0),
+          ramHead(0),
+          ramCount(0),
+          nextSequence(1),
+          sequenceLimit(0),
+          bootId(0),
+          dropped(0),
+          spilled(0),
+          delivered(0) {}
+
+    // Reserve sequence numbers and rebuild the flash backlog
+    bool begin() {
+        preferences.begin("telemetry", false);
+        flashReady = false;
+        if (!flash.begin() || flash.sectorCount() < 2) {
+            reserveSequences(0);
+            bootId = (uint8_t)(nextSequence / SEQUENCE_BLOCK);
+            return false;
+        }
+        slots = flash.sectorCount() * SLOTS_PER_SECTOR;
+
+        // Tail follows the newest valid record; head is the oldest pending one
+        bool any = false, anyPending = false, readable = true;
+        uint32_t newest = 0, oldestPending = 0;
+        flashCount = 0;
+        for (uint32_t slot = 0; slot < slots; slot++) {
+            TelemetryRecord record;
+            if (!readSlot(slot, record)) {
+                readable = false;
+                break;
+            }
+            if (!record.isValid()) continue;
+            if (!any || (int32_t)(record.sequence - newest) > 0) {
+                newest = record.sequence;
+                tail = (slot + 1) % slots;
+                any = true;
+            }
+            if (record.pending == 0xFFFF) {
+                flashCount++;
+                if (!anyPending || (int32_t)(record.sequence - oldestPending) < 0) {
+                    oldestPending = record.sequence;
+                    head = slot;
+                    anyPending = true;
+                }
+            }
+        }
+        if (!any) {
+            tail = 0;
+        } else if (tail % SLOTS_PER_SECTOR != 0) {
+            // Never program into a partly used sector twice: continue in the next one
+            tail = ((tail / SLOTS_PER_SECTOR + 1) * SLOTS_PER_SECTOR) % slots;
+        }
+        if (!anyPending) head = tail;
+        // Sequences must keep growing even if NVS was erased
+        reserveSequences(any ? newest + 1 : 0);
+        bootId = (uint8_t)(nextSequence / SEQUENCE_BLOCK);
+        if (!readable) return false;
+
+        flashReady = true;
+        return true;
+    }
+
+    // Stamp and enqueue a reading (sequence, boot, checksum are filled in here)
+    void push(TelemetryRecord& record) {
+        if (nextSequence >= sequenceLimit) {
+            reserveSequences(nextSequence);
+        }
+        record.magic = TelemetryRecord::MAGIC;
+        record.boot = bootId;
+        record.sequence = nextSequence++;
+        record.pending = 0xFFFF;
+        record.crc = record.checksum();
+
+        if (flashReady && (ramCount == RAM_RECORDS || flashCount > 0)) {
+            // Backlog building up: move the RAM front to flash, then keep writing there
+            // until it drains, so a reboot during an outage loses nothing
+            while (ramCount > 0) {
+                if (!spill(ram[ramHead])) dropped++;
+                ramHead = (ramHead + 1) % RAM_RECORDS;
+                ramCount--;
+            }
+            if (!spill(record)) dropped++;
+            return;
+        }
+        if (ramCount == RAM_RECORDS) {
+            // No flash: drop the oldest
+            ramHead = (ramHead + 1) % RAM_RECORDS;
+            ramCount--;
+            dropped++;
+        }
+        ram[(ramHead + ramCount) % RAM_RECORDS] = record;
+        ramCount++;
+    }
+
+    // Copy up to 'max' of the oldest undelivered records into 'out'; returns the count
+    uint8_t peek(TelemetryRecord* out, uint8_t max) {
+        uint8_t n = 0;
+        if (flashReady && flashCount > 0) {
+            uint32_t slot = head;
+            uint32_t left = flashCount;
+            while (n < max && left > 0) {
+                if (readSlot(slot, out[n]) && out[n].isValid() && out[n].pending == 0xFFFF) {
+                    n++;
+                    left--;
+                }
+                slot = (slot + 1) % slots;
+                if (slot == tail) break;
+            }
+            if (n == 0) {
+                // Backlog lost (e.g. unreadable flash): count it and carry on from RAM
+                dropped += flashCount;
+                flashCount = 0;
+                head = tail;
+            } else if (left > 0) {
+                return n;   // Flash records always go before the RAM front
+            }
+        }
+        for (uint8_t i = 0; n < max && i < ramCount; i++) {
+            out[n++] = ram[(ramHead + i) % RAM_RECORDS];
+        }
+        return n;
+    }
+
+    // The oldest 'count' records returned by peek() reached the server
+    void ack(uint8_t count) {
+        while (count-- > 0) {
+            if (flashReady && flashCount > 0) {
+                uint16_t done = 0;
+                flash.write(offsetOf(head) + offsetof(TelemetryRecord, pending), &done, sizeof(done));
+                flashCount--;
+                head = (head + 1) % slots;
+                advanceHead();
+            } else if (ramCount > 0) {
+                ramHead = (ramHead + 1) % RAM_RECORDS;
+                ramCount--;
+            } else {
+                return;
+            }
+            delivered++;
+        }
+    }
+
+    // Drop delivered records up to and including 'sequence'. Unlike ack(), this
+    // stays right when push() ran (and maybe dropped the oldest) during the upload.
+    void ackThrough(uint32_t sequence) {
+        TelemetryRecord oldest;
+        while (peek(&oldest, 1) == 1 && oldest.sequence <= sequence) {
+            ack(1);
+        }
+    }
+
+    // Age (s) of a record stamped with uptime instead of Unix time; only known
+    // for records of this boot
+    bool ageOf(const TelemetryRecord& record, uint32_t uptimeSeconds, uint32_t& age) const {
+        if ((record.flags & TelemetryRecord::FLAG_SYNCED) || record.boot != bootId) return false;
+        age = uptimeSeconds >= record.timestamp ? uptimeSeconds - record.timestamp : 0;
+        return true;
+    }
+
+    uint32_t depth() const {
+        return flashCount + ramCount;
+    }
+
+    // Records waiting in flash (a backlog the server has not caught up with)
+    uint32_t getFlashDepth() const {
+        return flashCount;
+    }
+
+    uint32_t getDropped() const {
+        return dropped;
+    }
+
+    uint32_t getSpilled() const {
+        return spilled;
+    }
+
+    uint32_t getDelivered() const {
+        return delivered;
+    }
+
+    bool isFlashReady() const {
+        return flashReady;
+    }
+};
+
+// Upload pacing: a fixed drain interval while the server answers, exponential
+// backoff (doubling up to maxBackoff) while it does not.
+class TelemetryDrain {
+private:
+    unsigned long interval;
+    unsigned long minBackoff;
+    unsigned long maxBackoff;
+    unsigned long backoff;
+    unsigned long lastAttempt;
+    unsigned long wait;
+    uint32_t failures;
+
+public:
+    TelemetryDrain(unsigned long drainInterval = 500, unsigned long firstBackoff = 2000,
+                   unsigned long longestBackoff = 300000)
+        : interval(drainInterval),
+          minBackoff(firstBackoff),
+          maxBackoff(longestBackoff),
+          backoff(firstBackoff),
+          lastAttempt(0),
+          wait(0),
+          failures(0) {}
+
+    bool isDue(unsigned long now) const {
+        return now - lastAttempt >= wait;
+    }
+
+    void succeeded(unsigned long now) {
+        lastAttempt = now;
+        wait = interval;
+        backoff = minBackoff;
+    }
+
+    void failed(unsigned long now) {
+        lastAttempt = now;
+        wait = backoff;
+        backoff = backoff * 2 < maxBackoff ? backoff * 2 : maxBackoff;
+        failures++;
+    }
+
+    uint32_t getFailures() const {
+        return failures;
+    }
+};
+
+#endif // TELEMETRY_QUEUE_H
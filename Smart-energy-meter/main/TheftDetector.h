@@ -2,68 +2,272 @@
 #define THEFT_DETECTOR_H
 
 #include <Arduino.h>
+#include <Preferences.h>
+#include <math.h>
+#include <atomic>
+#include "EventLog.h"
+
+// Leakage statistics without theft at one load level
+struct LeakageNoiseBin {
+    float mean;
+    float variance;
+    uint32_t count;
+};
+
+// Detector settings
+struct TheftDetectorConfig {
+    float minLeakage;          // Smallest leakage to detect (A rms)
+    float falseAlarmHours;     // Mean time between false alarms without theft
+    float maxLatencyMs;        // Upper bound on the alarm latency for minLeakage (0 = none)
+};
 
 // Theft Detection System
+// One-sided CUSUM (sequential likelihood-ratio test) on the per-cycle leakage
+// I3 - (I1 + I2). CT gain mismatch and sensor noise grow with the load, so the
+// mean and variance of the leakage without theft are learned online per load
+// level (octave bins of the main current) while the test statistic is low.
+// Until a level's bin has MIN_BIN_CYCLES it is tested against the prior (no
+// leakage), so a bypass present at power-up or appearing with a new load level
+// is still caught. Cycles at or above half of minLeakage over the model mean are
+// never learned. Trained bins are kept in NVS across reboots.
+// Theft is a shift of the mean by at least minLeakage. Noisy cycles near the
+// threshold no longer restart a timer - the evidence accumulates and decays.
 class TheftDetector {
 private:
     static const uint8_t BUZZER_PIN = 15;
-    static const unsigned long DETECTION_DURATION = 15000; // 15 seconds
-    static constexpr float THEFT_THRESHOLD = 0.004; // 0.004A difference threshold
-    
+    static constexpr float NOMINAL_FREQUENCY = 50.0;
+    static constexpr float LEARN_RATE = 0.002;          // EWMA weight (~10 s at 50 Hz)
+    static constexpr float NOISE_FLOOR = 0.0002;        // Minimum sigma (A), ADC quantization
+    static constexpr float MIN_THRESHOLD = 4.6;         // ln(100): never alarm on less evidence
+    static constexpr float LEARN_FRACTION = 0.25;       // Learn only while S < threshold * this
+    static const uint8_t LOAD_BINS = 8;                 // <0.25, 0.5, 1, 2, 4, 8, 16, >16 A
+    static const uint32_t MIN_BIN_CYCLES = 150;         // Bin is trained by 3 s of data
+    static const uint8_t SETTLE_CYCLES = 25;            // Hold the test after a load step
+    static const uint8_t MIN_ALARM_CYCLES = 10;         // Cap on the evidence of one cycle
+    static constexpr float LEARN_LIMIT = 0.5;           // Never learn leakage >= mean + minLeakage * this
+    static const uint32_t PRIOR_VARIANCE_CYCLES = 30;   // Training bin's own variance used from here on
+    static const uint32_t SAVE_CYCLES = 180000;         // Save a changed model at most hourly
+    static const uint8_t MODEL_VERSION = 1;
+
+    TheftDetectorConfig config;
+    float threshold;           // Decision threshold from the false-alarm rate (log-likelihood)
+
+    LeakageNoiseBin bins[LOAD_BINS];
+    float lastLoad;
+
+    // Model persistence: update() hands a copy to saveModel() on a slower task
+    Preferences preferences;
+    bool storageReady;
+    LeakageNoiseBin savedBins[LOAD_BINS];
+    std::atomic<bool> savePending;
+    bool modelChanged;
+    uint32_t lastSaveCycle;
+    uint8_t settleCycles;
+
+    float statistic;           // CUSUM log-likelihood ratio
+    float activeThreshold;     // Threshold used for the last cycle
+    float drift;               // Smoothed increment of the statistic per cycle
+    float cyclePeriodMs;
+    uint32_t cycles;
+
     bool theftDetected;
     bool buzzerActive;
-    unsigned long theftStartTime;
     unsigned long lastBuzzerToggle;
     bool buzzerState;
     bool continuousTheft;
-    
+    float lastLeakage;
+
+    static uint8_t binOf(float loadCurrent) {
+        float edge = 0.25f;
+        uint8_t b = 0;
+        while (b < LOAD_BINS - 1 && loadCurrent >= edge) {
+            edge *= 2.0f;
+            b++;
+        }
+        return b;
+    }
+
+    // Noise model for a load level. Until its bin is trained the mean is the
+    // prior (no leakage); the variance is the prior's, or the bin's own if larger.
+    void modelAt(float loadCurrent, float& mean, float& variance) const {
+        const LeakageNoiseBin& bin = bins[binOf(loadCurrent)];
+        if (bin.count >= MIN_BIN_CYCLES) {
+            mean = bin.mean;
+            variance = bin.variance;
+        } else {
+            mean = 0;
+            variance = config.minLeakage * config.minLeakage / 4.0f;
+            if (bin.count >= PRIOR_VARIANCE_CYCLES) {
+                float own = bin.variance + bin.mean * bin.mean;  // About the prior's zero mean
+                if (own > variance) variance = own;
+            }
+        }
+
+        float floor = NOISE_FLOOR * NOISE_FLOOR;
+        if (variance < floor) variance = floor;
+    }
+
+    void learn(float leakage, float loadCurrent) {
+        LeakageNoiseBin& bin = bins[binOf(loadCurrent)];
+        bin.count++;
+        // Plain average for the first samples, then exponential forgetting
+        float rate = 1.0f / bin.count;
+        if (rate < LEARN_RATE) rate = LEARN_RATE;
+        float e = leakage - bin.mean;
+        bin.mean += rate * e;
+        bin.variance += rate * (e * e - bin.variance);
+
+        // A newly trained level is saved right away, later changes at most hourly
+        if (bin.count >= MIN_BIN_CYCLES) modelChanged = true;
+        if (modelChanged && (bin.count == MIN_BIN_CYCLES || cycles - lastSaveCycle >= SAVE_CYCLES)) {
+            queueSave();
+        }
+    }
+
+    // Hand the trained bins to saveModel(); skipped while the last copy is unsaved
+    void queueSave() {
+        if (!storageReady || savePending.load(std::memory_order_acquire)) return;
+        for (uint8_t b = 0; b < LOAD_BINS; b++) {
+            savedBins[b] = bins[b].count >= MIN_BIN_CYCLES ? bins[b] : LeakageNoiseBin{0, 0, 0};
+        }
+        savePending.store(true, std::memory_order_release);
+        modelChanged = false;
+        lastSaveCycle = cycles;
+    }
+
+    void updateThreshold() {
+        // CUSUM average run length without a change is roughly e^h cycles
+        float runLength = config.falseAlarmHours * 3600.0f * NOMINAL_FREQUENCY;
+        threshold = runLength > 100.0f ? logf(runLength) : MIN_THRESHOLD;
+    }
+
 public:
-    TheftDetector() : theftDetected(false), buzzerActive(false), 
-                      theftStartTime(0), lastBuzzerToggle(0), 
-                      buzzerState(false), continuousTheft(false) {}
-    
+    TheftDetector() : storageReady(false), savePending(false), modelChanged(false),
+                      lastSaveCycle(0), theftDetected(false), buzzerActive(false),
+                      lastBuzzerToggle(0), buzzerState(false),
+                      continuousTheft(false), lastLeakage(0) {
+        config = {0.004, 720, 5000};  // 4 mA, one false alarm per 30 days, 5 s
+        updateThreshold();
+        reset();
+    }
+
+    // Restores the trained bins saved by an earlier boot
     void begin() {
         pinMode(BUZZER_PIN, OUTPUT);
         digitalWrite(BUZZER_PIN, LOW);
+
+        storageReady = preferences.begin("theft", false);
+        uint8_t restored = 0;
+        if (storageReady && preferences.getUChar("version", 0) == MODEL_VERSION &&
+            preferences.getBytesLength("bins") == sizeof(bins)) {
+            LeakageNoiseBin stored[LOAD_BINS];
+            preferences.getBytes("bins", stored, sizeof(stored));
+            for (uint8_t b = 0; b < LOAD_BINS; b++) {
+                if (stored[b].count < MIN_BIN_CYCLES || !(stored[b].variance >= 0)) continue;
+                bins[b] = stored[b];
+                restored++;
+            }
+        }
         Serial.println("🚨 Theft Detection System initialized");
+        if (restored > 0) {
+            LOG_INFO(LOG_MAIN, "Theft model: %u trained load levels restored", restored);
+        }
     }
-    
-    // Check for theft condition
-    bool checkTheft(float mainCurrent, float totalCurrent) {
-        float currentDifference = mainCurrent - totalCurrent;
-        
-        // Check if difference exceeds threshold
-        if (currentDifference > THEFT_THRESHOLD) {
-            if (!continuousTheft) {
-                // Start of potential theft
-                continuousTheft = true;
-                theftStartTime = millis();
-                Serial.println("⚠️ Potential theft detected - monitoring...");
-            } else {
-                // Check if threshold exceeded for full duration
-                if (millis() - theftStartTime >= DETECTION_DURATION) {
-                    if (!theftDetected) {
-                        theftDetected = true;
-                        buzzerActive = true;
-                        Serial.println("🚨 THEFT CONFIRMED! Alert activated!");
-                        Serial.print("   Current Difference: ");
-                        Serial.print(currentDifference, 4);
-                        Serial.println(" A");
-                        return true; // New theft detected
-                    }
-                }
-            }
+
+    // Write the model handed over by update(). Flash work: call from a low-priority task.
+    bool saveModel() {
+        if (!savePending.load(std::memory_order_acquire)) return false;
+        bool saved = preferences.putBytes("bins", savedBins, sizeof(savedBins)) == sizeof(savedBins) &&
+                     preferences.putUChar("version", MODEL_VERSION) > 0;
+        savePending.store(false, std::memory_order_release);
+        return saved;
+    }
+
+    void setConfig(const TheftDetectorConfig& newConfig) {
+        config = newConfig;
+        if (config.minLeakage <= 0) config.minLeakage = 0.004;
+        updateThreshold();
+    }
+
+    const TheftDetectorConfig& getConfig() const {
+        return config;
+    }
+
+    // Forget the learned noise model (the saved one too) and the accumulated evidence
+    void reset() {
+        for (uint8_t b = 0; b < LOAD_BINS; b++) {
+            bins[b] = {0, 0, 0};
+        }
+        modelChanged = storageReady;
+        lastLoad = 0;
+        settleCycles = SETTLE_CYCLES;
+        statistic = 0;
+        activeThreshold = threshold;
+        drift = 0;
+        cyclePeriodMs = 1000.0f / NOMINAL_FREQUENCY;
+        cycles = 0;
+    }
+
+    // Feed one mains cycle: fundamental leakage (A), main load current (A rms)
+    // and mains frequency (Hz, 0 if unknown). Returns true on a new theft alarm.
+    bool update(float leakage, float loadCurrent, float frequency) {
+        lastLeakage = leakage;
+        cyclePeriodMs = 1000.0f / (frequency > 0 ? frequency : NOMINAL_FREQUENCY);
+        cycles++;
+
+        bool trained = bins[binOf(loadCurrent)].count >= MIN_BIN_CYCLES;
+        float mean, variance;
+        modelAt(loadCurrent, mean, variance);
+        float delta = config.minLeakage;
+
+        // A latency bound lowers the threshold when the noise is high
+        activeThreshold = threshold;
+        if (config.maxLatencyMs > 0) {
+            float latencyCycles = config.maxLatencyMs / cyclePeriodMs;
+            float bound = latencyCycles * delta * delta / (2.0f * variance);
+            if (bound < activeThreshold) activeThreshold = bound;
+            if (activeThreshold < MIN_THRESHOLD) activeThreshold = MIN_THRESHOLD;
+        }
+
+        // Load steps bring switching transients and a new noise level: hold the test briefly
+        float step = loadCurrent - lastLoad;
+        if (fabsf(step) > 0.1f + 0.2f * lastLoad) {
+            settleCycles = SETTLE_CYCLES;
+        }
+        lastLoad = loadCurrent;
+
+        if (settleCycles > 0) {
+            settleCycles--;
         } else {
-            // Reset if difference drops below threshold
-            if (continuousTheft && !theftDetected) {
-                continuousTheft = false;
-                Serial.println("✅ False alarm - current normalized");
-            }
+            // Log-likelihood ratio of "mean shifted by delta" against "no shift"
+            // (against the prior while this load level is still training)
+            float increment = delta / variance * (leakage - mean - 0.5f * delta);
+            float maxIncrement = activeThreshold / MIN_ALARM_CYCLES;
+            if (increment > maxIncrement) increment = maxIncrement;
+            statistic += increment;
+            if (statistic < 0) statistic = 0;
+            drift += 0.05f * (increment - drift);
+        }
+
+        // A cycle that already looks like leakage never becomes the baseline
+        bool quiet = leakage - mean < LEARN_LIMIT * delta;
+        if (quiet && (!trained || (statistic < activeThreshold * LEARN_FRACTION && !theftDetected))) {
+            learn(leakage, loadCurrent);
+        }
+
+        continuousTheft = statistic > 0 || theftDetected;
+
+        if (statistic >= activeThreshold && !theftDetected) {
+            theftDetected = true;
+            buzzerActive = true;
+            LOG_ERROR(LOG_MAIN, "🚨 THEFT CONFIRMED! Alert activated! Leakage: %.4f A (baseline %.4f ± %.4f A)",
+                      leakage, mean, sqrtf(variance));
+            return true; // New theft detected
         }
-        
+
         return false;
     }
-    
+
     // Update buzzer (call this in loop)
     void updateBuzzer() {
         if (buzzerActive) {
@@ -78,27 +282,70 @@ public:
             buzzerState = false;
         }
     }
-    
+
     // Reset theft alert (called when relay3 is manually turned on from web)
     void resetAlert() {
         theftDetected = false;
         buzzerActive = false;
         continuousTheft = false;
+        statistic = 0;
         digitalWrite(BUZZER_PIN, LOW);
-        Serial.println("✅ Theft alert cleared by user");
+        LOG_INFO(LOG_MAIN, "✅ Theft alert cleared by user");
     }
-    
+
     // Check if theft is currently detected
     bool isTheftDetected() const {
         return theftDetected;
     }
-    
-    // Get remaining time until theft confirmation (for display)
+
+    // Evidence for theft as a fraction of what the alarm needs (0..1)
+    float getConfidence() const {
+        if (theftDetected) return 1.0f;
+        if (activeThreshold <= 0) return 0;
+        float confidence = statistic / activeThreshold;
+        return confidence < 1.0f ? confidence : 1.0f;
+    }
+
+    float getStatistic() const {
+        return statistic;
+    }
+
+    // Learned leakage without theft at a given load current (A)
+    float getBaseline(float loadCurrent) const {
+        float mean, variance;
+        modelAt(loadCurrent, mean, variance);
+        return mean;
+    }
+
+    float getNoiseSigma(float loadCurrent) const {
+        float mean, variance;
+        modelAt(loadCurrent, mean, variance);
+        return sqrtf(variance);
+    }
+
+    // Expected alarm latency for a leakage of minLeakage at this load (ms)
+    float getExpectedLatency(float loadCurrent) const {
+        float mean, variance;
+        modelAt(loadCurrent, mean, variance);
+        float delta = config.minLeakage;
+        float perCycle = delta * delta / (2.0f * variance);
+        return perCycle > 0 ? activeThreshold / perCycle * cyclePeriodMs : 0;
+    }
+
+    float getLastLeakage() const {
+        return lastLeakage;
+    }
+
+    uint32_t getCycleCount() const {
+        return cycles;
+    }
+
+    // Get remaining time until theft confirmation at the current rate of evidence (for display)
     unsigned long getRemainingTime() const {
-        if (continuousTheft && !theftDetected) {
-            unsigned long elapsed = millis() - theftStartTime;
-            if (elapsed < DETECTION_DURATION) {
-                return (DETECTION_DURATION - elapsed) / 1000; // Return seconds
+        if (continuousTheft && !theftDetected && drift > 0) {
+            float remainingCycles = (activeThreshold - statistic) / drift;
+            if (remainingCycles > 0) {
+                return (unsigned long)(remainingCycles * cyclePeriodMs / 1000.0f); // Return seconds
             }
         }
         return 0;
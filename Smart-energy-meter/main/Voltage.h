@@ -2,64 +2,107 @@
 #define VOLTAGE_H
 
 #include <Arduino.h>
-#include <ZMPT101B.h>
+#include "AdcSampler.h"
+#include "RmsKernel.h"
 
-// Voltage Sensor Class wrapper for ZMPT101B library
+// Voltage Sensor Class for the ZMPT101B module.
+// Same RMS method as the ZMPT101B library (zero point = window mean),
+// computed from sampler frames instead of blocking analogRead() loops.
 class VoltageSensor {
 private:
     // ==================== PRIVATE VARIABLES ====================
+    static constexpr float ADC_SCALE = 4095.0;
+    static const int32_t ADC_MIDSCALE = 2048;
+
     uint8_t sensorPin;
     float vref;
     float sensitivity;
-    ZMPT101B* sensor;
     bool initialized;
 
+    // Per-window integer accumulator (ADC counts about mid-scale)
+    RmsAccumulator acc;
+    float lastRmsCounts;
+    float lastMeanCounts;
+
 public:
     // Constructor
-    VoltageSensor(uint8_t pin, float reference = 3.3, float calibration = 890.0) 
-        : sensorPin(pin), 
+    VoltageSensor(uint8_t pin, float reference = 3.3, float calibration = 890.0)
+        : sensorPin(pin),
           vref(reference),
           sensitivity(calibration),
-          sensor(nullptr),
-          initialized(false) {}
-
-    // Destructor
-    ~VoltageSensor() {
-        if (sensor != nullptr) {
-            delete sensor;
-        }
-    }
+          initialized(false),
+          lastRmsCounts(0),
+          lastMeanCounts(0) {}
 
     // Initialize sensor
     void begin() {
         if (!initialized) {
-            // Create ZMPT101B sensor object
-            sensor = new ZMPT101B(sensorPin, vref);
-            
-            // Set calibration sensitivity
-            sensor->setSensitivity(sensitivity);
-            
+            acc.reset();
             initialized = true;
-            
+
             Serial.print("Voltage Sensor initialized on pin ");
             Serial.println(sensorPin);
         }
     }
 
-    // Get RMS voltage (directly calls library function)
+    // Sample in ADC counts about mid-scale (for cross-channel products)
+    inline int32_t toSample(uint16_t raw) const {
+        return (int32_t)raw - ADC_MIDSCALE;
+    }
+
+    // Accumulate samples [from, to) of one frame into the current window
+    void consume(const AdcFrame& frame, uint16_t from, uint16_t to) {
+        if (!initialized) return;
+        int8_t channel = frame.channelOf(sensorPin);
+        if (channel < 0) return;
+        const uint16_t* raw = frame.raw[channel];
+
+        for (uint16_t i = from; i < to; i++) {
+            acc.add(toSample(raw[i]));
+        }
+    }
+
+    // Latch the statistics of the window just ended and start a new one.
+    // Returns the number of samples the window held.
+    uint32_t closeWindow() {
+        uint32_t samples = acc.count;
+        if (samples > 0) {
+            lastRmsCounts = acc.sigma();
+            lastMeanCounts = acc.mean();
+        }
+        acc.reset();
+        return samples;
+    }
+
+    // Get RMS voltage of the last completed window
     float getRmsVoltage() {
-        if (!initialized || sensor == nullptr) {
+        if (!initialized) {
             return 0.0;
         }
-        return sensor->getRmsVoltage();
+        return lastRmsCounts * getVoltsPerCount();
+    }
+
+    // Scale from ADC counts to volts at the mains side
+    float getVoltsPerCount() const {
+        return vref * sensitivity / ADC_SCALE;
+    }
+
+    // Last window statistics in ADC counts
+    float getWindowSigma() const {
+        return lastRmsCounts;
+    }
+
+    float getWindowMean() const {
+        return lastMeanCounts;
+    }
+
+    uint8_t getPin() const {
+        return sensorPin;
     }
 
     // Set calibration sensitivity
     void setSensitivity(float factor) {
         sensitivity = factor;
-        if (initialized && sensor != nullptr) {
-            sensor->setSensitivity(sensitivity);
-        }
     }
 
     // Get current sensitivity value
@@ -75,7 +118,7 @@ public:
     // Print voltage reading to Serial
     void printVoltage() {
         if (!initialized) return;
-        
+
         float voltage = getRmsVoltage();
         Serial.print("AC RMS Voltage: ");
         Serial.print(voltage);
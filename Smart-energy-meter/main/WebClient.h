@@ -3,123 +3,269 @@
 
 #include <Arduino.h>
 #include <WiFi.h>
-#include <HTTPClient.h>
 #include <ArduinoJson.h>
+#include "PowerMeter.h"
+#include "PowerQualityMonitor.h"
+#include "TelemetryQueue.h"
+#include "TelemetryCodec.h"
+#include "HttpConnection.h"
+#include "EventLog.h"
+#include "Metrics.h"
+
+// Server endpoints with their own request statistics
+enum HttpEndpoint {
+    HTTP_DATA = 0,          // POST /api/data
+    HTTP_RELAY_POLL,        // GET /api/relay/state
+    HTTP_RELAY_POST,        // POST /api/relay/state
+    HTTP_PQ,                // POST /api/pq/event
+    HTTP_THEFT,             // POST /api/theft/alert
+    HTTP_COMMAND_ACK,       // POST /api/commands/ack
+    HTTP_METRICS,           // POST /api/metrics
+    HTTP_ENDPOINTS
+};
+
+// Endpoint label in the metrics
+inline const char* httpEndpointName(uint8_t endpoint) {
+    static const char* const names[HTTP_ENDPOINTS] = {
+        "data", "relay_poll", "relay_post", "pq", "theft", "command_ack", "metrics"
+    };
+    return endpoint < HTTP_ENDPOINTS ? names[endpoint] : "unknown";
+}
+
+// Latency is measured from sending the request to the end of the response
+struct HttpStats {
+    uint32_t requests;
+    uint32_t failures;      // Anything but HTTP 200
+    uint32_t connects;      // Requests that had to open a TCP connection
+    uint32_t stale;         // Kept-alive connections found dead and replaced
+    uint32_t lastMs;
+    uint32_t maxMs;
+    uint32_t totalMs;
+
+    uint32_t averageMs() const {
+        return requests ? totalMs / requests : 0;
+    }
+};
 
 class WebClient {
 private:
     const char* ssid;
     const char* password;
-    String serverUrl;
+    const char* serverUrl;
     bool connected;
     unsigned long lastReconnectAttempt;
-    const unsigned long reconnectInterval = 30000;
-    HTTPClient http;
+    unsigned long reconnectInterval;        // Doubles per failed attempt (5 s .. 60 s)
+    uint32_t wifiConnects;                  // WiFi connections since boot
+    static const unsigned long MIN_RECONNECT_INTERVAL = 5000;
+    static const unsigned long MAX_RECONNECT_INTERVAL = 60000;
+    static const unsigned long FIRST_CONNECT_TIMEOUT = 10000;   // Before the first retry after boot
+    HttpConnection connection;              // One keep-alive connection shared by every endpoint
+    static const uint16_t HTTP_TIMEOUT_MS = 5000;
+    HttpStats httpStats[HTTP_ENDPOINTS];
+
+    // Request bodies are built in these buffers; nothing on the request path uses the heap
+    static const size_t JSON_BUFFER_SIZE = 128;
+    char jsonBuffer[JSON_BUFFER_SIZE];
+
+    static const size_t PQ_BUFFER_SIZE = 3072;      // Power quality chunks and metrics parts
+    char pqBuffer[PQ_BUFFER_SIZE];
+
+    static const size_t BATCH_BUFFER_SIZE = 8192;
+    char batchBuffer[BATCH_BUFFER_SIZE];
+    bool binaryTelemetry;     // MessagePack batches until the server answers 415
+
+    // Send one request over the shared keep-alive connection (POST if body is
+    // set, else GET) and return the HTTP code. A connection the server closed
+    // while idle only shows up as a failed send or read, so a request that
+    // failed that way on a reused connection is retried once on a new one.
+    // The response body stays in connection.body() until the next request.
+    int request(HttpEndpoint endpoint, const char* path, const uint8_t* body = nullptr,
+                size_t length = 0, const char* contentType = nullptr) {
+        METRIC_SCOPE(STAGE_NETWORK);
+        HttpStats& stats = httpStats[endpoint];
+        unsigned long start = millis();
+        int code = HttpConnection::ERROR_CONNECT;
+
+        for (uint8_t attempt = 0; attempt < 2; attempt++) {
+            bool reused = connection.isOpen();
+            if (!reused) stats.connects++;
+
+            code = connection.request(path, body, length, contentType);
+            if (code > 0 || !reused) break;
+
+            // Stale connection: drop it and resend on a fresh one
+            connection.stop();
+            stats.stale++;
+        }
+
+        uint32_t elapsed = millis() - start;
+        stats.requests++;
+        if (code != 200) stats.failures++;
+        stats.lastMs = elapsed;
+        stats.totalMs += elapsed;
+        if (elapsed > stats.maxMs) stats.maxMs = elapsed;
+        return code;
+    }
 
 public:
+    static const uint16_t PQ_CHUNK_ROWS = 100;
+
+    // One reading as a JSON object; returns its length, or 0 if it does not fit.
+    // Public so the host benchmark can compare it with TelemetryEncoder.
+    static int appendReading(char* out, size_t space, const TelemetryRecord& record,
+                             int32_t age, bool comma) {
+        int n = snprintf(out, space, "%s{\"seq\":%lu", comma ? "," : "", (unsigned long)record.sequence);
+        if (record.flags & TelemetryRecord::FLAG_SYNCED) {
+            n += snprintf(out + n, n < (int)space ? space - n : 0, ",\"ts\":%lu", (unsigned long)record.timestamp);
+        } else if (age >= 0) {
+            n += snprintf(out + n, n < (int)space ? space - n : 0, ",\"age_s\":%ld", (long)age);
+        }
+        n += snprintf(out + n, n < (int)space ? space - n : 0,
+            ",\"voltage\":%.2f,\"frequency\":%.3f,\"current1\":%.4f,\"current2\":%.4f,\"current3\":%.4f,"
+            "\"power1\":%.2f,\"power2\":%.2f,\"energy_l1_mj\":%llu,\"energy_l2_mj\":%llu,"
+            "\"theft_detected\":%s,\"relay1\":%s,\"relay2\":%s,"
+            "\"apparent_power1\":%.2f,\"apparent_power2\":%.2f,"
+            "\"reactive_power1\":%.2f,\"reactive_power2\":%.2f,"
+            "\"power_factor1\":%.3f,\"power_factor2\":%.3f",
+            record.voltage, record.frequency, record.current1, record.current2, record.current3,
+            record.power1, record.power2,
+            (unsigned long long)record.energyL1, (unsigned long long)record.energyL2,
+            (record.flags & TelemetryRecord::FLAG_THEFT) ? "true" : "false",
+            (record.flags & TelemetryRecord::FLAG_RELAY1) ? "true" : "false",
+            (record.flags & TelemetryRecord::FLAG_RELAY2) ? "true" : "false",
+            record.apparentPower1, record.apparentPower2,
+            record.reactivePower1, record.reactivePower2,
+            record.powerFactor1, record.powerFactor2);
+
+        // Optional harmonic analysis: THD plus 3rd..11th harmonics in % of fundamental
+        if (record.flags & TelemetryRecord::FLAG_HARMONICS) {
+            static const char* const channels[3] = {"v", "i1", "i2"};
+            for (uint8_t c = 0; c < 3; c++) {
+                const uint16_t* h = record.harmonics[c];
+                n += snprintf(out + n, n < (int)space ? space - n : 0,
+                    ",\"thd_%s\":%.2f,\"harmonics_%s\":[%.2f,%.2f,%.2f,%.2f,%.2f]",
+                    channels[c], record.thd[c], channels[c],
+                    h[0] / 100.0f, h[1] / 100.0f, h[2] / 100.0f, h[3] / 100.0f, h[4] / 100.0f);
+            }
+        }
+        n += snprintf(out + n, n < (int)space ? space - n : 0, "}");
+        return n < (int)space ? n : 0;
+    }
+
     WebClient(const char* wifi_ssid, const char* wifi_password, const char* server_url)
         : ssid(wifi_ssid), 
           password(wifi_password),
           serverUrl(server_url),
           connected(false),
-          lastReconnectAttempt(0) {}
+          lastReconnectAttempt(0),
+          reconnectInterval(MIN_RECONNECT_INTERVAL),
+          wifiConnects(0),
+          binaryTelemetry(true) {
+        memset(httpStats, 0, sizeof(httpStats));
+    }
 
+    // Start connecting and return at once; maintain() reports the connection
+    // (and keeps retrying), so metering runs while WiFi comes up
     void begin() {
         Serial.println("\n========================================");
-        Serial.println("🌐 WebClient: Connecting to WiFi...");
+        Serial.println("🌐 WebClient: Connecting to WiFi in the background...");
         Serial.print("   SSID: ");
         Serial.println(ssid);
         Serial.println("========================================");
         
         WiFi.mode(WIFI_STA);
         WiFi.begin(ssid, password);
-        
-        int attempts = 0;
-        while (WiFi.status() != WL_CONNECTED && attempts < 20) {
-            delay(500);
-            Serial.print(".");
-            attempts++;
+        if (!connection.begin(serverUrl, HTTP_TIMEOUT_MS)) {
+            Serial.println("❌ WebClient: Invalid server URL (expected http://host:port)");
         }
-        Serial.println();
-        
-        if (WiFi.status() == WL_CONNECTED) {
-            connected = true;
-            Serial.println("\n✅ WiFi Connected Successfully!");
-            Serial.print("   IP Address: ");
-            Serial.println(WiFi.localIP());
-            Serial.print("   Signal Strength: ");
-            Serial.print(WiFi.RSSI());
-            Serial.println(" dBm");
-            Serial.print("   Server URL: ");
-            Serial.println(serverUrl);
-        } else {
-            connected = false;
-            Serial.println("\n❌ WiFi Connection Failed!");
-        }
-        Serial.println("========================================\n");
+        connected = false;
+        lastReconnectAttempt = millis();
+        reconnectInterval = FIRST_CONNECT_TIMEOUT;
     }
 
     void maintain() {
         if (WiFi.status() != WL_CONNECTED) {
+            if (connected) connection.stop();   // The kept-alive socket died with the link
             connected = false;
             if (millis() - lastReconnectAttempt >= reconnectInterval) {
                 lastReconnectAttempt = millis();
-                Serial.println("🔄 WebClient: Reconnecting to WiFi...");
+                reconnectInterval = (reconnectInterval * 2 < MAX_RECONNECT_INTERVAL) ?
+                                    reconnectInterval * 2 : MAX_RECONNECT_INTERVAL;
+                LOG_INFO(LOG_NET, "🔄 WebClient: Reconnecting to WiFi...");
                 WiFi.disconnect();
                 WiFi.begin(ssid, password);
             }
         } else if (!connected) {
             connected = true;
-            Serial.println("\n✅ WebClient: WiFi Reconnected!");
-            Serial.print("   IP Address: ");
-            Serial.println(WiFi.localIP());
+            reconnectInterval = MIN_RECONNECT_INTERVAL;
+            IPAddress ip = WiFi.localIP();
+            if (wifiConnects++ == 0) {
+                LOG_INFO(LOG_NET, "✅ WiFi Connected Successfully after %lu ms | Signal Strength: %d dBm | Server URL: %s",
+                         millis(), WiFi.RSSI(), serverUrl);
+            } else {
+                LOG_INFO(LOG_NET, "✅ WebClient: WiFi Reconnected!");
+            }
+            LOG_INFO(LOG_NET, "   IP Address: %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
         }
     }
 
-    // Send complete data including energy and theft status
-    bool sendCompleteData(float voltage, float current1, float current2, float current3,
-                         float totalCurrent, float power1, float power2, float totalPower,
-                         float energyL1, float energyL2, float totalEnergy,
-                         float costL1, float costL2, float totalCost, bool theftDetected) {
-        
-        if (!connected) return false;
+    // JSON batch {"readings":[...]}; returns the body length and how many readings fitted
+    int encodeJson(const TelemetryRecord* records, const int32_t* ages, uint8_t count,
+                   uint32_t queueDepth, uint32_t queueDropped, uint8_t& packed) {
+        int length = snprintf(batchBuffer, BATCH_BUFFER_SIZE,
+            "{\"queue_depth\":%lu,\"queue_dropped\":%lu,\"readings\":[",
+            (unsigned long)queueDepth, (unsigned long)queueDropped);
+        for (packed = 0; packed < count; packed++) {
+            int added = appendReading(batchBuffer + length, BATCH_BUFFER_SIZE - length - 2,
+                                      records[packed], ages[packed], packed > 0);
+            if (added <= 0) break;  // Buffer full: the rest goes in the next batch
+            length += added;
+        }
+        length += snprintf(batchBuffer + length, BATCH_BUFFER_SIZE - length, "]}");
+        return length;
+    }
+
+    // Delta-coded MessagePack batch (see TelemetryCodec.h)
+    int encodeBinary(const TelemetryRecord* records, const int32_t* ages, uint8_t count,
+                     uint32_t queueDepth, uint32_t queueDropped, uint8_t& packed) {
+        TelemetryEncoder encoder((uint8_t*)batchBuffer, BATCH_BUFFER_SIZE, queueDepth, queueDropped);
+        for (packed = 0; packed < count; packed++) {
+            if (!encoder.add(records[packed], ages[packed])) break;
+        }
+        return (int)encoder.finish();
+    }
+
+    // Upload a batch of queued readings in one POST, as MessagePack or JSON.
+    // Each reading carries 'seq' (the server drops duplicates of a retried
+    // upload) and its capture time as 'ts' (Unix) or 'age_s' (ages[i] >= 0).
+    // Returns how many leading readings were delivered (0 unless HTTP 200).
+    uint8_t sendReadings(const TelemetryRecord* records, const int32_t* ages, uint8_t count,
+                         uint32_t queueDepth, uint32_t queueDropped) {
+        if (!connected || count == 0) return 0;
+
+        uint8_t packed = 0;
+        bool binary = binaryTelemetry;
+        int length = binary ? encodeBinary(records, ages, count, queueDepth, queueDropped, packed)
+                            : encodeJson(records, ages, count, queueDepth, queueDropped, packed);
+        if (packed == 0 || length <= 0) return 0;
 
-        StaticJsonDocument<768> doc;
-        doc["voltage"] = voltage;
-        doc["current1"] = current1;
-        doc["current2"] = current2;
-        doc["current3"] = current3;
-        doc["total_current"] = totalCurrent;
-        doc["power1"] = power1;
-        doc["power2"] = power2;
-        doc["total_power"] = totalPower;
-        doc["energy_l1"] = energyL1;
-        doc["energy_l2"] = energyL2;
-        doc["total_energy"] = totalEnergy;
-        doc["cost_l1"] = costL1;
-        doc["cost_l2"] = costL2;
-        doc["total_cost"] = totalCost;
-        doc["theft_detected"] = theftDetected;
-
-        String jsonData;
-        serializeJson(doc, jsonData);
-
-        String endpoint = serverUrl + "/api/data";
-        http.begin(endpoint);
-        http.addHeader("Content-Type", "application/json");
+        int httpResponseCode = request(HTTP_DATA, "/api/data", (const uint8_t*)batchBuffer, length,
+                                       binary ? "application/x-msgpack" : "application/json");
         
-        int httpResponseCode = http.POST(jsonData);
+        if (httpResponseCode == 415 && binary) {
+            // Server without the binary decoder: stay on JSON from now on
+            LOG_INFO(LOG_NET, "ℹ️ Server wants JSON telemetry - switching encoding");
+            binaryTelemetry = false;
+            return sendReadings(records, ages, count, queueDepth, queueDropped);
+        }
         
-        if (httpResponseCode > 0) {
-            Serial.print("✅ Complete data sent | Response: ");
-            Serial.println(httpResponseCode);
-            http.end();
-            return true;
+        if (httpResponseCode == 200) {
+            LOG_DEBUG(LOG_NET, "✅ %u readings sent%s, %d B (#%lu..) | Queue: %u", packed,
+                      binary ? "" : " as JSON", length, records[0].sequence, queueDepth - packed);
+            return packed;
         } else {
-            Serial.print("❌ Failed to send data | Error: ");
-            Serial.println(httpResponseCode);
-            http.end();
-            return false;
+            LOG_WARN(LOG_NET, "❌ Failed to send readings | Response: %d", httpResponseCode);
+            return 0;
         }
     }
 
@@ -129,25 +275,16 @@ public:
         StaticJsonDocument<128> doc;
         doc["relay1"] = relay1State;
         doc["relay2"] = relay2State;
+        size_t length = serializeJson(doc, jsonBuffer, JSON_BUFFER_SIZE);
 
-        String jsonData;
-        serializeJson(doc, jsonData);
-
-        String endpoint = serverUrl + "/api/relay/state";
-        http.begin(endpoint);
-        http.addHeader("Content-Type", "application/json");
-        
-        int httpResponseCode = http.POST(jsonData);
+        int httpResponseCode = request(HTTP_RELAY_POST, "/api/relay/state",
+                                       (const uint8_t*)jsonBuffer, length, "application/json");
         
         if (httpResponseCode == 200) {
-            Serial.print("✅ Relay state posted: R1=");
-            Serial.print(relay1State ? "ON" : "OFF");
-            Serial.print(", R2=");
-            Serial.println(relay2State ? "ON" : "OFF");
-            http.end();
+            LOG_DEBUG(LOG_NET, "✅ Relay state posted: R1=%s, R2=%s",
+                      relay1State ? "ON" : "OFF", relay2State ? "ON" : "OFF");
             return true;
         } else {
-            http.end();
             return false;
         }
     }
@@ -156,17 +293,12 @@ public:
     bool getRelayAndSettings(bool &relay1State, bool &relay2State, bool &relay3State, float &price) {
         if (!connected) return false;
 
-        String endpoint = serverUrl + "/api/relay/state";
-        http.begin(endpoint);
-        http.setTimeout(5000);
-        
-        int httpResponseCode = http.GET();
+        int httpResponseCode = request(HTTP_RELAY_POLL, "/api/relay/state");
         
         if (httpResponseCode == 200) {
-            String payload = http.getString();
-            
+            // Parsed in place: strings in doc point into the response buffer
             StaticJsonDocument<512> doc;
-            DeserializationError error = deserializeJson(doc, payload);
+            DeserializationError error = deserializeJson(doc, connection.body(), connection.bodyLength());
             
             if (!error) {
                 bool newRelay1 = doc["relay1"];
@@ -178,22 +310,19 @@ public:
                 
                 if (newRelay1 != relay1State) {
                     relay1State = newRelay1;
-                    Serial.print("🌐 Web command: Relay 1 → ");
-                    Serial.println(relay1State ? "ON" : "OFF");
+                    LOG_INFO(LOG_NET, "🌐 Web command: Relay 1 → %s", relay1State ? "ON" : "OFF");
                     changed = true;
                 }
                 
                 if (newRelay2 != relay2State) {
                     relay2State = newRelay2;
-                    Serial.print("🌐 Web command: Relay 2 → ");
-                    Serial.println(relay2State ? "ON" : "OFF");
+                    LOG_INFO(LOG_NET, "🌐 Web command: Relay 2 → %s", relay2State ? "ON" : "OFF");
                     changed = true;
                 }
                 
                 if (newRelay3 != relay3State) {
                     relay3State = newRelay3;
-                    Serial.print("🌐 Web command: Relay 3 (Main) → ");
-                    Serial.println(relay3State ? "ON" : "OFF");
+                    LOG_INFO(LOG_NET, "🌐 Web command: Relay 3 (Main) → %s", relay3State ? "ON" : "OFF");
                     changed = true;
                 }
                 
@@ -201,35 +330,133 @@ public:
                     price = newPrice;
                 }
                 
-                http.end();
                 return changed;
             }
         }
         
-        http.end();
         return false;
     }
 
-    // Send theft alert status
-    bool sendTheftAlert(bool detected) {
+    // Upload one chunk of a captured power-quality event waveform.
+    // Chunks are small so a single call holds the loop only briefly.
+    bool sendPowerQualityChunk(const PqEvent& event, uint16_t chunk) {
+        if (!connected) return false;
+
+        const uint16_t chunks = (PqEvent::ROWS + PQ_CHUNK_ROWS - 1) / PQ_CHUNK_ROWS;
+        if (chunk >= chunks) return false;
+        uint16_t firstRow = chunk * PQ_CHUNK_ROWS;
+        uint16_t rowCount = (PqEvent::ROWS - firstRow < PQ_CHUNK_ROWS) ? PqEvent::ROWS - firstRow : PQ_CHUNK_ROWS;
+
+        int length = snprintf(pqBuffer, PQ_BUFFER_SIZE,
+            "{\"event_id\":%lu,\"device_ms\":%lu,\"type\":\"%s\",\"channel\":%u,"
+            "\"trigger_value\":%.3f,\"extreme_value\":%.3f,\"sample_rate\":%lu,"
+            "\"pre_rows\":%u,\"rows\":%u,\"channels\":%u,\"pins\":[",
+            (unsigned long)event.id, (unsigned long)event.timestamp, PqEvent::typeName(event.type),
+            event.channel, event.triggerValue, event.extremeValue, (unsigned long)event.sampleRate,
+            PqEvent::PRE_ROWS, PqEvent::ROWS, event.channels);
+        for (uint8_t c = 0; c < event.channels; c++) {
+            length += snprintf(pqBuffer + length, PQ_BUFFER_SIZE - length, c ? ",%u" : "%u", event.pins[c]);
+        }
+        length += snprintf(pqBuffer + length, PQ_BUFFER_SIZE - length,
+            "],\"chunk\":%u,\"chunks\":%u,\"start_row\":%u,\"samples\":[", chunk, chunks, firstRow);
+
+        // Flat row-major samples: row0ch0, row0ch1, ..., row1ch0, ...
+        for (uint16_t r = 0; r < rowCount && length < (int)PQ_BUFFER_SIZE - 8; r++) {
+            for (uint8_t c = 0; c < event.channels; c++) {
+                bool first = (r == 0 && c == 0);
+                length += snprintf(pqBuffer + length, PQ_BUFFER_SIZE - length,
+                                   first ? "%u" : ",%u", event.rows[firstRow + r][c]);
+            }
+        }
+        length += snprintf(pqBuffer + length, PQ_BUFFER_SIZE - length, "]}");
+        if (length >= (int)PQ_BUFFER_SIZE) return false;
+
+        int httpResponseCode = request(HTTP_PQ, "/api/pq/event", (const uint8_t*)pqBuffer, length,
+                                       "application/json");
+        
+        if (httpResponseCode == 200 && chunk == chunks - 1) {
+            LOG_INFO(LOG_NET, "📉 Power quality event uploaded: %s", PqEvent::typeName(event.type));
+        }
+        return (httpResponseCode == 200);
+    }
+
+    // Send theft alert status with the detector confidence (0..1) and leakage (A)
+    bool sendTheftAlert(bool detected, float confidence = 0, float leakageCurrent = 0) {
         if (!connected) return false;
 
         StaticJsonDocument<128> doc;
         doc["theft_detected"] = detected;
+        doc["confidence"] = confidence;
+        doc["leakage"] = leakageCurrent;
+        size_t length = serializeJson(doc, jsonBuffer, JSON_BUFFER_SIZE);
+
+        int httpResponseCode = request(HTTP_THEFT, "/api/theft/alert",
+                                       (const uint8_t*)jsonBuffer, length, "application/json");
+        return (httpResponseCode == 200);
+    }
 
-        String jsonData;
-        serializeJson(doc, jsonData);
+    // Confirm a pushed command was applied, with the receive-to-relay-write time
+    bool ackCommand(uint32_t id, uint32_t applyMicros) {
+        if (!connected) return false;
 
-        String endpoint = serverUrl + "/api/theft/alert";
-        http.begin(endpoint);
-        http.addHeader("Content-Type", "application/json");
-        
-        int httpResponseCode = http.POST(jsonData);
-        
-        http.end();
+        int length = snprintf(jsonBuffer, JSON_BUFFER_SIZE, "{\"id\":%lu,\"apply_us\":%lu}",
+                              (unsigned long)id, (unsigned long)applyMicros);
+        int httpResponseCode = request(HTTP_COMMAND_ACK, "/api/commands/ack",
+                                       (const uint8_t*)jsonBuffer, length, "application/json");
         return (httpResponseCode == 200);
     }
 
+    // Upload one part of the metrics snapshot (Prometheus text, at most
+    // PQ_BUFFER_SIZE). `item` is where the part starts and moves to where the
+    // next one does; `last` is set when the part ends the snapshot. The server
+    // starts a new snapshot at part 0 and publishes it with the last part.
+    bool sendMetricsPart(MetricsSource source, uint16_t& item, uint16_t part, bool& last) {
+        if (!connected) return false;
+
+        // pqBuffer is free between calls: every body is built and sent within one call
+        MetricsWriter writer(pqBuffer, PQ_BUFFER_SIZE, item);
+        source(writer);
+        last = writer.isComplete();
+
+        char path[48];
+        snprintf(path, sizeof(path), "/api/metrics?part=%u&last=%u", part, last ? 1 : 0);
+        int httpResponseCode = request(HTTP_METRICS, path, (const uint8_t*)pqBuffer, writer.getLength(),
+                                       "text/plain; version=0.0.4");
+        if (httpResponseCode != 200) return false;
+        if (!last) item = writer.getNextItem();
+        return true;
+    }
+
+    // Prefer the compact MessagePack batch format (JSON is the fallback)
+    void setBinaryTelemetry(bool enabled) {
+        binaryTelemetry = enabled;
+    }
+
+    const HttpStats& getHttpStats(HttpEndpoint endpoint) const {
+        return httpStats[endpoint < HTTP_ENDPOINTS ? endpoint : HTTP_DATA];
+    }
+
+    // WiFi connections since boot (the first one, then every reconnect)
+    uint32_t getWifiConnectCount() const {
+        return wifiConnects;
+    }
+
+    // TCP connections opened over all endpoints (1 while keep-alive holds)
+    uint32_t getConnectionCount() const {
+        uint32_t total = 0;
+        for (uint8_t e = 0; e < HTTP_ENDPOINTS; e++) total += httpStats[e].connects;
+        return total;
+    }
+
+    // Server address parsed at begin(), for the command channel's own socket
+    const char* getServerHost() const {
+        return connection.getHost();
+    }
+
+    uint16_t getServerPort() const {
+        return connection.getPort();
+    }
+
     bool isConnected() {
         return connected && (WiFi.status() == WL_CONNECTED);
     }
@@ -0,0 +1,121 @@
+#ifndef ZERO_CROSS_DETECTOR_H
+#define ZERO_CROSS_DETECTOR_H
+
+#include <stdint.h>
+
+// Rising zero-crossing detector for the mains voltage channel.
+// Tracks the DC level cycle by cycle, uses hysteresis against noise and
+// interpolates the crossing between samples to measure the period precisely.
+class ZeroCrossDetector {
+private:
+    static const int32_t HYSTERESIS = 24;       // ADC counts below the level to re-arm
+    static const int32_t MIN_AMPLITUDE = 64;    // Ignore signals smaller than this (no mains)
+
+    float minFrequency;
+    float maxFrequency;
+    uint32_t sampleRate;
+
+    int32_t level;           // DC level of the previous cycle (ADC counts)
+    int64_t cycleSum;        // Running sum over the current cycle
+    uint32_t cycleCount;
+    int32_t cycleMin;
+    int32_t cycleMax;
+
+    bool armed;
+    int32_t previous;        // Previous sample
+    uint32_t sampleIndex;    // Running sample counter (wraps, differences are safe)
+    uint32_t lastCrossingIndex;
+    float lastCrossingOffset;
+    bool hasCrossing;
+
+    float lastPeriod;        // Samples, fractional
+
+    void startCycle() {
+        if (cycleCount > 0 && cycleMax - cycleMin >= MIN_AMPLITUDE) {
+            level = (int32_t)(cycleSum / cycleCount);
+        }
+        cycleSum = 0;
+        cycleCount = 0;
+        cycleMin = 4095;
+        cycleMax = 0;
+    }
+
+public:
+    ZeroCrossDetector(float minHz = 40.0, float maxHz = 70.0)
+        : minFrequency(minHz),
+          maxFrequency(maxHz),
+          sampleRate(0),
+          level(2048),
+          cycleSum(0),
+          cycleCount(0),
+          cycleMin(4095),
+          cycleMax(0),
+          armed(false),
+          previous(0),
+          sampleIndex(0),
+          lastCrossingIndex(0),
+          lastCrossingOffset(0),
+          hasCrossing(false),
+          lastPeriod(0) {}
+
+    void setSampleRate(uint32_t rate) {
+        sampleRate = rate;
+    }
+
+    // Scan raw[from, to) and return the index of the first sample of a new cycle,
+    // or -1 if no rising crossing occurs in that range. Resume scanning after the returned index.
+    int32_t next(const uint16_t* raw, uint16_t from, uint16_t to) {
+        float minPeriod = sampleRate ? sampleRate / maxFrequency : 0.0f;
+        float maxPeriod = sampleRate ? sampleRate / minFrequency : 0.0f;
+
+        for (uint16_t i = from; i < to; i++) {
+            int32_t sample = raw[i];
+            uint32_t index = sampleIndex++;
+            bool crossed = false;
+
+            if (sample < level - HYSTERESIS) {
+                armed = true;
+            } else if (armed && sample >= level) {
+                armed = false;
+
+                // Crossing lies between index-1 and index; offset is relative to index (-1..0)
+                float offset = (sample == previous) ? 0.0f
+                             : (float)(level - previous) / (float)(sample - previous) - 1.0f;
+                float period = hasCrossing
+                    ? (float)(index - lastCrossingIndex) + (offset - lastCrossingOffset)
+                    : 0.0f;
+
+                // Reject crossings that would imply a frequency above maxFrequency
+                if (!hasCrossing || period >= minPeriod) {
+                    lastPeriod = (hasCrossing && period <= maxPeriod) ? period : 0.0f;
+                    lastCrossingIndex = index;
+                    lastCrossingOffset = offset;
+                    hasCrossing = true;
+                    crossed = true;
+                    startCycle();
+                }
+            }
+            previous = sample;
+
+            cycleSum += sample;
+            cycleCount++;
+            if (sample < cycleMin) cycleMin = sample;
+            if (sample > cycleMax) cycleMax = sample;
+
+            if (crossed) return i;
+        }
+        return -1;
+    }
+
+    // Length of the cycle that ended at the last crossing, in samples (0 if unknown)
+    float getLastPeriod() const {
+        return lastPeriod;
+    }
+
+    // Samples since the last accepted crossing
+    uint32_t samplesSinceCrossing() const {
+        return hasCrossing ? sampleIndex - lastCrossingIndex : sampleIndex;
+    }
+};
+
+#endif // ZERO_CROSS_DETECTOR_H
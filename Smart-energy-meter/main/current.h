@@ -3,21 +3,40 @@
 #define CURRENT_SENSOR_H
 
 #include <Arduino.h>
-#include <Filters.h>
+#include "AdcSampler.h"
+#include "RmsKernel.h"
+#include "EventLog.h"
 
 class CurrentSensor {
 private:
     uint8_t pin;
     float slope;
     float intercept;
-    float offset;
-    float window;
+    int32_t offset;        // Zero offset in ADC units (counts, or mV with a linearization table)
     float adcRef;
     int adcMax;
-    
-    RunningStatistics stats;
+    const AdcLinearization* linearization;
+
+    // Integer statistics of the window being filled, results of the last completed one
+    RmsAccumulator acc;
+    float lastSigma;       // ADC units
+    float lastMean;        // ADC units
+    bool hasWindow;
+
+    // Zero offset calibration state
+    RmsAccumulator calibration;
+    uint32_t calibrationTarget;
     bool calibrated;
-    
+
+    inline int32_t toUnits(uint16_t raw) const {
+        return linearization ? linearization->toMillivolts(raw) : raw;
+    }
+
+    // Scale from accumulator units to mV, applied once per window
+    float millivoltsPerUnit() const {
+        return linearization ? 1.0f : adcRef / adcMax;
+    }
+
 public:
     // Constructor
     // Takes the pin number and the linear regression slope/intercept (A/mV and A)
@@ -26,88 +45,153 @@ public:
         slope = _slope;
         intercept = _intercept;
         offset = 0;
-        window = 40.0 / 50.0;  // 40ms window for 50Hz
         adcRef = 3300.0;       // ESP32 reference voltage in mV (3.3V)
         adcMax = 4095;         // 12-bit ADC resolution
+        linearization = nullptr;
+        lastSigma = 0;
+        lastMean = 0;
+        hasWindow = false;
+        calibrationTarget = 0;
         calibrated = false;
     }
 
-    // Initialize the sensor
-    void begin() {
-        pinMode(pin, INPUT);
-        analogReadResolution(12);
-        stats.setWindowSecs(window);
+    // Initialize the sensor (samples arrive from the AdcSampler frames).
+    // With a linearization table, samples are linearized mV instead of raw counts.
+    void begin(const AdcLinearization* table = nullptr) {
+        linearization = (table != nullptr && table->isReady()) ? table : nullptr;
+        acc.reset();
+        hasWindow = false;
     }
 
-    // Calibration: Simplified to only calculate Zero Offset (matching .ino logic)
-    void calibrate(int samples = 1500) {
+    // Calibration: Zero offset averaged over the next `samples` frame samples.
+    // Non-blocking; keep feeding frames through consume() until isCalibrated().
+    void startCalibration(uint32_t samples = 1500) {
         Serial.print("Calibrating sensor on pin ");
         Serial.print(pin);
         Serial.println("...");
-        
-        float sum = 0;
-        
-        // Collect samples for offset calculation
-        for (int i = 0; i < samples; i++) {
-            // Read and convert ADC value to mV
-            float reading = (analogRead(pin) * adcRef) / adcMax;
-            sum += reading;
-            delay(1); // Small delay to match the pacing in the .ino file
-        }
 
-        offset = sum / samples;
+        calibration.reset();
+        calibrationTarget = samples > 0 ? samples : 1;
+        calibrated = false;
+    }
+
+    // Use a known zero offset (ADC units, e.g. saved from an earlier boot).
+    // The sensor counts as calibrated right away; a running calibration is cancelled.
+    void setOffset(int32_t units) {
+        offset = units;
+        calibrationTarget = 0;
         calibrated = true;
-        
-        Serial.print("Zero offset calibrated to: ");
-        Serial.print(offset, 2);
-        Serial.println(" mV");
     }
 
-    // Collect samples continuously and feed them to the RunningStatistics filter
-    void update() {
-        if (!calibrated) return;
-        
-        float mv = (analogRead(pin) * adcRef) / adcMax;
-        float corrected_mv = mv - offset;
-        stats.input(corrected_mv);
+    // Offset-corrected sample in ADC units (for cross-channel products)
+    inline int32_t toSample(uint16_t raw) const {
+        return toUnits(raw) - offset;
+    }
+
+    // Accumulate samples [from, to) of one frame into the current window
+    void consume(const AdcFrame& frame, uint16_t from, uint16_t to) {
+        int8_t channel = frame.channelOf(pin);
+        if (channel < 0) return;
+        const uint16_t* raw = frame.raw[channel];
+
+        if (!calibrated) {
+            if (calibrationTarget == 0) return;
+            for (uint16_t i = from; i < to && calibration.count < calibrationTarget; i++) {
+                calibration.add(toUnits(raw[i]));
+            }
+            if (calibration.count >= calibrationTarget) {
+                offset = (int32_t)lroundf(calibration.mean());
+                calibrated = true;
+                acc.reset();
+
+                LOG_INFO(LOG_METER, "Zero offset calibrated to: %.2f mV", getOffset());
+            }
+            return;
+        }
+
+        for (uint16_t i = from; i < to; i++) {
+            acc.add(toUnits(raw[i]) - offset);
+        }
+    }
+
+    // Latch the statistics of the window just ended and start a new one.
+    // Returns the number of samples the window held (0 if not calibrated).
+    uint32_t closeWindow() {
+        uint32_t samples = calibrated ? acc.count : 0;
+        if (samples > 0) {
+            lastSigma = acc.sigma();
+            lastMean = acc.mean();
+            hasWindow = true;
+        }
+        acc.reset();
+        return samples;
     }
 
     // Compute RMS -> Amps using only linear regression and noise threshold (matching .ino logic)
     // Note: The original sen_num parameter was removed as it was unused and unnecessary.
     float getCurrent() {
-        if (!calibrated) return 0.0;
-        
-        // 1. Get RMS voltage (standard deviation) from the RunningStatistics window
-        float rms_voltage = stats.sigma();
-        
+        if (!calibrated || !hasWindow) return 0.0;
+        return rmsToCurrent(lastSigma);
+    }
+
+    // Same conversion for any RMS value in ADC units (e.g. half-cycle RMS)
+    float rmsToCurrent(float rmsUnits) const {
+        // 1. RMS voltage (standard deviation) in mV
+        float rms_voltage = rmsUnits * millivoltsPerUnit();
+
         // 2. Convert RMS voltage to current using linear regression (A = Intercept + Slope * V_RMS)
         // This directly implements the core calculation from the .ino file.
         float current = intercept + slope * rms_voltage;
-        
+
         // 3. Apply the simple noise threshold (clamp anything below 0.002A to 0, matching the .ino file)
         if (current < 0.002) {
             current = 0.0;
         }
-        
+
         return current;
     }
-    
-    // Get current offset value
+
+    // Last window statistics in ADC units
+    float getWindowSigma() const {
+        return lastSigma;
+    }
+
+    float getWindowMean() const {
+        return lastMean;
+    }
+
+    // Instantaneous scale from offset-corrected ADC units to amps (regression slope only)
+    float getAmpsPerUnit() const {
+        return slope * millivoltsPerUnit();
+    }
+
+    // Get current offset value (mV)
     float getOffset() const {
+        return offset * millivoltsPerUnit();
+    }
+
+    int32_t getOffsetUnits() const {
         return offset;
     }
 
-    // Set custom window length
-    void setWindow(float freq) {
-        window = 40.0 / freq;
-        stats.setWindowSecs(window);
+    float getMillivoltsPerUnit() const {
+        return millivoltsPerUnit();
+    }
+
+    // Samples are linearized mV rather than raw counts
+    bool isLinearized() const {
+        return linearization != nullptr;
+    }
+
+    uint8_t getPin() const {
+        return pin;
     }
-    
+
     // Check if calibrated
     bool isCalibrated() const {
         return calibrated;
     }
-    
+
     // Removed all advanced filtering/noise suppression methods and members.
 };
 
@@ -5,18 +5,120 @@
 #include <Arduino.h>
 #include <Wire.h>
 #include <LiquidCrystal_I2C.h>
+#include <atomic>
+#include <stdarg.h>
+#include <stdio.h>
 
-// Enhanced wrapper for 16x2 I2C LCD
+// Pages shown in turn
+enum DisplayPage : uint8_t {
+    DISPLAY_CURRENTS = 0,
+    DISPLAY_POWER,
+    DISPLAY_ENERGY,
+    DISPLAY_THEFT,
+    DISPLAY_PAGES
+};
+
+// Enhanced wrapper for 16x2 I2C LCD.
+// Pages are composed into a framebuffer and only the cells that differ from
+// what the LCD already shows are written (no clear(), no flicker). On the
+// PCF8574 backpack every LCD byte is 6 one-byte I2C writes (two nibbles, each
+// with an enable pulse), so a changed digit costs about 24 bus bytes instead of
+// ~340 for a full redraw. Pages rotate every PAGE_INTERVAL; nextPage() (IR key,
+// any task) switches at the next update and holds the page for MANUAL_HOLD.
 class Display {
+public:
+    static const uint8_t MAX_COLS = 16;
+    static const uint8_t MAX_ROWS = 2;
+    static const uint8_t I2C_BYTES_PER_LCD_BYTE = 12;   // 6 writes of address + data
+    static const unsigned long PAGE_INTERVAL = 4000;
+    static const unsigned long MANUAL_HOLD = 30000;
+
 private:
     LiquidCrystal_I2C lcd;
     bool initialized;
-    uint8_t displayMode;  // 0=currents, 1=power, 2=voltage
+    uint8_t cols;
+    uint8_t rows;
+    uint8_t displayMode;  // Current DisplayPage
+    unsigned long pageStart;
+    unsigned long pageHold;
+    std::atomic<uint8_t> pageRequests;
+
+    char shown[MAX_ROWS][MAX_COLS];     // What the LCD holds
+    char frame[MAX_ROWS][MAX_COLS];     // Being composed
+
+    uint32_t updates;
+    uint32_t lcdBytes;                  // Commands and characters sent
+    uint32_t redrawBytes;               // What clear() and reprinting would have sent
+    uint32_t lastBytes;
+
+    // Format one row of the frame, padded with spaces and cut at the last column
+    void compose(uint8_t row, const char* format, ...) {
+        if (row >= rows) return;
+        char text[MAX_COLS + 1];
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        if (n < 0) n = 0;
+        if (n > cols) n = cols;
+        memcpy(frame[row], text, n);
+        memset(frame[row] + n, ' ', cols - n);
+    }
+
+    // Write the runs of changed cells (a single unchanged cell between two
+    // changes is rewritten: it costs the same as moving the cursor)
+    void flush() {
+        uint32_t bytes = 0;
+        uint32_t redraw = 1;            // clear()
+        for (uint8_t r = 0; r < rows; r++) {
+            uint8_t used = cols;
+            while (used > 0 && frame[r][used - 1] == ' ') used--;
+            if (used > 0) redraw += 1 + used;
+
+            uint8_t c = 0;
+            while (c < cols) {
+                if (frame[r][c] == shown[r][c]) {
+                    c++;
+                    continue;
+                }
+                uint8_t end = c + 1;
+                while (end < cols && (frame[r][end] != shown[r][end] ||
+                                      (end + 1 < cols && frame[r][end + 1] != shown[r][end + 1]))) {
+                    end++;
+                }
+                lcd.setCursor(c, r);
+                bytes++;
+                for (; c < end; c++) {
+                    lcd.write((uint8_t)frame[r][c]);
+                    shown[r][c] = frame[r][c];
+                    bytes++;
+                }
+            }
+        }
+        updates++;
+        lcdBytes += bytes;
+        redrawBytes += redraw;
+        lastBytes = bytes;
+    }
 
 public:
     // Constructor: default address 0x27, 16x2 display
-    Display(uint8_t address = 0x27, uint8_t cols = 16, uint8_t rows = 2)
-      : lcd(address, cols, rows), initialized(false), displayMode(0) {}
+    Display(uint8_t address = 0x27, uint8_t _cols = 16, uint8_t _rows = 2)
+      : lcd(address, _cols, _rows),
+        initialized(false),
+        cols(_cols < MAX_COLS ? _cols : MAX_COLS),
+        rows(_rows < MAX_ROWS ? _rows : MAX_ROWS),
+        displayMode(DISPLAY_CURRENTS),
+        pageStart(0),
+        pageHold(PAGE_INTERVAL),
+        pageRequests(0),
+        updates(0),
+        lcdBytes(0),
+        redrawBytes(0),
+        lastBytes(0) {
+        memset(shown, ' ', sizeof(shown));
+        memset(frame, ' ', sizeof(frame));
+    }
 
     // Initialize the display
     void begin() {
@@ -24,86 +126,113 @@ public:
         Wire.begin();
         lcd.init();
         lcd.backlight();
-        lcd.clear();
+        lcd.clear();    // The only clear: the framebuffer starts blank too
+        memset(shown, ' ', sizeof(shown));
+        pageStart = millis();
         initialized = true;
     }
 
-    // Show currents and voltage (synchronized with your requirements)
-    void showCurrents(float i1, float i2, float voltage) {
+    // Switch to the next page at the next update; safe from any task
+    void nextPage() {
+        pageRequests++;
+    }
+
+    // Page to show now: advances on requests and every PAGE_INTERVAL
+    uint8_t pageAt(unsigned long now) {
+        uint8_t requests = pageRequests.exchange(0);
+        if (requests > 0) {
+            displayMode = (displayMode + requests) % DISPLAY_PAGES;
+            pageStart = now;
+            pageHold = MANUAL_HOLD;
+        } else if (now - pageStart >= pageHold) {
+            displayMode = (displayMode + 1) % DISPLAY_PAGES;
+            pageStart = now;
+            pageHold = PAGE_INTERVAL;
+        }
+        return displayMode;
+    }
+
+    // Show currents with voltage and frequency
+    void showCurrents(float i1, float i2, float voltage, float frequency) {
+        if (!initialized) return;
+        compose(0, "I1:%5.2fA %5.1fV", i1, voltage);
+        compose(1, "I2:%5.2fA %4.1fHz", i2, frequency);
+        flush();
+    }
+
+    // Show real power and power factor of both loads
+    void showPower(float power1, float pf1, float power2, float pf2) {
         if (!initialized) return;
-        lcd.clear();
-        
-        // Line 1: Current readings
-        lcd.setCursor(0, 0);
-        lcd.print("I1:");
-        lcd.print(i1, 2);  // 2 decimal places for better readability
-        lcd.print("A I2:");
-        lcd.print(i2, 2);
-        lcd.print("A");
-        
-        // Line 2: Voltage
-        lcd.setCursor(0, 1);
-        lcd.print("V:");
-        lcd.print(voltage, 1);  // 1 decimal place
-        lcd.print("V");
-    }
-    
-    // Alternative: Show power and voltage
-    void showPower(float power1, float power2, float voltage) {
+        compose(0, "P1%6.0fW PF%4.2f", power1, pf1);
+        compose(1, "P2%6.0fW PF%4.2f", power2, pf2);
+        flush();
+    }
+
+    // Show total energy (kWh) and its cost at the price per unit
+    void showEnergy(float energy, float cost, float price) {
+        if (!initialized) return;
+        compose(0, "E:%9.3f kWh", energy);
+        compose(1, "Rs%8.2f @%4.1f", cost, price);
+        flush();
+    }
+
+    // Theft evidence (0..1), seconds until confirmation (0: none pending) and leakage (A)
+    void showTheft(bool detected, float confidence, unsigned long remaining, float leakage) {
         if (!initialized) return;
-        lcd.clear();
-        
-        // Line 1: Power readings
-        lcd.setCursor(0, 0);
-        lcd.print("P1:");
-        lcd.print(power1, 1);
-        lcd.print("W P2:");
-        lcd.print(power2, 1);
-        lcd.print("W");
-        
-        // Line 2: Voltage
-        lcd.setCursor(0, 1);
-        lcd.print("V:");
-        lcd.print(voltage, 1);
-        lcd.print("V");
-    }
-    
+        if (detected) {
+            compose(0, "THEFT DETECTED!");
+        } else if (remaining > 0) {
+            compose(0, "Theft? %3.0f%% %3lus", confidence * 100.0f, remaining < 999 ? remaining : 999);
+        } else {
+            compose(0, "Theft: %3.0f%%", confidence * 100.0f);
+        }
+        if (leakage >= 0) {
+            compose(1, "Leak:%8.4f A", leakage);
+        } else {
+            compose(1, "Leak: --");
+        }
+        flush();
+    }
+
     // Show total power and current
     void showTotals(float totalCurrent, float totalPower, float voltage) {
         if (!initialized) return;
-        lcd.clear();
-        
-        // Line 1: Total current and power
-        lcd.setCursor(0, 0);
-        lcd.print("I:");
-        lcd.print(totalCurrent, 2);
-        lcd.print("A P:");
-        lcd.print(totalPower, 1);
-        lcd.print("W");
-        
-        // Line 2: Voltage
-        lcd.setCursor(0, 1);
-        lcd.print("Voltage:");
-        lcd.print(voltage, 1);
-        lcd.print("V");
-    }
-    
+        compose(0, "I:%5.2fA P:%4.0fW", totalCurrent, totalPower);
+        compose(1, "Voltage:%6.1fV", voltage);
+        flush();
+    }
+
     // Display custom message
     void showMessage(const char* line1, const char* line2 = "") {
         if (!initialized) return;
-        lcd.clear();
-        lcd.setCursor(0, 0);
-        lcd.print(line1);
-        if (strlen(line2) > 0) {
-            lcd.setCursor(0, 1);
-            lcd.print(line2);
-        }
+        compose(0, "%s", line1);
+        compose(1, "%s", line2);
+        flush();
     }
-    
+
     // Clear display
     void clear() {
         if (!initialized) return;
-        lcd.clear();
+        compose(0, "");
+        compose(1, "");
+        flush();
+    }
+
+    // Page updates so far and I2C bytes they sent, against full clear() redraws
+    uint32_t getUpdateCount() const {
+        return updates;
+    }
+
+    uint32_t getI2cBytes() const {
+        return lcdBytes * I2C_BYTES_PER_LCD_BYTE;
+    }
+
+    uint32_t getRedrawI2cBytes() const {
+        return redrawBytes * I2C_BYTES_PER_LCD_BYTE;
+    }
+
+    uint32_t getLastI2cBytes() const {
+        return lastBytes * I2C_BYTES_PER_LCD_BYTE;
     }
 };
 
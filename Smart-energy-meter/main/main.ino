@@ -1,17 +1,39 @@
 #include <Arduino.h>
 #include "PinConfig.h"
+#include "AdcSampler.h"
+#include "RmsKernel.h"
 #include "IRHandler.h"
 #include "Current.h"
 #include "Voltage.h"
+#include "PowerMeter.h"
+#include "PowerQualityMonitor.h"
+#include "DifferentialCurrent.h"
 #include "display.h"
 #include "WebClient.h"
 #include "TheftDetector.h"
+#include "FlashPartition.h"
+#include "EnergyJournal.h"
 #include "EnergyCalculator.h"
+#include "RollupStore.h"
+#include "TelemetryQueue.h"
+#include "ReportByException.h"
+#include "HeapMonitor.h"
+#include "CommandChannel.h"
+#include "LocalApi.h"
+#include "DeadlineScheduler.h"
+#include "CalibrationStore.h"
+#include "OffsetTracker.h"
+#include "EventLog.h"
+#include "Metrics.h"
+#include <time.h>
+#include <atomic>
 
 // ===================== CONFIGURATION =====================
 const char* WIFI_SSID = "RCB";
 const char* WIFI_PASSWORD = "http@007";
 const char* SERVER_URL = "http://192.168.31.222:5000";
+const char* NTP_SERVER_1 = "pool.ntp.org";
+const char* NTP_SERVER_2 = "time.google.com";
 
 // Sensor Calibration Constants
 const float slope_1 = 0.0007272;    
@@ -20,6 +42,16 @@ const float slope_2 = 0.0007272;
 const float intercept_2 = -0.01672;
 const float slope_3 = 0.0006825;     
 const float intercept_3 = -0.01442;
+const int8_t LOAD_POLARITY[] = {1, 1, 1};  // -1 for a current sensor fitted backwards (import reads negative)
+
+// Sampling Configuration (continuous ADC on core 0)
+const uint32_t ADC_SAMPLE_RATE = 20000;  // Hz per channel
+const uint8_t SAMPLED_PINS[] = {32, 33, 34, 35};
+const uint32_t CALIBRATION_SAMPLES = 20000;
+const bool USE_ADC_LINEARIZATION = true;  // 8 KB raw->mV table from eFuse calibration
+const bool ENABLE_HARMONICS = true;       // THD and odd harmonics in /api/data
+const bool USE_BINARY_TELEMETRY = true;   // Delta-coded MessagePack batches (JSON if the server answers 415)
+const bool REPORT_BY_EXCEPTION = true;    // Send readings only on change, state change or heartbeat
 
 // Voltage Sensor Configuration
 const uint8_t VOLTAGE_PIN = 35;
@@ -28,76 +60,264 @@ const float VOLTAGE_CALIBRATION = 890.0;
 
 // ===================== CREATE INSTANCES =====================
 PinConfig pinConfig;
+Esp32AdcSource adcSource;
+AdcSampler sampler(adcSource, SAMPLED_PINS, sizeof(SAMPLED_PINS), ADC_SAMPLE_RATE);
+AdcLinearization adcLinearization;
 CurrentSensor sensor1(32, slope_1, intercept_1);
 CurrentSensor sensor2(33, slope_2, intercept_2);
 CurrentSensor sensor3(34, slope_3, intercept_3);
+CalibrationStore calibrationStore;      // Zero offsets kept across reboots
+OffsetTracker offsetTracker;            // Zero offset drift, learned while the relays are off
 VoltageSensor voltageSensor(VOLTAGE_PIN, Vref, VOLTAGE_CALIBRATION);
+PowerMeter powerMeter(voltageSensor);
+PowerQualityMonitor pqMonitor(voltageSensor, powerMeter);
+DifferentialCurrent leakage(sensor3, sensor1, sensor2, powerMeter);
 IRHandler irHandler(pinConfig);
 Display display;
 WebClient webClient(WIFI_SSID, WIFI_PASSWORD, SERVER_URL);
 TheftDetector theftDetector;
+Esp32FlashPartition energyPartition("energy");   // See partitions.csv
+EnergyJournal energyJournal(energyPartition);
 EnergyCalculator energyCalc;
+Esp32FlashPartition rollupPartition("rollup");   // See partitions.csv
+RollupStore rollupStore(rollupPartition);
+Esp32FlashPartition queuePartition("queue");   // See partitions.csv
+TelemetryQueue telemetryQueue(queuePartition);
+ExceptionReporter exceptionReporter;
+TelemetryDrain telemetryDrain(500, 2000, 300000);  // Backlog: a batch per 0.5 s, back off 2 s .. 5 min
+HeapMonitor heapMonitor;
+CommandChannel commandChannel;          // Relay and price commands pushed by the server
+LocalApi localApi(80);                  // Read API for LAN clients, served by the meter
+DeadlineScheduler controlScheduler("control");  // Core 1: sensing and actuation
+DeadlineScheduler networkScheduler("network");  // Core 0: every blocking network call
+DeadlineScheduler reportScheduler("report");    // Core 1 below control: serial report and LCD
+DeadlineScheduler storageScheduler("storage");  // Core 1 below control: every flash and NVS write
 
 // ===================== TIMING VARIABLES =====================
-unsigned long samplePeriod = 1500;   
+// Task periods (ms); each task's deadline is set where it is scheduled in setup()
+unsigned long framePeriod = 5;          // Two 10 ms sampler frames: drain well before an overrun
+unsigned long controlPeriod = 10;       // IR remote, buzzer, theft alarm, relay commands
 unsigned long printPeriod = 1500;
-unsigned long previousMillis = 0;
-unsigned long webSendPeriod = 10000;
+unsigned long telemetryPeriod = 1000;   // One timestamped reading per second
+unsigned long webSendPeriod = 10000;    // Upload at least every 10 s
 unsigned long previousWebMillis = 0;
-unsigned long relayPollPeriod = 1500;
-unsigned long previousRelayPoll = 0;
-unsigned long energySavePeriod = 60000; // Save energy every minute
-unsigned long previousEnergySave = 0;
+const uint8_t TELEMETRY_BATCH = 10;     // Readings per POST
+unsigned long drainPeriod = 100;        // Check the upload queue (the drain paces itself)
+unsigned long relayPollPeriod = 1500;   // While the command channel is down
+unsigned long relayFallbackPeriod = 60000;  // Slow safety poll while commands are pushed
+unsigned long energySavePeriod = 5000;  // Journal energy every 5 seconds
+unsigned long storagePeriod = 100;      // Readings and rollup windows handed over by control
+unsigned long pqUploadPeriod = 250;     // One event chunk per period
+unsigned long networkPeriod = 20;       // Command stream, local API, messages to the server
+unsigned long wifiCheckPeriod = 500;
+unsigned long statsPeriod = 30000;      // Print task timing
+unsigned long modelSavePeriod = 10000;  // Write a theft model handed over by the control task
+unsigned long lcdPeriod = 500;          // LCD page (only changed cells are sent)
+unsigned long logPeriod = 10;           // Drain the log into the UART TX FIFO (~115 B per 10 ms)
+unsigned long metricsPeriod = 250;      // One part of a metrics snapshot per period
+unsigned long metricsPushPeriod = 60000;    // Snapshot to the server every minute
 
 // ===================== GLOBAL VARIABLES =====================
 float lastVoltage = 0;
+float lastFrequency = 0;
 float lastCurrent1 = 0;
 float lastCurrent2 = 0;
 float lastCurrent3 = 0;
 float lastTotalCurrent = 0;
+float lastLeakage = -1;       // Fundamental of I3 - (I1 + I2), -1 until available
+uint32_t leakageCycles = 0;   // Cycles already passed to the theft detector
+uint32_t energyWindows = 0;   // Power windows already integrated into energy
+bool theftPending = false;    // New theft alarm raised while processing frames
+std::atomic<bool> telemetryUrgent(false); // Queued reading carries a state change: upload without batching
 float lastPower1 = 0;
 float lastPower2 = 0;
 float lastTotalPower = 0;
+PowerReading lastLoad1 = {0, 0, 0, 0, 0, 0};
+PowerReading lastLoad2 = {0, 0, 0, 0, 0, 0};
+float lastEnergy = 0;         // kWh, both loads
+float lastCost = 0;
+unsigned long lastTheftRemaining = 0;   // s until a building theft alarm confirms, 0 if none
 
 bool previousRelay1State = false;
 bool previousRelay2State = false;
 bool initialSyncDone = false;
+bool firstReadingDone = false;
+
+// Samples each channel got (column order of SAMPLED_PINS) and the rate over the last power window
+uint32_t adcSamples[AdcFrame::MAX_CHANNELS] = {0};
+uint32_t rateSamples[AdcFrame::MAX_CHANNELS] = {0};
+float adcSampleRate[AdcFrame::MAX_CHANNELS] = {0};
+uint32_t rateStartUs = 0;
+
+// Metrics snapshot being published to the server
+bool metricsPushing = false;
+uint16_t metricsItem = 0;
+uint16_t metricsPart = 0;
+unsigned long lastMetricsPush = 0;
+
+// Power quality event being uploaded
+const PqEvent* pqUpload = nullptr;
+uint16_t pqUploadChunk = 0;
+uint8_t pqUploadFailures = 0;
+const uint8_t PQ_MAX_UPLOAD_FAILURES = 5;
+
+// ===================== TASK COMMUNICATION =====================
+// Messages from the control task for the network task to send
+enum UplinkType : uint8_t {
+    UPLINK_RELAY_STATE,
+    UPLINK_THEFT_ALERT,
+    UPLINK_THEFT_CLEARED,
+    UPLINK_COMMAND_ACK
+};
+
+struct UplinkMessage {
+    UplinkType type;
+    bool relay1;
+    bool relay2;
+    float confidence;
+    float leakage;
+    uint32_t commandId;
+    uint32_t applyMicros;
+};
+
+// Relay and price settings for the control task. A polled state is dropped
+// if the relays were switched locally after the poll started (it would undo that).
+struct QueuedCommand {
+    ServerCommand command;        // id 0: polled, nothing to acknowledge
+    uint32_t localChanges;        // localRelayChanges when the poll started
+};
+
+// A reading for the telemetry queue, written by the storage task
+struct CapturedReading {
+    TelemetryRecord record;
+    bool urgent;                  // Carries a state change: upload without batching
+};
+
+// A completed measurement window for the rollups, written by the storage task
+struct RollupWindow {
+    float values[ROLLUP_CHANNELS];
+    uint64_t energyL1;            // Registers before the window (mJ)
+    uint64_t energyL2;
+    uint32_t timestamp;
+    bool synced;
+};
+
+QueueHandle_t commandQueue;       // Network -> control
+QueueHandle_t uplinkQueue;        // Control -> network
+QueueHandle_t captureQueue;       // Control -> storage
+QueueHandle_t rollupQueue;        // Control -> storage
+SemaphoreHandle_t telemetryLock;  // TelemetryQueue: pushed on storage, drained on network
+SemaphoreHandle_t rollupLock;     // RollupStore: written on storage, read by the local API
+std::atomic<uint32_t> localRelayChanges(0);
+uint32_t uplinkDropped = 0;
+uint32_t storageDropped = 0;      // Readings and windows dropped (storage task behind)
+
+// TelemetryQueue counters, copied under telemetryLock for tasks that do not take it
+std::atomic<uint32_t> telemetryDepth(0);
+std::atomic<uint32_t> telemetryFlashDepth(0);
+std::atomic<uint32_t> telemetryDropped(0);
+
+int8_t commandTaskId = -1;
+int8_t captureTaskId = -1;
+int8_t displayTaskId = -1;
+int8_t lcdTaskId = -1;
+int8_t uplinkTaskId = -1;
+int8_t relayPollTaskId = -1;
+int8_t storeTaskId = -1;
+int8_t energySaveTaskId = -1;
+
+char consoleLine[48];                   // Serial console command being typed ("log net debug")
+uint8_t consoleLength = 0;
 
 // ===================== SETUP =====================
 void setup() {
     Serial.begin(115200);
-    delay(1000);
     
     Serial.println("\n\n========================================");
     Serial.println("⚡ SMART ENERGY METER v2.0");
     Serial.println("   with Theft Detection & Energy Monitoring");
     Serial.println("========================================\n");
-    delay(2000);
     
+    // Relays first, so they are in a defined state within milliseconds of power-up
+    Serial.println("🔌 Initializing relay control...");
+    pinConfig.begin();
+    
+    // Queues and locks between the control, network and storage tasks (started at the end)
+    commandQueue = xQueueCreate(8, sizeof(QueuedCommand));
+    uplinkQueue = xQueueCreate(16, sizeof(UplinkMessage));
+    captureQueue = xQueueCreate(8, sizeof(CapturedReading));
+    rollupQueue = xQueueCreate(32, sizeof(RollupWindow));    // 6 s of windows
+    telemetryLock = xSemaphoreCreateMutex();
+    rollupLock = xSemaphoreCreateMutex();
+    
+    // Initialize Energy Calculator before any power window is integrated (default price ₹5 per kWh)
+    energyCalc.begin(5.0, &energyJournal);
+
+    // Load profile history (1 s in RAM, 1 min / 15 min in flash)
+    if (!rollupStore.begin()) {
+        Serial.println("⚠️ Rollup partition not found - keeping 1 s history in RAM only");
+    }
+
+    // Outbound readings survive WiFi/server outages (and reboots, once spilled to flash)
+    if (telemetryQueue.begin()) {
+        Serial.print("📦 Telemetry queue: ");
+        Serial.print(telemetryQueue.depth());
+        Serial.println(" readings waiting from before the restart");
+    } else {
+        Serial.println("⚠️ Queue partition not found - buffering readings in RAM only");
+    }
+    publishTelemetryCounts();
+
+    // Start continuous sampling
+    Serial.println("📈 Starting ADC sampler...");
+    if (!sampler.begin() || !sampler.start(0)) {
+        Serial.println("❌ ADC sampler failed to start!");
+    }
+
     // Initialize Current Sensors
     Serial.println("📊 Initializing current sensors...");
-    sensor1.begin();
-    sensor2.begin();
-    sensor3.begin();
-
-    // Calibrate Current Sensors
-    Serial.println("🔧 Calibrating current sensors...");
-    Serial.println("   Ensure NO LOAD is connected!");
-    delay(1000);
-    sensor1.calibrate(1000);
-    delay(500);
-    sensor2.calibrate(1000);
-    delay(500);
-    sensor3.calibrate(1000);
-    Serial.println("✅ Calibration complete\n");
-    
-    // Initialize Voltage Sensor
+    if (USE_ADC_LINEARIZATION) {
+        bool fitted = adcLinearization.begin();
+        Serial.println(fitted ? "   ADC linearization: eFuse line fitting" : "   ADC linearization: ideal");
+    }
+    sensor1.begin(&adcLinearization);
+    sensor2.begin(&adcLinearization);
+    sensor3.begin(&adcLinearization);
+    powerMeter.addLoad(sensor1, LOAD_POLARITY[0]);
+    powerMeter.addLoad(sensor2, LOAD_POLARITY[1]);
+    powerMeter.addLoad(sensor3, LOAD_POLARITY[2]);
+    powerMeter.setHarmonicsEnabled(ENABLE_HARMONICS);
+    pqMonitor.addLoad(sensor1);
+    pqMonitor.addLoad(sensor2);
+    pqMonitor.addLoad(sensor3);
+    pqMonitor.begin();
+
+    // Initialize Voltage Sensor (shares the sampling clock with the current channels)
     Serial.println("⚡ Initializing voltage sensor...");
     voltageSensor.begin();
-    
-    // Initialize Hardware
-    Serial.println("🔌 Initializing relay control...");
-    pinConfig.begin();
+
+    // Zero offsets: reuse the saved ones (checked in the background against the
+    // first power windows), or calibrate in the background on the first boot
+    calibrationStore.addSensor(sensor1);
+    calibrationStore.addSensor(sensor2);
+    calibrationStore.addSensor(sensor3);
+    if (calibrationStore.begin()) {
+        Serial.print("♻️ Zero offsets restored (mV): ");
+        Serial.print(sensor1.getOffset(), 1);
+        Serial.print(" / ");
+        Serial.print(sensor2.getOffset(), 1);
+        Serial.print(" / ");
+        Serial.println(sensor3.getOffset(), 1);
+    } else {
+        Serial.println("🔧 No saved zero offsets - calibrating current sensors in the background...");
+        sensor1.startCalibration(CALIBRATION_SAMPLES);
+        sensor2.startCalibration(CALIBRATION_SAMPLES);
+        sensor3.startCalibration(CALIBRATION_SAMPLES);
+    }
+    // Sensor 3 sees the supply: its branch is idle only with both relays off
+    offsetTracker.addChannel(sensor1, OFFSET_RELAY1);
+    offsetTracker.addChannel(sensor2, OFFSET_RELAY2);
+    offsetTracker.addChannel(sensor3, OFFSET_RELAY1 | OFFSET_RELAY2);
     
     Serial.println("📡 Initializing IR receiver...");
     irHandler.begin();
@@ -108,20 +328,16 @@ void setup() {
     // Initialize Theft Detector
     theftDetector.begin();
     
-    // Initialize Energy Calculator (default price ₹5 per kWh)
-    energyCalc.begin(5.0);
-    
     // Initialize WiFi
+    exceptionReporter.setEnabled(REPORT_BY_EXCEPTION);
+    webClient.setBinaryTelemetry(USE_BINARY_TELEMETRY);
     webClient.begin();
+    commandChannel.begin(webClient.getServerHost(), webClient.getServerPort());
+    localApi.begin(&rollupStore, &offsetTracker, writeMetrics);
     
-    // Initial relay state sync with server
-    if (webClient.isConnected()) {
-        Serial.println("🔄 Performing initial relay state sync...");
-        previousRelay1State = pinConfig.getRelay1State();
-        previousRelay2State = pinConfig.getRelay2State();
-        webClient.postRelayState(previousRelay1State, previousRelay2State);
-        initialSyncDone = true;
-    }
+    // SNTP keeps the clock synced in the background (UTC); readings are stamped
+    // with uptime until the first sync
+    configTime(0, 0, NTP_SERVER_1, NTP_SERVER_2);
     
     Serial.println("\n========================================");
     Serial.println("✅ SYSTEM READY");
@@ -132,192 +348,876 @@ void setup() {
     Serial.println("  • Energy Consumption Tracking");
     Serial.println("  • Cost Calculator");
     Serial.println("\nData Flow:");
-    Serial.println("  • Sensors → Server: Every 10s");
+    Serial.println(REPORT_BY_EXCEPTION ? "  • Sensors → Server: on change (1 s check), heartbeat 5 min"
+                                       : "  • Sensors → Server: 1 s readings, batched every 10s");
     Serial.println("  • IR Change → Server: Immediate POST");
-    Serial.println("  • Server → ESP32: Every 1.5s (poll)");
+    Serial.println("  • Server → ESP32: Pushed commands (poll while the stream is down)");
     Serial.println("========================================\n");
     
-    delay(1000);
+    // Sensing and actuation on core 1. Blocking network calls run on core 0 with
+    // the WiFi stack, below the ADC sampler's priority, so a stalled server only
+    // delays other network tasks. The slow serial report and LCD update run on a
+    // lower-priority task that control preempts, and so do flash and NVS writes
+    // (a sector erase stalls for tens of ms): control only hands those RAM copies.
+    // Deadlines (ms) count misses. Runtime messages go through the event log,
+    // written out by the report task.
+    controlScheduler.add("frames", processFrames, framePeriod, 10, 5);
+    commandTaskId = controlScheduler.add("commands", commandTask, controlPeriod, 20, 4);
+    controlScheduler.add("ir", irTask, controlPeriod, 20, 4);
+    controlScheduler.add("theft", theftTask, controlPeriod, 50, 3);
+    captureTaskId = controlScheduler.add("capture", captureTask, telemetryPeriod, 200, 2);
+    controlScheduler.add("latch", latchTask, printPeriod, 100, 1);
+    controlScheduler.add("energy", energyHandoffTask, energySavePeriod, 1000, 1);
+    
+    reportScheduler.add("log", logTask, logPeriod, 100, 2);
+    displayTaskId = reportScheduler.add("display", updateAllDisplays, 0, 1000, 1);
+    lcdTaskId = reportScheduler.add("lcd", lcdTask, lcdPeriod, 500, 1);
+    reportScheduler.add("stats", statsTask, statsPeriod, 5000, 0);
+    
+    storeTaskId = storageScheduler.add("store", storeTask, storagePeriod, 1000, 2);
+    energySaveTaskId = storageScheduler.add("energy", energySaveTask, energySavePeriod, 5000, 1);
+    storageScheduler.add("model", theftModelTask, modelSavePeriod, 5000, 0);
+    
+    uplinkTaskId = networkScheduler.add("uplink", uplinkTask, networkPeriod, 500, 4);
+    networkScheduler.add("stream", commandStreamTask, networkPeriod, 100, 4);
+    networkScheduler.add("local", localApiTask, networkPeriod, 100, 3);
+    networkScheduler.add("wifi", wifiTask, wifiCheckPeriod, 1000, 2);
+    networkScheduler.add("drain", drainTask, drainPeriod, 6000, 2);
+    relayPollTaskId = networkScheduler.add("poll", relayPollTask, relayPollPeriod, 6000, 2);
+    networkScheduler.add("pq", powerQualityTask, pqUploadPeriod, 6000, 1);
+    networkScheduler.add("metrics", metricsTask, metricsPeriod, 6000, 0);
+    
+    if (!controlScheduler.start(1, 3, 8192) || !networkScheduler.start(0, 2, 8192) ||
+        !reportScheduler.start(1, 1, 4096) || !storageScheduler.start(1, 1, 4096)) {
+        Serial.println("❌ Scheduler tasks failed to start!");
+    }
+    LOG_INFO(LOG_MAIN, "⏱️ Setup done after %lu ms", millis());
 }
 
-void readSensors() {
-    unsigned long startTime = millis();
-    
-    while (millis() - startTime < samplePeriod) {
-        sensor1.update();
-        sensor2.update();
-        sensor3.update();
-        delayMicroseconds(100);
+// Unix time once the clock has been set, seconds since boot before that
+uint32_t currentTimestamp(bool& synced) {
+    time_t now = time(nullptr);
+    synced = now > 1600000000;
+    return synced ? (uint32_t)now : millis() / 1000;
+}
+
+// Snapshot the current readings into a telemetry record
+void buildTelemetry(TelemetryRecord& record) {
+    memset(&record, 0, sizeof(record));
+    bool synced;
+    record.timestamp = currentTimestamp(synced);
+    if (synced) record.flags |= TelemetryRecord::FLAG_SYNCED;
+    if (theftDetector.isTheftDetected()) record.flags |= TelemetryRecord::FLAG_THEFT;
+    if (pinConfig.getRelay1State()) record.flags |= TelemetryRecord::FLAG_RELAY1;
+    if (pinConfig.getRelay2State()) record.flags |= TelemetryRecord::FLAG_RELAY2;
+
+    // Latest completed power window (readSensors() only latches every printPeriod)
+    const PowerReading& load1 = powerMeter.getReading(0);
+    const PowerReading& load2 = powerMeter.getReading(1);
+    record.voltage = voltageSensor.getRmsVoltage();
+    record.frequency = powerMeter.getFrequency();
+    record.current1 = sensor1.getCurrent();
+    record.current2 = sensor2.getCurrent();
+    record.current3 = sensor3.getCurrent();
+    record.power1 = load1.realPower;
+    record.power2 = load2.realPower;
+    record.energyL1 = energyCalc.getEnergyL1Millijoules();
+    record.energyL2 = energyCalc.getEnergyL2Millijoules();
+    record.apparentPower1 = load1.apparentPower;
+    record.apparentPower2 = load2.apparentPower;
+    record.reactivePower1 = load1.reactivePower;
+    record.reactivePower2 = load2.reactivePower;
+    record.powerFactor1 = load1.powerFactor;
+    record.powerFactor2 = load2.powerFactor;
+
+    if (ENABLE_HARMONICS) {
+        record.flags |= TelemetryRecord::FLAG_HARMONICS;
+        const HarmonicReading* readings[3] = {
+            &powerMeter.getVoltageHarmonics(), &powerMeter.getLoadHarmonics(0), &powerMeter.getLoadHarmonics(1)
+        };
+        for (uint8_t c = 0; c < 3; c++) {
+            record.thd[c] = readings[c]->thd;
+            for (uint8_t h = 0; h < HarmonicReading::COUNT - 1; h++) {
+                float percent = readings[c]->percent[h] * 100.0f + 0.5f;
+                record.harmonics[c][h] = percent < 65535.0f ? (uint16_t)percent : 65535;
+            }
+        }
     }
-    
+}
+
+// Relay and theft state as carried in the record flags
+uint8_t telemetryState() {
+    uint8_t state = 0;
+    if (theftDetector.isTheftDetected()) state |= TelemetryRecord::FLAG_THEFT;
+    if (pinConfig.getRelay1State()) state |= TelemetryRecord::FLAG_RELAY1;
+    if (pinConfig.getRelay2State()) state |= TelemetryRecord::FLAG_RELAY2;
+    return state;
+}
+
+// Take a reading and queue it unless report-by-exception suppresses it
+void captureTelemetry() {
+    TelemetryRecord record;
+    buildTelemetry(record);
+
+    float values[REPORT_CHANNELS] = {
+        record.voltage, record.frequency, record.current1, record.current2,
+        record.current3, record.power1, record.power2
+    };
+    uint8_t state = telemetryState();
+    uint8_t reason = exceptionReporter.check(values, state, millis());
+    exceptionReporter.update(reason, values, state, millis());
+    if (reason == REPORT_SUPPRESS) return;
+
+    // Queued by the storage task: a push may spill to flash
+    CapturedReading captured = {record, (reason & REPORT_STATE) != 0};
+    if (xQueueSend(captureQueue, &captured, 0) != pdTRUE) {
+        storageDropped++;
+        return;
+    }
+    storageScheduler.trigger(storeTaskId);
+}
+
+// Copy the TelemetryQueue counters (telemetryLock held, or before the tasks start)
+void publishTelemetryCounts() {
+    telemetryDepth = telemetryQueue.depth();
+    telemetryFlashDepth = telemetryQueue.getFlashDepth();
+    telemetryDropped = telemetryQueue.getDropped();
+}
+
+// Upload the oldest queued readings in one batch when the pacing allows.
+// Returns true if a batch was delivered.
+bool drainTelemetry() {
+    if (!webClient.isConnected() || !telemetryDrain.isDue(millis())) return false;
+
+    // The control task keeps capturing meanwhile: hold the lock only to copy the batch
+    TelemetryRecord batch[TELEMETRY_BATCH];
+    int32_t ages[TELEMETRY_BATCH];
+    uint8_t count = 0;
+    xSemaphoreTake(telemetryLock, portMAX_DELAY);
+    uint32_t depth = telemetryQueue.depth();
+    uint32_t dropped = telemetryQueue.getDropped();
+    // Wait for a full batch unless the last upload was a whole period ago or a state changed
+    if (depth > 0 && (telemetryUrgent || depth >= TELEMETRY_BATCH ||
+        (unsigned long)(millis() - previousWebMillis) >= webSendPeriod)) {
+        count = telemetryQueue.peek(batch, TELEMETRY_BATCH);
+        uint32_t uptime = millis() / 1000;
+        for (uint8_t i = 0; i < count; i++) {
+            uint32_t age;
+            ages[i] = telemetryQueue.ageOf(batch[i], uptime, age) ? (int32_t)age : -1;
+        }
+        publishTelemetryCounts();   // peek() drops an unreadable flash backlog
+    }
+    xSemaphoreGive(telemetryLock);
+    if (count == 0) return false;
+    previousWebMillis = millis();
+
+    uint8_t sent = webClient.sendReadings(batch, ages, count, depth, dropped);
+    if (sent > 0) {
+        xSemaphoreTake(telemetryLock, portMAX_DELAY);
+        telemetryQueue.ackThrough(batch[sent - 1].sequence);
+        publishTelemetryCounts();
+        xSemaphoreGive(telemetryLock);
+        telemetryDrain.succeeded(millis());
+        telemetryUrgent = false;
+        return true;
+    }
+    telemetryDrain.failed(millis());
+    return false;
+}
+
+// Sensor processing of one sampler frame
+void consumeFrame(const AdcFrame& frame) {
+    METRIC_SCOPE(STAGE_SAMPLING);
+    powerMeter.consume(frame);
+    pqMonitor.consume(frame);
+    leakage.consume(frame);
+    for (uint8_t c = 0; c < frame.channels; c++) adcSamples[c] += AdcFrame::SAMPLES;
+}
+
+// Achieved per-channel sample rate since the last call (as consumed, so
+// within a frame of the ADC's own timing)
+void updateSampleRates() {
+    uint32_t now = micros();
+    uint32_t elapsed = now - rateStartUs;
+    if (rateStartUs != 0 && elapsed > 0) {
+        for (uint8_t c = 0; c < AdcFrame::MAX_CHANNELS; c++) {
+            adcSampleRate[c] = (adcSamples[c] - rateSamples[c]) * 1e6f / elapsed;
+        }
+    }
+    memcpy(rateSamples, adcSamples, sizeof(rateSamples));
+    rateStartUs = now;
+}
+
+// Feed every completed sampler frame to the sensors (non-blocking)
+void processFrames() {
+    const AdcFrame* frame;
+    while ((frame = sampler.acquireFrame()) != nullptr) {
+        consumeFrame(*frame);
+        sampler.releaseFrame(frame);
+
+        // Integrate every completed power window into the energy registers and rollups
+        if (powerMeter.getWindowCount() != energyWindows) {
+            METRIC_SCOPE(STAGE_COMPUTE);
+            updateSampleRates();
+            energyWindows = powerMeter.getWindowCount();
+            const PowerReading& load1 = powerMeter.getReading(0);
+            const PowerReading& load2 = powerMeter.getReading(1);
+            // Registers before this window, where the rollup bucket of its second closes
+            uint64_t energyBeforeL1 = energyCalc.getEnergyL1Millijoules();
+            uint64_t energyBeforeL2 = energyCalc.getEnergyL2Millijoules();
+            energyCalc.addWindow(load1.realPower, load2.realPower,
+                                 powerMeter.getWindowSamples(),
+                                 powerMeter.getWindowSampleRate());
+
+            bool synced;
+            uint32_t now = currentTimestamp(synced);
+            RollupWindow rollup = {
+                {load1.voltage, load1.current, load2.current,
+                 powerMeter.getReading(2).current, load1.realPower, load2.realPower},
+                energyBeforeL1, energyBeforeL2, now, synced
+            };
+            if (xQueueSend(rollupQueue, &rollup, 0) == pdTRUE) {
+                storageScheduler.trigger(storeTaskId);
+            } else {
+                storageDropped++;
+            }
+            
+            LocalWindow window = {
+                energyWindows, now, synced, load1.voltage, powerMeter.getFrequency(),
+                load1.current, load2.current, powerMeter.getReading(2).current,
+                load1.realPower, load2.realPower,
+                energyCalc.getEnergyL1Millijoules(), energyCalc.getEnergyL2Millijoules()
+            };
+            localApi.publishWindow(window);
+
+            // Follow offset drift on idle branches once the boot check is done
+            calibrationStore.addWindow();
+            if (!calibrationStore.isChecking()) {
+                uint8_t relaysOn = (pinConfig.getRelay1State() ? OFFSET_RELAY1 : 0) |
+                                   (pinConfig.getRelay2State() ? OFFSET_RELAY2 : 0);
+                offsetTracker.addWindow(relaysOn, millis());
+            }
+            
+            if (!firstReadingDone && sensor1.isCalibrated() && sensor2.isCalibrated() && sensor3.isCalibrated()) {
+                firstReadingDone = true;
+                LOG_INFO(LOG_METER, "⏱️ First reading after %lu ms", millis());
+            }
+        }
+
+        // Sequential theft test, one step per completed mains cycle
+        if (leakage.getCycleCount() != leakageCycles) {
+            leakageCycles = leakage.getCycleCount();
+            if (theftDetector.update(leakage.getCycleFundamental(), sensor3.getCurrent(),
+                                     powerMeter.getFrequency())) {
+                theftPending = true;
+            }
+        }
+    }
+}
+
+// Latch the results of the last completed measurement windows
+void readSensors() {
+    METRIC_SCOPE(STAGE_COMPUTE);
     lastCurrent1 = sensor1.getCurrent();
     lastCurrent2 = sensor2.getCurrent();
     lastCurrent3 = sensor3.getCurrent();
     lastVoltage = voltageSensor.getRmsVoltage();
+    lastFrequency = powerMeter.getFrequency();
+    
+    lastLoad1 = powerMeter.getReading(0);
+    lastLoad2 = powerMeter.getReading(1);
     
     lastTotalCurrent = lastCurrent1 + lastCurrent2;
-    lastPower1 = lastVoltage * lastCurrent1;
-    lastPower2 = lastVoltage * lastCurrent2;
+    float averageLeakage = leakage.takeAverageLeakage();
+    if (averageLeakage >= 0) lastLeakage = averageLeakage;
+    lastPower1 = lastLoad1.realPower;
+    lastPower2 = lastLoad2.realPower;
     lastTotalPower = lastPower1 + lastPower2;
+    lastEnergy = energyCalc.getTotalEnergy();
+    lastCost = energyCalc.getTotalCost();
+    lastTheftRemaining = theftDetector.getRemainingTime();
+    
+    // Same values for LAN clients of the local API
+    LocalSnapshot snapshot;
+    snapshot.window = energyWindows;
+    snapshot.timestamp = currentTimestamp(snapshot.synced);
+    snapshot.voltage = lastVoltage;
+    snapshot.frequency = lastFrequency;
+    snapshot.current1 = lastCurrent1;
+    snapshot.current2 = lastCurrent2;
+    snapshot.current3 = lastCurrent3;
+    snapshot.power1 = lastPower1;
+    snapshot.power2 = lastPower2;
+    snapshot.apparentPower1 = lastLoad1.apparentPower;
+    snapshot.apparentPower2 = lastLoad2.apparentPower;
+    snapshot.powerFactor1 = lastLoad1.powerFactor;
+    snapshot.powerFactor2 = lastLoad2.powerFactor;
+    snapshot.leakage = lastLeakage;
+    snapshot.energyL1 = energyCalc.getEnergyL1Millijoules();
+    snapshot.energyL2 = energyCalc.getEnergyL2Millijoules();
+    snapshot.price = energyCalc.getPricePerUnit();
+    snapshot.relay1 = pinConfig.getRelay1State();
+    snapshot.relay2 = pinConfig.getRelay2State();
+    snapshot.theft = theftDetector.isTheftDetected();
+    localApi.setLatest(snapshot);
 }
 
-void updateAllDisplays() {
-    Serial.println("\n========== READINGS ==========");
-    Serial.print("Voltage: ");
-    Serial.print(lastVoltage, 2);
-    Serial.println(" V");
+// Send captured power-quality events one chunk at a time
+void uploadPowerQualityEvents() {
+    if (pqUpload == nullptr) {
+        pqUpload = pqMonitor.acquireEvent();
+        pqUploadChunk = 0;
+        pqUploadFailures = 0;
+        if (pqUpload == nullptr) return;
+        
+        LOG_INFO(LOG_METER, "📉 Power quality event captured: %s", PqEvent::typeName(pqUpload->type));
+    }
     
-    Serial.print("Current 1: ");
-    Serial.print(lastCurrent1, 3);
-    Serial.println(" A");
+    if (!webClient.isConnected()) return;
     
-    Serial.print("Current 2: ");
-    Serial.print(lastCurrent2, 3);
-    Serial.println(" A");
-
-    Serial.print("Main Current 3: ");
-    Serial.print(lastCurrent3, 3);
-    Serial.println(" A");
+    if (webClient.sendPowerQualityChunk(*pqUpload, pqUploadChunk)) {
+        pqUploadChunk++;
+        pqUploadFailures = 0;
+    } else if (++pqUploadFailures >= PQ_MAX_UPLOAD_FAILURES) {
+        LOG_WARN(LOG_NET, "❌ Power quality event upload abandoned");
+        pqUploadChunk = PqEvent::ROWS;  // Force release below
+    }
     
-    Serial.print("Total Current: ");
-    Serial.print(lastTotalCurrent, 3);
-    Serial.println(" A");
+    if ((uint32_t)pqUploadChunk * WebClient::PQ_CHUNK_ROWS >= PqEvent::ROWS) {
+        pqMonitor.releaseEvent(pqUpload);
+        pqUpload = nullptr;
+    }
+}
+
+// Apply relay states and price from the server (pushed command or poll)
+void applyServerSettings(bool relay1, bool relay2, bool relay3, float newPrice) {
+    pinConfig.setRelay1(relay1);
+    pinConfig.setRelay2(relay2);
     
-    Serial.print("Power 1: ");
-    Serial.print(lastPower1, 2);
-    Serial.println(" W");
+    // Check if relay3 is being turned on (theft reset)
+    if (relay3 && theftDetector.isTheftDetected()) {
+        pinConfig.setRelay3(true);
+        theftDetector.resetAlert();
+        UplinkMessage message = {UPLINK_THEFT_CLEARED};  // Clear theft status
+        sendUplink(message);
+        LOG_INFO(LOG_MAIN, "✅ Theft alert cleared from web dashboard");
+    }
     
-    Serial.print("Power 2: ");
-    Serial.print(lastPower2, 2);
-    Serial.println(" W");
+    // Update price if changed
+    if (newPrice > 0 && newPrice != energyCalc.getPricePerUnit()) {
+        energyCalc.setPricePerUnit(newPrice);
+    }
     
-    Serial.print("Total Power: ");
-    Serial.print(lastTotalPower, 2);
-    Serial.println(" W");
+    previousRelay1State = relay1;
+    previousRelay2State = relay2;
+}
+
+// Apply a pushed command at once and acknowledge it; the ack reports how long
+// the meter took from the complete event to the relay write
+void applyServerCommand(const ServerCommand& command) {
+    bool relay1 = pinConfig.getRelay1State();
+    bool relay2 = pinConfig.getRelay2State();
     
-    Serial.print("Relays: R1=");
-    Serial.print(pinConfig.getRelay1State() ? "ON" : "OFF");
-    Serial.print(" | R2=");
-    Serial.println(pinConfig.getRelay2State() ? "ON" : "OFF");
+    if (command.relay1 != relay1) {
+        LOG_INFO(LOG_NET, "🌐 Web command: Relay 1 → %s", command.relay1 ? "ON" : "OFF");
+    }
+    if (command.relay2 != relay2) {
+        LOG_INFO(LOG_NET, "🌐 Web command: Relay 2 → %s", command.relay2 ? "ON" : "OFF");
+    }
+    applyServerSettings(command.relay1, command.relay2, command.relay3, command.price);
     
+    UplinkMessage ack = {UPLINK_COMMAND_ACK};
+    ack.commandId = command.id;
+    ack.applyMicros = micros() - command.receivedUs;
+    sendUplink(ack);
+}
+
+void updateAllDisplays() {
+    METRIC_SCOPE(STAGE_DISPLAY);
+    LOG_INFO(LOG_MAIN, "========== READINGS ==========");
+    LOG_INFO(LOG_MAIN, "Voltage: %.2f V @ %.2f Hz", lastVoltage, lastFrequency);
+    LOG_INFO(LOG_MAIN, "Current 1: %.3f A | Current 2: %.3f A | Main Current 3: %.3f A | Total: %.3f A",
+             lastCurrent1, lastCurrent2, lastCurrent3, lastTotalCurrent);
+    LOG_INFO(LOG_MAIN, "Leakage: %.4f A | theft confidence %.0f %%",
+             lastLeakage, theftDetector.getConfidence() * 100.0);
+    LOG_INFO(LOG_MAIN, "Power 1: %.2f W | %.2f VA | PF %.2f",
+             lastPower1, lastLoad1.apparentPower, lastLoad1.powerFactor);
+    LOG_INFO(LOG_MAIN, "Power 2: %.2f W | %.2f VA | PF %.2f",
+             lastPower2, lastLoad2.apparentPower, lastLoad2.powerFactor);
+    LOG_INFO(LOG_MAIN, "Total Power: %.2f W", lastTotalPower);
+
+    LOG_INFO(LOG_NET, "Upload queue: %u waiting | %lu dropped | %lu unchanged, not sent",
+             telemetryDepth.load(), telemetryDropped.load(), exceptionReporter.getSuppressedCount());
+
+    const HttpStats& dataStats = webClient.getHttpStats(HTTP_DATA);
+    const HttpStats& pollStats = webClient.getHttpStats(HTTP_RELAY_POLL);
+    LOG_INFO(LOG_NET, "HTTP: upload %lu ms avg (max %lu) | poll %lu ms avg (max %lu) | %lu connections opened",
+             dataStats.averageMs(), dataStats.maxMs, pollStats.averageMs(), pollStats.maxMs,
+             webClient.getConnectionCount());
+    LOG_INFO(LOG_NET, "Local API: %u clients (%u streaming) | %lu requests | %lu events skipped",
+             localApi.getClientCount(), localApi.getStreamCount(),
+             localApi.getRequestCount(), localApi.getEventsSkipped());
+
+    for (uint8_t i = 0; i < offsetTracker.getChannelCount(); i++) {
+        LOG_INFO(LOG_METER, "Zero offset pin %u: %.1f mV (%.2f mV/h%s)",
+                 offsetTracker.getSensor(i).getPin(), offsetTracker.getSensor(i).getOffset(),
+                 offsetTracker.getDriftRate(i), offsetTracker.isIdle(i, millis()) ? ", tracking" : "");
+    }
+
+    heapMonitor.sample();
+    LOG_INFO(LOG_MAIN, "Heap: %lu B free (min %lu) | largest block %lu B | fragmentation %u %% (worst %u %%)",
+             heapMonitor.getFreeBytes(), heapMonitor.getMinFreeBytes(), heapMonitor.getLargestBlock(),
+             heapMonitor.getFragmentation(), heapMonitor.getWorstFragmentation());
+    LOG_INFO(LOG_MAIN, "Relays: R1=%s | R2=%s | heap block lows %lu",
+             pinConfig.getRelay1State() ? "ON" : "OFF", pinConfig.getRelay2State() ? "ON" : "OFF",
+             heapMonitor.getBlockLows());
+
     if (theftDetector.isTheftDetected()) {
-        Serial.println("⚠️ THEFT ALERT ACTIVE!");
+        LOG_WARN(LOG_MAIN, "⚠️ THEFT ALERT ACTIVE!");
     }
-    
-    Serial.println("==============================\n");
+}
 
-    display.showCurrents(lastCurrent1, lastCurrent2, lastVoltage);
+// ===================== METRICS =====================
+// One-sample metric family
+void writeScalar(MetricsWriter& w, const char* name, const char* type, const char* help, double value) {
+    w.family(name, type, help);
+    w.sample(name, nullptr, value);
 }
 
-void loop() {
-    webClient.maintain();
+// Instrumentation snapshot in the Prometheus text format, for GET /metrics on
+// the local API and the periodic upload to the server. The writer skips what
+// earlier parts already sent, so this runs once per part with no state of its own.
+void writeMetrics(MetricsWriter& w) {
+    char labels[64];
+    Metrics& metrics = Metrics::instance();
+    const DeadlineScheduler* schedulers[4] = {&controlScheduler, &networkScheduler, &reportScheduler,
+                                              &storageScheduler};
+
+    writeScalar(w, "meter_uptime_seconds", "gauge", "Time since boot", millis() / 1000.0);
+
+    w.family("meter_stage_duration_seconds", "histogram", "Time spent per hot-path stage run");
+    for (uint8_t s = 0; s < METRIC_STAGES; s++) {
+        snprintf(labels, sizeof(labels), "stage=\"%s\"", Metrics::stageName(s));
+        w.histogram("meter_stage_duration_seconds", labels, metrics.getStage(s));
+    }
+    w.family("meter_stage_duration_max_seconds", "gauge", "Longest stage run since boot");
+    for (uint8_t s = 0; s < METRIC_STAGES; s++) {
+        HistogramSnapshot snapshot;
+        metrics.getStage(s).snapshot(snapshot);
+        snprintf(labels, sizeof(labels), "stage=\"%s\"", Metrics::stageName(s));
+        w.sample("meter_stage_duration_max_seconds", labels, snapshot.maxUs / 1e6);
+    }
+
+    // Release-to-start latency of the scheduled tasks (loop jitter)
+    w.family("meter_scheduler_latency_seconds", "histogram", "Task release to start, all tasks of a scheduler");
+    for (uint8_t i = 0; i < 4; i++) {
+        snprintf(labels, sizeof(labels), "scheduler=\"%s\"", schedulers[i]->getName());
+        w.histogram("meter_scheduler_latency_seconds", labels, schedulers[i]->getLatencyHistogram());
+    }
+    w.family("meter_task_runs_total", "counter", "Task runs");
+    for (uint8_t i = 0; i < 4; i++) {
+        for (uint8_t t = 0; t < schedulers[i]->getTaskCount(); t++) {
+            snprintf(labels, sizeof(labels), "scheduler=\"%s\",task=\"%s\"",
+                     schedulers[i]->getName(), schedulers[i]->getTaskName(t));
+            w.sample("meter_task_runs_total", labels, schedulers[i]->getStats(t).runs);
+        }
+    }
+    w.family("meter_task_deadline_misses_total", "counter", "Task runs that finished after their deadline");
+    for (uint8_t i = 0; i < 4; i++) {
+        for (uint8_t t = 0; t < schedulers[i]->getTaskCount(); t++) {
+            snprintf(labels, sizeof(labels), "scheduler=\"%s\",task=\"%s\"",
+                     schedulers[i]->getName(), schedulers[i]->getTaskName(t));
+            w.sample("meter_task_deadline_misses_total", labels, schedulers[i]->getStats(t).misses);
+        }
+    }
+    w.family("meter_task_latency_max_seconds", "gauge", "Worst task release to start since boot");
+    for (uint8_t i = 0; i < 4; i++) {
+        for (uint8_t t = 0; t < schedulers[i]->getTaskCount(); t++) {
+            snprintf(labels, sizeof(labels), "scheduler=\"%s\",task=\"%s\"",
+                     schedulers[i]->getName(), schedulers[i]->getTaskName(t));
+            w.sample("meter_task_latency_max_seconds", labels, schedulers[i]->getStats(t).maxLatencyUs / 1e6);
+        }
+    }
+
+    // Sampling
+    w.family("meter_adc_samples_total", "counter", "Samples processed per channel");
+    for (uint8_t c = 0; c < sizeof(SAMPLED_PINS); c++) {
+        snprintf(labels, sizeof(labels), "pin=\"%u\"", SAMPLED_PINS[c]);
+        w.sample("meter_adc_samples_total", labels, adcSamples[c]);
+    }
+    w.family("meter_adc_sample_rate_hz", "gauge", "Achieved sample rate per channel over the last power window");
+    for (uint8_t c = 0; c < sizeof(SAMPLED_PINS); c++) {
+        snprintf(labels, sizeof(labels), "pin=\"%u\"", SAMPLED_PINS[c]);
+        w.sample("meter_adc_sample_rate_hz", labels, adcSampleRate[c]);
+    }
+    writeScalar(w, "meter_adc_overruns_total", "counter", "Sampler frames lost to a slow consumer",
+                sampler.getOverruns());
+    writeScalar(w, "meter_adc_sync_errors_total", "counter", "Sampler frames with out-of-order channels",
+                sampler.getSyncErrors());
+
+    // Server requests
+    w.family("meter_http_requests_total", "counter", "Requests to the server per endpoint");
+    for (uint8_t e = 0; e < HTTP_ENDPOINTS; e++) {
+        snprintf(labels, sizeof(labels), "endpoint=\"%s\"", httpEndpointName(e));
+        w.sample("meter_http_requests_total", labels, webClient.getHttpStats((HttpEndpoint)e).requests);
+    }
+    w.family("meter_http_failures_total", "counter", "Requests not answered with HTTP 200");
+    for (uint8_t e = 0; e < HTTP_ENDPOINTS; e++) {
+        snprintf(labels, sizeof(labels), "endpoint=\"%s\"", httpEndpointName(e));
+        w.sample("meter_http_failures_total", labels, webClient.getHttpStats((HttpEndpoint)e).failures);
+    }
+    w.family("meter_http_request_duration_seconds", "summary", "Request to end of response per endpoint");
+    for (uint8_t e = 0; e < HTTP_ENDPOINTS; e++) {
+        const HttpStats& stats = webClient.getHttpStats((HttpEndpoint)e);
+        snprintf(labels, sizeof(labels), "endpoint=\"%s\"", httpEndpointName(e));
+        w.sample("meter_http_request_duration_seconds_sum", labels, stats.totalMs / 1000.0);
+        w.sample("meter_http_request_duration_seconds_count", labels, stats.requests);
+    }
+    w.family("meter_http_request_duration_max_seconds", "gauge", "Slowest request per endpoint since boot");
+    for (uint8_t e = 0; e < HTTP_ENDPOINTS; e++) {
+        snprintf(labels, sizeof(labels), "endpoint=\"%s\"", httpEndpointName(e));
+        w.sample("meter_http_request_duration_max_seconds", labels,
+                 webClient.getHttpStats((HttpEndpoint)e).maxMs / 1000.0);
+    }
+    writeScalar(w, "meter_http_connections_total", "counter", "TCP connections opened to the server",
+                webClient.getConnectionCount());
+    uint32_t wifiConnects = webClient.getWifiConnectCount();
+    writeScalar(w, "meter_wifi_reconnects_total", "counter", "WiFi connections after the first",
+                wifiConnects > 0 ? wifiConnects - 1 : 0);
+    writeScalar(w, "meter_wifi_connected", "gauge", "1 while WiFi is up", webClient.isConnected() ? 1 : 0);
+    writeScalar(w, "meter_local_api_requests_total", "counter", "Requests served by the local API",
+                localApi.getRequestCount());
+
+    // Memory and queues
+    writeScalar(w, "meter_heap_free_bytes", "gauge", "Free heap", heapMonitor.getFreeBytes());
+    writeScalar(w, "meter_heap_min_free_bytes", "gauge", "Lowest free heap since boot",
+                heapMonitor.getMinFreeBytes());
+    writeScalar(w, "meter_heap_largest_block_bytes", "gauge", "Largest free heap block",
+                heapMonitor.getLargestBlock());
+    writeScalar(w, "meter_telemetry_queue_depth", "gauge", "Readings waiting for upload", telemetryDepth.load());
+    writeScalar(w, "meter_telemetry_dropped_total", "counter", "Readings dropped from a full upload queue",
+                telemetryDropped.load());
+    writeScalar(w, "meter_uplink_dropped_total", "counter", "Messages to the server dropped (network task behind)",
+                uplinkDropped);
+    writeScalar(w, "meter_storage_dropped_total", "counter",
+                "Readings and rollup windows dropped (storage task behind)", storageDropped);
+    EventLog& log = EventLog::instance();
+    writeScalar(w, "meter_log_events_total", "counter", "Log events written", log.getWritten());
+    writeScalar(w, "meter_log_dropped_total", "counter", "Log events dropped (ring full)", log.getDropped());
+    writeScalar(w, "meter_lcd_i2c_bytes_total", "counter", "I2C bytes sent to the LCD", display.getI2cBytes());
+}
+
+// ===================== TASKS =====================
+// Hand a message to the network task; dropped (and counted) if it is far behind
+void sendUplink(const UplinkMessage& message) {
+    if (xQueueSend(uplinkQueue, &message, 0) != pdTRUE) {
+        uplinkDropped++;
+        return;
+    }
+    networkScheduler.trigger(uplinkTaskId);
+}
+
+// A relay or theft change is captured right away instead of at the next period
+void captureOnStateChange() {
+    if (exceptionReporter.stateChanged(telemetryState())) {
+        controlScheduler.trigger(captureTaskId);
+    }
+}
+
+// ---------- Control task (core 1) ----------
+
+// Relay and price settings received by the network task
+void commandTask() {
+    QueuedCommand queued;
+    while (xQueueReceive(commandQueue, &queued, 0) == pdTRUE) {
+        const ServerCommand& command = queued.command;
+        if (command.id != 0) {
+            applyServerCommand(command);
+        } else if (queued.localChanges == localRelayChanges) {
+            applyServerSettings(command.relay1, command.relay2, command.relay3, command.price);
+        }
+    }
+    captureOnStateChange();
+}
+
+void irTask() {
+    if (!irHandler.update()) {
+        if (irHandler.takePageRequest()) {
+            display.nextPage();
+            reportScheduler.trigger(lcdTaskId);
+        }
+        return;
+    }
+    bool currentRelay1 = pinConfig.getRelay1State();
+    bool currentRelay2 = pinConfig.getRelay2State();
+    
+    LOG_INFO(LOG_MAIN, "📡 IR remote triggered - syncing with server...");
+    UplinkMessage message = {UPLINK_RELAY_STATE, currentRelay1, currentRelay2};
+    sendUplink(message);
+    localRelayChanges++;    // Counted after queueing, see relayPollTask()
     
-    // Update buzzer if theft detected
+    previousRelay1State = currentRelay1;
+    previousRelay2State = currentRelay2;
+    captureOnStateChange();
+}
+
+// Buzzer pattern and the theft alarm raised by processFrames()
+void theftTask() {
     theftDetector.updateBuzzer();
+    if (!theftPending) return;
+    theftPending = false;
     
-    // ========== IR REMOTE CONTROL ==========
-    if (irHandler.update()) {
-        bool currentRelay1 = pinConfig.getRelay1State();
-        bool currentRelay2 = pinConfig.getRelay2State();
-        
-        Serial.println("📡 IR remote triggered - syncing with server...");
-        
-        if (webClient.isConnected()) {
-            webClient.postRelayState(currentRelay1, currentRelay2);
+    // New theft detected - turn off relay3
+    pinConfig.setRelay3(false);
+    LOG_ERROR(LOG_MAIN, "🚨 RELAY 3 TURNED OFF DUE TO THEFT!");
+    
+    // Notify server about theft
+    UplinkMessage message = {UPLINK_THEFT_ALERT};
+    message.confidence = theftDetector.getConfidence();
+    message.leakage = theftDetector.getLastLeakage();
+    sendUplink(message);
+    captureOnStateChange();
+}
+
+// Stamped at capture and queued even while offline; drainTelemetry() batches it
+void captureTask() {
+    captureTelemetry();
+    // While a backlog waits in flash, capture at the upload period instead so the
+    // flash ring covers hours of outage rather than about one
+    controlScheduler.setPeriod(captureTaskId,
+        telemetryFlashDepth.load() > 0 ? webSendPeriod : telemetryPeriod);
+}
+
+// Latch readings here, next to the frame processing; print them on the report task
+void latchTask() {
+    readSensors();
+    reportScheduler.trigger(displayTaskId);
+}
+
+// Copy the energy registers for the storage task
+void energyHandoffTask() {
+    energyCalc.queueSave();
+    storageScheduler.trigger(energySaveTaskId);
+}
+
+// ---------- Report task (core 1, preempted by control) ----------
+
+// Write log lines while the UART takes them without blocking, and take
+// "log <module|all> <level>" commands from the serial console
+void logTask() {
+    EventLog& log = EventLog::instance();
+    while (Serial.available() > 0) {
+        int ch = Serial.read();
+        if (ch == '\r' || ch == '\n') {
+            consoleLine[consoleLength] = '\0';
+            if (consoleLength > 0) log.command(consoleLine);
+            consoleLength = 0;
+        } else if (consoleLength < sizeof(consoleLine) - 1) {
+            consoleLine[consoleLength++] = (char)ch;
         }
-        
-        previousRelay1State = currentRelay1;
-        previousRelay2State = currentRelay2;
     }
+    log.drain(Serial);
+}
 
-    // ========== PRINT READINGS AND UPDATE DISPLAY ==========
-    if ((unsigned long)(millis() - previousMillis) >= printPeriod) {
-        previousMillis = millis();
-        
-        readSensors();
-        updateAllDisplays();
-        
-        // Update energy calculation
-        energyCalc.updateEnergy(lastPower1, lastPower2);
-        
-        // Check for theft
-        if (theftDetector.checkTheft(lastCurrent3, lastTotalCurrent)) {
-            // New theft detected - turn off relay3
-            pinConfig.setRelay3(false);
-            Serial.println("🚨 RELAY 3 TURNED OFF DUE TO THEFT!");
-            
-            // Notify server about theft
-            if (webClient.isConnected()) {
-                webClient.sendTheftAlert(true);
-            }
+// LCD page from the latched readings; a theft alarm building or raised keeps its page up
+void lcdTask() {
+    METRIC_SCOPE(STAGE_DISPLAY);
+    uint8_t page = display.pageAt(millis());
+    if (theftDetector.isTheftDetected() || lastTheftRemaining > 0) page = DISPLAY_THEFT;
+    switch (page) {
+        case DISPLAY_CURRENTS:
+            display.showCurrents(lastCurrent1, lastCurrent2, lastVoltage, lastFrequency);
+            break;
+        case DISPLAY_POWER:
+            display.showPower(lastPower1, lastLoad1.powerFactor, lastPower2, lastLoad2.powerFactor);
+            break;
+        case DISPLAY_ENERGY:
+            display.showEnergy(lastEnergy, lastCost, energyCalc.getPricePerUnit());
+            break;
+        case DISPLAY_THEFT:
+            display.showTheft(theftDetector.isTheftDetected(), theftDetector.getConfidence(),
+                              lastTheftRemaining, lastLeakage);
+            break;
+    }
+}
+
+void statsTask() {
+    controlScheduler.printStats();
+    networkScheduler.printStats();
+    reportScheduler.printStats();
+    storageScheduler.printStats();
+    if (uplinkDropped > 0) {
+        LOG_WARN(LOG_TASKS, "⚠️ Messages to the server dropped (network task behind): %lu", uplinkDropped);
+    }
+    if (storageDropped > 0) {
+        LOG_WARN(LOG_TASKS, "⚠️ Readings and windows dropped (storage task behind): %lu", storageDropped);
+    }
+    uint32_t lcdUpdates = display.getUpdateCount();
+    if (lcdUpdates > 0) {
+        LOG_INFO(LOG_TASKS, "LCD: %lu updates | %lu I2C bytes per update (%lu with clear() redraws)",
+                 lcdUpdates, display.getI2cBytes() / lcdUpdates, display.getRedrawI2cBytes() / lcdUpdates);
+    }
+    EventLog& log = EventLog::instance();
+    LOG_INFO(LOG_TASKS, "Log: %lu events | %lu dropped (ring full) | ring high water %u of %u",
+             log.getWritten(), log.getDropped(), log.getHighWater(), EventLog::RING_SIZE);
+}
+
+// ---------- Storage task (core 1, preempted by control) ----------
+
+// Readings and rollup windows handed over by the control task
+void storeTask() {
+    METRIC_SCOPE(STAGE_FLASH);  // Telemetry spills and rollup records (with sector erases)
+    CapturedReading captured;
+    while (xQueueReceive(captureQueue, &captured, 0) == pdTRUE) {
+        xSemaphoreTake(telemetryLock, portMAX_DELAY);
+        telemetryQueue.push(captured.record);
+        publishTelemetryCounts();
+        xSemaphoreGive(telemetryLock);
+        if (captured.urgent) telemetryUrgent = true;
+    }
+    
+    RollupWindow window;
+    while (xQueueReceive(rollupQueue, &window, 0) == pdTRUE) {
+        xSemaphoreTake(rollupLock, portMAX_DELAY);
+        rollupStore.addWindow(window.values, window.energyL1, window.energyL2, window.timestamp, window.synced);
+        xSemaphoreGive(rollupLock);
+    }
+}
+
+// Energy registers, price and zero offsets handed over by the control task
+void energySaveTask() {
+    METRIC_SCOPE(STAGE_FLASH);
+    energyCalc.saveToFlash();
+    calibrationStore.saveIfMoved(millis());
+}
+
+// Theft noise model to NVS (the control task only hands over a copy)
+void theftModelTask() {
+    METRIC_SCOPE(STAGE_FLASH);
+    if (theftDetector.saveModel()) {
+        LOG_DEBUG(LOG_MAIN, "Theft model saved");
+    }
+}
+
+// ---------- Network task (core 0) ----------
+
+// Send what the control task queued: relay sync, theft alerts, command acks
+void uplinkTask() {
+    UplinkMessage message;
+    while (xQueueReceive(uplinkQueue, &message, 0) == pdTRUE) {
+        if (!webClient.isConnected()) continue;
+        switch (message.type) {
+            case UPLINK_RELAY_STATE:
+                webClient.postRelayState(message.relay1, message.relay2);
+                break;
+            case UPLINK_THEFT_ALERT:
+                webClient.sendTheftAlert(true, message.confidence, message.leakage);
+                break;
+            case UPLINK_THEFT_CLEARED:
+                webClient.sendTheftAlert(false);
+                break;
+            case UPLINK_COMMAND_ACK:
+                webClient.ackCommand(message.commandId, message.applyMicros);
+                break;
         }
     }
+}
 
-    // ========== SEND DATA TO SERVER ==========
-    if ((unsigned long)(millis() - previousWebMillis) >= webSendPeriod) {
-        previousWebMillis = millis();
-        
-        if (webClient.isConnected()) {
-            Serial.println("📤 Sending data to server...");
-            
-            // Send sensor data with energy values
-            webClient.sendCompleteData(
-                lastVoltage,
-                lastCurrent1,
-                lastCurrent2,
-                lastCurrent3,
-                lastTotalCurrent,
-                lastPower1,
-                lastPower2,
-                lastTotalPower,
-                energyCalc.getEnergyL1(),
-                energyCalc.getEnergyL2(),
-                energyCalc.getTotalEnergy(),
-                energyCalc.getCostL1(),
-                energyCalc.getCostL2(),
-                energyCalc.getTotalCost(),
-                theftDetector.isTheftDetected()
-            );
+// Commands pushed by the server go straight to the control task
+void commandStreamTask() {
+    QueuedCommand queued;
+    queued.localChanges = 0;
+    while (commandChannel.poll(queued.command, millis())) {
+        if (xQueueSend(commandQueue, &queued, 0) == pdTRUE) {
+            controlScheduler.trigger(commandTaskId);
         }
     }
+    // Commands normally arrive pushed; polling is the fallback
+    networkScheduler.setPeriod(relayPollTaskId,
+        commandChannel.isConnected() ? relayFallbackPeriod : relayPollPeriod);
+}
+
+// Readings and offsets reach the local API without a lock (see LocalApi); only
+// the rollup store, written by the storage task, is held while serving
+void localApiTask() {
+    xSemaphoreTake(rollupLock, portMAX_DELAY);
+    localApi.poll(millis());
+    xSemaphoreGive(rollupLock);
+}
+
+void wifiTask() {
+    webClient.maintain();
+    
+    // WiFi comes up after boot: tell the server the relay state once it does
+    if (!initialSyncDone && webClient.isConnected()) {
+        LOG_INFO(LOG_NET, "🔄 Performing initial relay state sync...");
+        webClient.postRelayState(pinConfig.getRelay1State(), pinConfig.getRelay2State());
+        initialSyncDone = true;
+    }
+}
+
+void drainTask() {
+    // Without the command channel, poll for commands right after an upload so
+    // both requests go back-to-back on the still-open keep-alive connection
+    if (drainTelemetry() && !commandChannel.isConnected()) {
+        networkScheduler.trigger(relayPollTaskId);
+    }
+}
+
+void relayPollTask() {
+    if (!webClient.isConnected()) return;
     
-    // ========== POLL SERVER FOR COMMANDS ==========
-    if ((unsigned long)(millis() - previousRelayPoll) >= relayPollPeriod) {
-        previousRelayPoll = millis();
-        
-        if (webClient.isConnected()) {
-            bool relay1 = pinConfig.getRelay1State();
-            bool relay2 = pinConfig.getRelay2State();
-            bool relay3 = !theftDetector.isTheftDetected(); // Current state
-            float newPrice = 0;
-            
-            // Check server for new commands
-            if (webClient.getRelayAndSettings(relay1, relay2, relay3, newPrice)) {
-                pinConfig.setRelay1(relay1);
-                pinConfig.setRelay2(relay2);
-                
-                // Check if relay3 is being turned on (theft reset)
-                if (relay3 && theftDetector.isTheftDetected()) {
-                    pinConfig.setRelay3(true);
-                    theftDetector.resetAlert();
-                    webClient.sendTheftAlert(false); // Clear theft status
-                    Serial.println("✅ Theft alert cleared from web dashboard");
-                }
-                
-                // Update price if changed
-                if (newPrice > 0 && newPrice != energyCalc.getPricePerUnit()) {
-                    energyCalc.setPricePerUnit(newPrice);
-                }
-                
-                previousRelay1State = relay1;
-                previousRelay2State = relay2;
-            }
+    // Relay changes made locally reach the server before it is asked for the
+    // state; one made after this point makes the control task drop the answer
+    QueuedCommand queued;
+    queued.localChanges = localRelayChanges;
+    uplinkTask();
+    
+    ServerCommand& command = queued.command;
+    command.id = 0;
+    command.relay1 = pinConfig.getRelay1State();
+    command.relay2 = pinConfig.getRelay2State();
+    command.relay3 = !theftDetector.isTheftDetected(); // Current state
+    command.price = 0;
+    
+    // Check server for new commands
+    if (webClient.getRelayAndSettings(command.relay1, command.relay2, command.relay3, command.price)) {
+        command.receivedUs = micros();
+        if (xQueueSend(commandQueue, &queued, 0) == pdTRUE) {
+            controlScheduler.trigger(commandTaskId);
         }
     }
-    
-    // ========== SAVE ENERGY DATA ==========
-    if ((unsigned long)(millis() - previousEnergySave) >= energySavePeriod) {
-        previousEnergySave = millis();
-        energyCalc.saveToFlash();
+}
+
+void powerQualityTask() {
+    uploadPowerQualityEvents();
+}
+
+// Publish a metrics snapshot every metricsPushPeriod, one part per run; a
+// failed part drops the snapshot (the next one is complete again)
+void metricsTask() {
+    if (!webClient.isConnected()) {
+        metricsPushing = false;
+        return;
+    }
+    if (!metricsPushing) {
+        if (millis() - lastMetricsPush < metricsPushPeriod) return;
+        lastMetricsPush = millis();
+        metricsPushing = true;
+        metricsItem = 0;
+        metricsPart = 0;
     }
-}
\ No newline at end of file
+    bool last = false;
+    if (!webClient.sendMetricsPart(writeMetrics, metricsItem, metricsPart, last)) {
+        LOG_DEBUG(LOG_NET, "Metrics snapshot upload failed at part %u", metricsPart);
+        metricsPushing = false;
+        return;
+    }
+    metricsPart++;
+    if (last) metricsPushing = false;
+}
+
+// Everything runs on the two scheduler tasks started in setup()
+void loop() {
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,97 @@
+// Size and encode time of a telemetry batch: the JSON batch written by
+// WebClient::appendReading against the delta-coded MessagePack TelemetryEncoder.
+// 10000 synced readings with harmonics, uploaded in batches of 10, once with
+// measurement noise on every value and once with a steady load.
+#include <chrono>
+#include <random>
+#include <string.h>
+#include "WebClient.h"
+#include "TelemetryCodec.h"
+
+static const int READINGS = 10000;
+static const int BATCH = 10;
+static const int REPEATS = 20;
+
+static void makeReadings(TelemetryRecord* records, bool noisy) {
+    std::mt19937 rng(5);
+    std::normal_distribution<float> gauss(0.0f, 1.0f);
+    float k = noisy ? 1.0f : 0.0f;
+    uint64_t energyL1 = 4444200000000ULL, energyL2 = 314100000000ULL;
+    for (int i = 0; i < READINGS; i++) {
+        TelemetryRecord& r = records[i];
+        memset(&r, 0, sizeof r);
+        r.sequence = 40960 + i;
+        r.timestamp = 1760000000 + i;
+        r.flags = TelemetryRecord::FLAG_SYNCED | TelemetryRecord::FLAG_HARMONICS;
+        r.voltage = 231.4f + k * 0.3f * gauss(rng);
+        r.frequency = 50.01f + k * 0.005f * gauss(rng);
+        r.current1 = 2.512f + k * 0.004f * gauss(rng);
+        r.current2 = 0.433f + k * 0.002f * gauss(rng);
+        r.current3 = r.current1 + r.current2;
+        r.power1 = r.voltage * r.current1 * 0.97f;
+        r.power2 = r.voltage * r.current2 * 0.6f;
+        energyL1 += (uint64_t)(r.power1 * 1000);
+        energyL2 += (uint64_t)(r.power2 * 1000);
+        r.energyL1 = energyL1;
+        r.energyL2 = energyL2;
+        r.apparentPower1 = r.voltage * r.current1;
+        r.apparentPower2 = r.voltage * r.current2;
+        r.reactivePower1 = r.apparentPower1 * 0.243f;
+        r.reactivePower2 = r.apparentPower2 * 0.8f;
+        r.powerFactor1 = 0.97f;
+        r.powerFactor2 = 0.6f;
+        for (int c = 0; c < 3; c++) {
+            r.thd[c] = 3.1f + c + k * 0.05f * gauss(rng);
+            for (int h = 0; h < 5; h++) {
+                r.harmonics[c][h] = (uint16_t)(250 - 40 * h + k * 3 * gauss(rng));
+            }
+        }
+    }
+}
+
+// Same document as WebClient::encodeJson
+static size_t encodeJson(char* out, size_t size, const TelemetryRecord* records, const int32_t* ages) {
+    int length = snprintf(out, size, "{\"queue_depth\":%lu,\"queue_dropped\":%lu,\"readings\":[",
+                          (unsigned long)BATCH, 0UL);
+    for (int i = 0; i < BATCH; i++) {
+        length += WebClient::appendReading(out + length, size - length - 2, records[i], ages[i], i > 0);
+    }
+    length += snprintf(out + length, size - length, "]}");
+    return length;
+}
+
+static size_t encodeBinary(char* out, size_t size, const TelemetryRecord* records, const int32_t* ages) {
+    TelemetryEncoder encoder((uint8_t*)out, size, BATCH, 0);
+    for (int i = 0; i < BATCH; i++) {
+        encoder.add(records[i], ages[i]);
+    }
+    return encoder.finish();
+}
+
+template <typename Encode>
+static void measure(const char* name, const TelemetryRecord* records, Encode encode) {
+    static char buffer[8192];
+    static const int32_t ages[BATCH] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+    size_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < READINGS; i += BATCH) {
+            bytes += encode(buffer, sizeof buffer, records + i, ages);
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    double readings = (double)READINGS * REPEATS;
+    printf("  %-8s %7.1f bytes/reading %8.0f ns/reading\n", name, bytes / readings, ns / readings);
+}
+
+int main() {
+    static TelemetryRecord records[READINGS];
+    const bool loads[] = {true, false};
+    for (bool noisy : loads) {
+        makeReadings(records, noisy);
+        printf("%s load, batches of %d:\n", noisy ? "noisy" : "steady", BATCH);
+        measure("json", records, encodeJson);
+        measure("msgpack", records, encodeBinary);
+    }
+    return 0;
+}
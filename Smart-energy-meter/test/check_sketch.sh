@@ -0,0 +1,18 @@
+#!/bin/sh
+# Type-check main.ino against the host stubs (no firmware is built).
+# Arduino prepends prototypes of the sketch's functions; do the same here.
+set -e
+out=build/sketch
+mkdir -p $out
+ln -sf ../../../main/current.h $out/Current.h
+sed -e 's/sampler\.start(0)/true/' ../main/main.ino > $out/main_body.inc
+grep -E '^[A-Za-z_][A-Za-z_0-9<>:*& ]* [*&]?[A-Za-z_][A-Za-z_0-9]*\([^;]*\) *\{' $out/main_body.inc \
+    | grep -vE '^(if|while|for|switch|struct|class|enum)' | sed -e 's/ *{$/;/' > $out/protos.inc
+{
+    echo '#include "sketch_prelude.h"'
+    sed -e "/^void setup() {/e cat $out/protos.inc" $out/main_body.inc
+    echo 'int main() { setup(); return 0; }'
+} > $out/main.cpp
+${CXX:-g++} -std=c++17 -fsyntax-only -Wall -Wextra -Wno-unused-parameter -Wno-missing-field-initializers \
+    -Istubs -I. -I$out -I../main $out/main.cpp
+echo "main.ino: ok"
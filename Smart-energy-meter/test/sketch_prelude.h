@@ -0,0 +1,14 @@
+// Host stand-ins for the ARDUINO-only classes main.ino instantiates
+#include <Arduino.h>
+#include "AdcSampler.h"
+#include "FlashPartition.h"
+
+struct Esp32AdcSource : public FakeAdcSource {};
+
+struct Esp32FlashPartition : public RamFlashPartition {
+    explicit Esp32FlashPartition(const char*) : RamFlashPartition(16) {}
+};
+
+#define ARDUINO
+#include "DeadlineScheduler.h"
+#undef ARDUINO
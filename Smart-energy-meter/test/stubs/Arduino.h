@@ -0,0 +1,84 @@
+// Host stand-in for the parts of the Arduino core and FreeRTOS the sketch uses
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <type_traits>
+
+struct Print {
+  virtual ~Print() {}
+  virtual size_t write(const uint8_t*, size_t n) { return n; }
+  virtual int availableForWrite() { return 0; }
+};
+
+struct SerialStub : Print {
+  size_t write(const uint8_t* d, size_t n) override { fwrite(d, 1, n, stdout); return n; }
+  int availableForWrite() override { return 128; }
+  int available() { return 0; }
+  int read() { return -1; }
+  template<class T> void print(T) {}
+  template<class T> void print(T, int) {}
+  template<class T> void println(T) {}
+  template<class T> void println(T, int) {}
+  void println() {}
+  void begin(unsigned long) {}
+};
+inline SerialStub Serial;
+
+// Monotonic clock; a test can switch it to manual and step it (hostClock().advance())
+struct HostClock {
+  bool manual = false;
+  uint64_t us = 0;
+  void set(uint64_t t) { manual = true; us = t; }
+  void advance(uint64_t d) { manual = true; us += d; }
+};
+inline HostClock& hostClock() { static HostClock c; return c; }
+inline uint64_t nowUs() {
+  if (hostClock().manual) return hostClock().us;
+  timespec t; clock_gettime(CLOCK_MONOTONIC, &t); return t.tv_sec * 1000000ull + t.tv_nsec / 1000;
+}
+inline unsigned long millis() { return (unsigned long)(nowUs() / 1000); }
+inline unsigned long micros() { return (unsigned long)nowUs(); }
+inline void delay(unsigned long ms) { if (hostClock().manual) hostClock().advance(ms * 1000ull); else usleep(ms * 1000); }
+
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define INPUT 0
+#define INPUT_PULLUP 2
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return 0; }
+inline void configTime(long, int, const char*, const char* = nullptr, const char* = nullptr) {}
+
+// FreeRTOS: single-threaded no-ops, enough to compile the sketch
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void* TaskHandle_t;
+typedef void* QueueHandle_t;
+typedef void* SemaphoreHandle_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xFFFFFFFF
+#define portTICK_PERIOD_MS 1
+inline QueueHandle_t xQueueCreate(UBaseType_t, UBaseType_t) { return nullptr; }
+inline BaseType_t xQueueSend(QueueHandle_t, const void*, TickType_t) { return pdTRUE; }
+inline BaseType_t xQueueReceive(QueueHandle_t, void*, TickType_t) { return pdFALSE; }
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return nullptr; }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t) { return pdTRUE; }
+inline void vTaskDelete(TaskHandle_t) {}
+inline void vTaskDelay(TickType_t) {}
+inline void taskYIELD() {}
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { return 0; }
+inline BaseType_t xTaskNotifyGive(TaskHandle_t) { return pdTRUE; }
+inline BaseType_t xTaskCreatePinnedToCore(void (*)(void*), const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*, BaseType_t) { return pdPASS; }
+
+struct EspClass { uint32_t getCycleCount() { return micros() * 240; } uint32_t getCpuFreqMHz() { return 240; } };
+inline EspClass ESP;
@@ -0,0 +1,38 @@
+// Minimal stand-in for the ArduinoJson calls the sketch makes (flat objects of numbers and booleans)
+#pragma once
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+struct JsonVal {
+  const char* k; double* v; bool* set;
+  JsonVal& operator=(double x) { *v = x; *set = true; return *this; }
+  operator bool() const { return *v != 0; }
+  operator float() const { return (float)*v; }
+  template<class T> T operator|(T d) const { return *set ? (T)*v : d; }
+  operator uint32_t() const { return (uint32_t)*v; }
+};
+template<size_t N> struct StaticJsonDocument {
+  const char* keys[8]; double vals[8]; bool set[8]; int n = 0;
+  JsonVal operator[](const char* k) {
+    for (int i = 0; i < n; i++) if (!strcmp(keys[i], k)) return JsonVal{k, &vals[i], &set[i]};
+    keys[n] = k; vals[n] = 0; set[n] = false; n++; return JsonVal{k, &vals[n-1], &set[n-1]};
+  }
+};
+struct DeserializationError { bool e = false; operator bool() const { return e; } };
+template<class D> size_t serializeJson(D& d, char* out, size_t size) {
+  size_t len = snprintf(out, size, "{");
+  for (int i = 0; i < d.n; i++) len += snprintf(out + len, size - len, "%s\"%s\":%g", i ? "," : "", d.keys[i], d.vals[i]);
+  len += snprintf(out + len, size - len, "}");
+  return len;
+}
+template<class D> DeserializationError deserializeJson(D& d, char* in, size_t) {
+  DeserializationError e; if (in[0] != '{') { e.e = true; return e; }
+  static const char* const names[] = {"id", "relay1", "relay2", "relay3", "price"};
+  for (const char* k : names) {
+    char pat[24]; snprintf(pat, sizeof(pat), "\"%s\":", k);
+    const char* p = strstr(in, pat); if (!p) continue;
+    p += strlen(pat); while (*p == ' ') p++;
+    d[k] = !strncmp(p, "true", 4) ? 1.0 : !strncmp(p, "false", 5) ? 0.0 : atof(p);
+  }
+  return e;
+}
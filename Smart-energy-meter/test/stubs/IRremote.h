@@ -0,0 +1,6 @@
+// Host stand-in so the sketch compiles; does nothing
+#pragma once
+#define ENABLE_LED_FEEDBACK true
+struct IRData { unsigned long decodedRawData; };
+struct IRrecvStub { IRData decodedIRData; void begin(int, bool) {} bool decode() { return false; } void resume() {} };
+inline IRrecvStub IrReceiver;
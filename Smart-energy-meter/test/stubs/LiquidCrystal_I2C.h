@@ -0,0 +1,19 @@
+// Host stand-in: keeps what a 16x2 LCD would show and counts the commands and
+// characters sent to it. last() is the most recently constructed one.
+#pragma once
+#include <string.h>
+#include <stdio.h>
+struct LiquidCrystal_I2C {
+  char ram[2][16];
+  int col = 0, row = 0;
+  unsigned long bytes = 0;    // LCD bytes: commands and characters
+  unsigned long clears = 0;
+  LiquidCrystal_I2C(int, int, int) { memset(ram, ' ', sizeof ram); last() = this; }
+  static LiquidCrystal_I2C*& last() { static LiquidCrystal_I2C* lcd = nullptr; return lcd; }
+  void init() {} void begin(int = 0, int = 0) {} void backlight() {}
+  void clear() { memset(ram, ' ', sizeof ram); col = row = 0; bytes++; clears++; }
+  void setCursor(int c, int r) { col = c; row = r; bytes++; }
+  size_t write(uint8_t b) { if (row < 2 && col < 16) ram[row][col] = b; col++; bytes++; return 1; }
+  void print(const char* s) { while (*s) write(*s++); }
+  void print(double v, int digits = 2) { char t[24]; snprintf(t, sizeof t, "%.*f", digits, v); print(t); }
+};
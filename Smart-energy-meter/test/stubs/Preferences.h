@@ -0,0 +1,34 @@
+// Host stand-in for Preferences (NVS), kept in memory for the life of the process
+#pragma once
+#include <map>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+struct Preferences {
+  static std::map<std::string, std::vector<uint8_t>>& store() { static std::map<std::string, std::vector<uint8_t>> s; return s; }
+  std::string ns;
+  bool begin(const char* n, bool = false) { ns = n; return true; }
+  void end() {}
+  template<class T> size_t put(const char* k, T v) { auto& b = store()[ns + "/" + k]; b.resize(sizeof(T)); memcpy(b.data(), &v, sizeof(T)); return sizeof(T); }
+  template<class T> T get(const char* k, T d) { auto it = store().find(ns + "/" + k); if (it == store().end()) return d; T v; memcpy(&v, it->second.data(), sizeof(T)); return v; }
+  bool isKey(const char* k) { return store().count(ns + "/" + k) > 0; }
+  bool remove(const char* k) { return store().erase(ns + "/" + k) > 0; }
+  bool clear() { for (auto it = store().begin(); it != store().end();) { if (it->first.rfind(ns + "/", 0) == 0) it = store().erase(it); else ++it; } return true; }
+  size_t putFloat(const char* k, float v) { return put(k, v); }
+  float getFloat(const char* k, float d = 0) { return get(k, d); }
+  size_t putULong64(const char* k, uint64_t v) { return put(k, v); }
+  uint64_t getULong64(const char* k, uint64_t d = 0) { return get(k, d); }
+  size_t putLong64(const char* k, int64_t v) { return put(k, v); }
+  int64_t getLong64(const char* k, int64_t d = 0) { return get(k, d); }
+  size_t putUInt(const char* k, uint32_t v) { return put(k, v); }
+  uint32_t getUInt(const char* k, uint32_t d = 0) { return get(k, d); }
+  size_t putUChar(const char* k, uint8_t v) { return put(k, v); }
+  uint8_t getUChar(const char* k, uint8_t d = 0) { return get(k, d); }
+  size_t putBool(const char* k, bool v) { return put(k, v); }
+  bool getBool(const char* k, bool d = false) { return get(k, d); }
+  size_t putBytes(const char* k, const void* v, size_t n) { auto& b = store()[ns + "/" + k]; b.assign((const uint8_t*)v, (const uint8_t*)v + n); return n; }
+  size_t getBytes(const char* k, void* v, size_t n) { auto it = store().find(ns + "/" + k); if (it == store().end()) return 0; size_t m = std::min(n, it->second.size()); memcpy(v, it->second.data(), m); return m; }
+  size_t getBytesLength(const char* k) { auto it = store().find(ns + "/" + k); return it == store().end() ? 0 : it->second.size(); }
+};
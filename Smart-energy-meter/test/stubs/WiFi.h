@@ -0,0 +1,71 @@
+// Host stand-ins for the WiFi client and server over real loopback sockets
+#pragma once
+#include <Arduino.h>
+#include <string>
+#include <memory>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+struct String {
+  std::string s;
+  String() {}
+  String(const char* c) : s(c) {}
+  const char* c_str() const { return s.c_str(); }
+  String toString() const { return *this; }
+};
+#define WL_CONNECTED 3
+#define WIFI_STA 1
+struct IP { String toString() { return String("127.0.0.1"); } uint8_t operator[](int i) const { return i == 0 ? 127 : (i == 3 ? 1 : 0); } };
+typedef IP IPAddress;
+struct WiFiStub {
+  int state = WL_CONNECTED;   // Tests set 0 to drop the link
+  void mode(int) {} void begin(const char*, const char*) {} void disconnect() {}
+  int status() { return state; } int RSSI() { return -50; } IP localIP() { return IP(); }
+};
+inline WiFiStub WiFi;
+struct Sock { int fd; explicit Sock(int f) : fd(f) {} ~Sock() { if (fd >= 0) close(fd); } };
+// WiFiClient over a real socket; copies share it (like the ESP32 core)
+struct WiFiClient {
+  std::shared_ptr<Sock> s;
+  WiFiClient() {}
+  explicit WiFiClient(int fd) : s(std::make_shared<Sock>(fd)) {}
+  int fd() const { return s ? s->fd : -1; }
+  explicit operator bool() const { return s && s->fd >= 0; }
+  int connect(const char* host, uint16_t port, int = 0) {
+    int f = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in a{}; a.sin_family = AF_INET; a.sin_port = htons(port); inet_pton(AF_INET, host, &a.sin_addr);
+    if (::connect(f, (sockaddr*)&a, sizeof(a)) != 0) { close(f); return 0; }
+    s = std::make_shared<Sock>(f); return 1;
+  }
+  void setNoDelay(bool on) { int v = on; setsockopt(fd(), IPPROTO_TCP, TCP_NODELAY, &v, sizeof(v)); }
+  uint8_t connected() {
+    if (fd() < 0) return 0;
+    char c; ssize_t r = recv(fd(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return r > 0 || (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+  }
+  void stop() { s.reset(); }
+  size_t write(const uint8_t* b, size_t n) { ssize_t r = send(fd(), b, n, MSG_NOSIGNAL); return r < 0 ? 0 : (size_t)r; }
+  int available() { if (fd() < 0) return 0; int n = 0; ioctl(fd(), FIONREAD, &n); return n; }
+  int read() { unsigned char c; return (fd() >= 0 && recv(fd(), &c, 1, MSG_DONTWAIT) == 1) ? c : -1; }
+};
+struct WiFiServer {
+  uint16_t port; int lfd = -1;
+  explicit WiFiServer(uint16_t p) : port(p) {}
+  void begin() {
+    lfd = socket(AF_INET, SOCK_STREAM, 0); int one = 1; setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in a{}; a.sin_family = AF_INET; a.sin_port = htons(port); a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(lfd, (sockaddr*)&a, sizeof(a)); listen(lfd, 16); fcntl(lfd, F_SETFL, O_NONBLOCK);
+  }
+  void setNoDelay(bool) {}
+  WiFiClient available() {
+    int f = accept(lfd, nullptr, nullptr);
+    if (f < 0) return WiFiClient();
+    // A small send buffer so a client that does not read fills it quickly
+    int sz = 4096; setsockopt(f, SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+    return WiFiClient(f);
+  }
+};
@@ -0,0 +1,4 @@
+// Host stand-in so the sketch compiles; does nothing
+#pragma once
+struct WireStub { void begin(int = 0, int = 0) {} };
+inline WireStub Wire;
@@ -0,0 +1,9 @@
+// Host stand-in for the few ESP-IDF heap calls HeapMonitor makes
+#pragma once
+#include <stdlib.h>
+#define MALLOC_CAP_SPIRAM 1
+#define MALLOC_CAP_8BIT 2
+inline void* heap_caps_malloc(size_t n, int) { return malloc(n); }
+inline size_t heap_caps_get_free_size(int) { return 200000; }
+inline size_t heap_caps_get_minimum_free_size(int) { return 150000; }
+inline size_t heap_caps_get_largest_free_block(int) { return 110000; }
@@ -0,0 +1,33 @@
+// Minimal checks for the host tests: a failed check is reported and makes the test exit non-zero
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <math.h>
+
+static int testFailures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            testFailures++; \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while (0)
+
+#define CHECK_NEAR(actual, expected, tolerance) \
+    do { \
+        double a_ = (actual), e_ = (expected), t_ = (tolerance); \
+        if (!(fabs(a_ - e_) <= t_)) { \
+            testFailures++; \
+            fprintf(stderr, "%s:%d: %s = %g, expected %g +/- %g\n", __FILE__, __LINE__, #actual, a_, e_, t_); \
+        } \
+    } while (0)
+
+// Return from main()
+inline int testResult(const char* name) {
+    printf("%s: %s\n", name, testFailures == 0 ? "ok" : "FAILED");
+    return testFailures == 0 ? 0 : 1;
+}
+
+#endif // TEST_H
@@ -0,0 +1,217 @@
+// AdcSampler driven by FakeAdcSource: frame assembly, resync after a lost
+// conversion, overrun accounting when the consumer lags or holds buffers, and
+// a producer thread racing the consumer
+#include "test.h"
+#include <atomic>
+#include <thread>
+#include "AdcSampler.h"
+
+static const uint8_t PINS[] = {32, 33, 34, 35};
+static const uint8_t CHANNELS = 4;
+static const uint32_t RATE = 5000;
+
+// Constant, distinct level per channel: a sample in the wrong column shows up
+static void setLevels(FakeAdcSource& source) {
+    for (uint8_t c = 0; c < CHANNELS; c++) {
+        source.setTone(c, 1000.0f + 500.0f * c, 0.0f, 50.0f);
+    }
+}
+
+static bool frameHoldsLevels(const AdcFrame& frame) {
+    for (uint8_t c = 0; c < frame.channels; c++) {
+        for (uint16_t n = 0; n < AdcFrame::SAMPLES; n++) {
+            if (frame.raw[c][n] != 1000 + 500 * c) return false;
+        }
+    }
+    return true;
+}
+
+// Loses one conversion at a given position in the stream
+class DroppingSource : public AdcSource {
+private:
+    FakeAdcSource& inner;
+    uint64_t position;
+    uint64_t dropAt;
+
+public:
+    DroppingSource(FakeAdcSource& source, uint64_t at) : inner(source), position(0), dropAt(at) {}
+
+    bool begin(const uint8_t* pins, uint8_t count, uint32_t rate) override {
+        return inner.begin(pins, count, rate);
+    }
+
+    size_t read(AdcConversion* out, size_t maxCount, uint32_t timeoutMs) override {
+        size_t count = inner.read(out, maxCount, timeoutMs);
+        size_t kept = 0;
+        for (size_t i = 0; i < count; i++, position++) {
+            if (position != dropAt) out[kept++] = out[i];
+        }
+        return kept;
+    }
+};
+
+// Pump until a frame is ready (bounded so a stuck producer fails instead of hanging)
+static const AdcFrame* nextFrame(AdcSampler& sampler) {
+    for (int i = 0; i < 1000; i++) {
+        const AdcFrame* frame = sampler.acquireFrame();
+        if (frame != nullptr) return frame;
+        sampler.pump(0);
+    }
+    return nullptr;
+}
+
+static void testAssembly() {
+    FakeAdcSource source;
+    const float amplitude[CHANNELS] = {300.0f, 600.0f, 900.0f, 1200.0f};
+    for (uint8_t c = 0; c < CHANNELS; c++) {
+        source.setTone(c, 2048.0f, amplitude[c], 50.0f, 0.3f * c);
+    }
+    AdcSampler sampler(source, PINS, CHANNELS, RATE);
+    CHECK(sampler.begin());
+
+    for (uint32_t f = 0; f < 3; f++) {
+        const AdcFrame* frame = nextFrame(sampler);
+        CHECK(frame != nullptr);
+        if (frame == nullptr) return;
+        CHECK(frame->sequence == f);
+        CHECK(frame->channels == CHANNELS);
+        CHECK(frame->sampleRate == RATE);
+        CHECK(frame->channelOf(34) == 2);
+        CHECK(frame->channelOf(36) == -1);
+
+        // Sample n of channel c is conversion (frame * SAMPLES + n) * CHANNELS + c
+        bool matches = true;
+        for (uint8_t c = 0; c < CHANNELS; c++) {
+            for (uint16_t n = 0; n < AdcFrame::SAMPLES; n++) {
+                uint64_t conversion = ((uint64_t)f * AdcFrame::SAMPLES + n) * CHANNELS + c;
+                double t = conversion / ((double)RATE * CHANNELS);
+                double value = 2048.0 + amplitude[c] * sin(2.0 * M_PI * 50.0 * t + 0.3 * c);
+                if (frame->raw[c][n] != (uint16_t)(value + 0.5)) matches = false;
+            }
+        }
+        CHECK(matches);
+        sampler.releaseFrame(frame);
+    }
+    CHECK(sampler.getOverruns() == 0);
+    CHECK(sampler.getSyncErrors() == 0);
+}
+
+static void testResync() {
+    FakeAdcSource fake;
+    setLevels(fake);
+    // Lose channel 2 of row 10 of the first frame
+    DroppingSource source(fake, 10 * CHANNELS + 2);
+    AdcSampler sampler(source, PINS, CHANNELS, RATE);
+    CHECK(sampler.begin());
+
+    for (int f = 0; f < 3; f++) {
+        const AdcFrame* frame = nextFrame(sampler);
+        CHECK(frame != nullptr);
+        if (frame == nullptr) return;
+        CHECK(frameHoldsLevels(*frame));
+        sampler.releaseFrame(frame);
+    }
+    // The partial row is dropped and the sampler waits for channel 0 again
+    CHECK(sampler.getSyncErrors() == 1);
+    CHECK(sampler.getOverruns() == 0);
+}
+
+static void pumpFrames(AdcSampler& sampler, uint32_t frames) {
+    uint32_t target = sampler.getFrameCount() + frames;
+    for (int i = 0; i < 100000 && sampler.getFrameCount() < target; i++) {
+        sampler.pump(0);
+    }
+}
+
+static void testOverruns() {
+    FakeAdcSource source;
+    setLevels(source);
+    AdcSampler sampler(source, PINS, CHANNELS, RATE);
+    CHECK(sampler.begin());
+
+    // Nobody consuming: every frame after the first replaces the unread one
+    pumpFrames(sampler, 5);
+    CHECK(sampler.getFrameCount() == 5);
+    CHECK(sampler.getOverruns() == 4);
+
+    // The newest frame survives
+    const AdcFrame* frame = sampler.acquireFrame();
+    CHECK(frame != nullptr);
+    if (frame == nullptr) return;
+    CHECK(frame->sequence == 4);
+    sampler.releaseFrame(frame);
+
+    // Consumer holding one buffer: the next frame waits for it a few pumps,
+    // then the producer takes that unread frame back
+    const AdcFrame* held = nextFrame(sampler);
+    CHECK(held != nullptr);
+    uint32_t overruns = sampler.getOverruns();
+    pumpFrames(sampler, 3);
+    CHECK(sampler.getOverruns() == overruns + 2);
+
+    // Consumer holding both: the producer reads nothing and returns at once
+    const AdcFrame* second = sampler.acquireFrame();
+    CHECK(second != nullptr);
+    if (held == nullptr || second == nullptr) return;
+    CHECK(held->sequence == 5);
+    CHECK(second->sequence == 8);
+    uint32_t produced = sampler.getFrameCount();
+    overruns = sampler.getOverruns();
+    size_t consumed = 0;
+    for (int i = 0; i < 100; i++) {
+        consumed += sampler.pump(0);
+    }
+    CHECK(consumed == 0);
+    CHECK(sampler.getFrameCount() == produced);
+    CHECK(sampler.getOverruns() == overruns);
+
+    // Released buffers fill again from the conversions left waiting in the source
+    sampler.releaseFrame(held);
+    sampler.releaseFrame(second);
+    frame = nextFrame(sampler);
+    CHECK(frame != nullptr);
+    if (frame == nullptr) return;
+    CHECK(frameHoldsLevels(*frame));
+    CHECK(frame->sequence == produced);
+    sampler.releaseFrame(frame);
+}
+
+// Producer on its own thread, as on core 0: the consumer gets intact frames in
+// order, and every frame is either consumed or counted as an overrun
+static void testThreads() {
+    FakeAdcSource source;
+    setLevels(source);
+    AdcSampler sampler(source, PINS, CHANNELS, RATE);
+    CHECK(sampler.begin());
+    std::atomic<bool> stop{false};
+    std::thread producer([&] {
+        while (!stop) sampler.pump(0);
+    });
+
+    uint32_t consumed = 0, damaged = 0, outOfOrder = 0;
+    int64_t last = -1;
+    while (consumed < 200) {
+        const AdcFrame* frame = sampler.acquireFrame();
+        if (frame == nullptr) continue;
+        if (!frameHoldsLevels(*frame)) damaged++;
+        if ((int64_t)frame->sequence <= last) outOfOrder++;
+        last = frame->sequence;
+        consumed++;
+        sampler.releaseFrame(frame);
+    }
+    stop = true;
+    producer.join();
+
+    // Up to two frames may still be waiting in the buffers
+    uint32_t accounted = consumed + sampler.getOverruns();
+    CHECK(damaged == 0 && outOfOrder == 0);
+    CHECK(accounted <= sampler.getFrameCount() && accounted + 2 >= sampler.getFrameCount());
+}
+
+int main() {
+    testAssembly();
+    testResync();
+    testOverruns();
+    testThreads();
+    return testResult("adc_sampler");
+}
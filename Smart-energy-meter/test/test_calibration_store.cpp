@@ -0,0 +1,134 @@
+// Boot of the measurement chain (AdcSampler, PowerMeter, CalibrationStore) on
+// simulated mains with loads on: time to the first reading, and which offsets
+// are restored, re-measured and saved across reboots. Times are sampling time.
+#include "test.h"
+#include "AdcSampler.h"
+#include "PowerMeter.h"
+#include "CalibrationStore.h"
+
+static const uint8_t PINS[] = {32, 33, 34, 35};
+static const uint32_t RATE = 20000;
+
+struct Boot {
+    bool restored;
+    double firstReadingMs;          // -1 if none
+    float offsets[3];               // mV
+    uint32_t saves;
+};
+
+// offset1 and the three offsets below are in raw ADC counts
+static Boot boot(float offset1, bool linearized, uint32_t calibrationSamples = RATE) {
+    FakeAdcSource source;
+    source.setTone(0, offset1, 600, 50.03f, 0);
+    source.setTone(1, 1890, 300, 50.03f, 0.4f);
+    source.setTone(2, 1905, 900, 50.03f, 0.2f);
+    source.setTone(3, 2048, 1000, 50.03f, 0);
+    AdcSampler sampler(source, PINS, 4, RATE);
+    CHECK(sampler.begin());
+    AdcLinearization table;
+    table.begin();
+    const AdcLinearization* linear = linearized ? &table : nullptr;
+
+    CurrentSensor load1(32, 0.0007272f, -0.01636f);
+    CurrentSensor load2(33, 0.0007272f, -0.01672f);
+    CurrentSensor main(34, 0.0006825f, -0.01442f);
+    VoltageSensor voltage(35, 3.3f, 890.0f);
+    load1.begin(linear);
+    load2.begin(linear);
+    main.begin(linear);
+    voltage.begin();
+    PowerMeter meter(voltage);
+    meter.addLoad(load1);
+    meter.addLoad(load2);
+    meter.addLoad(main);
+
+    CalibrationStore store;
+    store.addSensor(load1);
+    store.addSensor(load2);
+    store.addSensor(main);
+    Boot b = {};
+    b.restored = store.begin();
+    if (!b.restored) {
+        // Loads stay on: calibrate in the background
+        load1.startCalibration(calibrationSamples);
+        load2.startCalibration(calibrationSamples);
+        main.startCalibration(calibrationSamples);
+    }
+
+    b.firstReadingMs = -1;
+    uint32_t windows = 0;
+    uint64_t samples = 0;
+    while (samples < 6ull * RATE) {
+        sampler.pump(0);
+        const AdcFrame* frame;
+        while ((frame = sampler.acquireFrame()) != nullptr) {
+            meter.consume(*frame);
+            sampler.releaseFrame(frame);
+            samples += AdcFrame::SAMPLES;
+            if (meter.getWindowCount() == windows) continue;
+            windows = meter.getWindowCount();
+            store.addWindow();                      // Control task
+            store.saveIfMoved(samples * 1000 / RATE);    // Storage task
+            if (b.firstReadingMs < 0 && load1.isCalibrated() && load2.isCalibrated() &&
+                main.isCalibrated() && load1.getCurrent() > 0) {
+                b.firstReadingMs = samples * 1000.0 / RATE;
+            }
+        }
+    }
+    CHECK(!store.isChecking());
+    b.offsets[0] = load1.getOffset();
+    b.offsets[1] = load2.getOffset();
+    b.offsets[2] = main.getOffset();
+    b.saves = store.getSaveCount();
+    return b;
+}
+
+static void show(const char* what, const Boot& b) {
+    printf("%-36s restored %d, first reading %5.0f ms, offsets %6.1f %6.1f %6.1f mV, %u saved\n",
+           what, b.restored, b.firstReadingMs, b.offsets[0], b.offsets[1], b.offsets[2], b.saves);
+}
+
+int main() {
+    Preferences preferences;
+    preferences.begin("calibration", false);
+    preferences.clear();
+
+    // First boot calibrates with the loads on and saves once checked
+    Boot first = boot(1900, false);
+    show("first boot", first);
+    CHECK(!first.restored && first.saves == 1);
+    CHECK(first.firstReadingMs > 1000 && first.firstReadingMs < 1100);
+
+    // Reboot: restored at once, nothing re-saved
+    Boot again = boot(1900, false);
+    show("reboot", again);
+    CHECK(again.restored && again.saves == 0);
+    CHECK(again.firstReadingMs > 0 && again.firstReadingMs < 50);
+    for (uint8_t i = 0; i < 3; i++) CHECK(again.offsets[i] == first.offsets[i]);
+
+    // Sensor 1 drifted by 40 counts (~32 mV): re-measured and saved
+    Boot drifted = boot(1940, false);
+    show("reboot, sensor 1 drifted", drifted);
+    CHECK(drifted.restored && drifted.saves == 1);
+    CHECK_NEAR(drifted.offsets[0] - first.offsets[0], 40 * 3300.0 / 4095, 1.0);
+    CHECK(drifted.offsets[1] == first.offsets[1] && drifted.offsets[2] == first.offsets[2]);
+    Boot back = boot(1900, false);
+    show("reboot, drifted back", back);
+    CHECK(back.saves == 1 && back.offsets[0] == first.offsets[0]);
+
+    // Offsets saved in raw counts do not apply to linearized sensors
+    Boot linear = boot(1900, true);
+    show("reboot, linearized", linear);
+    CHECK(!linear.restored && linear.saves == 1);
+    Boot linearAgain = boot(1900, true);
+    show("reboot, linearized again", linearAgain);
+    CHECK(linearAgain.restored && linearAgain.saves == 0);
+
+    // A corrupted record is ignored
+    uint8_t junk[sizeof(CalibrationRecord)] = {1, 2, 3};
+    preferences.putBytes("offsets", junk, sizeof junk);
+    Boot corrupted = boot(1900, true);
+    show("reboot, corrupted record", corrupted);
+    CHECK(!corrupted.restored && corrupted.saves == 1);
+    return testResult("calibration_store");
+}
@@ -0,0 +1,191 @@
+// CommandChannel against a scripted event stream on a loopback socket: event
+// parsing (pings, CRLF, other events, data split over lines), a refused
+// stream, reconnects after a close and after the idle timeout.
+// With "<port> <seconds>" it instead runs as the meter for
+// test_command_channel.py: it holds the stream to the Flask server, applies
+// each command and acks it over WebClient's kept-alive connection, then prints
+// its counters when the time is up or on SIGTERM.
+#include "test.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <signal.h>
+#include "WebClient.h"
+#include "CommandChannel.h"
+
+static const uint16_t PORT = 18421;
+static const char* const STREAM_OK = "HTTP/1.0 200 OK\r\nContent-Type: text/event-stream\r\n\r\n";
+
+// Serves one script per connection, then keeps it open until released
+class StreamServer {
+private:
+    int listener;
+    std::vector<std::string> scripts;
+    std::thread thread;
+
+    void serve() {
+        for (const std::string& script : scripts) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) return;
+            std::string request;
+            char buffer[512];
+            while (request.find("\r\n\r\n") == std::string::npos) {
+                ssize_t n = recv(fd, buffer, sizeof buffer, 0);
+                if (n <= 0) break;
+                request.append(buffer, n);
+            }
+            if (request.compare(0, 34, "GET /api/commands/stream HTTP/1.0\r") == 0) requests++;
+            send(fd, script.data(), script.size(), MSG_NOSIGNAL);
+            while (!release.exchange(false)) usleep(1000);
+            ::close(fd);
+        }
+    }
+
+public:
+    std::atomic<uint32_t> requests{0};
+    std::atomic<bool> release{false};
+
+    explicit StreamServer(const std::vector<std::string>& connections) : scripts(connections) {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(PORT);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        CHECK(bind(listener, (sockaddr*)&address, sizeof(address)) == 0);
+        CHECK(listen(listener, 4) == 0);
+        thread = std::thread(&StreamServer::serve, this);
+    }
+
+    ~StreamServer() {
+        shutdown(listener, SHUT_RDWR);
+        release = true;
+        thread.join();
+        ::close(listener);
+    }
+};
+
+// Poll (with the clock at `now`) for up to 1 s of real time
+static bool receive(CommandChannel& channel, ServerCommand& command, unsigned long now) {
+    for (int i = 0; i < 1000; i++) {
+        if (channel.poll(command, now)) return true;
+        usleep(1000);
+    }
+    return false;
+}
+
+// Poll until the channel reaches the wanted state
+static bool settle(CommandChannel& channel, bool connected, unsigned long now) {
+    ServerCommand ignored;
+    for (int i = 0; i < 1000 && channel.isConnected() != connected; i++) {
+        channel.poll(ignored, now);
+        usleep(1000);
+    }
+    return channel.isConnected() == connected;
+}
+
+static void testStream() {
+    std::string first = std::string(STREAM_OK) +
+        ": ping\n\n"
+        "event: command\r\nid: 7\r\n"
+        "data: {\"id\":7,\"relay1\":true,\"relay2\":false,\"relay3\":true,\"price\":6.5}\r\n\r\n"
+        "event: other\ndata: {\"id\":8,\"relay1\":true}\n\n"
+        "data: {\"id\":8,\"relay2\":true}\n\n"
+        "event: command\ndata: {\"id\":9,\"relay1\":false,\ndata: \"relay2\":true,\"relay3\":false}\n\n";
+    std::string refused = "HTTP/1.0 503 Service Unavailable\r\n\r\n";
+    std::string second = std::string(STREAM_OK) +
+        "event: command\ndata: {\"id\":10,\"relay1\":true,\"relay2\":true,\"relay3\":true,\"price\":7}\n\n";
+    StreamServer server({first, refused, second, STREAM_OK});
+
+    CommandChannel channel;
+    channel.begin("127.0.0.1", PORT);
+    unsigned long now = CommandChannel::MIN_RETRY;
+    ServerCommand command;
+
+    CHECK(receive(channel, command, now));
+    CHECK(channel.isConnected() && channel.getConnectCount() == 1);
+    CHECK(command.id == 7 && command.relay1 && !command.relay2 && command.relay3);
+    CHECK(command.price == 6.5f);
+
+    // Other events and events without a type are skipped; data lines are joined
+    CHECK(receive(channel, command, now));
+    CHECK(command.id == 9 && !command.relay1 && command.relay2 && !command.relay3);
+    CHECK(command.price == 0);
+    CHECK(channel.getCommandCount() == 2);
+
+    // Server closes: the channel notices and retries after MIN_RETRY
+    server.release = true;
+    CHECK(settle(channel, false, now));
+    CHECK(!receive(channel, command, now + 10));       // Too early to retry
+    CHECK(server.requests == 1);
+
+    // A refused stream is closed and retried again later
+    now += CommandChannel::MIN_RETRY;
+    for (int i = 0; i < 1000 && server.requests < 2; i++) {
+        channel.poll(command, now);
+        usleep(1000);
+    }
+    server.release = true;
+    CHECK(settle(channel, false, now));
+    CHECK(channel.getConnectCount() == 1);
+
+    now += CommandChannel::MAX_RETRY;
+    CHECK(receive(channel, command, now));
+    CHECK(command.id == 10 && command.relay1 && command.relay2 && command.price == 7.0f);
+    CHECK(channel.getConnectCount() == 2);
+
+    // A silent stream is dropped after IDLE_TIMEOUT and reopened
+    server.release = true;
+    CHECK(settle(channel, false, now + CommandChannel::IDLE_TIMEOUT));
+    now += CommandChannel::IDLE_TIMEOUT + CommandChannel::MAX_RETRY;
+    CHECK(settle(channel, true, now));
+    CHECK(channel.getConnectCount() == 3 && server.requests == 4);
+}
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int) {
+    stopping = 1;
+}
+
+// Meter side of test_command_channel.py
+static int runMeter(uint16_t port, unsigned long seconds) {
+    signal(SIGTERM, stop);
+    char url[32];
+    snprintf(url, sizeof url, "http://127.0.0.1:%u", port);
+    static WebClient web("meter", "secret", url);
+    web.begin();
+    web.maintain();
+    CommandChannel channel;
+    channel.begin(web.getServerHost(), web.getServerPort());
+
+    bool relay1 = false, relay2 = false;
+    uint32_t acked = 0, maxApplyUs = 0;
+    unsigned long end = millis() + seconds * 1000;
+    while (!stopping && millis() < end) {
+        ServerCommand command;
+        if (channel.poll(command, millis())) {
+            relay1 = command.relay1;                // The relay write
+            relay2 = command.relay2;
+            uint32_t applyUs = micros() - command.receivedUs;
+            if (applyUs > maxApplyUs) maxApplyUs = applyUs;
+            if (web.ackCommand(command.id, applyUs)) acked++;
+        }
+        usleep(1000);                               // About one loop pass
+    }
+    const HttpStats& acks = web.getHttpStats(HTTP_COMMAND_ACK);
+    printf("commands=%u acked=%u ack_failures=%u ack_connections=%u stream_connections=%u "
+           "relay1=%d relay2=%d max_apply_us=%u\n",
+           channel.getCommandCount(), acked, acks.failures, acks.connects, channel.getConnectCount(),
+           relay1, relay2, maxApplyUs);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    signal(SIGPIPE, SIG_IGN);
+    if (argc > 2) return runMeter((uint16_t)atoi(argv[1]), strtoul(argv[2], nullptr, 10));
+    testStream();
+    return testResult("command_channel");
+}
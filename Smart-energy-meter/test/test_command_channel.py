@@ -0,0 +1,116 @@
+# Pushed relay commands end to end: app.py on Werkzeug's development server
+# (in a child process) and the meter side of build/test_command_channel on
+# real sockets. 50 dashboard clicks are each applied and acked, every ack over
+# one kept-alive connection; after a server restart the stream reconnects and
+# the next click is applied too.
+import json
+import logging
+import multiprocessing
+import os
+import random
+import signal
+import subprocess
+import sys
+import time
+import urllib.request
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path[:0] = [os.path.join(HERE, 'stubs', 'python'), os.path.join(HERE, '..', 'Flask_server')]
+import app
+from werkzeug.serving import make_server
+
+PORT = 18422
+URL = f'http://127.0.0.1:{PORT}'
+CLICKS = 50
+
+failures = []
+
+def check(condition, message):
+    if not condition:
+        failures.append(message)
+        print(f'  {message}')
+
+def serve():
+    sys.stdout = open(os.devnull, 'w')
+    logging.getLogger('werkzeug').setLevel(logging.ERROR)
+    make_server('127.0.0.1', PORT, app.app, threaded=True,
+                request_handler=app.KeepAliveRequestHandler).serve_forever()
+
+def start_server():
+    server = multiprocessing.get_context('fork').Process(target=serve, daemon=True)
+    server.start()
+    return server
+
+def stats():
+    try:
+        with urllib.request.urlopen(URL + '/api/commands/stats', timeout=2) as response:
+            return json.load(response)
+    except OSError:
+        return None
+
+def wait_for(condition, seconds):
+    end = time.monotonic() + seconds
+    while time.monotonic() < end:
+        current = stats()
+        if current is not None and condition(current):
+            return current
+        time.sleep(0.002)
+    return None
+
+def click(relay, state):
+    body = json.dumps({'relay': relay, 'state': state}).encode()
+    request = urllib.request.Request(URL + '/api/relay/control', body, {'Content-Type': 'application/json'})
+    with urllib.request.urlopen(request, timeout=2) as response:
+        return json.load(response)['command_id']
+
+# Click, wait for the meter's ack, then pause as a person would
+def click_and_wait(relays, acked):
+    relay = random.choice([1, 2])
+    relays[relay] = random.choice([True, False])
+    click(relay, relays[relay])
+    current = wait_for(lambda s: s['acked'] > acked, 3)
+    time.sleep(random.uniform(0.05, 0.1))
+    return current
+
+random.seed(18)
+relays = {1: False, 2: False}
+server = start_server()
+meter = subprocess.Popen([os.path.join(HERE, 'build', 'test_command_channel'), str(PORT), '60'],
+                         stdout=subprocess.PIPE, text=True)
+try:
+    check(wait_for(lambda s: s['streams'] == 1, 10) is not None, 'stream not opened')
+    current = None
+    for n in range(CLICKS):
+        current = click_and_wait(relays, n)
+        if current is None:
+            check(False, f'click {n + 1} not acked')
+            break
+    if current is not None:
+        check(current['acked'] == CLICKS, f"{current['acked']} of {CLICKS} clicks acked")
+        print(f"{CLICKS} clicks: click to ack {current['avg_ms']} ms average, {current['max_ms']} ms max (loopback)")
+
+    # Restart the server: the stream comes back and the next click goes through
+    server.terminate()
+    server.join()
+    server = start_server()
+    relays = {1: False, 2: False}     # The new server starts from its defaults
+    check(wait_for(lambda s: s['streams'] == 1, 15) is not None, 'stream not reopened after the restart')
+    check(click_and_wait(relays, 0) is not None, 'click after the restart not acked')
+finally:
+    meter.send_signal(signal.SIGTERM)
+    output, _ = meter.communicate(timeout=10)
+    server.terminate()
+    server.join()
+
+counters = dict(field.split('=') for field in output.split())
+expected = {
+    'commands': CLICKS + 1, 'acked': CLICKS + 1, 'ack_failures': 0,
+    'ack_connections': 2,           # One per server process
+    'stream_connections': 2,
+    'relay1': int(relays[1]), 'relay2': int(relays[2]),
+}
+for key, value in expected.items():
+    check(int(counters.get(key, -1)) == value, f'meter {key}={counters.get(key)}, expected {value}')
+
+print('command_channel.py: ' + ('FAILED' if failures else 'ok'))
+sys.exit(1 if failures else 0)
@@ -0,0 +1,120 @@
+// DifferentialCurrent on FakeAdcSource mains. The fake converts the channels
+// one after another like the ESP32, so the main channel lags the first branch
+// by two conversions. Without interpolation that skew alone reads as a few mA
+// of fundamental leakage; with it a balanced load reads about 0 and an
+// injected 5 mA leak reads 5 mA. A branch sensor fitted backwards and
+// registered with polarity -1 in PowerMeter cancels out the same way.
+#include "test.h"
+#include "AdcSampler.h"
+#include "PowerMeter.h"
+#include "DifferentialCurrent.h"
+
+static const uint8_t PINS[] = {32, 33, 34, 35};
+static const uint32_t RATE = 20000;
+static const float FREQUENCY = 50.0f;
+static const float PHASE = 0.3f;
+static const float LOAD1 = 0.4f;    // Amps rms
+static const float LOAD2 = 0.3f;
+
+struct Run {
+    float interpolated;   // Mean of takeAverageLeakage() (A)
+    float naive;          // Fundamental of the sample-by-sample difference without interpolation (A)
+};
+
+// Peak ADC counts for a current on a sensor
+static float amplitude(const CurrentSensor& sensor, float amps) {
+    return amps / sensor.getAmpsPerUnit() * sqrtf(2);
+}
+
+// load2Polarity is how the second branch sensor is fitted, registered is what
+// PowerMeter is told
+static Run run(float leak, int8_t load2Polarity, int8_t registered) {
+    CurrentSensor load1(32, 0.0007272f, -0.01636f);
+    CurrentSensor load2(33, 0.0007272f, -0.01672f);
+    CurrentSensor main(34, 0.0006825f, -0.01442f);
+    VoltageSensor voltage(35, 3.3f, 890.0f);
+    load1.begin();
+    load2.begin();
+    main.begin();
+    voltage.begin();
+    load1.setOffset(1900);
+    load2.setOffset(1890);
+    main.setOffset(1905);
+
+    FakeAdcSource source;
+    source.setNoise(2);
+    source.setTone(0, 1900, amplitude(load1, LOAD1), FREQUENCY, PHASE);
+    source.setTone(1, 1890, amplitude(load2, LOAD2), FREQUENCY, load2Polarity < 0 ? PHASE + M_PI : PHASE);
+    source.setTone(2, 1905, amplitude(main, LOAD1 + LOAD2 + leak), FREQUENCY, PHASE);
+    source.setTone(3, 2048, 1000, FREQUENCY);
+    AdcSampler sampler(source, PINS, 4, RATE);
+    CHECK(sampler.begin());
+
+    PowerMeter meter(voltage);
+    meter.addLoad(load1);
+    meter.addLoad(load2, registered);
+    meter.addLoad(main);
+    DifferentialCurrent leakage(main, load1, load2, meter);
+
+    // Fundamental of main - (load1 + load2) taken at each channel's own conversion time
+    double in = 0, quadrature = 0;
+    uint32_t n = 0;
+    float sum = 0;
+    uint32_t takes = 0;
+    while (n < RATE * 2) {
+        sampler.pump(0);
+        const AdcFrame* frame;
+        while ((frame = sampler.acquireFrame()) != nullptr) {
+            meter.consume(*frame);
+            leakage.consume(*frame);
+            for (uint16_t i = 0; i < AdcFrame::SAMPLES; i++, n++) {
+                float difference = main.toSample(frame->raw[2][i]) * main.getAmpsPerUnit() -
+                                   load1.toSample(frame->raw[0][i]) * load1.getAmpsPerUnit() -
+                                   registered * load2.toSample(frame->raw[1][i]) * load2.getAmpsPerUnit();
+                double angle = 2 * M_PI * FREQUENCY * n / RATE;
+                in += difference * cos(angle);
+                quadrature += difference * sin(angle);
+            }
+            sampler.releaseFrame(frame);
+            // Once a second after the first half second, like the sketch's theft check
+            if (n % (RATE / 2) == 0) {
+                float average = leakage.takeAverageLeakage();
+                if (n > RATE / 2 && average >= 0) {
+                    sum += average;
+                    takes++;
+                }
+            }
+        }
+    }
+    Run r;
+    r.interpolated = takes > 0 ? sum / takes : -1;
+    r.naive = sqrt(in * in + quadrature * quadrature) * 2 / n / sqrtf(2);
+    return r;
+}
+
+int main() {
+    // Skew residual without interpolation: each branch current times
+    // 2 pi f times its lag behind the main channel (2 and 1 conversions)
+    const float conversion = 1.0f / (RATE * 4);
+    float skew = 2 * M_PI * FREQUENCY * (LOAD1 * 2 * conversion + LOAD2 * conversion);
+
+    Run balanced = run(0, 1, 1);
+    printf("balanced: %.2f mA interpolated, %.2f mA without (skew %.2f mA)\n",
+           1000 * balanced.interpolated, 1000 * balanced.naive, 1000 * skew);
+    CHECK_NEAR(balanced.naive, skew, 0.2f * skew);
+    CHECK(balanced.interpolated >= 0 && balanced.interpolated < 0.5e-3f);
+
+    Run leaking = run(0.005f, 1, 1);
+    printf("5 mA leak: %.2f mA interpolated, %.2f mA without\n", 1000 * leaking.interpolated, 1000 * leaking.naive);
+    CHECK_NEAR(leaking.interpolated, 0.005f, 0.5e-3f);
+    CHECK_NEAR(leaking.naive, sqrtf(0.005f * 0.005f + skew * skew), 0.2f * skew);
+
+    // A backwards sensor reads the whole branch twice over unless PowerMeter knows
+    Run reversed = run(0.005f, -1, -1);
+    Run unregistered = run(0.005f, -1, 1);
+    printf("load2 reversed: %.2f mA registered, %.1f mA not\n",
+           1000 * reversed.interpolated, 1000 * unregistered.interpolated);
+    CHECK_NEAR(reversed.interpolated, 0.005f, 0.5e-3f);
+    CHECK_NEAR(unregistered.interpolated, 2 * LOAD2, 0.1f * LOAD2);
+    return testResult("differential_current");
+}
@@ -0,0 +1,119 @@
+// Display's dirty-cell renderer on a counting LCD stand-in: 1 h of noisy
+// readings latched every 1.5 s and rendered every 500 ms on rotating pages.
+// After every update the LCD must show what a full redraw would show; the bus
+// bytes are compared with the old clear() and reprint of the currents page.
+#include "test.h"
+#include <random>
+#include "display.h"
+
+static const unsigned long UPDATE_MS = 500;
+static const int UPDATES = 3600 * 1000 / UPDATE_MS;
+
+// The old showCurrents(): clear() and reprint, once per 1.5 s report
+static void legacy(LiquidCrystal_I2C& lcd, float i1, float i2, float v) {
+    lcd.clear();
+    lcd.setCursor(0, 0);
+    lcd.print("I1:");
+    lcd.print(i1, 2);
+    lcd.print("A I2:");
+    lcd.print(i2, 2);
+    lcd.print("A");
+    lcd.setCursor(0, 1);
+    lcd.print("V:");
+    lcd.print(v, 1);
+    lcd.print("V");
+}
+
+struct Readings {
+    float i1, i2, voltage, frequency, power1, power2, energy;
+};
+
+static void show(Display& display, uint8_t page, const Readings& r) {
+    switch (page) {
+        case DISPLAY_CURRENTS: display.showCurrents(r.i1, r.i2, r.voltage, r.frequency); break;
+        case DISPLAY_POWER: display.showPower(r.power1, 0.95f, r.power2, 0.80f); break;
+        case DISPLAY_ENERGY: display.showEnergy(r.energy, r.energy * 7.5f, 7.5f); break;
+        case DISPLAY_THEFT: display.showTheft(false, 0.02f, 0, 0.0012f); break;
+    }
+}
+
+// What a blank LCD shows after drawing this page once
+static bool sameAsRedraw(const LiquidCrystal_I2C& lcd, uint8_t page, const Readings& r) {
+    Display fresh;
+    fresh.begin();
+    show(fresh, page, r);
+    return memcmp(lcd.ram, LiquidCrystal_I2C::last()->ram, sizeof lcd.ram) == 0;
+}
+
+int main() {
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0, 1);
+    Readings r = {};
+    r.energy = 12.3f;
+    auto latch = [&] {
+        r.i1 = 1.2f + 0.01f * noise(rng);
+        r.i2 = 0.45f + 0.01f * noise(rng);
+        r.voltage = 230 + 0.5f * noise(rng);
+        r.frequency = 50 + 0.02f * noise(rng);
+        r.power1 = r.i1 * r.voltage * 0.95f;
+        r.power2 = r.i2 * r.voltage * 0.8f;
+        r.energy += (r.power1 + r.power2) * 1.5f / 3.6e6f;
+    };
+
+    LiquidCrystal_I2C old(0x27, 16, 2);
+    const int REPORTS = UPDATES / 3;
+    for (int k = 0; k < REPORTS; k++) {
+        latch();
+        legacy(old, r.i1, r.i2, r.voltage);
+    }
+    double oldBytes = (double)old.bytes / REPORTS;
+
+    Display display;
+    display.begin();
+    LiquidCrystal_I2C& lcd = *LiquidCrystal_I2C::last();
+    unsigned long start = lcd.bytes;
+    uint32_t pageUpdates[DISPLAY_PAGES] = {};
+    uint32_t mismatches = 0;
+    unsigned long now = 0;
+    for (int k = 0; k < UPDATES; k++, now += UPDATE_MS) {
+        if (k % 3 == 0) latch();
+        uint8_t page = display.pageAt(now);
+        show(display, page, r);
+        pageUpdates[page]++;
+        if (!sameAsRedraw(lcd, page, r)) mismatches++;
+    }
+    double newBytes = (double)(lcd.bytes - start) / UPDATES;
+    printf("clear() and reprint: %.0f I2C bytes per 1.5 s report (%.0f B/s)\n",
+           oldBytes * Display::I2C_BYTES_PER_LCD_BYTE, oldBytes * Display::I2C_BYTES_PER_LCD_BYTE / 1.5);
+    printf("dirty cells: %.0f I2C bytes per 500 ms update (%.0f B/s), all pages and page switches\n",
+           newBytes * Display::I2C_BYTES_PER_LCD_BYTE, newBytes * Display::I2C_BYTES_PER_LCD_BYTE * 1000 / UPDATE_MS);
+    CHECK(mismatches == 0);
+    CHECK(lcd.clears == 1);                                 // Only in begin()
+    CHECK(newBytes * 1000 / UPDATE_MS < oldBytes / 1.5);     // Less bus load at three times the rate
+    CHECK(display.getUpdateCount() == (uint32_t)UPDATES);
+    CHECK(display.getI2cBytes() == (lcd.bytes - start) * Display::I2C_BYTES_PER_LCD_BYTE);
+    CHECK(display.getRedrawI2cBytes() > display.getI2cBytes());
+    for (uint8_t p = 0; p < DISPLAY_PAGES; p++) CHECK(pageUpdates[p] == (uint32_t)UPDATES / DISPLAY_PAGES);
+
+    // An unchanged frame sends nothing
+    show(display, display.pageAt(now), r);
+    show(display, display.pageAt(now), r);
+    CHECK(display.getLastI2cBytes() == 0);
+
+    // Rows are cut at 16 columns; the theft countdown is capped at 999 s
+    display.showTheft(false, 0.5f, 1234, 0.01f);
+    CHECK(memcmp(lcd.ram[0], "Theft?  50% 999s", 16) == 0);
+    CHECK(memcmp(lcd.ram[1], "Leak:  0.0100 A ", 16) == 0);
+    display.showMessage("A message longer than the screen", "");
+    CHECK(memcmp(lcd.ram[0], "A message longer", 16) == 0);
+    CHECK(memcmp(lcd.ram[1], "                ", 16) == 0);
+
+    // Two IR presses: two pages on, held for MANUAL_HOLD, then rotating again
+    uint8_t before = display.pageAt(now);
+    display.nextPage();
+    display.nextPage();
+    CHECK(display.pageAt(now) == (before + 2) % DISPLAY_PAGES);
+    CHECK(display.pageAt(now + Display::MANUAL_HOLD - 1) == (before + 2) % DISPLAY_PAGES);
+    CHECK(display.pageAt(now + Display::MANUAL_HOLD) == (before + 3) % DISPLAY_PAGES);
+    return testResult("display");
+}
@@ -0,0 +1,129 @@
+// Power-fail injection for EnergyJournal on RamFlashPartition: an append is cut
+// after every possible number of programmed bytes, and a sector erase after every
+// possible number of cleared bytes, both in a fresh sector and in one still
+// holding old records. After each cut, begin() must recover the last committed
+// value, and the journal must keep working. EnergyCalculator's handoff to the
+// storage task (queueSave() then saveToFlash()) is checked on the same partition.
+#include "test.h"
+#include "FlashPartition.h"
+#include "EnergyJournal.h"
+#include "EnergyCalculator.h"
+
+static const uint32_t SECTORS = 4;
+static const uint32_t SLOTS = EnergyJournal::SLOTS_PER_SECTOR;
+
+static uint64_t valueOf(uint32_t n) {
+    return 1000003ull * n + 7;
+}
+
+// Journal holding `records` appends; the last one holds valueOf(records)
+static void fill(RamFlashPartition& flash, uint32_t records) {
+    EnergyJournal journal(flash);
+    CHECK(journal.begin());
+    for (uint32_t n = 1; n <= records; n++) {
+        CHECK(journal.append(valueOf(n), valueOf(n) * 2));
+    }
+}
+
+// Reboot, check the newest value, then append once more and check again
+static bool recovers(RamFlashPartition& flash, uint64_t expected) {
+    flash.powerCycle();
+    EnergyJournal journal(flash);
+    uint64_t l1 = 0, l2 = 0;
+    if (!journal.begin() || !journal.getLatest(l1, l2)) return false;
+    if (l1 != expected || l2 != expected * 2) return false;
+
+    if (!journal.append(expected + 1, (expected + 1) * 2)) return false;
+    EnergyJournal again(flash);
+    if (!again.begin() || !again.getLatest(l1, l2)) return false;
+    return l1 == expected + 1 && l2 == (expected + 1) * 2;
+}
+
+// Cut the append after the first `records` at every programmed byte
+static void cutAppend(uint32_t records, const char* where) {
+    uint32_t failures = 0;
+    for (uint32_t cut = 0; cut < EnergyJournal::SLOT_SIZE; cut++) {
+        RamFlashPartition flash(SECTORS);
+        fill(flash, records);
+        EnergyJournal journal(flash);
+        CHECK(journal.begin());
+        flash.failAfter(cut);
+        CHECK(!journal.append(12345, 67890));
+        CHECK(flash.hasFailed());
+        if (!recovers(flash, valueOf(records))) failures++;
+    }
+    printf("append cut at each of %u bytes, %s: %u failed recoveries\n",
+           EnergyJournal::SLOT_SIZE, where, failures);
+    CHECK(failures == 0);
+}
+
+// Cut the erase that opens the next sector at every byte of the sector
+static void cutErase(uint32_t records, const char* where) {
+    uint32_t failures = 0;
+    for (uint32_t cut = 0; cut <= FlashPartition::SECTOR_SIZE; cut++) {
+        RamFlashPartition flash(SECTORS);
+        fill(flash, records);
+        EnergyJournal journal(flash);
+        CHECK(journal.begin());
+        flash.failEraseAfter(cut);
+        CHECK(!journal.append(12345, 67890));
+        CHECK(flash.hasFailed());
+        if (!recovers(flash, valueOf(records))) failures++;
+    }
+    printf("erase cut at each of %u bytes, %s: %u failed recoveries\n",
+           FlashPartition::SECTOR_SIZE + 1, where, failures);
+    CHECK(failures == 0);
+}
+
+int main() {
+    // Appends inside a sector: first slot, middle, last slot
+    cutAppend(SLOTS, "first slot of sector 1");
+    cutAppend(5, "middle of sector 0");
+    cutAppend(SLOTS - 1, "last slot of sector 0");
+    cutAppend(SECTORS * SLOTS, "first slot after the wrap");
+
+    // Erases: a never-used sector, then the oldest sector on wrap-around
+    cutErase(SLOTS, "fresh sector 1");
+    cutErase(SECTORS * SLOTS, "sector 0 holding the oldest records");
+    cutErase(2 * SECTORS * SLOTS, "sector 0 on the second wrap");
+
+    // A cut on an already-dirty slot: two cuts in a row, then recovery
+    {
+        RamFlashPartition flash(SECTORS);
+        fill(flash, 10);
+        for (uint32_t cut = 3; cut < 30; cut += 13) {
+            EnergyJournal journal(flash);
+            CHECK(journal.begin());
+            flash.failAfter(cut);
+            CHECK(!journal.append(1, 2));
+            flash.powerCycle();
+        }
+        CHECK(recovers(flash, valueOf(10)));
+    }
+    // Handoff: saveToFlash() writes only what queueSave() copied, and retries a failed write
+    {
+        RamFlashPartition flash(SECTORS);
+        EnergyJournal journal(flash);
+        EnergyCalculator energy;
+        energy.begin(5.0, &journal);
+        uint32_t seeded = journal.getSequence();
+        energy.addWindow(1000.0f, 250.0f, 20000, 20000);        // 1 s: 1000 J and 250 J
+        energy.saveToFlash();
+        CHECK(journal.getSequence() == seeded);
+        energy.queueSave();
+        energy.addWindow(1000.0f, 250.0f, 20000, 20000);        // Not in the copy
+        flash.failAfter(3);
+        energy.saveToFlash();
+        flash.powerCycle();
+        energy.saveToFlash();
+        energy.saveToFlash();                                   // Nothing pending any more
+        CHECK(journal.getSequence() == seeded + 1);
+
+        EnergyJournal reopened(flash);
+        EnergyCalculator restored;
+        restored.begin(5.0, &reopened);
+        CHECK(restored.getEnergyL1Millijoules() == 1000000);
+        CHECK(restored.getEnergyL2Millijoules() == 250000);
+    }
+    return testResult("energy_journal");
+}
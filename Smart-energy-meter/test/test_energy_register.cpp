@@ -0,0 +1,92 @@
+// EnergyRegister over ten simulated years of real-size power windows (10 mains
+// cycles, ~4000 samples at 20 kHz with frequency wander) against an exact
+// integer reference, including windows whose sample rate changes.
+// The register may trail the exact energy by less than 1 mJ, plus at most
+// 1 uW-sample per rate change, and it must never run ahead.
+#include "test.h"
+#include <Arduino.h>
+#include "EnergyCalculator.h"
+
+typedef unsigned __int128 u128;
+
+static const double YEARS = 10;
+static const uint64_t WINDOWS = (uint64_t)(YEARS * 365.25 * 86400 * 5);   // 200 ms each
+
+// Exact energy in uW-samples over the common rate lcm(20000, 19000, 16000).
+// Windows are summed in 64 bits per rate and folded into 128 bits now and then.
+struct ExactEnergy {
+    static const uint64_t COMMON_RATE = 1520000;
+    u128 total = 0;
+    uint64_t pending = 0;
+    uint32_t pendingRate = 0;
+    uint32_t pendingWindows = 0;
+
+    void fold() {
+        if (pendingRate != 0) total += (u128)pending * (COMMON_RATE / pendingRate);
+        pending = 0;
+        pendingWindows = 0;
+    }
+
+    void add(uint64_t microwatts, uint32_t samples, uint32_t rate) {
+        if (rate != pendingRate || pendingWindows == 1000000) {
+            fold();
+            pendingRate = rate;
+        }
+        pending += microwatts * samples;
+        pendingWindows++;
+    }
+
+    uint64_t millijoules() {
+        fold();
+        return (uint64_t)(total / (COMMON_RATE * 1000));
+    }
+};
+
+static uint32_t lcg = 12345;
+static uint32_t nextRandom() {
+    lcg = lcg * 1664525u + 1013904223u;
+    return lcg >> 8;
+}
+
+static void run(const float* watts, uint8_t powers, bool changeRate) {
+    static const uint32_t rates[] = {20000, 19000, 16000};
+    EnergyRegister reg;
+    reg.reset();
+    ExactEnergy exact;
+    uint32_t rate = rates[0];
+    uint32_t rateChanges = 0;
+
+    for (uint64_t w = 0; w < WINDOWS; w++) {
+        // Rate change about once a simulated day
+        if (changeRate && nextRandom() % 432000 == 0) {
+            uint32_t next = rates[nextRandom() % 3];
+            if (next != rate) rateChanges++;
+            rate = next;
+        }
+        float p = watts[w % powers];
+        uint32_t samples = rate / 5 + nextRandom() % 7 - 3;       // +/- 3 samples of wander
+        reg.add(p, samples, rate);
+        exact.add((uint64_t)(p * 1e6f + 0.5f), samples, rate);
+    }
+
+    uint64_t expected = exact.millijoules();
+    CHECK(reg.millijoules <= expected);
+    // Each rate change may floor away under one uW-sample (far below 1 mJ)
+    CHECK(expected - reg.millijoules <= 1);
+    printf("%.0f years, %u power levels, %u rate changes: %.6f kWh, %llu mJ behind exact\n",
+           YEARS, powers, rateChanges, reg.kWh(),
+           (unsigned long long)(expected - reg.millijoules));
+}
+
+int main() {
+    // Standby to full load, window by window, with occasional rate changes
+    const float mixed[] = {0.35f, 61.7f, 1234.567f, 3.7f, 2300.0f, 0.0f};
+    run(mixed, 6, true);
+
+    // Register outgrowing float: a 3.7 W load still counts on top of 1 MWh
+    EnergyRegister big;
+    big.reset(3600000000000ull);                               // 1000 kWh in mJ
+    for (int w = 0; w < 5 * 3600; w++) big.add(3.7f, 4000, 20000);
+    CHECK(big.millijoules - 3600000000000ull == 3700 * 3600);
+    return testResult("energy_register");
+}
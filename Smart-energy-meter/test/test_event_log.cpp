@@ -0,0 +1,174 @@
+// EventLog: the deferred formatter against printf, the runtime level filter,
+// LOG_COMPILE_LEVEL, and three producer threads against a consumer that only
+// takes a few bytes per drain. Every event is either drained intact and in
+// order or counted as dropped (and reported in a drop notice).
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#include "test.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "EventLog.h"
+
+// Collects drained lines; takes at most `fifo` bytes per call, like the UART
+struct Capture : Print {
+    std::string text;
+    int fifo = 1 << 30;
+
+    size_t write(const uint8_t* data, size_t n) override {
+        text.append((const char*)data, n);
+        return n;
+    }
+
+    int availableForWrite() override {
+        return fifo;
+    }
+};
+
+// Text of each complete line after "time L module: "
+static std::vector<std::string> bodies(std::string& text) {
+    std::vector<std::string> lines;
+    size_t start = 0, end;
+    while ((end = text.find("\r\n", start)) != std::string::npos) {
+        std::string line = text.substr(start, end - start);
+        size_t colon = line.find(": ");
+        lines.push_back(colon == std::string::npos ? line : line.substr(colon + 2));
+        start = end + 2;
+    }
+    text.erase(0, start);
+    return lines;
+}
+
+static void testFormatting(EventLog& log) {
+    Capture out;
+    LOG_INFO(LOG_MAIN, "Voltage: %.2f V @ %.2f Hz", 229.456f, 50.02);
+    LOG_INFO(LOG_NET, "%u readings sent, %lu B (#%lu..) | Queue: %d", 12u, 345ul, 4000000000ul, -3);
+    LOG_INFO(LOG_MAIN, "R1=%s 100%% |%5d|%-4u|%x|%c", "ON", 42, 7u, 255u, 'Z');
+    LOG_INFO(LOG_MAIN, "no args");
+    LOG_INFO(LOG_MAIN, "missing %d");
+    log.drain(out, 100);
+    unsigned long seconds, ms;
+    char level, module[8];
+    CHECK(sscanf(out.text.c_str(), "%lu.%3lu %c %7[a-z]: ", &seconds, &ms, &level, module) == 4);
+    CHECK(level == 'I' && strcmp(module, "main") == 0);
+
+    const char* expected[] = {"Voltage: 229.46 V @ 50.02 Hz",
+                              "12 readings sent, 345 B (#4000000000..) | Queue: -3",
+                              "R1=ON 100% |   42|7   |ff|Z", "no args", "missing "};
+    std::vector<std::string> lines = bodies(out.text);
+    CHECK(lines.size() == 5);
+    for (size_t i = 0; i < lines.size() && i < 5; i++) CHECK(lines[i] == expected[i]);
+}
+
+static void testLevels(EventLog& log) {
+    Capture out;
+    uint32_t written = log.getWritten();
+    LOG_DEBUG(LOG_NET, "debug %d", 1);                  // Off by default
+    CHECK(log.getWritten() == written);
+
+    // Runtime filter per module and for all of them
+    CHECK(log.command("log net error"));
+    LOG_WARN(LOG_NET, "net warning");
+    LOG_WARN(LOG_MAIN, "main warning");
+    CHECK(log.command("log all off"));
+    LOG_ERROR(LOG_METER, "meter error");
+    CHECK(!log.command("logger"));
+    CHECK(log.command("log all info"));
+    log.drain(out, 100);
+    std::vector<std::string> lines = bodies(out.text);
+    CHECK(lines.size() == 7);       // Two level reports per command, one warning
+    CHECK(lines.size() > 2 && lines[2] == "main warning");
+
+    // Compiled out above LOG_COMPILE_LEVEL, whatever the runtime level
+    log.setLevel(LOG_NET, LOG_LEVEL_DEBUG);
+    written = log.getWritten();
+    LOG_DEBUG(LOG_NET, "debug %d", 2);
+    CHECK(log.getWritten() == written);
+    log.setLevel(LOG_NET, LOG_LEVEL_INFO);
+    log.drain(out, 100);
+
+    // The debug format strings are not in the binary, the info ones are
+    LOG_INFO(LOG_MAIN, "EVENT_LOG_INFO_MARKER");
+    LOG_DEBUG(LOG_MAIN, "EVENT_LOG_DEBUG_MARKER");
+    log.drain(out, 100);
+    FILE* binary = fopen("/proc/self/exe", "rb");
+    CHECK(binary != nullptr);
+    if (binary == nullptr) return;
+    std::string image;
+    char buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof buffer, binary)) > 0) image.append(buffer, n);
+    fclose(binary);
+    std::string marker = "EVENT_LOG_";
+    CHECK(image.find(marker + "INFO_MARKER") != std::string::npos);
+    CHECK(image.find(marker + "DEBUG_MARKER") == std::string::npos);
+}
+
+static void testProducers(EventLog& log) {
+    const int PRODUCERS = 3;
+    const int EVENTS = 200000;
+    uint32_t written = log.getWritten(), dropped = log.getDropped();
+    std::atomic<bool> done{false};
+    std::vector<std::thread> producers;
+    for (int t = 0; t < PRODUCERS; t++) {
+        producers.emplace_back([t] {
+            for (int i = 0; i < EVENTS; i++) {
+                LOG_INFO(LOG_METER, "t%d seq %d check %d %.1f", t, i, t * 1000003 + i, (float)(i % 100));
+                if (i % 64 == 0) std::this_thread::yield();
+            }
+        });
+    }
+
+    Capture sink;
+    sink.fifo = 128;
+    uint64_t lines = 0, notices = 0, reported = 0;
+    uint32_t corrupt = 0;
+    int last[PRODUCERS] = {-1, -1, -1};
+    auto verify = [&] {
+        for (const std::string& line : bodies(sink.text)) {
+            unsigned long lost;
+            int t, i, check;
+            float f;
+            if (sscanf(line.c_str(), "t%d seq %d check %d %f", &t, &i, &check, &f) == 4 && t >= 0 &&
+                t < PRODUCERS && check == t * 1000003 + i && (int)f == i % 100 && i > last[t]) {
+                last[t] = i;
+                lines++;
+            } else if (sscanf(line.c_str(), "⚠️ %lu log events dropped", &lost) == 1) {
+                notices++;
+                reported += lost;
+            } else {
+                corrupt++;
+            }
+        }
+    };
+    std::thread consumer([&] {
+        while (!done) {
+            log.drain(sink, 16);
+            if (sink.text.size() > 65536) verify();
+        }
+    });
+    for (std::thread& producer : producers) producer.join();
+    done = true;
+    consumer.join();
+    while (log.drain(sink, 1000)) {}
+    verify();
+
+    written = log.getWritten() - written;
+    dropped = log.getDropped() - dropped;
+    printf("%d producers: %u written + %u dropped of %d, %llu drained, %llu drop notices, high water %u of %u\n",
+           PRODUCERS, written, dropped, PRODUCERS * EVENTS, (unsigned long long)lines,
+           (unsigned long long)notices, log.getHighWater(), EventLog::RING_SIZE);
+    CHECK(written + dropped == (uint32_t)(PRODUCERS * EVENTS));
+    CHECK(lines == written);
+    CHECK(reported == dropped);
+    CHECK(corrupt == 0);
+    CHECK(dropped > 0);             // The consumer really was too slow
+}
+
+int main() {
+    EventLog& log = EventLog::instance();
+    testFormatting(log);
+    testLevels(log);
+    testProducers(log);
+    return testResult("event_log");
+}
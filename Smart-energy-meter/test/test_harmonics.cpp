@@ -0,0 +1,32 @@
+// GoertzelBank recovers known harmonic content over a whole-cycle window,
+// including when the mains is off nominal and the bank follows it
+#include "test.h"
+#include "HarmonicAnalyzer.h"
+
+static const uint32_t RATE = 20000;
+
+static const HarmonicReading& analyze(double fundamentalHz, int cycles) {
+    static GoertzelBank bank;
+    bank.start(fundamentalHz, RATE);
+    int n = (int)lround(cycles * RATE / fundamentalHz);
+    for (int i = 0; i < n; i++) {
+        double t = (double)i / RATE;
+        double w = 2 * M_PI * fundamentalHz * t;
+        bank.add((int32_t)lround(1000 * sin(w) + 50 * sin(3 * w + 1) + 30 * sin(11 * w)));
+    }
+    bank.finish();
+    return bank.getReading();
+}
+
+int main() {
+    const double frequencies[] = {50.0, 49.5, 60.0};
+    for (double f : frequencies) {
+        const HarmonicReading& r = analyze(f, 10);
+        CHECK_NEAR(r.fundamental, 1000, 1);
+        CHECK_NEAR(r.percent[0], 5, 0.01);
+        CHECK_NEAR(r.percent[1], 0, 0.02);
+        CHECK_NEAR(r.percent[4], 3, 0.01);
+        CHECK_NEAR(r.thd, sqrt(5.0 * 5.0 + 3.0 * 3.0), 0.02);
+    }
+    return testResult("harmonics");
+}
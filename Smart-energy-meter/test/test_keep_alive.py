@@ -0,0 +1,89 @@
+# KeepAliveRequestHandler from app.py on Werkzeug's development server: one
+# HTTP/1.1 connection serves a JSON POST, a 415 whose body the app never read,
+# 404s and two pipelined GETs, in order and without being closed. An HTTP/1.0
+# client still gets one response per connection.
+import logging
+import os
+import socket
+import sys
+import threading
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path[:0] = [os.path.join(HERE, 'stubs', 'python'), os.path.join(HERE, '..', 'Flask_server')]
+import app
+from werkzeug.serving import make_server
+
+failures = []
+
+def check(condition, message):
+    if not condition:
+        failures.append(message)
+        print(f'  {message}')
+
+def receive(sock):
+    """Next bytes from the server; b'' once it closed, reset or went quiet"""
+    try:
+        return sock.recv(4096)
+    except OSError:
+        return b''
+
+def read_response(sock, pending):
+    """One response (status code, header lines, body) and whatever follows it"""
+    while b'\r\n\r\n' not in pending:
+        data = receive(sock)
+        if not data:
+            return None, [], b'', pending
+        pending += data
+    head, pending = pending.split(b'\r\n\r\n', 1)
+    lines = head.decode().split('\r\n')
+    length = next((int(l.split(':')[1]) for l in lines if l.lower().startswith('content-length:')), 0)
+    while len(pending) < length:
+        data = receive(sock)
+        if not data:
+            return None, [], b'', pending
+        pending += data
+    return int(lines[0].split()[1]), lines[1:], pending[:length], pending[length:]
+
+def closes(lines):
+    return any(l.lower() == 'connection: close' for l in lines)
+
+logging.getLogger('werkzeug').setLevel(logging.ERROR)
+server = make_server('127.0.0.1', 0, app.app, threaded=True, request_handler=app.KeepAliveRequestHandler)
+threading.Thread(target=server.serve_forever, daemon=True).start()
+address = ('127.0.0.1', server.server_port)
+
+with socket.create_connection(address, timeout=5) as sock:
+    body = b'{"theft_detected": false}'
+    requests = [
+        (b'POST /api/theft/alert HTTP/1.1\r\nHost: meter\r\nContent-Type: application/json\r\n'
+         b'Content-Length: %d\r\n\r\n%s' % (len(body), body), 200),
+        # Rejected before the body is read: the rest must not be taken for a request
+        (b'POST /api/data HTTP/1.1\r\nHost: meter\r\nContent-Type: text/plain\r\n'
+         b'Content-Length: 16\r\n\r\nGET / HTTP/1.1\r\n', 415),
+        (b'GET /api/nothing HTTP/1.1\r\nHost: meter\r\n\r\n', 404),
+        (b'GET /api/commands/stats HTTP/1.1\r\nHost: meter\r\n\r\n', 200),
+    ]
+    pending = b''
+    for request, expected in requests:
+        sock.sendall(request)
+        code, lines, _, pending = read_response(sock, pending)
+        check(code == expected, f'{request.split(b" ")[1].decode()}: {code}, expected {expected}')
+        check(not closes(lines), f'{request.split(b" ")[1].decode()}: connection closed')
+
+    # Both requests written before either response is read
+    sock.sendall(b'GET /api/commands/stats HTTP/1.1\r\nHost: meter\r\n\r\n'
+                 b'GET /api/nothing HTTP/1.1\r\nHost: meter\r\n\r\n')
+    first, _, _, pending = read_response(sock, pending)
+    second, lines, _, pending = read_response(sock, pending)
+    check((first, second) == (200, 404), f'pipelined: {first}, {second}')
+    check(not closes(lines) and pending == b'', 'pipelined: connection closed or extra bytes')
+
+with socket.create_connection(address, timeout=5) as sock:
+    sock.sendall(b'GET /api/commands/stats HTTP/1.0\r\n\r\n')
+    code, lines, _, pending = read_response(sock, b'')
+    check(code == 200, f'HTTP/1.0: {code}')
+    check(receive(sock) == b'', 'HTTP/1.0: connection left open')
+
+server.shutdown()
+print('keep_alive.py: ' + ('FAILED' if failures else 'ok'))
+sys.exit(1 if failures else 0)
@@ -0,0 +1,356 @@
+// LocalApi on real loopback sockets, driven by poll() from this thread:
+// /api/history larger than the 1 KB output buffer, read fast and in small
+// pieces, history across a run of unreadable rollup slots longer than one
+// refill may scan, the 503 for a client arriving while every slot is busy, and
+// windows and snapshots published from another thread while this one polls.
+#include "test.h"
+#include <signal.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "LocalApi.h"
+
+static const uint16_t PORT = 18419;
+static const uint32_t T0 = 1759996800;         // On an hour boundary
+static const uint32_t WINDOWS_PER_SECOND = 5;
+static const uint64_t MJ_PER_WINDOW = 54000;     // 270 W on load 1
+
+// Plain POSIX client, non-blocking once connected
+class Client {
+private:
+    int fd;
+
+public:
+    std::string received;
+    bool closed;
+
+    Client() : fd(-1), closed(false) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(PORT);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0) closed = true;
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+    }
+
+    ~Client() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    void get(const char* path) {
+        std::string request = std::string("GET ") + path + " HTTP/1.1\r\nHost: meter\r\n\r\n";
+        CHECK(send(fd, request.data(), request.size(), MSG_NOSIGNAL) == (ssize_t)request.size());
+    }
+
+    // Read up to `limit` bytes of what has arrived
+    void receive(size_t limit = 65536) {
+        char buffer[65536];
+        ssize_t n = recv(fd, buffer, limit < sizeof buffer ? limit : sizeof buffer, 0);
+        if (n > 0) {
+            received.append(buffer, n);
+        } else if (n == 0) {
+            closed = true;
+        }
+    }
+
+    void hangUp() {
+        ::close(fd);
+        fd = -1;
+        closed = true;
+    }
+
+    std::string body() const {
+        size_t at = received.find("\r\n\r\n");
+        return at == std::string::npos ? "" : received.substr(at + 4);
+    }
+};
+
+// Poll the API and read the client until the server closes (bounded)
+static void exchange(LocalApi& api, Client& client, size_t readSize) {
+    for (int i = 0; i < 200000 && !client.closed; i++) {
+        api.poll(millis());
+        client.receive(readSize);
+    }
+}
+
+static void fillRollups(RollupStore& store, uint32_t seconds) {
+    float values[ROLLUP_CHANNELS] = {230, 1.2f, 0.4f, 1.6f, 270, 90};
+    uint64_t energyL1 = 0, energyL2 = 0;
+    for (uint32_t w = 0; w < seconds * WINDOWS_PER_SECOND; w++) {
+        store.addWindow(values, energyL1, energyL2, T0 + w / WINDOWS_PER_SECOND, true);
+        energyL1 += MJ_PER_WINDOW;
+        energyL2 += MJ_PER_WINDOW / 3;
+    }
+}
+
+// An hour of 1 minute records (~16 KB) through the 1 KB buffer
+static void testHistory(LocalApi& api, size_t readSize) {
+    Client client;
+    char path[96];
+    snprintf(path, sizeof path, "/api/history?tier=1m&from=%lu&to=%lu",
+             (unsigned long)T0, (unsigned long)(T0 + 3600));
+    client.get(path);
+    exchange(api, client, readSize);
+    CHECK(client.closed);
+    CHECK(client.received.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+
+    std::string body = client.body();
+    CHECK(body.size() > 10 * LocalApi::OUTPUT_SIZE);
+    CHECK(body.compare(0, 25, "{\"tier\":\"1m\",\"records\":[{") == 0);
+
+    // Every record whole and in order, none lost or repeated at a refill
+    uint32_t records = 0;
+    uint32_t expectedStart = T0;
+    double energy = 0;
+    for (size_t at = body.find("{\"start\":"); at != std::string::npos; at = body.find("{\"start\":", at + 1)) {
+        unsigned long start = 0;
+        float energyL1 = 0, energyL2 = 0;
+        CHECK(sscanf(body.c_str() + at, "{\"start\":%lu", &start) == 1);
+        size_t field = body.find("\"energy_j\":[", at);
+        CHECK(field != std::string::npos);
+        CHECK(sscanf(body.c_str() + field, "\"energy_j\":[%f,%f]}", &energyL1, &energyL2) == 2);
+        CHECK(start == expectedStart);
+        expectedStart += 60;
+        energy += energyL1;
+        records++;
+    }
+    unsigned long count = 0;
+    size_t tail = body.rfind("],\"count\":");
+    CHECK(tail != std::string::npos && sscanf(body.c_str() + tail, "],\"count\":%lu}", &count) == 1);
+    CHECK(body.back() == '}');
+    CHECK(records == 60 && count == 60);
+    CHECK_NEAR(energy, 3600.0 * WINDOWS_PER_SECOND * MJ_PER_WINDOW / 1000, 0.01);
+    printf("history, reads of %zu bytes: %zu bytes, %u records\n", readSize, body.size(), records);
+}
+
+// Minute records of [from, to) made unreadable (magic cleared in flash)
+static void corrupt(RamFlashPartition& flash, uint32_t from, uint32_t to) {
+    for (uint32_t offset = 0; offset < flash.size(); offset += sizeof(RollupRecord)) {
+        RollupRecord r;
+        flash.read(offset, &r, sizeof(r));
+        if (!r.isValid(ROLLUP_MINUTE) || r.start < from || r.start >= to) continue;
+        uint16_t zero = 0;
+        flash.write(offset + offsetof(RollupRecord, magic), &zero, sizeof(zero));
+    }
+}
+
+// The last 90 minutes with 80 of them unreadable: the cursor crosses them in
+// steps of at most HISTORY_SCAN slots, some refills find nothing to send, and
+// the response still ends with the 9 records around them (the last minute is
+// still open)
+static void testGap(LocalApi& api, const RollupStore& store) {
+    const uint32_t from = T0 + 1800, to = T0 + 7200;
+    RollupCursor cursor = store.query(ROLLUP_MINUTE, from, to);
+    uint32_t found = 0, emptyPasses = 0, widest = 0;
+    while (!cursor.isDone()) {
+        uint32_t position = cursor.getPosition();
+        if (cursor.next(LocalApi::HISTORY_SCAN) != nullptr) found++;
+        else if (!cursor.isDone()) emptyPasses++;
+        if (cursor.getPosition() - position > widest && !cursor.isDone()) widest = cursor.getPosition() - position;
+    }
+    CHECK(found == 9);
+    CHECK(emptyPasses >= 80 / LocalApi::HISTORY_SCAN);
+    CHECK(widest <= LocalApi::HISTORY_SCAN);
+
+    Client client;
+    char path[96];
+    snprintf(path, sizeof path, "/api/history?tier=1m&from=%lu&to=%lu", (unsigned long)from, (unsigned long)to);
+    client.get(path);
+    exchange(api, client, 65536);
+    CHECK(client.closed);
+    std::string body = client.body();
+    uint32_t records = 0;
+    for (size_t at = body.find("{\"start\":"); at != std::string::npos; at = body.find("{\"start\":", at + 1)) {
+        records++;
+    }
+    unsigned long count = 0;
+    size_t tail = body.rfind("],\"count\":");
+    CHECK(tail != std::string::npos && sscanf(body.c_str() + tail, "],\"count\":%lu}", &count) == 1);
+    CHECK(records == 9 && count == 9);
+    printf("history across 80 unreadable slots: %u records, %u empty passes of %u slots\n",
+           records, emptyPasses, LocalApi::HISTORY_SCAN);
+}
+
+// Every slot holding a stream: the next client gets a 503 and is closed
+static void testBusy(LocalApi& api) {
+    std::vector<Client*> streams;
+    for (uint8_t i = 0; i < LocalApi::MAX_CLIENTS; i++) {
+        streams.push_back(new Client());
+        streams.back()->get("/api/stream");
+        for (int p = 0; p < 1000 && api.getStreamCount() <= i; p++) api.poll(millis());
+    }
+    CHECK(api.getStreamCount() == LocalApi::MAX_CLIENTS);
+
+    uint32_t rejected = api.getRejectedCount();
+    Client extra;
+    extra.get("/api/latest");
+    exchange(api, extra, 65536);
+    CHECK(extra.closed);
+    CHECK(extra.received.compare(0, 32, "HTTP/1.1 503 Service Unavailable") == 0);
+    CHECK(api.getRejectedCount() == rejected + 1);
+
+    // The streams were not disturbed: each gets the next window
+    LocalWindow window = {1, T0, true, 230.1f, 50.0f, 1.2f, 0.4f, 1.6f, 270, 90, 1000, 2000};
+    api.publishWindow(window);
+    for (int p = 0; p < 100; p++) {
+        api.poll(millis());
+        for (Client* stream : streams) stream->receive();
+    }
+    for (Client* stream : streams) {
+        CHECK(stream->received.find("data: {\"window\":1,") != std::string::npos);
+    }
+
+    // A freed slot serves the next client
+    streams.back()->hangUp();
+    for (int p = 0; p < 1000 && api.getClientCount() == LocalApi::MAX_CLIENTS; p++) api.poll(millis());
+    CHECK(api.getClientCount() == LocalApi::MAX_CLIENTS - 1);
+    Client next;
+    next.get("/api/latest");
+    exchange(api, next, 65536);
+    CHECK(next.received.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+    CHECK(api.getRejectedCount() == rejected + 1);
+    printf("busy: %u clients served, %u rejected\n", LocalApi::MAX_CLIENTS + 1, api.getRejectedCount() - rejected);
+
+    for (Client* stream : streams) delete stream;
+}
+
+// SeqlockSlot with a value large enough that the writer is often preempted
+// mid-copy: a read reported good is always one whole write
+static void testSlot() {
+    struct Block {
+        uint32_t words[1024];
+    };
+    static SeqlockSlot<Block> slot;
+    std::atomic<bool> stop{false};
+    std::thread writer([&] {
+        static Block block;
+        for (uint32_t n = 1; !stop; n++) {
+            for (uint32_t& word : block.words) word = n;
+            slot.write(block);
+        }
+    });
+    static Block copy;
+    uint32_t reads = 0, gaveUp = 0, torn = 0;
+    uint64_t end = nowUs() + 300000;
+    while (nowUs() < end) {
+        if (!slot.read(copy)) {
+            gaveUp++;
+            continue;
+        }
+        for (uint32_t word : copy.words) {
+            if (word != copy.words[0]) {
+                torn++;
+                break;
+            }
+        }
+        reads++;
+    }
+    stop = true;
+    writer.join();
+    printf("slot: %u reads, %u gave up, %u torn\n", reads, gaveUp, torn);
+    CHECK(reads > 1000 && torn == 0);
+}
+
+// A control thread publishing every 100 us: every streamed event and
+// every /api/latest is one whole window, and the stream never goes back
+static void testConcurrent(LocalApi& api) {
+    for (int p = 0; p < 1000 && api.getClientCount() > 0; p++) api.poll(millis());
+    Client stream;
+    stream.get("/api/stream");
+    for (int p = 0; p < 1000 && api.getStreamCount() == 0; p++) api.poll(millis());
+    CHECK(api.getStreamCount() == 1);
+
+    std::atomic<bool> stop{false};
+    std::thread control([&] {
+        for (uint32_t n = 2; !stop; n++) {
+            LocalWindow window = {n, T0 + n, true, 230.1f, 50.0f, 1.2f, 0.4f, 1.6f, 270, 90,
+                                  n * 1000ull, n * 2000ull};
+            api.publishWindow(window);
+            LocalSnapshot snapshot = {};
+            snapshot.window = n;
+            snapshot.timestamp = T0 + n;
+            snapshot.energyL1 = n * 1000ull;
+            snapshot.energyL2 = n * 3ull;
+            api.setLatest(snapshot);
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+
+    uint32_t sentBefore = api.getEventsSent(), skippedBefore = api.getEventsSkipped();
+    uint32_t latests = 0, tornLatest = 0;
+    uint64_t end = nowUs() + 300000;
+    while (nowUs() < end) {
+        Client latest;
+        latest.get("/api/latest");
+        exchange(api, latest, 65536);
+        std::string body = latest.body();
+        unsigned long window = 0, timestamp = 0;
+        unsigned long long energyL1 = 0, energyL2 = 0;
+        if (sscanf(body.c_str(), "{\"window\":%lu,\"timestamp\":%lu", &window, &timestamp) == 2) {
+            size_t at = body.find("\"energy_l1_mj\":");
+            sscanf(body.c_str() + at, "\"energy_l1_mj\":%llu,\"energy_l2_mj\":%llu", &energyL1, &energyL2);
+            // Window 0 is main()'s snapshot from before the thread started
+            if (window == 0) continue;
+            if (timestamp != T0 + window || energyL1 != window * 1000ull || energyL2 != window * 3ull) tornLatest++;
+            latests++;
+        }
+        stream.receive();
+    }
+    stop = true;
+    control.join();
+    for (int p = 0; p < 100; p++) {
+        api.poll(millis());
+        stream.receive();
+    }
+
+    uint32_t events = 0, torn = 0, backwards = 0;
+    unsigned long first = 0, previous = 0;
+    for (size_t at = stream.received.find("data: "); at != std::string::npos; at = stream.received.find("data: ", at + 1)) {
+        unsigned long window = 0, timestamp = 0;
+        unsigned long long energyL1 = 0, energyL2 = 0;
+        sscanf(stream.received.c_str() + at, "data: {\"window\":%lu,\"timestamp\":%lu", &window, &timestamp);
+        size_t field = stream.received.find("\"energy_l1_mj\":", at);
+        sscanf(stream.received.c_str() + field, "\"energy_l1_mj\":%llu,\"energy_l2_mj\":%llu", &energyL1, &energyL2);
+        if (timestamp != T0 + window || energyL1 != window * 1000ull || energyL2 != window * 2000ull) torn++;
+        if (window <= previous) backwards++;
+        if (first == 0) first = window;
+        previous = window;
+        events++;
+    }
+    uint32_t sent = api.getEventsSent() - sentBefore, skipped = api.getEventsSkipped() - skippedBefore;
+    printf("concurrent: %u events streamed (%u skipped), %u latest, %u torn\n",
+           events, skipped, latests, torn + tornLatest);
+    CHECK(events > 100 && latests > 100);
+    CHECK(torn == 0 && tornLatest == 0 && backwards == 0);
+    CHECK(sent == events);
+    // Every window from the first streamed one on was sent or counted as skipped
+    CHECK(sent + skipped == previous - first + 1);
+}
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+    static RamFlashPartition flash(128);
+    static RollupStore store(flash);
+    CHECK(store.begin());
+    fillRollups(store, 2 * 3600);
+
+    static LocalApi api(PORT);
+    api.begin(&store);
+    LocalSnapshot snapshot = {};
+    snapshot.voltage = 230.1f;
+    snapshot.price = 5;
+    api.setLatest(snapshot);
+    api.poll(millis());     // Starts listening
+
+    testHistory(api, 65536);
+    testHistory(api, 100);
+    corrupt(flash, T0 + 1800 + 300, T0 + 1800 + 300 + 80 * 60);
+    testGap(api, store);
+    testBusy(api);
+    testSlot();
+    testConcurrent(api);
+    return testResult("local_api");
+}
@@ -0,0 +1,182 @@
+// LatencyHistogram and MetricsWriter: bucket placement, snapshots written in
+// parts of any size concatenating byte-for-byte to the whole, an item too large
+// for the buffer, and snapshots taken while another thread records once per
+// microsecond. With a directory argument it instead writes two meters'
+// snapshots in 3 KB parts there, as uploaded to POST /api/metrics, for
+// test_metrics.py.
+#include "test.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Metrics.h"
+
+static LatencyHistogram schedulers[4];
+static uint32_t taskRuns[19];
+static uint32_t meterNumber = 1;
+
+// A snapshot shaped like the sketch's writeMetrics()
+static void writeSnapshot(MetricsWriter& w) {
+    char labels[64];
+    Metrics& metrics = Metrics::instance();
+    w.family("meter_uptime_seconds", "gauge", "Time since boot");
+    w.sample("meter_uptime_seconds", nullptr, 1234.5 * meterNumber);
+    w.family("meter_stage_duration_seconds", "histogram", "Time spent per hot-path stage run");
+    for (uint8_t s = 0; s < METRIC_STAGES; s++) {
+        snprintf(labels, sizeof(labels), "stage=\"%s\"", Metrics::stageName(s));
+        w.histogram("meter_stage_duration_seconds", labels, metrics.getStage(s));
+    }
+    w.family("meter_scheduler_latency_seconds", "histogram", "Task release to start, all tasks of a scheduler");
+    for (uint8_t i = 0; i < 4; i++) {
+        snprintf(labels, sizeof(labels), "scheduler=\"s%u\"", i);
+        w.histogram("meter_scheduler_latency_seconds", labels, schedulers[i]);
+    }
+    w.family("meter_task_runs_total", "counter", "Task runs");
+    for (uint8_t t = 0; t < 19; t++) {
+        snprintf(labels, sizeof(labels), "scheduler=\"network\",task=\"task%02u\"", t);
+        w.sample("meter_task_runs_total", labels, taskRuns[t] * meterNumber);
+    }
+    w.family("meter_http_request_duration_seconds", "summary", "Request latency per endpoint");
+    for (uint8_t e = 0; e < 7; e++) {
+        snprintf(labels, sizeof(labels), "endpoint=\"e%u\"", e);
+        w.sample("meter_http_request_duration_seconds_sum", labels, e * 0.123);
+        w.sample("meter_http_request_duration_seconds_count", labels, e * 10);
+    }
+    w.family("meter_heap_free_bytes", "gauge", "Free heap");
+    w.sample("meter_heap_free_bytes", nullptr, 180000 + meterNumber);
+    w.family("meter_wifi_reconnects_total", "counter", "WiFi reconnects");
+    w.sample("meter_wifi_reconnects_total", nullptr, 4000000000u);
+}
+
+static std::string whole() {
+    static char buffer[65536];
+    MetricsWriter w(buffer, sizeof(buffer));
+    writeSnapshot(w);
+    CHECK(w.isComplete());
+    return std::string(w.getText(), w.getLength());
+}
+
+// The snapshot written part by part into `size` byte buffers
+static std::vector<std::string> parts(size_t size) {
+    std::vector<std::string> result;
+    std::vector<char> buffer(size);
+    uint16_t item = 0;
+    for (;;) {
+        MetricsWriter w(buffer.data(), size, item);
+        writeSnapshot(w);
+        result.emplace_back(w.getText(), w.getLength());
+        if (w.isComplete() || result.size() > 10000) break;
+        CHECK(w.getNextItem() > item);
+        item = w.getNextItem();
+    }
+    return result;
+}
+
+static void fill() {
+    for (uint32_t i = 0; i < 100000; i++) {
+        Metrics::instance().histogramOf((MetricStage)(i % METRIC_STAGES)).record((i * 7919u) % 3000000u);
+        schedulers[i % 4].record(i % 700);
+    }
+    for (uint8_t t = 0; t < 19; t++) taskRuns[t] = t * 1000003u;
+}
+
+static void testBuckets() {
+    LatencyHistogram h;
+    const uint32_t values[] = {0, 50, 51, 100, 999, 1000, 1001, 2000000, 2000001, 0xFFFFFFFF};
+    for (uint32_t v : values) h.record(v);
+    HistogramSnapshot s;
+    CHECK(h.snapshot(s));
+    CHECK(s.buckets[0] == 2 && s.buckets[1] == 2 && s.buckets[4] == 2 && s.buckets[5] == 1);
+    CHECK(s.buckets[11] == 1 && s.buckets[12] == 2);
+    CHECK(s.count == 10 && s.maxUs == 0xFFFFFFFF);
+
+    // Cumulative buckets and the sum in seconds
+    LatencyHistogram small;
+    small.record(40);
+    small.record(300);
+    char buffer[2048];
+    MetricsWriter w(buffer, sizeof(buffer));
+    w.histogram("t", "a=\"b\"", small);
+    std::string text(w.getText(), w.getLength());
+    CHECK(text.find("t_bucket{a=\"b\",le=\"5e-05\"} 1\n") != std::string::npos);
+    CHECK(text.find("t_bucket{a=\"b\",le=\"0.00025\"} 1\n") != std::string::npos);
+    CHECK(text.find("t_bucket{a=\"b\",le=\"0.0005\"} 2\n") != std::string::npos);
+    CHECK(text.find("t_bucket{a=\"b\",le=\"+Inf\"} 2\n") != std::string::npos);
+    CHECK(text.find("t_sum{a=\"b\"} 0.000340\nt_count{a=\"b\"} 2\n") != std::string::npos);
+}
+
+static void testParts() {
+    std::string reference = whole();
+    const size_t sizes[] = {200, 300, 1024, 3072};
+    for (size_t size : sizes) {
+        std::vector<std::string> list = parts(size);
+        std::string joined;
+        for (const std::string& part : list) {
+            CHECK(part.size() < size);
+            joined += part;
+        }
+        printf("%4zu B parts: %zu of them for a %zu B snapshot\n", size, list.size(), reference.size());
+        CHECK(joined == reference);
+    }
+
+    // An item longer than the buffer is dropped; the parts still end
+    std::vector<std::string> tiny = parts(40);
+    CHECK(tiny.size() < 10000);
+    for (const std::string& part : tiny) CHECK(part.size() < 40);
+}
+
+// One record per microsecond on another thread: a snapshot reported
+// consistent always has its buckets adding up to its count
+static void testConcurrent() {
+    LatencyHistogram histogram;
+    std::atomic<bool> stop{false};
+    std::thread writer([&] {
+        for (uint32_t i = 0; !stop; i++) {
+            histogram.record(i % 5000);
+            uint64_t until = nowUs() + 1;
+            while (nowUs() < until) {}
+        }
+    });
+    uint32_t snapshots = 0, gaveUp = 0, torn = 0;
+    uint64_t end = nowUs() + 300000;
+    while (nowUs() < end) {
+        HistogramSnapshot s;
+        bool consistent = histogram.snapshot(s);
+        uint32_t sum = 0;
+        for (uint8_t b = 0; b < HistogramSnapshot::BUCKETS; b++) sum += s.buckets[b];
+        if (!consistent) gaveUp++;
+        else if (sum != s.count) torn++;
+        snapshots++;
+    }
+    stop = true;
+    writer.join();
+    printf("%u snapshots during %u records: %u gave up, %u torn\n", snapshots, histogram.getCount(), gaveUp, torn);
+    CHECK(torn == 0);
+    CHECK(snapshots > 1000 && histogram.getCount() > 1000);
+}
+
+// Parts as the meter uploads them: <directory>/meter<n>-<part>.prom
+static int writeParts(const char* directory) {
+    fill();
+    for (meterNumber = 1; meterNumber <= 2; meterNumber++) {
+        std::vector<std::string> list = parts(3072);
+        for (size_t i = 0; i < list.size(); i++) {
+            std::string path = std::string(directory) + "/meter" + std::to_string(meterNumber) + "-" +
+                               std::to_string(i) + ".prom";
+            FILE* file = fopen(path.c_str(), "wb");
+            if (file == nullptr) return 1;
+            fwrite(list[i].data(), 1, list[i].size(), file);
+            fclose(file);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) return writeParts(argv[1]);
+    testBuckets();
+    fill();
+    testParts();
+    testConcurrent();
+    return testResult("metrics");
+}
@@ -0,0 +1,110 @@
+# Metrics snapshots of two meters, written in 3 KB parts by build/test_metrics,
+# uploaded to POST /api/metrics through Flask's test client and scraped from
+# GET /metrics: valid exposition text with one HELP and TYPE per family, every
+# sample under its own family and labelled with its meter, and nothing lost or
+# changed against the snapshots. A part out of order is refused.
+import glob
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path[:0] = [os.path.join(HERE, 'stubs', 'python'), os.path.join(HERE, '..', 'Flask_server')]
+import app
+
+METERS = {'meter1': '10.0.0.11', 'meter2': '10.0.0.12'}
+SAMPLE = re.compile(r'^([a-zA-Z_:][a-zA-Z0-9_:]*)(?:\{(.*)\})? (\S+)$')
+SUFFIXES = {'histogram': ('_bucket', '_sum', '_count'), 'summary': ('', '_sum', '_count'),
+            'counter': ('',), 'gauge': ('',)}
+
+failures = []
+
+def check(condition, message):
+    if not condition:
+        failures.append(message)
+        print(f'  {message}')
+
+def upload(client, address, parts, first=0):
+    codes = []
+    for number, text in enumerate(parts, first):
+        last = int(number == first + len(parts) - 1)
+        response = client.post(f'/api/metrics?part={number}&last={last}', data=text,
+                               content_type='text/plain', environ_base={'REMOTE_ADDR': address})
+        codes.append(response.status_code)
+    return codes
+
+with tempfile.TemporaryDirectory() as directory:
+    subprocess.run([os.path.join(HERE, 'build', 'test_metrics'), directory], check=True)
+    snapshots = {}
+    for meter in METERS:
+        paths = sorted(glob.glob(os.path.join(directory, meter + '-*.prom')),
+                       key=lambda path: int(path.rsplit('-', 1)[1].split('.')[0]))
+        parts = []
+        for path in paths:
+            with open(path) as file:
+                parts.append(file.read())
+        snapshots[meter] = parts
+
+client = app.app.test_client()
+for meter, parts in snapshots.items():
+    check(len(parts) > 1, f'{meter}: {len(parts)} parts')
+    check(upload(client, METERS[meter], parts) == [200] * len(parts), f'{meter}: upload refused')
+
+# A snapshot missing its first part is refused and the last complete one stays
+codes = upload(client, METERS['meter1'], snapshots['meter2'][1:], 1)
+check(codes == [409] * len(codes), f'parts out of order: {codes}')
+
+response = client.get('/metrics')
+check(response.status_code == 200, f'/metrics: {response.status_code}')
+check(response.content_type.startswith('text/plain; version=0.0.4'), f'/metrics: {response.content_type}')
+text = response.get_data(as_text=True)
+check(text.endswith('\n'), 'exposition does not end with a newline')
+
+helps, types = {}, {}
+family = None
+received = {meter: [] for meter in METERS}
+addresses = {address: meter for meter, address in METERS.items()}
+for number, line in enumerate(text.splitlines(), 1):
+    if line.startswith('# HELP ') or line.startswith('# TYPE '):
+        kind, name, value = line[2:].split(' ', 2)
+        seen = helps if kind == 'HELP' else types
+        check(name not in seen, f'line {number}: second {kind} for {name}')
+        seen[name] = value
+        family = name
+        continue
+    match = SAMPLE.match(line)
+    check(match is not None, f'line {number}: not a sample: {line!r}')
+    if match is None:
+        continue
+    name, labels, value = match.groups()
+    try:
+        float(value)
+    except ValueError:
+        check(False, f'line {number}: bad value {value!r}')
+    kind = types.get(family)
+    check(kind is not None and any(name == family + suffix for suffix in SUFFIXES[kind]),
+          f'line {number}: {name} outside its family (under {family})')
+    instance = re.match(r'instance="([^"]*)"(?:,(.*))?$', labels or '')
+    check(instance is not None, f'line {number}: no instance label')
+    if instance is None:
+        continue
+    meter = addresses.get(instance.group(1))
+    check(meter is not None, f'line {number}: unknown instance {instance.group(1)}')
+    if meter is None:
+        continue
+    rest = instance.group(2)
+    received[meter].append(f'{name}{{{rest}}} {value}' if rest else f'{name} {value}')
+
+check(set(helps) == set(types), 'families with only one of HELP and TYPE')
+check('meter_metrics_age_seconds' in types, 'no meter_metrics_age_seconds')
+for meter, parts in snapshots.items():
+    sent = [line for line in ''.join(parts).splitlines() if not line.startswith('#')]
+    # The age gauge is the server's own
+    got = [line for line in received[meter] if not line.startswith('meter_metrics_age_seconds')]
+    check(got == sent, f'{meter}: {len(got)} samples scraped, {len(sent)} uploaded or changed')
+print(f"{len(types)} families, {sum(len(lines) for lines in received.values())} samples from {len(METERS)} meters")
+
+print('metrics.py: ' + ('FAILED' if failures else 'ok'))
+sys.exit(1 if failures else 0)
@@ -0,0 +1,110 @@
+// OffsetTracker on simulated mains: sensor 1's zero drifts 60 counts (~48 mV)
+// per hour, the supply sensor's half as fast, while relay 1 cycles 20 min on
+// (about 2 A) and 10 min off. Relay 2 stays off. Compares the offset error at
+// the end of each idle period with and without the tracker.
+#include "test.h"
+#include "AdcSampler.h"
+#include "PowerMeter.h"
+#include "OffsetTracker.h"
+
+static const uint8_t PINS[] = {32, 33, 34, 35};
+static const uint32_t RATE = 5000;              // Enough for cycle-aligned windows, and quick
+static const uint32_t SECONDS = 3600;
+static const float DRIFT_PER_HOUR = 60;         // ADC counts
+
+struct Run {
+    float worstIdleError;           // mV, last 10 s of the idle periods
+    float offsets[3];               // mV at the end
+    float startOffsets[3];
+    uint32_t corrections[3];
+    float driftRate[3];             // mV/h
+    uint8_t history;
+};
+
+static Run run(bool track) {
+    FakeAdcSource source;
+    source.setNoise(3);
+    AdcSampler sampler(source, PINS, 4, RATE);
+    CHECK(sampler.begin());
+    CurrentSensor load1(32, 0.0007272f, -0.01636f);
+    CurrentSensor load2(33, 0.0007272f, -0.01672f);
+    CurrentSensor main(34, 0.0006825f, -0.01442f);
+    VoltageSensor voltage(35, 3.3f, 890.0f);
+    load1.begin();
+    load2.begin();
+    main.begin();
+    voltage.begin();
+    load1.setOffset(1900);
+    load2.setOffset(1890);
+    main.setOffset(1905);
+    PowerMeter meter(voltage);
+    meter.addLoad(load1);
+    meter.addLoad(load2);
+    meter.addLoad(main);
+
+    OffsetTracker tracker;
+    tracker.addChannel(load1, OFFSET_RELAY1);
+    tracker.addChannel(load2, OFFSET_RELAY2);
+    tracker.addChannel(main, OFFSET_RELAY1 | OFFSET_RELAY2);
+
+    Run r = {};
+    r.startOffsets[0] = load1.getOffset();
+    r.startOffsets[1] = load2.getOffset();
+    r.startOffsets[2] = main.getOffset();
+    uint32_t windows = 0;
+    uint64_t samples = 0;
+    const float amplitude = 2.0f / 0.0007272f / (3300.0f / 4095) * 1.414f;     // About 2 A rms
+    while (samples < (uint64_t)SECONDS * RATE) {
+        double t = (double)samples / RATE;
+        bool relay1 = fmod(t, 1800) < 1200;
+        float drift = DRIFT_PER_HOUR * t / 3600;
+        source.setTone(0, 1900 + drift, relay1 ? amplitude : 0, 50.0f);
+        source.setTone(1, 1890, 0, 50.0f);
+        source.setTone(2, 1905 + drift / 2, relay1 ? amplitude : 0, 50.0f);
+        source.setTone(3, 2048, 1000, 50.0f);
+        sampler.pump(0);
+        const AdcFrame* frame;
+        while ((frame = sampler.acquireFrame()) != nullptr) {
+            meter.consume(*frame);
+            sampler.releaseFrame(frame);
+            samples += AdcFrame::SAMPLES;
+            if (meter.getWindowCount() == windows) continue;
+            windows = meter.getWindowCount();
+            if (track) tracker.addWindow(relay1 ? OFFSET_RELAY1 : 0, samples * 1000 / RATE);
+            float error = fabsf(load1.getWindowMean() * load1.getMillivoltsPerUnit());
+            if (!relay1 && fmod(t, 1800) > 1790 && error > r.worstIdleError) r.worstIdleError = error;
+        }
+    }
+    r.offsets[0] = load1.getOffset();
+    r.offsets[1] = load2.getOffset();
+    r.offsets[2] = main.getOffset();
+    for (uint8_t i = 0; i < 3; i++) {
+        r.corrections[i] = tracker.getCorrections(i);
+        r.driftRate[i] = tracker.getDriftRate(i);
+    }
+    r.history = tracker.getHistoryCount();
+    return r;
+}
+
+int main() {
+    const float driftMv = DRIFT_PER_HOUR * SECONDS / 3600 * 3300 / 4095;
+
+    Run untracked = run(false);
+    printf("untracked: %.1f mV offset error at the end of the idle periods\n", untracked.worstIdleError);
+    CHECK_NEAR(untracked.worstIdleError, driftMv, 2.0);
+
+    Run tracked = run(true);
+    printf("tracked:   %.2f mV offset error, sensor 1 moved %+.1f mV (%+.1f mV/h), supply %+.1f mV (%+.1f mV/h)\n",
+           tracked.worstIdleError, tracked.offsets[0] - tracked.startOffsets[0], tracked.driftRate[0],
+           tracked.offsets[2] - tracked.startOffsets[2], tracked.driftRate[2]);
+    CHECK(tracked.worstIdleError < 1.0f);
+    CHECK_NEAR(tracked.offsets[0] - tracked.startOffsets[0], driftMv, 1.5);
+    CHECK_NEAR(tracked.offsets[2] - tracked.startOffsets[2], driftMv / 2, 1.5);
+    CHECK(tracked.corrections[0] > 0 && tracked.corrections[1] == 0 && tracked.corrections[2] > 0);
+    CHECK(tracked.offsets[1] == tracked.startOffsets[1]);
+    // The history only sees the offset at the idle periods, so the fitted rate lags the true one
+    CHECK(tracked.history == SECONDS * 1000 / OffsetTracker::HISTORY_INTERVAL_MS);
+    CHECK(tracked.driftRate[0] > 0.5f * driftMv && tracked.driftRate[0] < 1.2f * driftMv);
+    CHECK(tracked.driftRate[1] == 0);
+    return testResult("offset_tracker");
+}
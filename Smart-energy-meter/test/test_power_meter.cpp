@@ -0,0 +1,86 @@
+// Sign of real power: export reads negative, a reversed sensor is corrected by
+// its polarity, and only import reaches the energy registers
+#include "test.h"
+#include "AdcSampler.h"
+#include "PowerMeter.h"
+#include "EnergyCalculator.h"
+
+static const uint8_t PINS[] = {32, 33, 34, 35};
+static const uint32_t RATE = 20000;
+
+int main() {
+    FakeAdcSource source;
+    source.setTone(0, 1900.0f, 400.0f, 50.0f, M_PI / 3);          // Import, PF 0.5
+    source.setTone(1, 1900.0f, 400.0f, 50.0f, M_PI);              // Export, PF 1
+    source.setTone(2, 1900.0f, 400.0f, 50.0f, M_PI + M_PI / 3);   // Import through a reversed sensor
+    source.setTone(3, 2048.0f, 1000.0f, 50.0f);                   // Voltage
+    AdcSampler sampler(source, PINS, 4, RATE);
+    CHECK(sampler.begin());
+
+    CurrentSensor load1(32, 0.0007272f, -0.01636f);
+    CurrentSensor load2(33, 0.0007272f, -0.01636f);
+    CurrentSensor load3(34, 0.0007272f, -0.01636f);
+    VoltageSensor voltage(35, 3.3f, 180.0f);
+    load1.begin();
+    load2.begin();
+    load3.begin();
+    voltage.begin();
+    load1.setOffset(1900);
+    load2.setOffset(1900);
+    load3.setOffset(1900);
+
+    PowerMeter meter(voltage);
+    CHECK(meter.addLoad(load1) == 0);
+    CHECK(meter.addLoad(load2) == 1);
+    CHECK(meter.addLoad(load3, -1) == 2);
+
+    EnergyCalculator energy;
+    energy.begin();
+    energy.resetEnergy();
+
+    uint32_t windows = 0;
+    while (meter.getWindowCount() < 6) {
+        sampler.pump(0);
+        const AdcFrame* frame = sampler.acquireFrame();
+        if (frame == nullptr) continue;
+        meter.consume(*frame);
+        sampler.releaseFrame(frame);
+        if (meter.getWindowCount() == windows) continue;
+        windows = meter.getWindowCount();
+        // The first window is the partial one before the first zero crossing
+        if (windows < 2) continue;
+
+        const PowerReading& import = meter.getReading(0);
+        const PowerReading& exported = meter.getReading(1);
+        const PowerReading& reversed = meter.getReading(2);
+        CHECK(import.apparentPower > 0);
+        CHECK_NEAR(import.realPower, 0.5 * import.apparentPower, 0.02 * import.apparentPower);
+        CHECK_NEAR(import.powerFactor, 0.5, 0.02);
+        CHECK_NEAR(exported.realPower, -exported.apparentPower, 0.01 * exported.apparentPower);
+        CHECK_NEAR(exported.powerFactor, 1.0, 0.01);
+        CHECK_NEAR(reversed.realPower, import.realPower, 0.01 * import.apparentPower);
+        CHECK_NEAR(reversed.reactivePower, import.reactivePower, 0.01 * import.apparentPower);
+
+        // Export adds nothing to the register, import adds P * t
+        uint64_t before1 = energy.getEnergyL1Millijoules();
+        uint64_t before2 = energy.getEnergyL2Millijoules();
+        energy.addWindow(import.realPower, exported.realPower,
+                         meter.getWindowSamples(), meter.getWindowSampleRate());
+        double expected = import.realPower * 1000.0 * meter.getWindowSamples() / meter.getWindowSampleRate();
+        CHECK_NEAR((double)(energy.getEnergyL1Millijoules() - before1), expected, 1.0);
+        CHECK(energy.getEnergyL2Millijoules() == before2);
+    }
+
+    // Flipping the polarity of the export channel makes it import
+    meter.setPolarity(1, -1);
+    uint32_t target = meter.getWindowCount() + 2;
+    while (meter.getWindowCount() < target) {
+        sampler.pump(0);
+        const AdcFrame* frame = sampler.acquireFrame();
+        if (frame == nullptr) continue;
+        meter.consume(*frame);
+        sampler.releaseFrame(frame);
+    }
+    CHECK(meter.getReading(1).realPower > 0);
+    return testResult("power_meter");
+}
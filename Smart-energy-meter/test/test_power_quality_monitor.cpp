@@ -0,0 +1,298 @@
+// PowerQualityMonitor on FakeAdcSource mains: a 3-cycle 50% voltage sag and a
+// load current step each freeze one event of the right type and channel whose
+// rows bracket the onset, a third event with both slots taken is dropped, and
+// an event read out through WebClient's chunks reassembles to the frozen rows.
+#include "test.h"
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <signal.h>
+#include "WebClient.h"
+#include "AdcSampler.h"
+#include "PowerMeter.h"
+#include "PowerQualityMonitor.h"
+
+static const uint8_t PINS[] = {32, 33, 34, 35};
+static const uint32_t RATE = 20000;
+static const uint8_t MARKER = 1;                // Pin 33: not a monitored channel
+static const float VOLTAGE_AMPLITUDE = 450;     // Counts, peak
+static const float CURRENT_AMPLITUDE = 241;     // About 0.1 A rms
+static const uint16_t PORT = 18423;
+
+// Scales a channel's swing about its offset over a range of sweeps. The
+// marker channel carries the stored row number (sweep / STORE_DECIMATION), so
+// every frozen row says where in the stream it came from.
+class ScriptedSource : public AdcSource {
+private:
+    struct Step {
+        uint8_t channel;
+        uint64_t from;
+        uint64_t to;
+        float offset;
+        float scale;
+    };
+
+    FakeAdcSource& inner;
+    uint8_t channels;
+    uint64_t position;
+    Step steps[4];
+    uint8_t stepCount;
+
+public:
+    explicit ScriptedSource(FakeAdcSource& source) : inner(source), channels(0), position(0), stepCount(0) {}
+
+    void scale(uint8_t channel, uint64_t from, uint64_t to, float offset, float factor) {
+        if (stepCount < 4) steps[stepCount++] = {channel, from, to, offset, factor};
+    }
+
+    bool begin(const uint8_t* pins, uint8_t count, uint32_t rate) override {
+        channels = count;
+        return inner.begin(pins, count, rate);
+    }
+
+    size_t read(AdcConversion* out, size_t maxCount, uint32_t timeoutMs) override {
+        size_t count = inner.read(out, maxCount, timeoutMs);
+        for (size_t i = 0; i < count; i++, position++) {
+            uint64_t sweep = position / channels;
+            for (uint8_t s = 0; s < stepCount; s++) {
+                const Step& step = steps[s];
+                if (out[i].channel != step.channel || sweep < step.from || sweep >= step.to) continue;
+                float value = step.offset + (out[i].raw - step.offset) * step.scale;
+                out[i].raw = (uint16_t)(value < 0 ? 0 : value > 4095 ? 4095 : value);
+            }
+            if (out[i].channel == MARKER) {
+                out[i].raw = (uint16_t)((sweep / PowerQualityMonitor::STORE_DECIMATION) % 4096);
+            }
+        }
+        return count;
+    }
+};
+
+// Swing of a channel over rows [from, to) of an event
+static uint16_t swing(const PqEvent& event, uint8_t channel, uint16_t from, uint16_t to) {
+    uint16_t low = 4095, high = 0;
+    for (uint16_t r = from; r < to; r++) {
+        if (event.rows[r][channel] < low) low = event.rows[r][channel];
+        if (event.rows[r][channel] > high) high = event.rows[r][channel];
+    }
+    return high - low;
+}
+
+// Event row whose marker is the given stored row, or -1
+static int32_t rowOf(const PqEvent& event, uint64_t storedRow) {
+    for (uint16_t r = 0; r < PqEvent::ROWS; r++) {
+        if (event.rows[r][MARKER] == storedRow % 4096) return r;
+    }
+    return -1;
+}
+
+// The frozen rows are consecutive, the onset lies in the pre-trigger part at
+// most a cycle before the trigger, and the channel's swing changes there
+static void checkEvent(const PqEvent& event, uint8_t channel, uint64_t onsetSweep, float factor) {
+    bool consecutive = true;
+    for (uint16_t r = 1; r < PqEvent::ROWS; r++) {
+        if (event.rows[r][MARKER] != (event.rows[r - 1][MARKER] + 1) % 4096) consecutive = false;
+    }
+    CHECK(consecutive);
+    CHECK(event.channels == 4 && event.pins[MARKER] == PINS[MARKER]);
+    CHECK(event.sampleRate == RATE / PowerQualityMonitor::STORE_DECIMATION);
+
+    const uint16_t cycleRows = event.sampleRate / 50;
+    int32_t onset = rowOf(event, onsetSweep / PowerQualityMonitor::STORE_DECIMATION);
+    printf("  onset at row %d of %u (trigger at row %u)\n", onset, PqEvent::ROWS, PqEvent::PRE_ROWS);
+    CHECK(onset >= PqEvent::PRE_ROWS - cycleRows && onset <= PqEvent::PRE_ROWS);
+    if (onset < cycleRows) return;
+    float before = swing(event, channel, onset - cycleRows, onset);
+    float after = swing(event, channel, onset + 1, onset + 1 + cycleRows);
+    CHECK_NEAR(after / before, factor, 0.1 * factor);
+}
+
+// Records the body of every request and answers 200, keeping the connection open
+class ChunkServer {
+private:
+    int listener;
+    std::atomic<int> client{-1};
+    std::thread thread;
+
+    void serve() {
+        int fd;
+        while ((fd = accept(listener, nullptr, nullptr)) >= 0) {
+            client = fd;
+            std::string pending;
+            for (;;) {
+                size_t end;
+                bool open = true;
+                while (open && (end = pending.find("\r\n\r\n")) == std::string::npos) open = receive(fd, pending);
+                if (!open) break;
+                size_t field = pending.find("Content-Length: ");
+                size_t length = field < end ? strtoul(pending.c_str() + field + 16, nullptr, 10) : 0;
+                while (open && pending.size() < end + 4 + length) open = receive(fd, pending);
+                if (!open) break;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    bodies.push_back(pending.substr(end + 4, length));
+                }
+                pending.erase(0, end + 4 + length);
+                const char* reply = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: 2\r\n\r\n{}";
+                send(fd, reply, strlen(reply), MSG_NOSIGNAL);
+            }
+            client = -1;
+            ::close(fd);
+        }
+    }
+
+    static bool receive(int fd, std::string& pending) {
+        char buffer[4096];
+        ssize_t n = recv(fd, buffer, sizeof buffer, 0);
+        if (n > 0) pending.append(buffer, n);
+        return n > 0;
+    }
+
+public:
+    std::mutex mutex;
+    std::vector<std::string> bodies;
+
+    ChunkServer() {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(PORT);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        CHECK(bind(listener, (sockaddr*)&address, sizeof(address)) == 0);
+        CHECK(listen(listener, 4) == 0);
+        thread = std::thread(&ChunkServer::serve, this);
+    }
+
+    ~ChunkServer() {
+        shutdown(listener, SHUT_RDWR);
+        int fd = client.load();
+        if (fd >= 0) shutdown(fd, SHUT_RDWR);
+        thread.join();
+        ::close(listener);
+    }
+};
+
+static long number(const std::string& body, const char* key) {
+    size_t at = body.find(key);
+    return at == std::string::npos ? -1 : strtol(body.c_str() + at + strlen(key), nullptr, 10);
+}
+
+// Upload an event in chunks and rebuild its rows from the request bodies
+static void testReadout(const PqEvent& event) {
+    ChunkServer server;
+    static WebClient web("meter", "secret", "http://127.0.0.1:18423");
+    web.begin();
+    web.maintain();
+    const uint16_t chunks = (PqEvent::ROWS + WebClient::PQ_CHUNK_ROWS - 1) / WebClient::PQ_CHUNK_ROWS;
+    for (uint16_t chunk = 0; chunk < chunks; chunk++) CHECK(web.sendPowerQualityChunk(event, chunk));
+    CHECK(!web.sendPowerQualityChunk(event, chunks));
+
+    std::lock_guard<std::mutex> lock(server.mutex);
+    CHECK(server.bodies.size() == chunks);
+    std::vector<uint16_t> rows;
+    for (size_t i = 0; i < server.bodies.size(); i++) {
+        const std::string& body = server.bodies[i];
+        CHECK(body.find("\"type\":\"sag\"") != std::string::npos);
+        CHECK(number(body, "\"event_id\":") == (long)event.id);
+        CHECK(number(body, "\"pre_rows\":") == PqEvent::PRE_ROWS);
+        CHECK(number(body, "\"rows\":") == PqEvent::ROWS);
+        CHECK(number(body, "\"chunk\":") == (long)i && number(body, "\"chunks\":") == chunks);
+        CHECK(number(body, "\"start_row\":") == (long)(i * WebClient::PQ_CHUNK_ROWS));
+        const char* p = body.c_str() + body.find("\"samples\":[") + 11;
+        while (*p != ']' && *p != '\0') {
+            char* end;
+            rows.push_back((uint16_t)strtoul(p, &end, 10));
+            p = *end == ',' ? end + 1 : end;
+        }
+    }
+    CHECK(rows.size() == (size_t)PqEvent::ROWS * event.channels);
+    bool same = rows.size() == (size_t)PqEvent::ROWS * event.channels;
+    for (size_t i = 0; same && i < rows.size(); i++) {
+        same = rows[i] == event.rows[i / event.channels][i % event.channels];
+    }
+    CHECK(same);
+}
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+    const uint64_t sag = 20137, inrush = 60091, late = 100059;      // Sweeps, off frame and cycle boundaries
+    const uint64_t cycle = RATE / 50;
+
+    FakeAdcSource fake;
+    fake.setNoise(3);
+    fake.setTone(0, 1900, CURRENT_AMPLITUDE, 50.0f, 0.3f);
+    fake.setTone(1, 2048, 0, 50.0f);
+    fake.setTone(2, 1905, 0, 50.0f);
+    fake.setTone(3, 2048, VOLTAGE_AMPLITUDE, 50.0f);
+    ScriptedSource source(fake);
+    source.scale(3, sag, sag + 3 * cycle, 2048, 0.5f);
+    source.scale(0, inrush, inrush + 20 * cycle, 1900, 6.0f);
+    source.scale(3, late, late + 3 * cycle, 2048, 0.5f);
+    AdcSampler sampler(source, PINS, 4, RATE);
+    CHECK(sampler.begin());
+
+    CurrentSensor load1(32, 0.0007272f, -0.01636f);
+    VoltageSensor voltage(35, 3.3f, 890.0f);
+    load1.begin();
+    voltage.begin();
+    load1.setOffset(1900);
+    PowerMeter meter(voltage);
+    meter.addLoad(load1);
+    PowerQualityMonitor monitor(voltage, meter);
+    monitor.addLoad(load1);
+    CHECK(monitor.begin());
+    PowerQualityMonitor::Thresholds thresholds = monitor.getThresholds();
+    thresholds.nominalVoltage = VOLTAGE_AMPLITUDE / sqrtf(2) * voltage.getVoltsPerCount();
+    thresholds.inrushCurrent = 0.4f;
+    monitor.setThresholds(thresholds);
+
+    uint64_t sweeps = 0;
+    float normalCurrent = 0;
+    while (sweeps < late + 10 * cycle + 4 * PqEvent::POST_ROWS) {
+        sampler.pump(0);
+        const AdcFrame* frame;
+        while ((frame = sampler.acquireFrame()) != nullptr) {
+            meter.consume(*frame);
+            monitor.consume(*frame);
+            sampler.releaseFrame(frame);
+            sweeps += AdcFrame::SAMPLES;
+            if (sweeps < inrush && sweeps > cycle * 10) normalCurrent = load1.getCurrent();
+        }
+    }
+    printf("normal load %.3f A, nominal %.1f V\n", normalCurrent, thresholds.nominalVoltage);
+
+    // The late sag found both slots taken
+    CHECK(monitor.getEventsCaptured() == 2);
+    CHECK(monitor.getEventsDropped() == 1);
+
+    const PqEvent* first = monitor.acquireEvent();
+    CHECK(first != nullptr);
+    if (first == nullptr) return testResult("power_quality_monitor");
+    printf("%s on channel %u: %.1f V, down to %.1f V\n", PqEvent::typeName(first->type), first->channel,
+           first->triggerValue, first->extremeValue);
+    CHECK(first->type == PQ_SAG && first->channel == 0);
+    CHECK(first->triggerValue < 0.9f * thresholds.nominalVoltage);
+    CHECK_NEAR(first->extremeValue, 0.5f * thresholds.nominalVoltage, 0.05f * thresholds.nominalVoltage);
+    checkEvent(*first, 3, sag, 0.5f);
+    testReadout(*first);
+    monitor.releaseEvent(first);
+
+    const PqEvent* second = monitor.acquireEvent();
+    CHECK(second != nullptr);
+    if (second == nullptr) return testResult("power_quality_monitor");
+    printf("%s on channel %u: %.3f A, up to %.3f A\n", PqEvent::typeName(second->type), second->channel,
+           second->triggerValue, second->extremeValue);
+    CHECK(second->type == PQ_INRUSH && second->channel == 1);
+    CHECK(second->id > first->id);
+    CHECK(second->triggerValue > thresholds.inrushCurrent);
+    // Six times the swing, through load1's calibration offset
+    float stepCurrent = 6 * (normalCurrent + 0.01636f) - 0.01636f;
+    CHECK_NEAR(second->extremeValue, stepCurrent, 0.05f * stepCurrent);
+    checkEvent(*second, 0, inrush, 6.0f);
+    monitor.releaseEvent(second);
+    CHECK(monitor.acquireEvent() == nullptr);
+    return testResult("power_quality_monitor");
+}
@@ -0,0 +1,131 @@
+// ExceptionReporter: deadband, drift, state and heartbeat rules, then a 24 h
+// simulation at 1 s captures (with the noise of one 200 ms power window) using
+// the batching rule of drainTelemetry(): a full batch of 10, 10 s since the
+// last upload, or at once after a state change.
+#include "test.h"
+#include <random>
+#include "ReportByException.h"
+
+static const uint32_t DAY = 86400;
+static const uint32_t UPLOADS_AT_10_S = DAY / 10;
+
+static void fill(float* values, float voltage, float current1, float current2) {
+    values[REPORT_VOLTAGE] = voltage;
+    values[REPORT_FREQUENCY] = 50.0f;
+    values[REPORT_CURRENT1] = current1;
+    values[REPORT_CURRENT2] = current2;
+    values[REPORT_CURRENT3] = current1 + current2;
+    values[REPORT_POWER1] = voltage * current1;
+    values[REPORT_POWER2] = voltage * current2;
+}
+
+static void testRules() {
+    ExceptionReporter reporter;
+    float values[REPORT_CHANNELS];
+    fill(values, 230, 4.0f, 0);
+    CHECK(reporter.check(values, 0, 0) == REPORT_FIRST);       // Disabled: everything
+    reporter.setEnabled(true);
+    CHECK(reporter.check(values, 0, 0) == REPORT_FIRST);
+    reporter.update(REPORT_FIRST, values, 0, 0);
+
+    // Current 1 deadband is max(50 mA, 5 % of 4 A) = 200 mA; power moves with it
+    fill(values, 230, 4.19f, 0);
+    CHECK(reporter.check(values, 0, 1000) == REPORT_SUPPRESS);
+    fill(values, 230, 4.25f, 0);
+    CHECK(reporter.check(values, 0, 1000) == REPORT_DEADBAND);
+
+    // A slow drift is reported once it adds up, not lost step by step
+    uint32_t reported = 0;
+    for (uint32_t t = 1; t <= 60; t++) {
+        fill(values, 230 + 0.05f * t, 4.0f, 0);
+        uint8_t reason = reporter.check(values, 0, t * 1000);
+        reporter.update(reason, values, 0, t * 1000);
+        if (reason != REPORT_SUPPRESS) reported++;
+    }
+    CHECK(reported == 1);                                        // At 2.35 V: 1 % of 230 V
+
+    // State changes and the heartbeat
+    unsigned long last = 60000;
+    CHECK(reporter.stateChanged(1));
+    CHECK(reporter.check(values, 1, last + 1000) == REPORT_STATE);
+    CHECK(reporter.check(values, 0, last + 300000) == REPORT_HEARTBEAT);
+    CHECK(reporter.getSuppressedCount() == 59);
+}
+
+struct Day {
+    uint32_t reports;
+    uint32_t uploads;
+    uint32_t stateChanges;
+    uint32_t latestState;           // Longest wait from a state change to its upload (s)
+    uint32_t longestSilence;        // Longest gap between reports (s)
+};
+
+// scenario: 0 steady with relays off, 1 steady 1 kW heater, 2 fridge cycling and TV, 3 a mixed day
+static Day simulate(int scenario) {
+    std::mt19937 rng(3);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    ExceptionReporter reporter;
+    reporter.setEnabled(true);
+    Day day = {0, 0, 0, 0, 0};
+    uint32_t depth = 0, lastUpload = 0, lastReport = 0;
+    bool urgent = false;
+    int32_t stateSince = -1;
+
+    for (uint32_t t = 0; t < DAY; t++) {
+        int load = scenario;
+        if (scenario == 3) load = t < 28800 ? 0 : (t < 43200 ? 2 : (t < 61200 ? 1 : 2));
+        float voltage = 231 + 2.0f * sinf(t / 7200.0f) + 0.3f * noise(rng);
+        float current1 = 0.003f * noise(rng), current2 = 0.003f * noise(rng);
+        if (load == 1) current1 = 4.35f + 0.01f * noise(rng);
+        if (load == 2) {
+            current1 = ((t / 600) % 3 == 0 ? 0.9f : 0.05f) + 0.005f * noise(rng);     // Fridge compressor
+            current2 = 0.45f + 0.004f * noise(rng) + (t % 97 == 0 ? 0.1f : 0);        // TV
+        }
+        float values[REPORT_CHANNELS] = {voltage, 50 + 0.01f * noise(rng), current1, current2,
+                                         current1 + current2, voltage * current1 * 0.95f,
+                                         voltage * current2 * 0.7f};
+        uint8_t state = (load != 0 ? 1 : 0) | ((t / 5000) % 2 ? 2 : 0);
+
+        unsigned long now = t * 1000UL;
+        uint8_t reason = reporter.check(values, state, now);
+        reporter.update(reason, values, state, now);
+        if (reason != REPORT_SUPPRESS) {
+            if (t - lastReport > day.longestSilence) day.longestSilence = t - lastReport;
+            lastReport = t;
+            depth++;
+            day.reports++;
+            if (reason & REPORT_STATE) {
+                urgent = true;
+                day.stateChanges++;
+                stateSince = t;
+            }
+        }
+        if (depth > 0 && (urgent || depth >= 10 || t - lastUpload >= 10)) {
+            day.uploads++;
+            depth = 0;
+            lastUpload = t;
+            urgent = false;
+            if (stateSince >= 0 && t - stateSince > day.latestState) day.latestState = t - stateSince;
+            stateSince = -1;
+        }
+    }
+    return day;
+}
+
+int main() {
+    testRules();
+
+    const char* names[] = {"steady, relays off", "steady 1 kW heater", "fridge cycling + TV", "mixed day"};
+    const uint32_t most[] = {400, 400, 2200, 1200};     // Uploads per day allowed
+    for (int scenario = 0; scenario < 4; scenario++) {
+        Day day = simulate(scenario);
+        printf("%-20s %5u reports, %5u uploads per day (%.0fx fewer than at 10 s), "
+               "%u state changes sent after <= %u s\n",
+               names[scenario], day.reports, day.uploads, (double)UPLOADS_AT_10_S / day.uploads,
+               day.stateChanges, day.latestState);
+        CHECK(day.uploads <= most[scenario]);
+        CHECK(day.stateChanges >= 17 && day.latestState == 0);
+        CHECK(day.longestSilence <= 300);
+    }
+    return testResult("report_by_exception");
+}
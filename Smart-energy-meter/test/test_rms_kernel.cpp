@@ -0,0 +1,149 @@
+// Integer RMS path (RmsAccumulator, optional AdcLinearization table) against the
+// float path CurrentSensor and VoltageSensor used before it, on the same frames.
+//
+// Tolerances (the inputs are deterministic, so these are fixed bounds):
+// - current, integer path: 1e-5 A. The difference is the float path's own
+//   rounding over a 16000-sample window.
+// - current, table path: 2e-5 A. Each table entry is rounded to 1 mV (0.5 mV
+//   error at most), and the mV offset is rounded to a whole mV.
+// - voltage: 0.01 V on ~110 V (float sums again).
+#include "test.h"
+#include "AdcSampler.h"
+#include "current.h"
+#include "Voltage.h"
+
+static const uint8_t PINS[] = {32, 35};
+static const uint32_t RATE = 20000;
+static const uint32_t WINDOW = 16000;           // 0.8 s, the meter's window
+static const float SLOPE = 0.0007272f;
+static const float INTERCEPT = -0.01636f;
+
+// The float current path as it was: mV per sample, float offset and float sums
+struct FloatCurrent {
+    float offset = 0, sum = 0, sumSquares = 0, sigma = 0;
+    uint32_t calibrationCount = 0, count = 0;
+    float calibrationSum = 0;
+
+    void add(uint16_t raw, uint32_t calibrationTarget) {
+        float mv = raw * 3300.0f / 4095;
+        if (calibrationCount < calibrationTarget) {
+            calibrationSum += mv;
+            if (++calibrationCount == calibrationTarget) offset = calibrationSum / calibrationCount;
+            return;
+        }
+        float corrected = mv - offset;
+        sum += corrected;
+        sumSquares += corrected * corrected;
+        count++;
+    }
+
+    void closeWindow() {
+        float mean = sum / count;
+        float variance = sumSquares / count - mean * mean;
+        sigma = variance > 0 ? sqrtf(variance) : 0;
+        sum = sumSquares = 0;
+        count = 0;
+    }
+
+    float current() const {
+        float amps = INTERCEPT + SLOPE * sigma;
+        return amps < 0.002f ? 0.0f : amps;
+    }
+};
+
+// The float voltage path: counts about mid-scale in float sums
+struct FloatVoltage {
+    float sum = 0, sumSquares = 0, sigma = 0;
+    uint32_t count = 0;
+
+    void add(uint16_t raw) {
+        float value = (float)raw - 2048.0f;
+        sum += value;
+        sumSquares += value * value;
+        count++;
+    }
+
+    void closeWindow() {
+        float mean = sum / count;
+        float variance = sumSquares / count - mean * mean;
+        sigma = variance > 0 ? sqrtf(variance) : 0;
+        sum = sumSquares = 0;
+        count = 0;
+    }
+};
+
+static void compare(float currentAmplitude, float offsetCounts) {
+    FakeAdcSource source;
+    source.setNoise(3);
+    source.setTone(0, offsetCounts, currentAmplitude, 50.0f);
+    source.setTone(1, 2048.0f, 1100.0f, 50.0f, 0.4f);
+    AdcSampler sampler(source, PINS, 2, RATE);
+    CHECK(sampler.begin());
+
+    AdcLinearization table;
+    table.begin();
+    CurrentSensor integer(32, SLOPE, INTERCEPT);
+    CurrentSensor linearized(32, SLOPE, INTERCEPT);
+    VoltageSensor voltage(35, 3.3f, 180.0f);
+    integer.begin();
+    linearized.begin(&table);
+    voltage.begin();
+    const uint32_t calibrationSamples = 2000;
+    integer.startCalibration(calibrationSamples);
+    linearized.startCalibration(calibrationSamples);
+
+    FloatCurrent floatCurrent;
+    FloatVoltage floatVoltage;
+    uint32_t windows = 0;
+    uint32_t inWindow = 0;
+    bool calibrating = true;
+
+    while (windows < 4) {
+        sampler.pump(0);
+        const AdcFrame* frame = sampler.acquireFrame();
+        if (frame == nullptr) continue;
+
+        integer.consume(*frame, 0, AdcFrame::SAMPLES);
+        linearized.consume(*frame, 0, AdcFrame::SAMPLES);
+        for (uint16_t i = 0; i < AdcFrame::SAMPLES; i++) {
+            floatCurrent.add(frame->raw[0][i], calibrationSamples);
+        }
+        // Calibration takes whole frames here, so windows line up with the float path
+        if (calibrating) {
+            calibrating = !integer.isCalibrated();
+            sampler.releaseFrame(frame);
+            continue;
+        }
+        voltage.consume(*frame, 0, AdcFrame::SAMPLES);
+        for (uint16_t i = 0; i < AdcFrame::SAMPLES; i++) {
+            floatVoltage.add(frame->raw[1][i]);
+        }
+        sampler.releaseFrame(frame);
+
+        inWindow += AdcFrame::SAMPLES;
+        if (inWindow < WINDOW) continue;
+        inWindow = 0;
+        windows++;
+
+        CHECK(integer.closeWindow() == WINDOW);
+        CHECK(linearized.closeWindow() == WINDOW);
+        CHECK(voltage.closeWindow() == WINDOW);
+        floatCurrent.closeWindow();
+        floatVoltage.closeWindow();
+
+        CHECK_NEAR(integer.getCurrent(), floatCurrent.current(), 1e-5);
+        CHECK_NEAR(linearized.getCurrent(), floatCurrent.current(), 2e-5);
+        CHECK_NEAR(integer.getOffset(), floatCurrent.offset, 0.5 * 3300.0 / 4095);
+        CHECK_NEAR(voltage.getRmsVoltage(), floatVoltage.sigma * voltage.getVoltsPerCount(), 0.01);
+    }
+}
+
+int main() {
+    // Below the noise threshold, mid-range and near full scale
+    const float amplitudes[] = {5.0f, 50.0f, 300.0f, 1200.0f, 1800.0f};
+    for (float amplitude : amplitudes) {
+        compare(amplitude, 1900.0f);
+    }
+    compare(300.0f, 2200.0f);
+    return testResult("rms_kernel");
+}
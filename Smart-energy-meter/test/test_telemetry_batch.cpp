@@ -0,0 +1,127 @@
+// Batched upload of 1 s readings the way drainTelemetry() does it: peek up
+// to 10, post them as one JSON body, ackThrough() the last one delivered.
+// 20000 s with two outages, the first 2 minutes before SNTP sync. Like
+// captureTask(), readings are taken every 1 s, or every 10 s while a backlog
+// sits in flash.
+// With a directory argument it also writes a sample of the bodies to
+// batches.jsonl for test_telemetry_batch.py to parse with the server's code.
+#include "test.h"
+#include <string>
+#include "WebClient.h"
+#include "TelemetryQueue.h"
+
+static const uint32_t SECONDS = 20000;
+static const uint32_t SYNCED_AT = 120;          // SNTP sync after 2 minutes
+static const uint32_t T_SYNC = 1760000000;
+static const uint8_t BATCH = 10;                // TELEMETRY_BATCH
+static const uint32_t PERIOD = 10;              // Upload at least every 10 s
+static const uint8_t POSTS_PER_SECOND = 2;      // TelemetryDrain interval 500 ms
+static const size_t BODY_SIZE = 8192;           // WebClient's batch buffer
+
+static bool online(uint32_t t) {
+    return !(t > 3000 && t < 4000) && !(t > 9000 && t < 12600);
+}
+
+static TelemetryRecord reading(uint32_t t) {
+    TelemetryRecord r;
+    memset(&r, 0, sizeof r);
+    r.flags = TelemetryRecord::FLAG_HARMONICS;
+    if (t >= SYNCED_AT) {
+        r.flags |= TelemetryRecord::FLAG_SYNCED;
+        r.timestamp = T_SYNC + t;
+    } else {
+        r.timestamp = t;                         // Uptime
+    }
+    r.voltage = 230.12f;
+    r.frequency = 50.01f;
+    r.current1 = 1.25f;
+    r.current2 = 0.5f;
+    r.current3 = 1.75f;
+    r.power1 = 280.5f;
+    r.power2 = 110.25f;
+    r.energyL1 = 1234567891ULL + 280500ULL * t;
+    r.energyL2 = 987654321ULL + 110250ULL * t;
+    r.powerFactor1 = 0.97f;
+    r.powerFactor2 = 0.95f;
+    for (uint8_t c = 0; c < 3; c++) {
+        r.thd[c] = 123.45f;
+        for (uint8_t h = 0; h < 5; h++) r.harmonics[c][h] = 65535;    // Widest values
+    }
+    return r;
+}
+
+// Same document as WebClient::encodeJson
+static int encodeJson(char* out, const TelemetryRecord* records, const int32_t* ages, uint8_t count,
+                      uint32_t depth, uint32_t dropped, uint8_t& packed) {
+    int length = snprintf(out, BODY_SIZE, "{\"queue_depth\":%lu,\"queue_dropped\":%lu,\"readings\":[",
+                          (unsigned long)depth, (unsigned long)dropped);
+    for (packed = 0; packed < count; packed++) {
+        int added = WebClient::appendReading(out + length, BODY_SIZE - length - 2, records[packed],
+                                             ages[packed], packed > 0);
+        if (added <= 0) break;
+        length += added;
+    }
+    length += snprintf(out + length, BODY_SIZE - length, "]}");
+    return length;
+}
+
+int main(int argc, char** argv) {
+    FILE* sample = nullptr;
+    if (argc > 1) {
+        sample = fopen((std::string(argv[1]) + "/batches.jsonl").c_str(), "w");
+        CHECK(sample != nullptr);
+    }
+
+    RamFlashPartition flash(128);                // The 512 KB "queue" partition
+    TelemetryQueue queue(flash);
+    CHECK(queue.begin());
+    static char body[BODY_SIZE];
+    uint32_t captured = 0, delivered = 0, posts = 0, lastSequence = 0, lastPost = 0, first = 0;
+    uint32_t nextCapture = 0;
+    size_t largest = 0;
+    bool ordered = true, whole = true;
+
+    for (uint32_t t = 0; t < SECONDS; t++) {
+        if (t == nextCapture) {
+            TelemetryRecord record = reading(t);
+            queue.push(record);
+            if (captured++ == 0) first = record.sequence;
+            nextCapture = t + (queue.getFlashDepth() > 0 ? PERIOD : 1);
+        }
+
+        for (uint8_t p = 0; p < POSTS_PER_SECOND && online(t); p++) {
+            uint32_t depth = queue.depth();
+            if (depth == 0 || (depth < BATCH && t - lastPost < PERIOD)) break;
+            TelemetryRecord batch[BATCH];
+            int32_t ages[BATCH];
+            uint8_t count = queue.peek(batch, BATCH);
+            for (uint8_t i = 0; i < count; i++) {
+                uint32_t age;
+                ages[i] = queue.ageOf(batch[i], t, age) ? (int32_t)age : -1;
+            }
+            uint8_t packed = 0;
+            int length = encodeJson(body, batch, ages, count, depth, queue.getDropped(), packed);
+            whole = whole && packed == count && length > 0 && (size_t)length < BODY_SIZE;
+            if ((size_t)length > largest) largest = length;
+            if (sample != nullptr && (posts % 10 == 0 || ages[0] >= 0)) fprintf(sample, "%s\n", body);
+
+            for (uint8_t i = 0; i < packed; i++) {
+                ordered = ordered && batch[i].sequence == (delivered == 0 ? first : lastSequence + 1);
+                lastSequence = batch[i].sequence;
+                delivered++;
+            }
+            queue.ackThrough(batch[packed - 1].sequence);
+            posts++;
+            lastPost = t;
+        }
+    }
+    printf("%u s: %u readings, %u delivered in %u posts, %u left, %u dropped, largest body %zu bytes\n",
+           SECONDS, captured, delivered, posts, queue.depth(), queue.getDropped(), largest);
+    CHECK(ordered && whole);
+    CHECK(queue.getDropped() == 0);
+    CHECK(delivered + queue.depth() == captured);
+    CHECK(queue.depth() < BATCH);
+    CHECK(posts < captured / BATCH + 100);
+    if (sample != nullptr) CHECK(fclose(sample) == 0);
+    return testResult("telemetry_batch");
+}
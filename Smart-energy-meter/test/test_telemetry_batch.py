@@ -0,0 +1,69 @@
+# Batch bodies written by build/test_telemetry_batch, parsed as JSON and turned
+# into rows by reading_row() in app.py: totals, costs and kWh are derived from
+# the fields the meter sends, and the row time comes from ts or age_s.
+import json
+import os
+import subprocess
+import sys
+import tempfile
+from datetime import datetime, timedelta
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path[:0] = [os.path.join(HERE, 'stubs', 'python'), os.path.join(HERE, '..', 'Flask_server')]
+import app
+
+failures = []
+
+def check(condition, message):
+    if not condition:
+        failures.append(message)
+        print(f'  {message}')
+
+with tempfile.TemporaryDirectory() as directory:
+    subprocess.run([os.path.join(HERE, 'build', 'test_telemetry_batch'), directory],
+                   check=True, stdout=subprocess.DEVNULL)
+    with open(os.path.join(directory, 'batches.jsonl')) as file:
+        lines = file.read().splitlines()
+
+check(len(lines) > 100, f'only {len(lines)} batches written')
+stamped = aged = 0
+for number, line in enumerate(lines):
+    try:
+        batch = json.loads(line)
+    except ValueError as error:
+        check(False, f'batch {number}: {error}')
+        continue
+    readings = batch['readings']
+    check(1 <= len(readings) <= 10, f'batch {number}: {len(readings)} readings')
+    sequences = [r['seq'] for r in readings]
+    check(sequences == list(range(sequences[0], sequences[0] + len(sequences))),
+          f'batch {number}: sequences {sequences}')
+
+    for reading in readings:
+        now = datetime.now()
+        row = app.reading_row(reading, batch)
+        where = f'batch {number}, seq {reading["seq"]}'
+        check(row[1] == reading['seq'], f'{where}: device_seq')
+        check((row[2], row[3]) == (batch['queue_depth'], batch['queue_dropped']), f'{where}: queue counters')
+        if 'ts' in reading:
+            stamped += 1
+            check(row[0] == datetime.fromtimestamp(reading['ts']), f'{where}: time {row[0]}')
+        else:
+            aged += 1
+            expected = now - timedelta(seconds=reading['age_s'])
+            check(abs((row[0] - expected).total_seconds()) < 2, f'{where}: time {row[0]}')
+
+        energy_l1 = reading['energy_l1_mj'] / app.MJ_PER_KWH
+        energy_l2 = reading['energy_l2_mj'] / app.MJ_PER_KWH
+        check(abs(row[8] - (reading['current1'] + reading['current2'])) < 1e-9, f'{where}: total current')
+        check(abs(row[11] - (reading['power1'] + reading['power2'])) < 1e-9, f'{where}: total power')
+        check(abs(row[12] - energy_l1) < 1e-12 and abs(row[13] - energy_l2) < 1e-12, f'{where}: kWh')
+        check(abs(row[14] - (energy_l1 + energy_l2)) < 1e-12, f'{where}: total energy')
+        check(abs(row[15] - energy_l1 * app.price_per_unit) < 1e-9, f'{where}: cost l1')
+        check(abs(row[17] - (energy_l1 + energy_l2) * app.price_per_unit) < 1e-9, f'{where}: total cost')
+        check(sorted(json.loads(row[31])) == ['i1', 'i2', 'v'], f'{where}: harmonics')
+        check((row[32], row[33]) == (reading['energy_l1_mj'], reading['energy_l2_mj']), f'{where}: mJ')
+
+check(stamped > 0 and aged > 0, f'{stamped} readings with ts, {aged} with age_s')
+print('telemetry_batch.py: ' + ('FAILED' if failures else 'ok'))
+sys.exit(1 if failures else 0)
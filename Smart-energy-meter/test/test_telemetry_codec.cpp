@@ -0,0 +1,144 @@
+// MsgPackWriter integer encodings, TelemetryEncoder deltas and overflow.
+// With a directory argument it instead writes the same readings as a binary
+// batch and as WebClient's JSON batch, for test_telemetry_codec.py to decode
+// with the server's decoder and compare.
+#include "test.h"
+#include <string>
+#include <string.h>
+#include "WebClient.h"
+#include "TelemetryCodec.h"
+
+static const uint8_t READINGS = 6;
+
+static void makeReadings(TelemetryRecord* records, int32_t* ages) {
+    memset(records, 0, sizeof(TelemetryRecord) * READINGS);
+    for (uint8_t i = 0; i < READINGS; i++) {
+        TelemetryRecord& r = records[i];
+        r.sequence = 70000 + i;
+        r.voltage = 229.87f + 0.13f * i;
+        r.frequency = 49.987f;
+        r.current1 = 12.3456f - 0.001f * i;
+        r.current2 = 0.0042f;
+        r.current3 = 12.35f;
+        r.power1 = 2795.43f;
+        r.power2 = -412.06f;                     // Export
+        r.energyL1 = 9876543210123ULL + 559086ULL * i;
+        r.energyL2 = 4294967296ULL;
+        r.apparentPower1 = 2838.2f;
+        r.apparentPower2 = 412.9f;
+        r.reactivePower1 = 492.11f;
+        r.reactivePower2 = -26.33f;
+        r.powerFactor1 = 0.985f;
+        r.powerFactor2 = 0.998f;
+        ages[i] = -1;
+    }
+    // Unsynced with a known age, unsynced with no time, then synced readings
+    ages[0] = 30;
+    records[2].flags = TelemetryRecord::FLAG_SYNCED | TelemetryRecord::FLAG_RELAY1;
+    records[2].timestamp = 1760000000;
+    records[3].flags = TelemetryRecord::FLAG_SYNCED | TelemetryRecord::FLAG_THEFT |
+                       TelemetryRecord::FLAG_RELAY2 | TelemetryRecord::FLAG_HARMONICS;
+    records[3].timestamp = 1760000002;
+    records[3].sequence += 5;                    // Gap in the sequence
+    for (uint8_t c = 0; c < 3; c++) {
+        records[3].thd[c] = 2.5f + 3.25f * c;
+        for (uint8_t h = 0; h < 5; h++) records[3].harmonics[c][h] = 420 - 37 * h + c;
+    }
+    records[4] = records[3];
+    records[4].sequence++;
+    records[4].timestamp++;
+    records[5] = records[4];
+    records[5].sequence++;
+    records[5].timestamp++;
+    records[5].flags = TelemetryRecord::FLAG_SYNCED;
+}
+
+static bool writeFile(const std::string& path, const void* data, size_t length) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) return false;
+    bool written = fwrite(data, 1, length, file) == length;
+    return fclose(file) == 0 && written;
+}
+
+// Both encodings of the same readings, for the Python side of the round trip
+static int writeBatches(const std::string& directory) {
+    TelemetryRecord records[READINGS];
+    int32_t ages[READINGS];
+    makeReadings(records, ages);
+
+    static uint8_t binary[8192];
+    TelemetryEncoder encoder(binary, sizeof binary, 17, 3);
+    for (uint8_t i = 0; i < READINGS; i++) CHECK(encoder.add(records[i], ages[i]));
+    size_t binaryLength = encoder.finish();
+
+    static char json[8192];
+    int length = snprintf(json, sizeof json, "{\"queue_depth\":17,\"queue_dropped\":3,\"readings\":[");
+    for (uint8_t i = 0; i < READINGS; i++) {
+        length += WebClient::appendReading(json + length, sizeof(json) - length - 2, records[i], ages[i], i > 0);
+    }
+    length += snprintf(json + length, sizeof(json) - length, "]}");
+
+    CHECK(writeFile(directory + "/batch.msgpack", binary, binaryLength));
+    CHECK(writeFile(directory + "/batch.json", json, length));
+    return testFailures == 0 ? 0 : 1;
+}
+
+static std::string packed(int64_t value) {
+    uint8_t buffer[16];
+    MsgPackWriter writer(buffer, sizeof buffer);
+    writer.writeInt(value);
+    return std::string((const char*)buffer, writer.size());
+}
+
+static void testIntegers() {
+    CHECK(packed(0) == std::string("\x00", 1));
+    CHECK(packed(127) == "\x7f");
+    CHECK(packed(128) == "\xcc\x80");
+    CHECK(packed(65535) == "\xcd\xff\xff");
+    CHECK(packed(65536) == std::string("\xce\x00\x01\x00\x00", 5));
+    CHECK(packed(4294967296LL) == std::string("\xcf\x00\x00\x00\x01\x00\x00\x00\x00", 9));
+    CHECK(packed(-1) == "\xff");
+    CHECK(packed(-32) == "\xe0");
+    CHECK(packed(-33) == "\xd0\xdf");
+    CHECK(packed(-129) == "\xd1\xff\x7f");
+    CHECK(packed(-32769) == "\xd2\xff\xff\x7f\xff");
+    CHECK(packed(-2147483649LL) == "\xd3\xff\xff\xff\xff\x7f\xff\xff\xff");
+}
+
+static void testDeltas() {
+    TelemetryRecord records[READINGS];
+    int32_t ages[READINGS];
+    makeReadings(records, ages);
+
+    // An unchanged reading costs one byte: an empty map (the sequence is predicted)
+    uint8_t buffer[1024];
+    TelemetryEncoder encoder(buffer, sizeof buffer, 0, 0);
+    CHECK(encoder.add(records[4], -1));
+    size_t before = encoder.finish();
+    TelemetryRecord next = records[4];
+    next.sequence++;
+    CHECK(encoder.add(next, -1));
+    size_t after = encoder.finish();
+    CHECK(after == before + 1);
+    CHECK(buffer[after - 1] == 0x80);
+    CHECK(encoder.getCount() == 2);
+
+    // A reading that does not fit leaves the batch intact
+    uint8_t small[160];
+    TelemetryEncoder tight(small, sizeof small, 0, 0);
+    uint8_t added = 0;
+    while (added < READINGS && tight.add(records[added], ages[added])) added++;
+    CHECK(added > 0 && added < READINGS);
+    size_t length = tight.finish();
+    CHECK(length > 0 && length <= sizeof small);
+    CHECK(tight.getCount() == added);
+    // array16 header of the readings holds the count
+    CHECK(small[8] == 0xDC && small[9] == 0 && small[10] == added);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) return writeBatches(argv[1]);
+    testIntegers();
+    testDeltas();
+    return testResult("telemetry_codec");
+}
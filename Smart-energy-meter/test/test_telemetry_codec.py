@@ -0,0 +1,50 @@
+# Round trip of a binary telemetry batch: encoded in C++ by TelemetryEncoder
+# (build/test_telemetry_codec), decoded by decode_binary_batch in app.py and
+# compared with WebClient's JSON batch of the same readings. A field table out
+# of step between TelemetryCodec.h and BINARY_FIELDS shows up as a mismatch.
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path[:0] = [os.path.join(HERE, 'stubs', 'python'), os.path.join(HERE, '..', 'Flask_server')]
+import app
+
+failures = []
+
+def check(condition, message):
+    if not condition:
+        failures.append(message)
+        print(f'  {message}')
+
+with tempfile.TemporaryDirectory() as directory:
+    subprocess.run([os.path.join(HERE, 'build', 'test_telemetry_codec'), directory], check=True)
+    with open(os.path.join(directory, 'batch.msgpack'), 'rb') as file:
+        decoded = app.decode_binary_batch(file.read())
+    with open(os.path.join(directory, 'batch.json')) as file:
+        expected = json.load(file)
+
+# One quantisation step per field, from the server's own table
+steps = {key: 1.0 / scale for key, scale in app.BINARY_FIELDS}
+
+check(decoded['queue_depth'] == expected['queue_depth'], 'queue_depth')
+check(decoded['queue_dropped'] == expected['queue_dropped'], 'queue_dropped')
+check(len(decoded['readings']) == len(expected['readings']), 'reading count')
+for index, (got, want) in enumerate(zip(decoded['readings'], expected['readings'])):
+    check(sorted(got) == sorted(want), f'reading {index}: keys {sorted(set(got) ^ set(want))}')
+    for key, value in want.items():
+        if key not in got:
+            continue
+        if isinstance(value, (bool, int)):
+            check(got[key] == value, f'reading {index}: {key} {got[key]} != {value}')
+        elif isinstance(value, list):
+            check(len(got[key]) == len(value) and
+                  all(abs(a - b) <= steps[key] for a, b in zip(got[key], value)),
+                  f'reading {index}: {key} {got[key]} != {value}')
+        else:
+            check(abs(got[key] - value) <= steps[key], f'reading {index}: {key} {got[key]} != {value}')
+
+print('telemetry_codec.py: ' + ('FAILED' if failures else 'ok'))
+sys.exit(1 if failures else 0)
@@ -0,0 +1,154 @@
+// TelemetryQueue against RamFlashPartition: 200k readings with alternating
+// outages and power cuts during the ack, checked against a deduplicating
+// server; ring overflow while offline; sequences after an NVS wipe; and the
+// TelemetryDrain backoff during a long outage.
+#include "test.h"
+#include <set>
+#include <random>
+#include "TelemetryQueue.h"
+
+static const uint32_t SECTORS = 16;
+static const uint32_t SLOTS = SECTORS * TelemetryQueue::SLOTS_PER_SECTOR;
+
+static TelemetryRecord blank() {
+    TelemetryRecord record;
+    memset(&record, 0, sizeof record);
+    return record;
+}
+
+static void clearSequences() {
+    Preferences preferences;
+    preferences.begin("telemetry", false);
+    preferences.clear();
+    preferences.end();
+}
+
+// The server stores each sequence once, like the unique key on device_seq
+static void testOutagesAndCuts() {
+    RamFlashPartition flash(SECTORS);
+    TelemetryQueue* queue = new TelemetryQueue(flash);
+    CHECK(queue->begin());
+    std::mt19937 rng(1);
+    std::set<uint32_t> produced, server;
+    uint32_t resends = 0, cuts = 0, last = 0;
+    bool ordered = true, valid = true;
+
+    for (uint32_t t = 0; t < 200000; t++) {
+        TelemetryRecord record = blank();
+        record.voltage = t;
+        queue->push(record);
+        produced.insert(record.sequence);
+
+        bool online = (t / 300) % 2 == 0;            // Outages of 300 readings
+        for (int k = 0; online && k < 3; k++) {
+            TelemetryRecord oldest;
+            if (queue->peek(&oldest, 1) != 1) break;
+            valid = valid && oldest.isValid();
+            if (!server.insert(oldest.sequence).second) {
+                resends++;
+            } else {
+                ordered = ordered && oldest.sequence > last;
+                last = oldest.sequence;
+            }
+            if (rng() % 500 == 0) {
+                // Power cut while marking the record delivered
+                flash.failAfter(rng() % 2);
+                queue->ack(1);
+                flash.powerCycle();
+                delete queue;
+                queue = new TelemetryQueue(flash);
+                CHECK(queue->begin());
+                cuts++;
+                continue;
+            }
+            queue->ack(1);
+        }
+    }
+    TelemetryRecord oldest;
+    while (queue->peek(&oldest, 1) == 1) {
+        if (!server.insert(oldest.sequence).second) resends++;
+        queue->ack(1);
+    }
+    uint32_t missing = 0;
+    for (uint32_t sequence : produced) {
+        if (server.count(sequence) == 0) missing++;
+    }
+    printf("200k readings, %u power cuts: %zu delivered, %u missing, %u resends deduplicated\n",
+           cuts, server.size(), missing, resends);
+    CHECK(valid && ordered);
+    CHECK(cuts > 0);
+    CHECK(produced.size() == 200000 && missing == 0 && server.size() == produced.size());
+    CHECK(queue->getDropped() == 0);
+    delete queue;
+}
+
+// 2000 readings offline: the ring keeps a contiguous tail, the rest is counted
+static void testOverflow() {
+    RamFlashPartition flash(SECTORS);
+    TelemetryQueue queue(flash);
+    CHECK(queue.begin());
+    for (int i = 0; i < 2000; i++) {
+        TelemetryRecord record = blank();
+        queue.push(record);
+    }
+    uint32_t depth = queue.depth();
+    CHECK(depth + queue.getDropped() == 2000);
+    CHECK(depth > SLOTS - TelemetryQueue::SLOTS_PER_SECTOR && depth <= SLOTS);
+
+    TelemetryRecord record;
+    uint32_t drained = 0, previous = 0;
+    bool contiguous = true;
+    while (queue.peek(&record, 1) == 1) {
+        if (drained > 0 && record.sequence != previous + 1) contiguous = false;
+        previous = record.sequence;
+        drained++;
+        queue.ack(1);
+    }
+    printf("2000 readings offline into %u slots: %u kept, %u dropped\n", SLOTS, drained, queue.getDropped());
+    CHECK(contiguous && drained == depth);
+}
+
+// Sequences keep growing when NVS is wiped but the flash backlog is not
+static void testWipedNvs() {
+    RamFlashPartition flash(SECTORS);
+    uint32_t last = 0;
+    {
+        TelemetryQueue queue(flash);
+        CHECK(queue.begin());
+        for (int i = 0; i < 100; i++) {
+            TelemetryRecord record = blank();
+            queue.push(record);
+            last = record.sequence;
+        }
+    }
+    clearSequences();
+    TelemetryQueue queue(flash);
+    CHECK(queue.begin());
+    TelemetryRecord record = blank();
+    queue.push(record);
+    CHECK(record.sequence > last);
+}
+
+// One attempt every 5 min once the backoff has grown
+static void testDrainBackoff() {
+    TelemetryDrain drain(500, 2000, 300000);
+    uint32_t attempts = 0;
+    for (unsigned long now = 0; now < 3600000; now += 100) {
+        if (drain.isDue(now)) {
+            drain.failed(now);
+            attempts++;
+        }
+    }
+    printf("1 h outage: %u upload attempts\n", attempts);
+    CHECK(attempts == drain.getFailures());
+    CHECK(attempts >= 15 && attempts <= 20);
+}
+
+int main() {
+    clearSequences();
+    testOutagesAndCuts();
+    testOverflow();
+    testWipedNvs();
+    testDrainBackoff();
+    return testResult("telemetry_queue");
+}
@@ -0,0 +1,230 @@
+// WebClient's keep-alive connection against a small HTTP/1.1 server on a
+// loopback socket: 100 telemetry upload + relay poll pairs with the server
+// dropping the idle connection every 10 pairs, then a WiFi drop. Then 4000
+// requests on the open connection with operator new counted on this thread,
+// a "Connection: close" reply and a response body longer than the buffer.
+#include "test.h"
+#include <atomic>
+#include <new>
+#include <string>
+#include <thread>
+#include <signal.h>
+#include "WebClient.h"
+
+// Allocations made by the client (the server thread is not counted)
+static thread_local bool countAllocations = false;
+static long allocations = 0;
+
+void* operator new(size_t size) {
+    if (countAllocations) allocations++;
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+static const uint16_t PORT = 18420;
+static const uint32_t PAIRS = 100;
+static const uint32_t DROP_EVERY = 10;          // Pairs per server-side idle timeout
+
+// Answers every request with 200; closes the connection after every
+// `dropEvery` requests (0 = never), as a server's idle timeout would.
+// Relay polls alternate relay 1 and relay 2.
+class Server {
+private:
+    int listener;
+    std::atomic<int> client{-1};
+    std::thread thread;
+
+    // One request: header up to the blank line, then Content-Length bytes
+    static bool readRequest(int fd, std::string& pending, std::string& line) {
+        size_t end;
+        while ((end = pending.find("\r\n\r\n")) == std::string::npos) {
+            char buffer[4096];
+            ssize_t n = recv(fd, buffer, sizeof buffer, 0);
+            if (n <= 0) return false;
+            pending.append(buffer, n);
+        }
+        line = pending.substr(0, pending.find("\r\n"));
+        size_t length = 0;
+        size_t field = pending.find("Content-Length: ");
+        if (field != std::string::npos && field < end) length = strtoul(pending.c_str() + field + 16, nullptr, 10);
+        while (pending.size() < end + 4 + length) {
+            char buffer[4096];
+            ssize_t n = recv(fd, buffer, sizeof buffer, 0);
+            if (n <= 0) return false;
+            pending.append(buffer, n);
+        }
+        pending.erase(0, end + 4 + length);
+        return true;
+    }
+
+    void serve() {
+        for (;;) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) return;
+            client = fd;
+            accepted++;
+            std::string pending, line;
+            while (readRequest(fd, pending, line)) {
+                std::string body = "{\"status\":\"success\"}";
+                if (line.compare(0, 4, "GET ") == 0) {
+                    bool odd = polls++ % 2 == 1;
+                    body = std::string("{\"relay1\":") + (odd ? "true" : "false") +
+                           ",\"relay2\":" + (odd ? "false" : "true") + ",\"relay3\":true,\"price\":5.0}";
+                    if (padding > 0) body.insert(1, padding, ' ');
+                }
+                bool closing = closeNext.exchange(false);
+                char header[160];
+                int length = snprintf(header, sizeof header,
+                    "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n%s\r\n",
+                    body.size(), closing ? "Connection: close\r\n" : "");
+                std::string response = std::string(header, length) + body;
+                send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+                served++;
+                if (closing || (dropEvery > 0 && served % dropEvery == 0)) break;
+            }
+            client = -1;
+            ::close(fd);
+        }
+    }
+
+public:
+    std::atomic<uint32_t> accepted{0};
+    std::atomic<uint32_t> served{0};
+    std::atomic<uint32_t> polls{0};
+    std::atomic<uint32_t> dropEvery{2 * DROP_EVERY};
+    std::atomic<bool> closeNext{false};      // Answer the next request with "Connection: close"
+    std::atomic<size_t> padding{0};          // Spaces added to relay poll bodies
+
+    Server() {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(PORT);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        CHECK(bind(listener, (sockaddr*)&address, sizeof(address)) == 0);
+        CHECK(listen(listener, 4) == 0);
+        thread = std::thread(&Server::serve, this);
+    }
+
+    ~Server() {
+        shutdown(listener, SHUT_RDWR);
+        int open = client;
+        if (open >= 0) shutdown(open, SHUT_RDWR);
+        thread.join();
+        ::close(listener);
+    }
+};
+
+static TelemetryRecord records[10];
+static int32_t ages[10];
+
+static void makeRecords() {
+    for (uint8_t i = 0; i < 10; i++) {
+        records[i] = TelemetryRecord();
+        records[i].sequence = 100 + i;
+        records[i].flags = TelemetryRecord::FLAG_SYNCED;
+        records[i].timestamp = 1760000000 + i;
+        records[i].voltage = 230;
+        ages[i] = -1;
+    }
+}
+
+// Relay poll: the server alternates relay 1 and relay 2
+static bool pollRelays(WebClient& web, Server& server) {
+    bool odd = server.polls % 2 == 1;
+    bool relay1 = !odd, relay2 = odd, relay3 = true;
+    float price = 0;
+    web.getRelayAndSettings(relay1, relay2, relay3, price);
+    return relay1 == odd && relay2 == !odd && relay3 && price == 5.0f;
+}
+
+static void testKeepAlive(WebClient& web, Server& server) {
+    uint32_t delivered = 0;
+    for (uint32_t pair = 0; pair < PAIRS; pair++) {
+        delivered += web.sendReadings(records, ages, 3, 3, 0);
+        CHECK(pollRelays(web, server));
+    }
+    const HttpStats& data = web.getHttpStats(HTTP_DATA);
+    const HttpStats& poll = web.getHttpStats(HTTP_RELAY_POLL);
+    printf("%u upload + poll pairs: %u requests served over %u connections "
+           "(%u stale replaced), %u failed\n",
+           PAIRS, server.served.load(), server.accepted.load(), data.stale + poll.stale,
+           data.failures + poll.failures);
+    CHECK(delivered == 3 * PAIRS);
+    CHECK(data.requests == PAIRS && poll.requests == PAIRS);
+    CHECK(data.failures == 0 && poll.failures == 0);
+    CHECK(server.served == 2 * PAIRS);
+    CHECK(server.accepted == PAIRS / DROP_EVERY);
+    CHECK(web.getConnectionCount() == PAIRS / DROP_EVERY);
+
+    // A WiFi drop closes the socket; the next request opens a new connection
+    WiFi.state = 0;
+    web.maintain();
+    CHECK(!web.isConnected());
+    CHECK(web.sendReadings(records, ages, 3, 3, 0) == 0);
+    WiFi.state = WL_CONNECTED;
+    web.maintain();
+    CHECK(web.sendReadings(records, ages, 3, 3, 0) == 3);
+    CHECK(server.accepted == PAIRS / DROP_EVERY + 1);
+    CHECK(data.failures == 0);
+}
+
+// Steady state on the open connection: no heap allocation per request
+static void testNoAllocations(WebClient& web, Server& server) {
+    server.dropEvery = 0;
+    uint32_t served = server.served;
+    uint32_t accepted = server.accepted;
+
+    uint32_t failed = 0;
+    countAllocations = true;
+    for (uint32_t n = 0; n < 1000; n++) {
+        if (web.sendReadings(records, ages, 10, 10, 0) != 10) failed++;
+        if (!pollRelays(web, server)) failed++;
+        if (!web.postRelayState(n % 2 == 1, n % 2 == 0)) failed++;
+        if (!web.sendTheftAlert(false)) failed++;
+    }
+    countAllocations = false;
+    printf("4000 requests on one connection: %ld heap allocations, %u failed\n", allocations, failed);
+    CHECK(allocations == 0 && failed == 0);
+    CHECK(server.served == served + 4000 && server.accepted == accepted);
+
+    // "Connection: close" drops the socket; the next request reconnects
+    server.closeNext = true;
+    CHECK(web.sendTheftAlert(false));
+    CHECK(web.sendTheftAlert(false));
+    CHECK(server.accepted == accepted + 1);
+
+    // A body longer than the response buffer is truncated but read to its end
+    server.padding = HttpConnection::RESPONSE_SIZE + 500;
+    pollRelays(web, server);
+    server.padding = 0;
+    CHECK(pollRelays(web, server));
+    CHECK(server.accepted == accepted + 1);
+}
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+    Server server;
+    char url[32];
+    snprintf(url, sizeof url, "http://127.0.0.1:%u", PORT);
+    static WebClient web("meter", "secret", url);
+    web.begin();
+    web.maintain();
+    CHECK(web.isConnected());
+    makeRecords();
+
+    testKeepAlive(web, server);
+    testNoAllocations(web, server);
+    return testResult("web_client");
+}
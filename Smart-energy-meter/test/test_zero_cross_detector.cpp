@@ -0,0 +1,112 @@
+// Cycle-aligned windows from ZeroCrossDetector and PowerMeter at off-nominal
+// mains frequencies: the measured frequency, window lengths of whole cycles,
+// and a current RMS that does not ripple from window to window. Without mains
+// on the voltage channel the windows fall back to a fixed length.
+#include "test.h"
+#include "AdcSampler.h"
+#include "PowerMeter.h"
+
+static const uint8_t PINS[] = {32, 33, 34, 35};
+static const uint32_t RATE = 20000;
+static const uint8_t CYCLES = 10;
+
+struct Run {
+    float worstFrequencyError;      // Hz
+    double worstLengthError;        // Samples, against CYCLES * RATE / f
+    double worstDrift;              // Window ends against whole cycles after the first one
+    float rippleFraction;           // (max - min) / mean of the current RMS
+    uint32_t windows;
+};
+
+// Windows after the first two (the partial one before the first crossing and
+// the first aligned one, whose period count starts late)
+static Run run(float frequency, float voltageAmplitude, uint32_t windows, uint16_t noise) {
+    FakeAdcSource source;
+    source.setNoise(noise);
+    source.setTone(0, 1900, 500, frequency, 0.3f);
+    source.setTone(1, 1890, 0, frequency);
+    source.setTone(2, 1905, 500, frequency, 0.3f);
+    source.setTone(3, 2048, voltageAmplitude, frequency);
+    AdcSampler sampler(source, PINS, 4, RATE);
+    CHECK(sampler.begin());
+    CurrentSensor load1(32, 0.0007272f, -0.01636f);
+    CurrentSensor load2(33, 0.0007272f, -0.01672f);
+    CurrentSensor main(34, 0.0006825f, -0.01442f);
+    VoltageSensor voltage(35, 3.3f, 890.0f);
+    load1.begin();
+    load2.begin();
+    main.begin();
+    voltage.begin();
+    load1.setOffset(1900);
+    load2.setOffset(1890);
+    main.setOffset(1905);
+    PowerMeter meter(voltage);
+    meter.addLoad(load1);
+    meter.addLoad(load2);
+    meter.addLoad(main);
+    meter.setWindowCycles(CYCLES);
+
+    Run r = {};
+    float minRms = 1e9f, maxRms = 0, sumRms = 0;
+    uint64_t elapsed = 0;
+    uint32_t seen = 0;
+    while (r.windows < windows) {
+        sampler.pump(0);
+        const AdcFrame* frame;
+        while ((frame = sampler.acquireFrame()) != nullptr) {
+            meter.consume(*frame);
+            sampler.releaseFrame(frame);
+        }
+        if (meter.getWindowCount() == seen) continue;
+        seen = meter.getWindowCount();
+        if (seen <= 2) continue;
+        r.windows++;
+
+        float measured = meter.getFrequency();
+        double expected = voltageAmplitude > 0 ? CYCLES * (double)RATE / frequency
+                                               : CYCLES * (double)RATE / 40.0;
+        float frequencyError = voltageAmplitude > 0 ? fabsf(measured - frequency) : fabsf(measured);
+        if (frequencyError > r.worstFrequencyError) r.worstFrequencyError = frequencyError;
+        double lengthError = fabs(meter.getWindowSamples() - expected);
+        if (lengthError > r.worstLengthError) r.worstLengthError = lengthError;
+        elapsed += meter.getWindowSamples();
+        double drift = fabs(elapsed - r.windows * expected);
+        if (drift > r.worstDrift) r.worstDrift = drift;
+        float rms = load1.getCurrent();
+        if (rms < minRms) minRms = rms;
+        if (rms > maxRms) maxRms = rms;
+        sumRms += rms;
+    }
+    r.rippleFraction = (maxRms - minRms) / (sumRms / r.windows);
+    return r;
+}
+
+int main() {
+    // Clean mains: every window is CYCLES periods to within the one sample a
+    // boundary can be late by
+    const float frequencies[] = {45.0f, 49.3f, 50.0f, 50.7f, 59.6f};
+    for (float f : frequencies) {
+        Run r = run(f, 1000, 50, 0);
+        CHECK(r.worstFrequencyError < 0.01f);
+        CHECK(r.worstLengthError < 1.0);
+        CHECK(r.worstDrift < 1.0);
+    }
+
+    // With +/-3 counts of noise the crossings jitter by a fraction of a sample,
+    // but the windows do not drift off the cycles and the RMS does not ripple
+    for (float f : frequencies) {
+        Run r = run(f, 1000, 50, 3);
+        printf("%.1f Hz: frequency within %.4f Hz, windows within %.2f samples (%.2f drift), current ripple %.3f%%\n",
+               f, r.worstFrequencyError, r.worstLengthError, r.worstDrift, 100 * r.rippleFraction);
+        CHECK(r.worstFrequencyError < 0.01f);
+        CHECK(r.worstLengthError < 1.5);
+        CHECK(r.worstDrift < 1.5);
+        CHECK(r.rippleFraction < 0.002f);
+    }
+
+    // No mains: fixed windows of CYCLES periods at PowerMeter's 40 Hz floor, no frequency
+    Run dead = run(50.0f, 0, 5, 3);
+    CHECK(dead.worstFrequencyError == 0);
+    CHECK(dead.worstLengthError < 1.0);
+    return testResult("zero_cross_detector");
+}